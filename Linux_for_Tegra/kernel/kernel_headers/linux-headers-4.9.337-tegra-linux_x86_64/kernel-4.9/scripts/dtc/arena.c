@@ -0,0 +1,268 @@
+/*
+ * Allocation arena for the parser and the live tree.
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *                                                                   USA
+ */
+
+#include "dtc.h"
+
+/*
+ * Everything that lives as long as the tree does (nodes, properties,
+ * labels, markers, names, source file state) is carved out of large
+ * chunks and never freed one by one; it all goes at once, either when
+ * the process exits or from arena_reset() between the compilations of
+ * a batch.
+ *
+ * Value buffers are different: a struct data is grown a few bytes at a
+ * time while it is parsed and dropped when a value is replaced or
+ * merged, so buffers come in power-of-two size classes with a free list
+ * per class.  Each buffer is preceded by a header giving its capacity,
+ * which lets arena_realloc() grow it in place until the class is full.
+ * Buffers bigger than the largest class (flattened blobs, /incbin/
+ * data) go to realloc() directly and are kept on a list so a reset can
+ * find them.
+ */
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+#define ARENA_ALIGN		(sizeof(uint64_t))
+#define ARENA_MIN_SHIFT		4	/* 16 byte buffers */
+#define ARENA_MAX_SHIFT		12	/* 4kB buffers */
+#define ARENA_NR_CLASSES	(ARENA_MAX_SHIFT - ARENA_MIN_SHIFT + 1)
+
+union arena_header {
+	size_t size;		/* capacity of the buffer that follows */
+	uint64_t align;
+};
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	uint64_t data[];
+};
+
+struct arena_large {
+	struct arena_large *prev, *next;
+	union arena_header h;	/* must come last, see arena_release() */
+};
+
+static struct {
+	char *next, *limit;	/* unused part of the current chunk */
+	struct arena_chunk *chunks;
+	struct arena_large *large_list;
+	void *free[ARENA_NR_CLASSES];
+
+	/* --stats */
+	unsigned long objects, object_bytes;
+	unsigned long buffers, reused, in_place, large;
+	unsigned long mallocs;
+	size_t footprint, peak;
+} arena;
+
+static void arena_account(ssize_t bytes)
+{
+	arena.footprint += bytes;
+	if (arena.footprint > arena.peak)
+		arena.peak = arena.footprint;
+}
+
+static struct arena_chunk *arena_new_chunk(size_t len)
+{
+	struct arena_chunk *c = xmalloc(sizeof(*c) + len);
+
+	c->next = arena.chunks;
+	arena.chunks = c;
+	arena.mallocs++;
+	arena_account(sizeof(*c) + len);
+
+	return c;
+}
+
+static void *arena_carve(size_t len)
+{
+	struct arena_chunk *c;
+	void *p;
+
+	len = ALIGN(len, ARENA_ALIGN);
+
+	/* don't throw away most of a chunk for one oversized object */
+	if (len > ARENA_CHUNK_SIZE / 4)
+		return arena_new_chunk(len)->data;
+
+	if ((arena.limit - arena.next) < len) {
+		c = arena_new_chunk(ARENA_CHUNK_SIZE);
+		arena.next = (char *)c->data;
+		arena.limit = arena.next + ARENA_CHUNK_SIZE;
+	}
+
+	p = arena.next;
+	arena.next += len;
+
+	return p;
+}
+
+void *arena_alloc(size_t len)
+{
+	arena.objects++;
+	arena.object_bytes += len;
+
+	return arena_carve(len);
+}
+
+char *arena_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	return memcpy(arena_alloc(len), s, len);
+}
+
+static int arena_class(size_t len)
+{
+	int shift = ARENA_MIN_SHIFT;
+
+	while (((size_t)1 << shift) < len)
+		shift++;
+
+	return shift - ARENA_MIN_SHIFT;
+}
+
+static void arena_link_large(struct arena_large *l)
+{
+	l->prev = NULL;
+	l->next = arena.large_list;
+	if (l->next)
+		l->next->prev = l;
+	arena.large_list = l;
+}
+
+static void arena_unlink_large(struct arena_large *l)
+{
+	if (l->prev)
+		l->prev->next = l->next;
+	else
+		arena.large_list = l->next;
+	if (l->next)
+		l->next->prev = l->prev;
+}
+
+void arena_release(void *p)
+{
+	union arena_header *h;
+	struct arena_large *l;
+	int class;
+
+	if (!p)
+		return;
+
+	/* small and large buffers both keep their size just before p */
+	h = (union arena_header *)p - 1;
+	if (h->size > (1 << ARENA_MAX_SHIFT)) {
+		l = (struct arena_large *)p - 1;
+		arena_account(-(ssize_t)(sizeof(*l) + l->h.size));
+		arena_unlink_large(l);
+		free(l);
+		return;
+	}
+
+	class = arena_class(h->size);
+	*(void **)p = arena.free[class];
+	arena.free[class] = p;
+}
+
+void *arena_realloc(void *p, size_t len)
+{
+	union arena_header *h = p ? (union arena_header *)p - 1 : NULL;
+	size_t oldsize = h ? h->size : 0;
+	struct arena_large *l;
+	size_t size;
+	void *new;
+	int class;
+
+	if (len <= oldsize) {
+		arena.in_place++;
+		return p;
+	}
+
+	arena.buffers++;
+
+	if (len > (1 << ARENA_MAX_SHIFT)) {
+		arena.large++;
+		arena.mallocs++;
+		if (oldsize > (1 << ARENA_MAX_SHIFT)) {
+			l = (struct arena_large *)p - 1;
+			arena_unlink_large(l);
+			arena_account(len - oldsize);
+			l = xrealloc(l, sizeof(*l) + len);
+			l->h.size = len;
+			arena_link_large(l);
+			return l + 1;
+		}
+
+		arena_account(sizeof(*l) + len);
+		l = xmalloc(sizeof(*l) + len);
+		l->h.size = len;
+		arena_link_large(l);
+		new = l + 1;
+	} else {
+		class = arena_class(len);
+		new = arena.free[class];
+		if (new) {
+			arena.free[class] = *(void **)new;
+			arena.reused++;
+		} else {
+			size = (size_t)1 << (class + ARENA_MIN_SHIFT);
+			h = arena_carve(sizeof(*h) + size);
+			h->size = size;
+			new = h + 1;
+		}
+	}
+
+	if (p) {
+		memcpy(new, p, oldsize);
+		arena_release(p);
+	}
+
+	return new;
+}
+
+/* Free everything allocated so far.  The statistics are kept. */
+void arena_reset(void)
+{
+	struct arena_chunk *c;
+	struct arena_large *l;
+
+	while ((c = arena.chunks)) {
+		arena.chunks = c->next;
+		free(c);
+	}
+
+	while ((l = arena.large_list)) {
+		arena.large_list = l->next;
+		free(l);
+	}
+
+	arena.next = arena.limit = NULL;
+	memset(arena.free, 0, sizeof(arena.free));
+	arena.footprint = 0;
+}
+
+void arena_print_stats(FILE *f)
+{
+	fprintf(f, "arena: %lu objects (%lu bytes), %lu value buffers "
+		"(%lu reused, %lu large), %lu grown in place\n",
+		arena.objects, arena.object_bytes, arena.buffers,
+		arena.reused, arena.large, arena.in_place);
+	fprintf(f, "arena: %lu malloc calls, peak %zu bytes\n",
+		arena.mallocs, arena.peak);
+}
@@ -0,0 +1,111 @@
+#!/bin/sh
+# Check that dtc --cache never gives a different output from plain dtc
+#
+# Each step compiles board.dts twice, once plain and once with --cache,
+# and the two outputs must be the same byte for byte.  The cached
+# compile must also have been skipped exactly when nothing it depends
+# on changed.  Between steps an included .dtsi is edited, an include
+# starts and stops being shadowed by one earlier in the search path,
+# the output is overwritten behind dtc's back and the options change.
+#
+# Usage, after building dtc:
+# $ ./scripts/dtc/cache-test/run.sh [path/to/dtc]
+
+set -e
+
+SRC=$(cd "$(dirname "$0")" && pwd)
+DTC=${1:-$SRC/../dtc}
+DTC=$(cd "$(dirname "$DTC")" && pwd)/$(basename "$DTC")
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+fail=0
+steps=0
+
+# the option sets, one per line
+OPTIONS="-O dtb
+-O dts
+-O asm
+-O dtb -@
+-O dtb -p 1024
+-O dtb -s -H epapr"
+
+setup()
+{
+	rm -rf "$WORK/tree"
+	mkdir -p "$WORK/tree/over"
+	cp -R "$SRC/board.dts" "$SRC/include" "$WORK/tree"
+}
+
+# check <step> <fresh|stale> <options...>
+check()
+{
+	step=$1
+	expect=$2
+	shift 2
+	steps=$((steps + 1))
+
+	(cd "$WORK/tree" &&
+	 "$DTC" -q "$@" -i over -i include -o ref board.dts &&
+	 "$DTC" -q "$@" --stats --cache out.cache -i over -i include \
+		-o out board.dts 2> log) || {
+		echo "FAIL: $step ($*): dtc failed"
+		fail=$((fail + 1))
+		return
+	}
+
+	if ! cmp -s "$WORK/tree/ref" "$WORK/tree/out"; then
+		echo "FAIL: $step ($*): --cache output differs"
+		fail=$((fail + 1))
+	fi
+
+	if grep -q "is up to date" "$WORK/tree/log"; then
+		got=fresh
+	else
+		got=stale
+	fi
+	if [ "$got" != "$expect" ]; then
+		echo "FAIL: $step ($*): expected $expect, was $got"
+		fail=$((fail + 1))
+	fi
+}
+
+while read -r opts; do
+	setup
+	check "first build" stale $opts
+	check "unchanged" fresh $opts
+
+	cp "$SRC/edit/pinmux.dtsi" "$WORK/tree/include"
+	check "edited .dtsi" stale $opts
+	check "edited .dtsi, again" fresh $opts
+
+	cp "$SRC/shadow/soc.dtsi" "$WORK/tree/over"
+	check "shadowing include" stale $opts
+	check "shadowing include, again" fresh $opts
+
+	rm "$WORK/tree/over/soc.dtsi"
+	check "shadow removed" stale $opts
+
+	echo garbage > "$WORK/tree/out"
+	check "output overwritten" stale $opts
+	check "output overwritten, again" fresh $opts
+done <<EOF
+$OPTIONS
+EOF
+
+# the same output and sidecar, compiled with each set of options in turn
+setup
+while read -r opts; do
+	check "changed options" stale $opts
+done <<EOF
+$OPTIONS
+EOF
+check "changed options, back to the first" stale -O dtb
+check "changed options, again" fresh -O dtb
+
+if [ $fail -ne 0 ]; then
+	echo "dtc --cache test: $fail of $steps steps failed"
+	exit 1
+fi
+echo "dtc --cache test: $steps steps passed"
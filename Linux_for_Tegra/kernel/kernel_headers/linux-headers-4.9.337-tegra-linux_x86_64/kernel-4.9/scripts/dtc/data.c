@@ -22,18 +22,9 @@
 
 void data_free(struct data d)
 {
-	struct marker *m, *nm;
-
-	m = d.markers;
-	while (m) {
-		nm = m->next;
-		free(m->ref);
-		free(m);
-		m = nm;
-	}
-
-	if (d.val)
-		free(d.val);
+	/* markers and their refs belong to the arena */
+	if (!d.borrowed)
+		arena_release(d.val);
 }
 
 struct data data_grow_for(struct data d, int xlen)
@@ -51,7 +42,14 @@ struct data data_grow_for(struct data d, int xlen)
 	while ((d.len + xlen) > newsize)
 		newsize *= 2;
 
-	nd.val = xrealloc(d.val, newsize);
+	if (d.borrowed) {
+		/* first modification: take a private copy */
+		nd.val = arena_realloc(NULL, newsize);
+		memcpy(nd.val, d.val, d.len);
+		nd.borrowed = false;
+	} else {
+		nd.val = arena_realloc(d.val, newsize);
+	}
 
 	return nd;
 }
@@ -68,6 +66,21 @@ struct data data_copy_mem(const char *mem, int len)
 	return d;
 }
 
+/*
+ * Reference len bytes at mem without copying them.  The memory must
+ * outlive the data; it is copied on the first modification.
+ */
+struct data data_ref_mem(const char *mem, int len)
+{
+	struct data d = empty_data;
+
+	d.len = len;
+	d.val = (char *)mem;
+	d.borrowed = true;
+
+	return d;
+}
+
 struct data data_copy_escape_string(const char *s, int len)
 {
 	int i = 0;
@@ -241,7 +254,7 @@ struct data data_add_marker(struct data d, enum markertype type, char *ref)
 {
 	struct marker *m;
 
-	m = xmalloc(sizeof(*m));
+	m = arena_alloc(sizeof(*m));
 	m->offset = d.len;
 	m->type = type;
 	m->ref = ref;
@@ -19,6 +19,7 @@
  */
 
 #include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "dtc.h"
 #include "srcpos.h"
@@ -61,6 +62,10 @@ static void fill_fullpaths(struct node *tree, const char *prefix)
 /* Usage related data. */
 #define FDT_VERSION(version)	_FDT_VERSION(version)
 #define _FDT_VERSION(version)	#version
+#define OPT_STATS		0x100	/* long options only */
+#define OPT_BATCH		0x101
+#define OPT_JOBS		0x102
+#define OPT_CACHE		0x103
 static const char usage_synopsis[] = "dtc [options] <input file>";
 static const char usage_short_opts[] = "qI:O:o:V:d:R:S:p:a:fb:i:H:sW:E:@Ahv";
 static struct option const usage_long_opts[] = {
@@ -83,6 +88,10 @@ static struct option const usage_long_opts[] = {
 	{"error",             a_argument, NULL, 'E'},
 	{"symbols",	     no_argument, NULL, '@'},
 	{"auto-alias",       no_argument, NULL, 'A'},
+	{"stats",            no_argument, NULL, OPT_STATS},
+	{"batch",             a_argument, NULL, OPT_BATCH},
+	{"jobs",              a_argument, NULL, OPT_JOBS},
+	{"cache",             a_argument, NULL, OPT_CACHE},
 	{"help",             no_argument, NULL, 'h'},
 	{"version",          no_argument, NULL, 'v'},
 	{NULL,               no_argument, NULL, 0x0},
@@ -116,6 +125,14 @@ static const char * const usage_opts_help[] = {
 	"\n\tEnable/disable errors (prefix with \"no-\")",
 	"\n\tEnable generation of symbols",
 	"\n\tEnable auto-alias of labels",
+	"\n\tPrint allocation statistics and the time spent in each check to stderr",
+	"\n\tCompile each job listed in <arg>, one per line as\n"
+	 "\t\t<input> <output> [<options>]\n"
+	 "\tOther options given on the command line apply to every job",
+	"\n\tNumber of --batch jobs to check and write out in parallel\n"
+	 "\t(defaults to the number of online CPUs)",
+	"\n\tRecord the inputs, options and output in <arg>, and leave the\n"
+	 "\toutput alone next time if none of them changed",
 	"\n\tPrint this help and exit",
 	"\n\tPrint version and exit",
 	NULL,
@@ -166,42 +183,67 @@ static const char *guess_input_format(const char *fname, const char *fallback)
 	return guess_type_by_name(fname, fallback);
 }
 
-int main(int argc, char *argv[])
-{
-	struct dt_info *dti;
-	const char *inform = NULL;
-	const char *outform = NULL;
-	const char *outname = "-";
-	const char *depname = NULL;
-	bool force = false, sort = false;
+/* Everything the command line, or one --batch line, asks for */
+struct dtc_job {
+	const char *inform;
+	const char *outform;
+	const char *outname;
+	const char *depname;
+	const char *cachename;
 	const char *arg;
+	bool force, sort, stats;
+	int outversion;
+	long long cmdline_boot_cpuid;
+
+	/* -W and -E, applied by apply_check_options() */
+	int nr_checkopts;
+	struct check_option {
+		bool warn, error;
+		const char *arg;
+	} *checkopts;
+
+	const char *manifest;
+	int nr_workers;
+};
+
+static void parse_options(struct dtc_job *job, int argc, char *argv[])
+{
 	int opt;
-	FILE *outf = NULL;
-	int outversion = DEFAULT_FDT_VERSION;
-	long long cmdline_boot_cpuid = -1;
 
 	quiet      = 0;
 	reservenum = 0;
 	minsize    = 0;
 	padsize    = 0;
 	alignsize  = 0;
+	phandle_format = PHANDLE_BOTH;
+	generate_symbols = 0;
+	generate_fixups = 0;
+	auto_label_aliases = 0;
+
+	memset(job, 0, sizeof(*job));
+	job->outname = "-";
+	job->outversion = DEFAULT_FDT_VERSION;
+	job->cmdline_boot_cpuid = -1;
+
+	/* each --batch job parses a fresh argv */
+	optind = 1;
 
 	while ((opt = util_getopt_long()) != EOF) {
 		switch (opt) {
 		case 'I':
-			inform = optarg;
+			job->inform = optarg;
 			break;
 		case 'O':
-			outform = optarg;
+			job->outform = optarg;
 			break;
 		case 'o':
-			outname = optarg;
+			job->outname = optarg;
 			break;
 		case 'V':
-			outversion = strtol(optarg, NULL, 0);
+			job->outversion = strtol(optarg, NULL, 0);
 			break;
 		case 'd':
-			depname = optarg;
+			job->depname = optarg;
 			break;
 		case 'R':
 			reservenum = strtol(optarg, NULL, 0);
@@ -219,13 +261,13 @@ int main(int argc, char *argv[])
 				    optarg);
 			break;
 		case 'f':
-			force = true;
+			job->force = true;
 			break;
 		case 'q':
 			quiet++;
 			break;
 		case 'b':
-			cmdline_boot_cpuid = strtoll(optarg, NULL, 0);
+			job->cmdline_boot_cpuid = strtoll(optarg, NULL, 0);
 			break;
 		case 'i':
 			srcfile_add_search_path(optarg);
@@ -245,15 +287,18 @@ int main(int argc, char *argv[])
 			break;
 
 		case 's':
-			sort = true;
+			job->sort = true;
 			break;
 
 		case 'W':
-			parse_checks_option(true, false, optarg);
-			break;
-
 		case 'E':
-			parse_checks_option(false, true, optarg);
+			job->checkopts = xrealloc(job->checkopts,
+						  (job->nr_checkopts + 1)
+						  * sizeof(*job->checkopts));
+			job->checkopts[job->nr_checkopts].warn = (opt == 'W');
+			job->checkopts[job->nr_checkopts].error = (opt == 'E');
+			job->checkopts[job->nr_checkopts].arg = optarg;
+			job->nr_checkopts++;
 			break;
 
 		case '@':
@@ -262,6 +307,18 @@ int main(int argc, char *argv[])
 		case 'A':
 			auto_label_aliases = 1;
 			break;
+		case OPT_STATS:
+			job->stats = true;
+			break;
+		case OPT_BATCH:
+			job->manifest = optarg;
+			break;
+		case OPT_JOBS:
+			job->nr_workers = strtol(optarg, NULL, 0);
+			break;
+		case OPT_CACHE:
+			job->cachename = optarg;
+			break;
 
 		case 'h':
 			usage(NULL);
@@ -273,52 +330,75 @@ int main(int argc, char *argv[])
 	if (argc > (optind+1))
 		usage("missing files");
 	else if (argc < (optind+1))
-		arg = "-";
+		job->arg = "-";
 	else
-		arg = argv[optind];
+		job->arg = argv[optind];
 
 	/* minsize and padsize are mutually exclusive */
 	if (minsize && padsize)
 		die("Can't set both -p and -S\n");
+}
+
+static void apply_check_options(struct dtc_job *job)
+{
+	int i;
+
+	for (i = 0; i < job->nr_checkopts; i++)
+		parse_checks_option(job->checkopts[i].warn,
+				    job->checkopts[i].error,
+				    job->checkopts[i].arg);
+}
+
+static struct dt_info *read_input(struct dtc_job *job)
+{
+	struct dt_info *dti;
 
-	if (depname) {
-		depfile = fopen(depname, "w");
+	if (job->depname) {
+		depfile = fopen(job->depname, "w");
 		if (!depfile)
-			die("Couldn't open dependency file %s: %s\n", depname,
-			    strerror(errno));
-		fprintf(depfile, "%s:", outname);
+			die("Couldn't open dependency file %s: %s\n",
+			    job->depname, strerror(errno));
+		fprintf(depfile, "%s:", job->outname);
 	}
 
-	if (inform == NULL)
-		inform = guess_input_format(arg, "dts");
-	if (outform == NULL) {
-		outform = guess_type_by_name(outname, NULL);
-		if (outform == NULL) {
-			if (streq(inform, "dts"))
-				outform = "dtb";
+	if (job->inform == NULL)
+		job->inform = guess_input_format(job->arg, "dts");
+	if (job->outform == NULL) {
+		job->outform = guess_type_by_name(job->outname, NULL);
+		if (job->outform == NULL) {
+			if (streq(job->inform, "dts"))
+				job->outform = "dtb";
 			else
-				outform = "dts";
+				job->outform = "dts";
 		}
 	}
-	if (streq(inform, "dts"))
-		dti = dt_from_source(arg);
-	else if (streq(inform, "fs"))
-		dti = dt_from_fs(arg);
-	else if(streq(inform, "dtb"))
-		dti = dt_from_blob(arg);
+	if (streq(job->inform, "dts"))
+		dti = dt_from_source(job->arg);
+	else if (streq(job->inform, "fs"))
+		dti = dt_from_fs(job->arg);
+	else if(streq(job->inform, "dtb"))
+		dti = dt_from_blob(job->arg);
 	else
-		die("Unknown input format \"%s\"\n", inform);
+		die("Unknown input format \"%s\"\n", job->inform);
 
 	if (depfile) {
 		fputc('\n', depfile);
 		fclose(depfile);
+		depfile = NULL;
 	}
 
-	if (cmdline_boot_cpuid != -1)
-		dti->boot_cpuid_phys = cmdline_boot_cpuid;
+	return dti;
+}
+
+static void write_output(struct dtc_job *job, struct dt_info *dti)
+{
+	FILE *outf = NULL;
+
+	if (job->cmdline_boot_cpuid != -1)
+		dti->boot_cpuid_phys = job->cmdline_boot_cpuid;
 
 	fill_fullpaths(dti->dt, "");
-	process_checks(force, dti);
+	process_checks(job->force, job->stats, dti);
 
 	/* on a plugin, generate by default */
 	if (dti->dtsflags & DTSF_PLUGIN) {
@@ -336,29 +416,279 @@ int main(int argc, char *argv[])
 		generate_local_fixups_tree(dti, "__local_fixups__");
 	}
 
-	if (sort)
+	if (job->sort)
 		sort_tree(dti);
 
-	if (streq(outname, "-")) {
+	if (streq(job->outname, "-")) {
 		outf = stdout;
 	} else {
-		outf = fopen(outname, "wb");
+		outf = fopen(job->outname, "wb");
 		if (! outf)
 			die("Couldn't open output file %s: %s\n",
-			    outname, strerror(errno));
+			    job->outname, strerror(errno));
 	}
 
-	if (streq(outform, "dts")) {
+	if (streq(job->outform, "dts")) {
 		dt_to_source(outf, dti);
-	} else if (streq(outform, "dtb")) {
-		dt_to_blob(outf, dti, outversion);
-	} else if (streq(outform, "asm")) {
-		dt_to_asm(outf, dti, outversion);
-	} else if (streq(outform, "null")) {
+	} else if (streq(job->outform, "dtb")) {
+		dt_to_blob(outf, dti, job->outversion);
+	} else if (streq(job->outform, "asm")) {
+		dt_to_asm(outf, dti, job->outversion);
+	} else if (streq(job->outform, "null")) {
 		/* do nothing */
 	} else {
-		die("Unknown output format \"%s\"\n", outform);
+		die("Unknown output format \"%s\"\n", job->outform);
 	}
 
+	if ((outf != stdout) && fclose(outf))
+		die("Couldn't write output file %s: %s\n", job->outname,
+		    strerror(errno));
+
+	if (job->stats) {
+		arena_print_stats(stderr);
+		print_check_stats(stderr);
+	}
+}
+
+/*
+ * --batch: inputs are parsed one after the other in this process,
+ * which lets .dtsi files shared between jobs be read once, and each
+ * parsed tree is handed to a forked worker that runs the checks and
+ * writes the output while the next input is parsed.  Workers are
+ * processes rather than threads because the checks and the output
+ * code keep their state in globals; fork() also gives each worker its
+ * own copy of the tree, so the arena can be reset for the next job
+ * right away.
+ */
+struct batch_worker {
+	pid_t pid;
+	int lineno;
+	char *input;
+};
+
+static struct {
+	const char *manifest;
+	struct batch_worker *workers;
+	int nr_workers, running, failed;
+	int lineno;		/* job being parsed, 0 if none */
+	const char *input;
+} batch;
+
+static void job_failed(int lineno, const char *input)
+{
+	fprintf(stderr, "ERROR: %s:%d: job for %s failed\n", batch.manifest,
+		lineno, input);
+	batch.failed++;
+}
+
+static void wait_worker(void)
+{
+	struct batch_worker *w;
+	int status;
+	pid_t pid;
+
+	do {
+		pid = wait(&status);
+	} while ((pid < 0) && (errno == EINTR));
+	if (pid < 0)
+		die("wait() failed: %s\n", strerror(errno));
+
+	for (w = batch.workers; w->pid != pid; w++)
+		assert(w < batch.workers + batch.nr_workers - 1);
+
+	if (!WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+		job_failed(w->lineno, w->input);
+
+	free(w->input);
+	w->pid = 0;
+	batch.running--;
+}
+
+/* If parsing a job dies, let the jobs already running finish */
+static void batch_atexit(void)
+{
+	if (!batch.workers)
+		return;
+
+	if (batch.lineno)
+		job_failed(batch.lineno, batch.input);
+
+	while (batch.running)
+		wait_worker();
+}
+
+static char **read_manifest(const char *manifest, int *nr_lines)
+{
+	char **lines = NULL;
+	char *line = NULL;
+	size_t size = 0;
+	FILE *f;
+
+	if (streq(manifest, "-"))
+		f = stdin;
+	else
+		f = fopen(manifest, "r");
+	if (!f)
+		die("Couldn't open manifest %s: %s\n", manifest,
+		    strerror(errno));
+
+	*nr_lines = 0;
+	while (getline(&line, &size, f) >= 0) {
+		lines = xrealloc(lines, (*nr_lines + 1) * sizeof(*lines));
+		lines[(*nr_lines)++] = xstrdup(line);
+	}
+	if (ferror(f))
+		die("Couldn't read manifest %s: %s\n", manifest,
+		    strerror(errno));
+
+	free(line);
+	if (f != stdin)
+		fclose(f);
+
+	return lines;
+}
+
+static int run_batch(struct dtc_job *opts, int nr_defaults, char *defaults[],
+		     char *argv0)
+{
+	struct batch_worker *w;
+	struct dtc_job job;
+	struct dt_info *dti;
+	char **lines, **words, **args, *tok;
+	int nr_lines, nr_words, nr_args;
+	int lineno, i;
+	pid_t pid;
+
+	/* read it all before any fork(), workers mustn't share the FILE */
+	batch.manifest = opts->manifest;
+	lines = read_manifest(batch.manifest, &nr_lines);
+
+	batch.nr_workers = opts->nr_workers;
+	if (batch.nr_workers <= 0)
+		batch.nr_workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (batch.nr_workers <= 0)
+		batch.nr_workers = 1;
+	batch.workers = xmalloc(batch.nr_workers * sizeof(*batch.workers));
+	memset(batch.workers, 0, batch.nr_workers * sizeof(*batch.workers));
+	atexit(batch_atexit);
+
+	srcfile_enable_cache();
+
+	for (lineno = 1; lineno <= nr_lines; lineno++) {
+		char *line = lines[lineno - 1];
+
+		words = xmalloc((strlen(line) / 2 + 1) * sizeof(*words));
+		nr_words = 0;
+		for (tok = strtok(line, " \t\n"); tok;
+		     tok = strtok(NULL, " \t\n"))
+			words[nr_words++] = tok;
+
+		if ((nr_words == 0) || (words[0][0] == '#')) {
+			free(words);
+			continue;
+		}
+		if (nr_words < 2)
+			die("%s:%d: expected <input> <output> [<options>]\n",
+			    batch.manifest, lineno);
+
+		/* argv0 <defaults> [<options>] -o <output> <input> */
+		args = xmalloc((nr_defaults + nr_words + 3) * sizeof(*args));
+		nr_args = 0;
+		args[nr_args++] = argv0;
+		for (i = 0; i < nr_defaults; i++)
+			args[nr_args++] = defaults[i];
+		for (i = 2; i < nr_words; i++)
+			args[nr_args++] = words[i];
+		args[nr_args++] = "-o";
+		args[nr_args++] = words[1];
+		args[nr_args++] = words[0];
+		args[nr_args] = NULL;
+
+		batch.lineno = lineno;
+		batch.input = words[0];
+
+		srcfile_reset_search_path();
+		parse_options(&job, nr_args, args);
+
+		cache_begin(job.cachename, nr_args, args);
+		if (cache_fresh(job.outname, job.depname, job.stats)) {
+			batch.lineno = 0;
+			free(job.checkopts);
+			free(args);
+			free(words);
+			continue;
+		}
+
+		dti = read_input(&job);
+
+		if (batch.running == batch.nr_workers)
+			wait_worker();
+		for (w = batch.workers; w->pid; w++)
+			;
+
+		fflush(NULL);
+		pid = fork();
+		if (pid < 0)
+			die("fork() failed: %s\n", strerror(errno));
+		if (pid == 0) {
+			batch.workers = NULL;
+			apply_check_options(&job);
+			write_output(&job, dti);
+			cache_write(dti, job.outname, job.stats);
+			exit(0);
+		}
+
+		w->pid = pid;
+		w->lineno = lineno;
+		w->input = xstrdup(words[0]);
+		batch.running++;
+		batch.lineno = 0;
+
+		free(job.checkopts);
+		free(args);
+		free(words);
+
+		/* the worker has its own copy of the tree */
+		reset_tree_index();
+		arena_reset();
+	}
+
+	while (batch.running)
+		wait_worker();
+
+	for (i = 0; i < nr_lines; i++)
+		free(lines[i]);
+	free(lines);
+
+	return batch.failed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct dtc_job job;
+	struct dt_info *dti;
+
+	parse_options(&job, argc, argv);
+
+	if (job.manifest) {
+		if ((optind < argc) || !streq(job.outname, "-")
+		    || job.depname)
+			die("--batch takes inputs, outputs and -d from "
+			    "the manifest\n");
+
+		/* getopt() has moved the options to the front */
+		exit(run_batch(&job, optind - 1, argv + 1, argv[0]) ?
+		     EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	cache_begin(job.cachename, argc, argv);
+	if (cache_fresh(job.outname, job.depname, job.stats))
+		exit(0);
+
+	apply_check_options(&job);
+	dti = read_input(&job);
+	write_output(&job, dti);
+	cache_write(dti, job.outname, job.stats);
+
 	exit(0);
 }
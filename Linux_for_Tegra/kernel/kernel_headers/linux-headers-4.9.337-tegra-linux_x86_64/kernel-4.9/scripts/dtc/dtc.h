@@ -71,6 +71,14 @@ typedef uint32_t cell_t;
 
 #define ALIGN(x, a)	(((x) + (a) - 1) & ~((a) - 1))
 
+/* Allocation arena, see arena.c */
+void *arena_alloc(size_t len);
+char *arena_strdup(const char *s);
+void *arena_realloc(void *p, size_t len);
+void arena_release(void *p);
+void arena_reset(void);
+void arena_print_stats(FILE *f);
+
 /* Data blobs */
 enum markertype {
 	REF_PHANDLE,
@@ -88,6 +96,7 @@ struct  marker {
 struct data {
 	int len;
 	char *val;
+	bool borrowed;	/* val points into memory owned elsewhere */
 	struct marker *markers;
 };
 
@@ -105,6 +114,7 @@ void data_free(struct data d);
 struct data data_grow_for(struct data d, int xlen);
 
 struct data data_copy_mem(const char *mem, int len);
+struct data data_ref_mem(const char *mem, int len);
 struct data data_copy_escape_string(const char *s, int len);
 struct data data_copy_file(FILE *f, size_t len);
 
@@ -221,7 +231,12 @@ struct node *get_node_by_path(struct node *tree, const char *path);
 struct node *get_node_by_label(struct node *tree, const char *label);
 struct node *get_node_by_phandle(struct node *tree, cell_t phandle);
 struct node *get_node_by_ref(struct node *tree, const char *ref);
+void set_node_phandle(struct node *node, cell_t phandle);
 cell_t get_node_phandle(struct node *root, struct node *node);
+void reset_tree_index(void);
+uint64_t subtree_hash(struct node *node,
+		      void (*fn)(struct node *node, uint64_t hash, void *arg),
+		      void *arg);
 
 uint32_t guess_boot_cpuid(struct node *tree);
 
@@ -264,7 +279,8 @@ void generate_local_fixups_tree(struct dt_info *dti, char *name);
 /* Checks */
 
 void parse_checks_option(bool warn, bool error, const char *arg);
-void process_checks(bool force, struct dt_info *dti);
+void process_checks(bool force, bool timing, struct dt_info *dti);
+void print_check_stats(FILE *f);
 
 /* Flattened trees */
 
@@ -282,4 +298,15 @@ struct dt_info *dt_from_source(const char *f);
 
 struct dt_info *dt_from_fs(const char *dirname);
 
+/* Build cache, see cache.c */
+
+#define CACHE_HASH_INIT		0xcbf29ce484222325ULL
+
+uint64_t cache_hash(uint64_t h, const void *buf, size_t len);
+void cache_begin(const char *name, int argc, char *argv[]);
+void cache_note_input(const char *fullname);
+void cache_note_absent(const char *fullname);
+bool cache_fresh(const char *outname, const char *depname, bool stats);
+void cache_write(struct dt_info *dti, const char *outname, bool stats);
+
 #endif /* _DTC_H */
@@ -0,0 +1,553 @@
+/*
+ * Structural diff of two flattened device trees.
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston,
+ * MA 02111-1307 USA
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libfdt.h>
+
+#include "util.h"
+
+/* Usage related data. */
+static const char usage_synopsis[] =
+	"compare two DT blobs node by node\n"
+	"	fdtdiff [options] <old.dtb> <new.dtb>\n"
+	"\n"
+	"Each difference is printed as one line of tab separated fields:\n"
+	"	-node	<path>\n"
+	"	+node	<path>\n"
+	"	-prop	<path>	<name>	<value>\n"
+	"	+prop	<path>	<name>	<value>\n"
+	"	~prop	<path>	<name>	<old value>	<new value>\n"
+	"	-memreserve	<address> <size>\n"
+	"	+memreserve	<address> <size>\n"
+	"\n"
+	"Nodes and properties are compared in name order, whatever order the\n"
+	"blobs have them in.  A node added or removed is reported once, not\n"
+	"with everything below it.  Unless --raw-phandles is given, a cell\n"
+	"holding a phandle compares equal to one holding the phandle of the\n"
+	"node with the same path in the other tree, and the phandle\n"
+	"properties themselves are not compared.\n"
+	"\n"
+	"The exit status is 0 if the trees are the same, 1 if they differ and\n"
+	"2 if a blob can't be read";
+static const char usage_short_opts[] = "qr" USAGE_COMMON_SHORT_OPTS;
+static struct option const usage_long_opts[] = {
+	{"quiet",           no_argument, NULL, 'q'},
+	{"raw-phandles",    no_argument, NULL, 'r'},
+	USAGE_COMMON_LONG_OPTS,
+};
+static const char * const usage_opts_help[] = {
+	"Print nothing, only set the exit status",
+	"Compare phandle values as plain numbers",
+	USAGE_COMMON_OPTS_HELP
+};
+
+struct phandle_path {
+	uint32_t phandle;
+	char *path;
+};
+
+struct blob {
+	const char *filename;
+	char *fdt;
+	struct phandle_path *phandles;	/* sorted by phandle */
+	int nr_phandles;
+};
+
+/* A node or property of one tree, for putting them in name order */
+struct entry {
+	const char *name;
+	int offset;
+};
+
+static struct blob old, new;
+static int quiet, raw_phandles;
+static int differ;
+
+/* Path of the node being compared */
+static char *path;
+static int path_len, path_size;
+
+static void __attribute__((noreturn)) bad_blob(struct blob *b, int err)
+{
+	fprintf(stderr, "fdtdiff: %s: %s\n", b->filename, fdt_strerror(err));
+	exit(2);
+}
+
+static void read_blob(struct blob *b, const char *filename)
+{
+	off_t len;
+	int err;
+
+	b->filename = filename;
+	b->fdt = utilfdt_read_len(filename, &len);
+	if (!b->fdt)
+		exit(2);
+
+	if (len < sizeof(struct fdt_header))
+		bad_blob(b, -FDT_ERR_TRUNCATED);
+	err = fdt_check_header(b->fdt);
+	if (err)
+		bad_blob(b, err);
+	if (fdt_totalsize(b->fdt) > len)
+		bad_blob(b, -FDT_ERR_TRUNCATED);
+}
+
+static int cmp_phandle(const void *a, const void *b)
+{
+	const struct phandle_path *pa = a, *pb = b;
+
+	return (pa->phandle > pb->phandle) - (pa->phandle < pb->phandle);
+}
+
+/*
+ * Record the path of every node with a phandle, building the paths up
+ * in one pass over the structure block rather than asking
+ * fdt_get_path() for each.
+ */
+static void read_phandles(struct blob *b)
+{
+	int *parent_len = NULL;
+	int offset, depth = 0, max_depth = 0;
+	int len, size = 0;
+	const char *name;
+	char *buf = NULL;
+	uint32_t phandle;
+
+	for (offset = 0; (offset >= 0) && (depth >= 0);
+	     offset = fdt_next_node(b->fdt, offset, &depth)) {
+		name = fdt_get_name(b->fdt, offset, &len);
+		if (!name)
+			bad_blob(b, len);
+
+		if (depth >= max_depth) {
+			max_depth = depth + 16;
+			parent_len = xrealloc(parent_len,
+					      max_depth * sizeof(*parent_len));
+		}
+
+		/* the root is "/", everything else is <parent>/<name> */
+		parent_len[depth] = depth ? parent_len[depth - 1] + 1 + len : 0;
+		if (parent_len[depth] + 2 > size) {
+			size = parent_len[depth] + 256;
+			buf = xrealloc(buf, size);
+		}
+		if (depth) {
+			buf[parent_len[depth - 1]] = '/';
+			memcpy(buf + parent_len[depth - 1] + 1, name, len);
+		}
+		buf[parent_len[depth]] = '\0';
+
+		phandle = fdt_get_phandle(b->fdt, offset);
+		if (!phandle)
+			continue;
+
+		b->phandles = xrealloc(b->phandles, (b->nr_phandles + 1) *
+				       sizeof(*b->phandles));
+		b->phandles[b->nr_phandles].phandle = phandle;
+		b->phandles[b->nr_phandles].path = xstrdup(depth ? buf : "/");
+		b->nr_phandles++;
+	}
+	/* past the root's end, depth goes negative instead */
+	if ((offset < 0) && (offset != -FDT_ERR_NOTFOUND))
+		bad_blob(b, offset);
+
+	if (b->nr_phandles)
+		qsort(b->phandles, b->nr_phandles, sizeof(*b->phandles),
+		      cmp_phandle);
+
+	free(parent_len);
+	free(buf);
+}
+
+static const char *phandle_path(struct blob *b, uint32_t phandle)
+{
+	struct phandle_path key = { .phandle = phandle };
+	struct phandle_path *p;
+
+	if (!b->nr_phandles)
+		return NULL;
+
+	p = bsearch(&key, b->phandles, b->nr_phandles, sizeof(*b->phandles),
+		    cmp_phandle);
+
+	return p ? p->path : NULL;
+}
+
+static int cmp_entry(const void *a, const void *b)
+{
+	return strcmp(((const struct entry *)a)->name,
+		      ((const struct entry *)b)->name);
+}
+
+static int read_props(struct blob *b, int node, struct entry **list)
+{
+	int offset, n = 0;
+
+	*list = NULL;
+	fdt_for_each_property_offset(offset, b->fdt, node) {
+		*list = xrealloc(*list, (n + 1) * sizeof(**list));
+		if (!fdt_getprop_by_offset(b->fdt, offset, &(*list)[n].name,
+					   NULL))
+			bad_blob(b, -FDT_ERR_BADSTRUCTURE);
+		(*list)[n++].offset = offset;
+	}
+	if (offset != -FDT_ERR_NOTFOUND)
+		bad_blob(b, offset);
+
+	if (n)
+		qsort(*list, n, sizeof(**list), cmp_entry);
+
+	return n;
+}
+
+static int read_subnodes(struct blob *b, int node, struct entry **list)
+{
+	int offset, n = 0;
+
+	*list = NULL;
+	fdt_for_each_subnode(offset, b->fdt, node) {
+		*list = xrealloc(*list, (n + 1) * sizeof(**list));
+		(*list)[n].name = fdt_get_name(b->fdt, offset, NULL);
+		if (!(*list)[n].name)
+			bad_blob(b, -FDT_ERR_BADSTRUCTURE);
+		(*list)[n++].offset = offset;
+	}
+	if (offset != -FDT_ERR_NOTFOUND)
+		bad_blob(b, offset);
+
+	if (n)
+		qsort(*list, n, sizeof(**list), cmp_entry);
+
+	return n;
+}
+
+/* Append /name to the current path, returning the length to go back to */
+static int push_path(const char *name)
+{
+	int len = path_len;
+	int need = path_len + 1 + strlen(name) + 1;
+
+	if (need > path_size) {
+		path_size = need + 256;
+		path = xrealloc(path, path_size);
+	}
+	path_len += sprintf(path + path_len, "/%s", name);
+
+	return len;
+}
+
+static void pop_path(int len)
+{
+	path_len = len;
+	path[len] = '\0';
+}
+
+static const char *current_path(void)
+{
+	return path_len ? path : "/";
+}
+
+static void print_value(const char *val, int len)
+{
+	const char *s, *end = val + len;
+	fdt32_t cell;
+	int i;
+
+	if (len == 0)
+		return;
+
+	if (util_is_printable_string(val, len)) {
+		for (s = val; s < end; s++) {
+			printf("%s\"", s == val ? "" : ", ");
+			for (; *s; s++) {
+				if ((*s == '"') || (*s == '\\'))
+					putchar('\\');
+				putchar(*s);
+			}
+			putchar('"');
+		}
+	} else if ((len % 4) == 0) {
+		printf("<");
+		for (i = 0; i < len; i += 4) {
+			memcpy(&cell, val + i, sizeof(cell));
+			printf("%s0x%x", i ? " " : "", fdt32_to_cpu(cell));
+		}
+		printf(">");
+	} else {
+		printf("[");
+		for (i = 0; i < len; i++)
+			printf("%s%02x", i ? " " : "", (unsigned char)val[i]);
+		printf("]");
+	}
+}
+
+static void report_node(char what)
+{
+	differ = 1;
+	if (!quiet)
+		printf("%cnode\t%s\n", what, current_path());
+}
+
+static void report_prop(char what, const char *name,
+			const char *val, int len,
+			const char *newval, int newlen)
+{
+	differ = 1;
+	if (quiet)
+		return;
+
+	printf("%cprop\t%s\t%s\t", what, current_path(), name);
+	print_value(val, len);
+	if (newval) {
+		printf("\t");
+		print_value(newval, newlen);
+	}
+	printf("\n");
+}
+
+static int is_phandle_prop(const char *name)
+{
+	return !strcmp(name, "phandle") || !strcmp(name, "linux,phandle");
+}
+
+static int same_value(const char *name, const char *a, int alen,
+		      const char *b, int blen)
+{
+	const char *apath, *bpath;
+	fdt32_t acell, bcell;
+	int i;
+
+	if ((alen == blen) && !memcmp(a, b, alen))
+		return 1;
+	if (raw_phandles || (alen != blen) || (alen % 4))
+		return 0;
+
+	/* a node's own phandle only matters through the cells naming it */
+	if (is_phandle_prop(name))
+		return 1;
+
+	/*
+	 * There's no telling from a blob which cells are phandles, but a
+	 * cell that differs can only be the same reference if both values
+	 * are phandles of nodes at the same path.
+	 */
+	for (i = 0; i < alen; i += 4) {
+		memcpy(&acell, a + i, sizeof(acell));
+		memcpy(&bcell, b + i, sizeof(bcell));
+		if (acell == bcell)
+			continue;
+
+		apath = phandle_path(&old, fdt32_to_cpu(acell));
+		bpath = phandle_path(&new, fdt32_to_cpu(bcell));
+		if (!apath || !bpath || strcmp(apath, bpath))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void diff_props(int aoff, int boff)
+{
+	struct entry *a, *b;
+	const char *aval = NULL, *bval = NULL;
+	int na, nb, i = 0, j = 0;
+	int alen, blen, cmp;
+
+	na = read_props(&old, aoff, &a);
+	nb = read_props(&new, boff, &b);
+
+	while (((i < na) || (j < nb)) && !(quiet && differ)) {
+		if (i == na)
+			cmp = 1;
+		else if (j == nb)
+			cmp = -1;
+		else
+			cmp = strcmp(a[i].name, b[j].name);
+
+		if (cmp <= 0)
+			aval = fdt_getprop_by_offset(old.fdt, a[i].offset,
+						     NULL, &alen);
+		if (cmp >= 0)
+			bval = fdt_getprop_by_offset(new.fdt, b[j].offset,
+						     NULL, &blen);
+
+		if (cmp < 0) {
+			report_prop('-', a[i].name, aval, alen, NULL, 0);
+			i++;
+		} else if (cmp > 0) {
+			report_prop('+', b[j].name, bval, blen, NULL, 0);
+			j++;
+		} else {
+			if (!same_value(a[i].name, aval, alen, bval, blen))
+				report_prop('~', a[i].name, aval, alen,
+					    bval, blen);
+			i++;
+			j++;
+		}
+	}
+
+	free(a);
+	free(b);
+}
+
+static void diff_node(int aoff, int boff)
+{
+	struct entry *a, *b;
+	int na, nb, i = 0, j = 0;
+	int cmp, len;
+
+	diff_props(aoff, boff);
+
+	na = read_subnodes(&old, aoff, &a);
+	nb = read_subnodes(&new, boff, &b);
+
+	while (((i < na) || (j < nb)) && !(quiet && differ)) {
+		if (i == na)
+			cmp = 1;
+		else if (j == nb)
+			cmp = -1;
+		else
+			cmp = strcmp(a[i].name, b[j].name);
+
+		len = push_path(cmp > 0 ? b[j].name : a[i].name);
+		if (cmp < 0) {
+			report_node('-');
+			i++;
+		} else if (cmp > 0) {
+			report_node('+');
+			j++;
+		} else {
+			diff_node(a[i].offset, b[j].offset);
+			i++;
+			j++;
+		}
+		pop_path(len);
+	}
+
+	free(a);
+	free(b);
+}
+
+static int cmp_rsv(const void *a, const void *b)
+{
+	const uint64_t *ra = a, *rb = b;
+
+	if (ra[0] != rb[0])
+		return (ra[0] > rb[0]) - (ra[0] < rb[0]);
+	return (ra[1] > rb[1]) - (ra[1] < rb[1]);
+}
+
+static int read_rsvmap(struct blob *b, uint64_t (**list)[2])
+{
+	int i, n = fdt_num_mem_rsv(b->fdt);
+
+	if (n < 0)
+		bad_blob(b, n);
+
+	*list = xmalloc((n + 1) * sizeof(**list));
+	for (i = 0; i < n; i++)
+		fdt_get_mem_rsv(b->fdt, i, &(*list)[i][0], &(*list)[i][1]);
+	if (n)
+		qsort(*list, n, sizeof(**list), cmp_rsv);
+
+	return n;
+}
+
+static void diff_rsvmap(void)
+{
+	uint64_t (*a)[2], (*b)[2];
+	int na, nb, i = 0, j = 0;
+	int cmp;
+
+	na = read_rsvmap(&old, &a);
+	nb = read_rsvmap(&new, &b);
+
+	while ((i < na) || (j < nb)) {
+		if (i == na)
+			cmp = 1;
+		else if (j == nb)
+			cmp = -1;
+		else
+			cmp = cmp_rsv(a[i], b[j]);
+
+		if (cmp == 0) {
+			i++;
+			j++;
+			continue;
+		}
+
+		differ = 1;
+		if (quiet)
+			break;
+		if (cmp < 0) {
+			printf("-memreserve\t0x%llx 0x%llx\n",
+			       (unsigned long long)a[i][0],
+			       (unsigned long long)a[i][1]);
+			i++;
+		} else {
+			printf("+memreserve\t0x%llx 0x%llx\n",
+			       (unsigned long long)b[j][0],
+			       (unsigned long long)b[j][1]);
+			j++;
+		}
+	}
+
+	free(a);
+	free(b);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	while ((opt = util_getopt_long()) != EOF) {
+		switch (opt) {
+		case_USAGE_COMMON_FLAGS
+
+		case 'q':
+			quiet = 1;
+			break;
+		case 'r':
+			raw_phandles = 1;
+			break;
+		}
+	}
+
+	if (argc - optind != 2)
+		usage("need two blobs to compare");
+
+	read_blob(&old, argv[optind]);
+	read_blob(&new, argv[optind + 1]);
+
+	if (!raw_phandles) {
+		read_phandles(&old);
+		read_phandles(&new);
+	}
+
+	diff_rsvmap();
+	if (!(quiet && differ))
+		diff_node(0, 0);
+
+	return differ;
+}
@@ -25,10 +25,16 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <libfdt.h>
 
@@ -277,55 +283,571 @@ static int do_fdtget(struct display_info *disp, const char *filename,
 	return 0;
 }
 
-static const char *usage_msg =
-	"fdtget - read values from device tree\n"
-	"\n"
-	"Each value is printed on a new line.\n\n"
-	"Usage:\n"
-	"	fdtget <options> <dt file> [<node> <property>]...\n"
-	"	fdtget -p <options> <dt file> [<node> ]...\n"
-	"Options:\n"
-	"\t-t <type>\tType of data\n"
-	"\t-p\t\tList properties for each node\n"
-	"\t-l\t\tList subnodes for each node\n"
-	"\t-d\t\tDefault value to display when the property is "
-			"missing\n"
-	"\t-h\t\tPrint this help\n\n"
-	USAGE_TYPE_MSG;
+/*
+ * Batch mode (-b): the queries come from stdin, one per line, and are all
+ * answered in a single pass over the blob.  A query is a node selector
+ * followed, optionally, by a property name or glob:
+ *
+ *	/path/to/node [prop]		each component may be a glob, and one
+ *					without a unit address matches any
+ *	alias[/more/path] [prop]	a path starting at an alias
+ *	compatible=<str> [prop]		every node with <str> (or a glob) in
+ *					its compatible list
+ *
+ * Without a property, every property of the matching nodes is shown.
+ *
+ * Path selectors are filed by depth, so each node is only tried against
+ * those that could match it, and the properties of a node are gone
+ * through once however many selectors matched it.
+ */
+
+struct sel_comp {
+	const char *name;
+	int len;
+	int glob;		/* name is a pattern */
+	int unit;		/* name has a unit address */
+};
+
+struct selector {
+	char *query;		/* the line as given */
+	char *text;		/* copy of it split up for the fields below */
+	char *alias_path;	/* expansion of a leading alias, if any */
+	struct sel_comp *comp;	/* path components, or the compatible */
+	int nr_comp;
+	int compatible;		/* compatible=, else a path */
+	struct sel_comp prop;	/* property, name NULL for all */
+	int index;		/* position on stdin */
+	int matches;
+	struct selector *next;	/* in its depth or compatible list */
+};
+
+struct matcher {
+	struct selector **sel;
+	int nr_sel;
+	struct selector *by_depth[MAX_LEVEL];
+	struct selector *compatible;
+};
+
+static int is_glob(const char *s, int len)
+{
+	return strcspn(s, "*?[") < len;
+}
+
+static void compile_comp(struct sel_comp *c, const char *name, int len)
+{
+	c->name = name;
+	c->len = len;
+	c->glob = is_glob(name, len);
+	c->unit = memchr(name, '@', len) != NULL;
+}
+
+static int comp_matches(const struct sel_comp *c, const char *name)
+{
+	char base[256];
+	int len;
+
+	/* without a unit address in the selector, compare base names */
+	len = c->unit ? strlen(name) : strcspn(name, "@");
+
+	if (!c->glob)
+		return (len == c->len) && !memcmp(name, c->name, len);
+
+	if (len >= sizeof(base))
+		return 0;
+	memcpy(base, name, len);
+	base[len] = '\0';
+
+	return !fnmatch(c->name, base, 0);
+}
 
-static void usage(const char *msg)
+static int path_matches(const struct selector *sel, const char **names)
 {
-	if (msg)
-		fprintf(stderr, "Error: %s\n\n", msg);
+	int i;
+
+	/* names[0] is the root's */
+	for (i = 0; i < sel->nr_comp; i++)
+		if (!comp_matches(&sel->comp[i], names[i + 1]))
+			return 0;
 
-	fprintf(stderr, "%s", usage_msg);
-	exit(2);
+	return 1;
 }
 
+static int compatible_matches(const struct selector *sel,
+			      const char *compat, int len)
+{
+	const char *s, *end = compat + len;
+	int slen;
+
+	for (s = compat; s < end; s += slen + 1) {
+		slen = strnlen(s, end - s);
+		if (slen == end - s)
+			break;		/* not NUL-terminated */
+		if (sel->comp->glob ? !fnmatch(sel->comp->name, s, 0)
+				    : !strcmp(sel->comp->name, s))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int prop_matches(const struct selector *sel, const char *name)
+{
+	if (!sel->prop.name)
+		return 1;
+
+	return sel->prop.glob ? !fnmatch(sel->prop.name, name, 0)
+			      : !strcmp(sel->prop.name, name);
+}
+
+/* Split a path into components, resolving a leading alias */
+static int compile_path(const void *blob, struct selector *sel, char *path)
+{
+	const char *alias;
+	char *p, *end;
+	int len;
+
+	if (*path != '/') {
+		len = strcspn(path, "/");
+		alias = fdt_get_alias_namelen(blob, path, len);
+		if (!alias)
+			return -FDT_ERR_BADPATH;
+		xasprintf(&sel->alias_path, "%s%s", alias, path + len);
+		path = sel->alias_path;
+	}
+
+	for (p = path; *p; p = end) {
+		p += strspn(p, "/");
+		end = p + strcspn(p, "/");
+		if (end == p)
+			break;
+
+		sel->comp = xrealloc(sel->comp,
+				     (sel->nr_comp + 1) * sizeof(*sel->comp));
+		compile_comp(&sel->comp[sel->nr_comp++], p, end - p);
+		if (*end)
+			*end++ = '\0';
+	}
+
+	return 0;
+}
+
+static void add_selector(struct matcher *m, const void *blob,
+			 const char *line)
+{
+	struct selector *sel;
+	char *node, *prop;
+
+	sel = xmalloc(sizeof(*sel));
+	memset(sel, 0, sizeof(*sel));
+	sel->query = xstrdup(line);
+	sel->text = xstrdup(line);
+
+	node = sel->text;
+	prop = node + strcspn(node, " \t");
+	if (*prop) {
+		*prop++ = '\0';
+		prop += strspn(prop, " \t");
+	}
+	if (*prop)
+		compile_comp(&sel->prop, prop, strlen(prop));
+
+	sel->index = m->nr_sel;
+	m->sel = xrealloc(m->sel, (m->nr_sel + 1) * sizeof(*m->sel));
+	m->sel[m->nr_sel++] = sel;
+
+	if (!strncmp(node, "compatible=", 11)) {
+		sel->compatible = 1;
+		sel->comp = xmalloc(sizeof(*sel->comp));
+		compile_comp(sel->comp, node + 11, strlen(node + 11));
+		sel->next = m->compatible;
+		m->compatible = sel;
+		return;
+	}
+
+	/* one that can never match is still reported, as not found */
+	if (compile_path(blob, sel, node) || (sel->nr_comp >= MAX_LEVEL))
+		return;
+	sel->next = m->by_depth[sel->nr_comp];
+	m->by_depth[sel->nr_comp] = sel;
+}
+
+static void read_selectors(struct matcher *m, const void *blob, FILE *f)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+
+	while ((len = getline(&line, &size, f)) >= 0) {
+		while (len && isspace((unsigned char)line[len - 1]))
+			line[--len] = '\0';
+		len = strspn(line, " \t");
+		if (line[len] && (line[len] != '#'))
+			add_selector(m, blob, line + len);
+	}
+
+	free(line);
+}
+
+static void print_json_string(const char *s, int len)
+{
+	unsigned char c;
+
+	putchar('"');
+	for (; len > 0; len--) {
+		c = *s++;
+		if ((c == '"') || (c == '\\'))
+			printf("\\%c", c);
+		else if ((c < 0x20) || (c == 0x7f))
+			printf("\\u%04x", c);
+		else
+			putchar(c);
+	}
+	putchar('"');
+}
+
+/**
+ * Displays data as a JSON array, following the same rules as show_data()
+ * except that numbers are unsigned unless -t says otherwise
+ *
+ * @param disp		Display information / options
+ * @param data		Data to display
+ * @param len		Maximum length of buffer
+ * @return NULL if ok, else what is wrong with the data
+ */
+static const char *show_json_data(struct display_info *disp,
+				  const char *data, int len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	const char *s;
+	uint32_t value;
+	int i, size;
+	int type = disp->type ? disp->type : 'u';
+
+	if (len == 0) {
+		printf("[]");
+		return NULL;
+	}
+
+	if ((disp->type == 's') ||
+	    (!disp->type && util_is_printable_string(data, len))) {
+		if (data[len - 1] != '\0')
+			return "Unterminated string";
+		for (s = data; s - data < len; s += strlen(s) + 1) {
+			printf(s == data ? "[" : ",");
+			print_json_string(s, strlen(s));
+		}
+		printf("]");
+		return NULL;
+	}
+
+	size = disp->size;
+	if (size == -1)
+		size = (len % 4) == 0 ? 4 : 1;
+	else if (len % size)
+		return "Property length must be a multiple of selected data size";
+
+	for (i = 0; i < len; i += size, p += size) {
+		printf(i ? "," : "[");
+		value = size == 4 ? fdt32_to_cpu(*(const uint32_t *)p) :
+			size == 2 ? (*p << 8) | p[1] : *p;
+		if (type == 'x')
+			printf("\"0x%x\"", value);
+		else if (type == 'i')
+			printf("%d", (int)value);
+		else
+			printf("%u", value);
+	}
+	printf("]");
+
+	return NULL;
+}
+
+static void show_batch_record(struct display_info *disp, struct selector *sel,
+			      const char *path, const char *name,
+			      const char *value, int len)
+{
+	const char *err;
+
+	printf("{\"query\":");
+	print_json_string(sel->query, strlen(sel->query));
+	printf(",\"path\":");
+	print_json_string(path, strlen(path));
+	printf(",\"property\":");
+	print_json_string(name, strlen(name));
+	printf(",\"value\":");
+
+	/* the value may be cut short; it is still valid JSON */
+	err = show_json_data(disp, value, len);
+	if (err) {
+		printf("null,\"error\":");
+		print_json_string(err, strlen(err));
+	}
+	printf("}\n");
+
+	sel->matches++;
+}
+
+static int show_batch_node(struct display_info *disp, const void *blob,
+			   int node, const char **names, int depth,
+			   struct selector **hit, int nr_hit)
+{
+	char path[MAX_LEVEL * 256];
+	const char *name, *value;
+	int i, len, prop, pathlen = 0;
+
+	for (i = 1; i <= depth; i++) {
+		pathlen += snprintf(path + pathlen, sizeof(path) - pathlen,
+				    "/%s", names[i]);
+		if (pathlen >= sizeof(path) - 1) {
+			/* report it truncated rather than run off the end */
+			pathlen = sizeof(path) - 1;
+			break;
+		}
+	}
+	if (!depth)
+		strcpy(path, "/");
+
+	fdt_for_each_property_offset(prop, blob, node) {
+		value = fdt_getprop_by_offset(blob, prop, &name, &len);
+		if (!value)
+			return len;
+
+		for (i = 0; i < nr_hit; i++)
+			if (prop_matches(hit[i], name))
+				show_batch_record(disp, hit[i], path, name,
+						  value, len);
+	}
+
+	return prop == -FDT_ERR_NOTFOUND ? 0 : prop;
+}
+
+/* Put the selectors matching a node back in the order they were given */
+static void sort_hits(struct selector **hit, int nr_hit)
+{
+	struct selector *sel;
+	int i, j;
+
+	for (i = 1; i < nr_hit; i++) {
+		sel = hit[i];
+		for (j = i; (j > 0) && (hit[j - 1]->index > sel->index); j--)
+			hit[j] = hit[j - 1];
+		hit[j] = sel;
+	}
+}
+
+static int run_batch(struct display_info *disp, const void *blob,
+		     struct matcher *m)
+{
+	const char *names[MAX_LEVEL];
+	struct selector **hit, *sel;
+	const char *compat;
+	int node, depth = 0, nr_hit, len, err = 0;
+
+	hit = xmalloc((m->nr_sel + 1) * sizeof(*hit));
+
+	for (node = 0; (node >= 0) && (depth >= 0);
+	     node = fdt_next_node(blob, node, &depth)) {
+		if (depth >= MAX_LEVEL) {
+			err = -FDT_ERR_BADSTRUCTURE;
+			break;
+		}
+		names[depth] = fdt_get_name(blob, node, &len);
+		if (!names[depth]) {
+			err = len;
+			break;
+		}
+
+		nr_hit = 0;
+		for (sel = m->by_depth[depth]; sel; sel = sel->next)
+			if (path_matches(sel, names))
+				hit[nr_hit++] = sel;
+
+		if (m->compatible) {
+			compat = fdt_getprop(blob, node, "compatible", &len);
+			for (sel = m->compatible; compat && sel; sel = sel->next)
+				if (compatible_matches(sel, compat, len))
+					hit[nr_hit++] = sel;
+		}
+
+		if (!nr_hit)
+			continue;
+		sort_hits(hit, nr_hit);
+
+		err = show_batch_node(disp, blob, node, names, depth,
+				      hit, nr_hit);
+		if (err)
+			break;
+	}
+	free(hit);
+
+	if (!err && (node < 0) && (node != -FDT_ERR_NOTFOUND))
+		err = node;
+	if (err) {
+		report_error("batch", err);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void free_matcher(struct matcher *m)
+{
+	struct selector *sel;
+	int i;
+
+	for (i = 0; i < m->nr_sel; i++) {
+		sel = m->sel[i];
+		free(sel->query);
+		free(sel->text);
+		free(sel->alias_path);
+		free(sel->comp);
+		free(sel);
+	}
+	free(m->sel);
+}
+
+/* Map the blob instead of copying it, it is only read once anyway */
+static char *map_blob(const char *filename)
+{
+	struct stat st;
+	char *blob;
+	int fd, err;
+
+	fd = open(filename, O_RDONLY);
+	if ((fd < 0) || fstat(fd, &st)) {
+		fprintf(stderr, "Couldn't open blob from '%s': %s\n",
+			filename, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+	if (st.st_size < sizeof(struct fdt_header)) {
+		report_error(filename, -FDT_ERR_TRUNCATED);
+		close(fd);
+		return NULL;
+	}
+
+	blob = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (blob == MAP_FAILED) {
+		fprintf(stderr, "Couldn't map blob from '%s': %s\n",
+			filename, strerror(errno));
+		return NULL;
+	}
+
+	err = fdt_check_header(blob);
+	if (!err && (fdt_totalsize(blob) > st.st_size))
+		err = -FDT_ERR_TRUNCATED;
+	if (err) {
+		report_error(filename, err);
+		munmap(blob, st.st_size);
+		return NULL;
+	}
+
+	return blob;
+}
+
+/**
+ * Run fdtget in batch mode, reading the queries from stdin
+ *
+ * @param disp		Display information / options
+ * @param filename	Filename of blob file
+ * @param return 0 if every query matched, -ve if not or on error
+ */
+static int do_fdtget_batch(struct display_info *disp, const char *filename)
+{
+	struct matcher m;
+	char *blob;
+	int i, ret;
+
+	blob = map_blob(filename);
+	if (!blob)
+		return -1;
+
+	memset(&m, 0, sizeof(m));
+	read_selectors(&m, blob, stdin);
+
+	ret = run_batch(disp, blob, &m);
+	if (ret) {
+		free_matcher(&m);
+		return ret;
+	}
+
+	/* queries that matched nothing, in the order they were given */
+	for (i = 0; i < m.nr_sel; i++) {
+		if (m.sel[i]->matches)
+			continue;
+
+		printf("{\"query\":");
+		print_json_string(m.sel[i]->query, strlen(m.sel[i]->query));
+		if (disp->default_val) {
+			printf(",\"value\":[");
+			print_json_string(disp->default_val,
+					  strlen(disp->default_val));
+			printf("]}\n");
+		} else {
+			printf(",\"error\":\"%s\"}\n",
+			       fdt_strerror(-FDT_ERR_NOTFOUND));
+			ret = -1;
+		}
+	}
+	free_matcher(&m);
+
+	return ret;
+}
+
+/* Usage related data. */
+static const char usage_synopsis[] =
+	"read values from device tree\n"
+	"	fdtget <options> <dt file> [<node> <property>]...\n"
+	"	fdtget -p <options> <dt file> [<node> ]...\n"
+	"	fdtget -b <options> <dt file> < <queries>\n"
+	"\n"
+	"Each value is printed on a new line.  With -b, each line of stdin\n"
+	"is a query, \"<node> [<property>]\", where <node> is a path or\n"
+	"alias, or compatible=<string>, and path components, the\n"
+	"compatible string and the property may be globs.  Every match is\n"
+	"printed as a line of JSON, in the order they appear in the tree,\n"
+	"followed by the queries that matched nothing.\n"
+	USAGE_TYPE_MSG;
+static const char usage_short_opts[] = "t:pld:b" USAGE_COMMON_SHORT_OPTS;
+static struct option const usage_long_opts[] = {
+	{"type",              a_argument, NULL, 't'},
+	{"properties",       no_argument, NULL, 'p'},
+	{"list",             no_argument, NULL, 'l'},
+	{"default",           a_argument, NULL, 'd'},
+	{"batch",            no_argument, NULL, 'b'},
+	USAGE_COMMON_LONG_OPTS,
+};
+static const char * const usage_opts_help[] = {
+	"Type of data",
+	"List properties for each node",
+	"List subnodes for each node",
+	"Default value to display when the property is missing",
+	"Answer the queries on stdin in one pass, as JSON lines",
+	USAGE_COMMON_OPTS_HELP
+};
+
 int main(int argc, char *argv[])
 {
 	char *filename = NULL;
 	struct display_info disp;
 	int args_per_step = 2;
+	int batch = 0;
+	int opt;
 
 	/* set defaults */
 	memset(&disp, '\0', sizeof(disp));
 	disp.size = -1;
 	disp.mode = MODE_SHOW_VALUE;
-	for (;;) {
-		int c = getopt(argc, argv, "d:hlpt:");
-		if (c == -1)
-			break;
-
-		switch (c) {
-		case 'h':
-		case '?':
-			usage(NULL);
+	while ((opt = util_getopt_long()) != EOF) {
+		switch (opt) {
+		case_USAGE_COMMON_FLAGS
 
 		case 't':
 			if (utilfdt_decode_type(optarg, &disp.type,
 					&disp.size))
-				usage("Invalid type string");
+				usage("invalid type string");
 			break;
 
 		case 'p':
@@ -341,24 +863,38 @@ int main(int argc, char *argv[])
 		case 'd':
 			disp.default_val = optarg;
 			break;
+
+		case 'b':
+			batch = 1;
+			break;
 		}
 	}
 
 	if (optind < argc)
 		filename = argv[optind++];
 	if (!filename)
-		usage("Missing filename");
+		usage("missing filename");
 
 	argv += optind;
 	argc -= optind;
 
+	if (batch) {
+		if (disp.mode != MODE_SHOW_VALUE)
+			usage("-b cannot be used with -p or -l");
+		if (argc)
+			usage("-b takes its queries from stdin");
+		if (!strcmp(filename, "-"))
+			usage("-b needs the blob in a file");
+		return do_fdtget_batch(&disp, filename) ? 1 : 0;
+	}
+
 	/* Allow no arguments, and silently succeed */
 	if (!argc)
 		return 0;
 
 	/* Check for node, property arguments */
 	if (args_per_step == 2 && (argc % 2))
-		usage("Must have an even number of arguments");
+		usage("must have an even number of arguments");
 
 	if (do_fdtget(&disp, filename, argv, argc, args_per_step))
 		return 1;
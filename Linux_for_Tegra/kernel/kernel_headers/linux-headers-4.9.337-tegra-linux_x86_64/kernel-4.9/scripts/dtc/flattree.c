@@ -18,6 +18,9 @@
  *                                                                   USA
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "dtc.h"
 #include "srcpos.h"
 
@@ -240,23 +243,118 @@ static struct emitter asm_emitter = {
 	.property = asm_emit_property,
 };
 
-static int stringtable_insert(struct data *d, const char *str)
+/*
+ * String table for the strings block.
+ *
+ * Every offset in the block is the start of a NUL-terminated suffix
+ * of some property name, and any of them may be reused by a later
+ * name ("reg" can point into the tail of "interrupt-reg").  To keep
+ * the output identical to a linear first-match scan, each suffix is
+ * indexed in an open-addressed hash table the first time it appears.
+ * The hash is computed from the end of the string so that all suffix
+ * hashes of a new entry fall out of a single backwards pass.
+ */
+struct stringtable {
+	struct data buf;
+	int *slots;		/* offset into buf, or -1 if empty */
+	int size;		/* number of slots, power of 2 */
+	int count;		/* number of used slots */
+};
+
+#define STRINGTABLE_INIT_SIZE	256
+
+static uint32_t stringtable_hash_step(uint32_t h, char c)
+{
+	return (h ^ (unsigned char)c) * 16777619;
+}
+
+static uint32_t stringtable_hash(const char *str, int len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len--)
+		h = stringtable_hash_step(h, str[len]);
+
+	return h;
+}
+
+static int *stringtable_slot(struct stringtable *st, const char *str,
+			     uint32_t hash)
+{
+	int i = hash & (st->size - 1);
+
+	while (st->slots[i] >= 0) {
+		if (streq(str, st->buf.val + st->slots[i]))
+			break;
+		i = (i + 1) & (st->size - 1);
+	}
+
+	return &st->slots[i];
+}
+
+static void stringtable_grow(struct stringtable *st)
 {
+	int *old = st->slots;
+	int oldsize = st->size;
 	int i;
 
-	/* FIXME: do this more efficiently? */
+	st->size = oldsize ? oldsize * 2 : STRINGTABLE_INIT_SIZE;
+	st->slots = xmalloc(st->size * sizeof(*st->slots));
+	memset(st->slots, 0xff, st->size * sizeof(*st->slots));
 
-	for (i = 0; i < d->len; i++) {
-		if (streq(str, d->val + i))
-			return i;
+	for (i = 0; i < oldsize; i++) {
+		const char *s;
+
+		if (old[i] < 0)
+			continue;
+		s = st->buf.val + old[i];
+		*stringtable_slot(st, s, stringtable_hash(s, strlen(s))) =
+			old[i];
 	}
 
-	*d = data_append_data(*d, str, strlen(str)+1);
-	return i;
+	free(old);
+}
+
+static int stringtable_insert(struct stringtable *st, const char *str)
+{
+	int len = strlen(str);
+	uint32_t h;
+	int *slot;
+	int off, i;
+
+	while (2 * (st->count + len + 1) >= st->size)
+		stringtable_grow(st);
+
+	slot = stringtable_slot(st, str, stringtable_hash(str, len));
+	if (*slot >= 0)
+		return *slot;
+
+	off = st->buf.len;
+	st->buf = data_append_data(st->buf, str, len+1);
+
+	/* Index every suffix not already present, longest one last */
+	h = 2166136261u;
+	for (i = len; i >= 0; i--) {
+		if (i < len)
+			h = stringtable_hash_step(h, str[i]);
+		slot = stringtable_slot(st, str + i, h);
+		if (*slot < 0) {
+			*slot = off + i;
+			st->count++;
+		}
+	}
+
+	return off;
+}
+
+static void stringtable_free(struct stringtable *st)
+{
+	free(st->slots);
+	data_free(st->buf);
 }
 
 static void flatten_tree(struct node *tree, struct emitter *emit,
-			 void *etarget, struct data *strbuf,
+			 void *etarget, struct stringtable *strtab,
 			 struct version_info *vi)
 {
 	struct property *prop;
@@ -281,7 +379,7 @@ static void flatten_tree(struct node *tree, struct emitter *emit,
 		if (streq(prop->name, "name"))
 			seen_name_prop = true;
 
-		nameoff = stringtable_insert(strbuf, prop->name);
+		nameoff = stringtable_insert(strtab, prop->name);
 
 		emit->property(etarget, prop->labels);
 		emit->cell(etarget, prop->val.len);
@@ -297,7 +395,7 @@ static void flatten_tree(struct node *tree, struct emitter *emit,
 	if ((vi->flags & FTF_NAMEPROPS) && !seen_name_prop) {
 		emit->property(etarget, NULL);
 		emit->cell(etarget, tree->basenamelen+1);
-		emit->cell(etarget, stringtable_insert(strbuf, "name"));
+		emit->cell(etarget, stringtable_insert(strtab, "name"));
 
 		if ((vi->flags & FTF_VARALIGN) && ((tree->basenamelen+1) >= 8))
 			emit->align(etarget, 8);
@@ -307,7 +405,7 @@ static void flatten_tree(struct node *tree, struct emitter *emit,
 	}
 
 	for_each_child(tree, child) {
-		flatten_tree(child, emit, etarget, strbuf, vi);
+		flatten_tree(child, emit, etarget, strtab, vi);
 	}
 
 	emit->endnode(etarget, tree->labels);
@@ -373,7 +471,7 @@ void dt_to_blob(FILE *f, struct dt_info *dti, int version)
 	struct data blob       = empty_data;
 	struct data reservebuf = empty_data;
 	struct data dtbuf      = empty_data;
-	struct data strbuf     = empty_data;
+	struct stringtable strtab = { empty_data };
 	struct fdt_header fdt;
 	int padlen = 0;
 
@@ -384,13 +482,13 @@ void dt_to_blob(FILE *f, struct dt_info *dti, int version)
 	if (!vi)
 		die("Unknown device tree blob version %d\n", version);
 
-	flatten_tree(dti->dt, &bin_emitter, &dtbuf, &strbuf, vi);
+	flatten_tree(dti->dt, &bin_emitter, &dtbuf, &strtab, vi);
 	bin_emit_cell(&dtbuf, FDT_END);
 
 	reservebuf = flatten_reserve_list(dti->reservelist, vi);
 
 	/* Make header */
-	make_fdt_header(&fdt, vi, reservebuf.len, dtbuf.len, strbuf.len,
+	make_fdt_header(&fdt, vi, reservebuf.len, dtbuf.len, strtab.buf.len,
 			dti->boot_cpuid_phys);
 
 	/*
@@ -430,7 +528,8 @@ void dt_to_blob(FILE *f, struct dt_info *dti, int version)
 	blob = data_merge(blob, reservebuf);
 	blob = data_append_zeroes(blob, sizeof(struct fdt_reserve_entry));
 	blob = data_merge(blob, dtbuf);
-	blob = data_merge(blob, strbuf);
+	blob = data_merge(blob, strtab.buf);
+	free(strtab.slots);
 
 	/*
 	 * If the user asked for more space than is used, pad out the blob.
@@ -471,7 +570,7 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version)
 {
 	struct version_info *vi = NULL;
 	int i;
-	struct data strbuf = empty_data;
+	struct stringtable strtab = { empty_data };
 	struct reserve_info *re;
 	const char *symprefix = "dt";
 
@@ -557,14 +656,14 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version)
 	fprintf(f, "\t.long\t0, 0\n\t.long\t0, 0\n");
 
 	emit_label(f, symprefix, "struct_start");
-	flatten_tree(dti->dt, &asm_emitter, f, &strbuf, vi);
+	flatten_tree(dti->dt, &asm_emitter, f, &strtab, vi);
 
 	fprintf(f, "\t/* FDT_END */\n");
 	asm_emit_cell(f, FDT_END);
 	emit_label(f, symprefix, "struct_end");
 
 	emit_label(f, symprefix, "strings_start");
-	dump_stringtable_asm(f, strbuf);
+	dump_stringtable_asm(f, strtab.buf);
 	emit_label(f, symprefix, "strings_end");
 
 	emit_label(f, symprefix, "blob_end");
@@ -583,7 +682,7 @@ void dt_to_asm(FILE *f, struct dt_info *dti, int version)
 		asm_emit_align(f, alignsize);
 	emit_label(f, symprefix, "blob_abs_end");
 
-	data_free(strbuf);
+	stringtable_free(&strtab);
 }
 
 struct inbuf {
@@ -639,7 +738,7 @@ static char *flat_read_string(struct inbuf *inb)
 		len++;
 	} while ((*p++) != '\0');
 
-	str = xstrdup(inb->ptr);
+	str = arena_strdup(inb->ptr);
 
 	inb->ptr += len;
 
@@ -650,15 +749,17 @@ static char *flat_read_string(struct inbuf *inb)
 
 static struct data flat_read_data(struct inbuf *inb, int len)
 {
-	struct data d = empty_data;
+	struct data d;
 
 	if (len == 0)
 		return empty_data;
 
-	d = data_grow_for(d, len);
-	d.len = len;
+	if ((inb->ptr + len) > inb->limit)
+		die("Premature end of data parsing flat device tree\n");
 
-	flat_read_chunk(inb, d.val, len);
+	/* the blob stays around, so values can point straight into it */
+	d = data_ref_mem(inb->ptr, len);
+	inb->ptr += len;
 
 	flat_realign(inb, sizeof(uint32_t));
 
@@ -681,7 +782,7 @@ static char *flat_read_stringtable(struct inbuf *inb, int offset)
 		p++;
 	}
 
-	return xstrdup(inb->base + offset);
+	return arena_strdup(inb->base + offset);
 }
 
 static struct property *flat_read_property(struct inbuf *dtbuf,
@@ -746,7 +847,7 @@ static char *nodename_from_path(const char *ppath, const char *cpath)
 	if (!streq(ppath, "/"))
 		plen++;
 
-	return xstrdup(cpath + plen);
+	return arena_strdup(cpath + plen);
 }
 
 static struct node *unflatten_tree(struct inbuf *dtbuf,
@@ -806,32 +907,51 @@ static struct node *unflatten_tree(struct inbuf *dtbuf,
 		}
 	} while (val != FDT_END_NODE);
 
-	if (node->name != flatname) {
-		free(flatname);
-	}
-
 	return node;
 }
 
 
-struct dt_info *dt_from_blob(const char *fname)
+/*
+ * Map a blob held in a regular file read-only, so the tree can refer
+ * to property values in place.  Returns NULL if the file can't be
+ * mapped, leaving the caller to read it instead.
+ */
+static char *flat_map_blob(FILE *f)
 {
-	FILE *f;
-	uint32_t magic, totalsize, version, size_dt, boot_cpuid_phys;
-	uint32_t off_dt, off_str, off_mem_rsvmap;
+	struct stat st;
+	struct fdt_header *fdt;
+	uint32_t totalsize;
+	char *blob;
+
+	if ((fstat(fileno(f), &st) < 0) || !S_ISREG(st.st_mode)
+	    || (ftello(f) != 0) || (st.st_size < FDT_V1_SIZE))
+		return NULL;
+
+	blob = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+	if (blob == MAP_FAILED)
+		return NULL;
+
+	fdt = (struct fdt_header *)blob;
+	if (fdt32_to_cpu(fdt->magic) != FDT_MAGIC)
+		die("Blob has incorrect magic number\n");
+
+	totalsize = fdt32_to_cpu(fdt->totalsize);
+	if (totalsize < FDT_V1_SIZE)
+		die("DT blob size (%d) is too small\n", totalsize);
+	if (totalsize > st.st_size)
+		die("EOF before reading %d bytes of DT blob\n", totalsize);
+
+	return blob;
+}
+
+static char *flat_read_blob(FILE *f)
+{
+	uint32_t magic, totalsize;
 	int rc;
 	char *blob;
 	struct fdt_header *fdt;
 	char *p;
-	struct inbuf dtbuf, strbuf;
-	struct inbuf memresvbuf;
 	int sizeleft;
-	struct reserve_info *reservelist;
-	struct node *tree;
-	uint32_t val;
-	int flags = 0;
-
-	f = srcfile_relative_open(fname, NULL);
 
 	rc = fread(&magic, sizeof(magic), 1, f);
 	if (ferror(f))
@@ -885,6 +1005,36 @@ struct dt_info *dt_from_blob(const char *fname)
 		p += rc;
 	}
 
+	return blob;
+}
+
+struct dt_info *dt_from_blob(const char *fname)
+{
+	FILE *f;
+	uint32_t totalsize, version, size_dt, boot_cpuid_phys;
+	uint32_t off_dt, off_str, off_mem_rsvmap;
+	char *blob;
+	struct fdt_header *fdt;
+	struct inbuf dtbuf, strbuf;
+	struct inbuf memresvbuf;
+	struct reserve_info *reservelist;
+	struct node *tree;
+	uint32_t val;
+	int flags = 0;
+
+	f = srcfile_relative_open(fname, NULL);
+
+	/*
+	 * Property values are not copied out of the blob, so it is never
+	 * unmapped or freed.
+	 */
+	blob = flat_map_blob(f);
+	if (!blob)
+		blob = flat_read_blob(f);
+
+	fdt = (struct fdt_header *)blob;
+	totalsize = fdt32_to_cpu(fdt->totalsize);
+
 	off_dt = fdt32_to_cpu(fdt->off_dt_struct);
 	off_str = fdt32_to_cpu(fdt->off_dt_strings);
 	off_mem_rsvmap = fdt32_to_cpu(fdt->off_mem_rsvmap);
@@ -938,8 +1088,6 @@ struct dt_info *dt_from_blob(const char *fname)
 	if (val != FDT_END)
 		die("Device tree blob doesn't end with FDT_END\n");
 
-	free(blob);
-
 	fclose(f);
 
 	return build_dt_info(DTSF_V1, reservelist, tree, boot_cpuid_phys);
@@ -284,6 +284,7 @@ int fdt_setprop(void *fdt, int nodeoffset, const char *name,
 		return err;
 
 	memcpy(prop->data, val, len);
+	memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
 	return 0;
 }
 
@@ -305,11 +306,13 @@ int fdt_appendprop(void *fdt, int nodeoffset, const char *name,
 			return err;
 		prop->len = cpu_to_fdt32(newlen);
 		memcpy(prop->data + oldlen, val, len);
+		memset(prop->data + newlen, 0, FDT_TAGALIGN(newlen) - newlen);
 	} else {
 		err = _fdt_add_property(fdt, nodeoffset, name, len, &prop);
 		if (err)
 			return err;
 		memcpy(prop->data, val, len);
+		memset(prop->data + len, 0, FDT_TAGALIGN(len) - len);
 	}
 	return 0;
 }
@@ -488,3 +491,554 @@ int fdt_pack(void *fdt)
 
 	return 0;
 }
+
+/*
+ * Transactions.  Edits are queued against the blob as it stood at
+ * fdt_txn_begin() and resolved right away to the spot the equivalent
+ * fdt_setprop() etc. call would have touched; fdt_txn_commit() then
+ * rebuilds the structure block in one pass instead of splicing once
+ * per edit.
+ *
+ * Records are kept in creation order until the commit, which sorts
+ * them by (target, type, newest first) so the rebuild can find the
+ * edits for each node and property as it reaches them.
+ */
+#define FDT_TXN_SETPROP		0	/* target: existing property */
+#define FDT_TXN_DELPROP		1	/* target: existing property */
+#define FDT_TXN_DELNODE		2	/* target: node, aux: end offset */
+#define FDT_TXN_ADDPROP		3	/* target: node, aux: name offset */
+#define FDT_TXN_ADDNODE		4	/* target: parent, aux: handle */
+#define FDT_TXN_DEAD		5
+
+static struct fdt_txn_edit *_fdt_txn_new(struct fdt_txn *txn, int type,
+					 int target, const char *name)
+{
+	struct fdt_txn_edit *e;
+
+	if (txn->num_edits >= txn->max_edits)
+		return NULL;
+
+	e = &txn->edits[txn->num_edits];
+	memset(e, 0, sizeof(*e));
+	e->type = type;
+	e->target = target;
+	e->seq = txn->num_edits++;
+	e->name = name;
+	return e;
+}
+
+/* the commit moves the blob under anything that points into it */
+static int _fdt_txn_in_blob(struct fdt_txn *txn, const void *p, int len)
+{
+	const char *start = txn->fdt;
+
+	return (len > 0) && ((const char *)p < start + fdt_totalsize(start))
+		&& ((const char *)p + len > start);
+}
+
+static int _fdt_txn_deleted(struct fdt_txn *txn, int offset)
+{
+	struct fdt_txn_edit *e;
+
+	for (e = txn->edits; e < txn->edits + txn->num_edits; e++)
+		if ((e->type == FDT_TXN_DELNODE)
+		    && (offset >= e->target) && (offset < e->aux))
+			return 1;
+	return 0;
+}
+
+static int _fdt_txn_check_node(struct fdt_txn *txn, int node)
+{
+	int err;
+
+	/* nodes added by this transaction hang off an original node */
+	while (node >= txn->struct_size) {
+		struct fdt_txn_edit *e = txn->edits + (node - txn->struct_size);
+
+		if ((node - txn->struct_size >= txn->num_edits)
+		    || (e->type != FDT_TXN_ADDNODE))
+			return -FDT_ERR_BADOFFSET;
+		node = e->target;
+	}
+
+	err = _fdt_check_node_offset(txn->fdt, node);
+	if (err < 0)
+		return err;
+	if (_fdt_txn_deleted(txn, node))
+		return -FDT_ERR_BADOFFSET;
+	return 0;
+}
+
+static int _fdt_txn_find_prop(struct fdt_txn *txn, int node, const char *name,
+			      struct fdt_txn_edit **rec, int *propoffset)
+{
+	const struct fdt_property *prop;
+	struct fdt_txn_edit *e;
+	const char *p;
+	int i, offset, len = strlen(name);
+
+	*rec = NULL;
+	*propoffset = -1;
+
+	/* properties added later sit in front of earlier ones */
+	for (i = txn->num_edits; i-- > 0; ) {
+		e = &txn->edits[i];
+		if ((e->type == FDT_TXN_ADDPROP) && (e->target == node)
+		    && (strcmp(e->name, name) == 0)) {
+			*rec = e;
+			return 0;
+		}
+	}
+
+	if (node >= txn->struct_size)
+		return -FDT_ERR_NOTFOUND;
+
+	for (offset = fdt_first_property_offset(txn->fdt, node);
+	     offset >= 0;
+	     offset = fdt_next_property_offset(txn->fdt, offset)) {
+		prop = fdt_get_property_by_offset(txn->fdt, offset, NULL);
+		if (!prop)
+			return -FDT_ERR_INTERNAL;
+		p = fdt_string(txn->fdt, fdt32_to_cpu(prop->nameoff));
+		if ((strlen(p) != len) || (memcmp(p, name, len) != 0))
+			continue;
+
+		for (e = txn->edits; e < txn->edits + txn->num_edits; e++)
+			if ((e->target == offset)
+			    && ((e->type == FDT_TXN_SETPROP)
+				|| (e->type == FDT_TXN_DELPROP)))
+				break;
+		if (e == txn->edits + txn->num_edits)
+			e = NULL;
+		if (e && (e->type == FDT_TXN_DELPROP))
+			continue;
+
+		*rec = e;
+		*propoffset = offset;
+		return 0;
+	}
+
+	return offset;
+}
+
+static int _fdt_txn_find_add_string(struct fdt_txn *txn,
+				    struct fdt_txn_edit *e)
+{
+	const char *strtab = (const char *)txn->fdt + fdt_off_dt_strings(txn->fdt);
+	int tabsize = fdt_size_dt_strings(txn->fdt);
+	const char *p;
+	struct fdt_txn_edit *s;
+	int len = strlen(e->name) + 1;
+	int slen;
+
+	/* the table only grows, so an earlier answer still holds */
+	for (s = txn->edits; s < e; s++)
+		if ((s->type == FDT_TXN_ADDPROP) && (strcmp(s->name, e->name) == 0))
+			return s->aux;
+
+	p = _fdt_find_string(strtab, tabsize, e->name);
+	if (p)
+		return p - strtab;
+
+	/* names this transaction appends, in the order they were added */
+	for (s = txn->edits; s < e; s++) {
+		if (!s->newstr)
+			continue;
+		slen = strlen(s->name) + 1;
+		if ((slen >= len)
+		    && (memcmp(s->name + slen - len, e->name, len) == 0))
+			return s->aux + slen - len;
+	}
+
+	e->newstr = 1;
+	txn->strings_added += len;
+	return tabsize + txn->strings_added - len;
+}
+
+int fdt_txn_begin(struct fdt_txn *txn, void *fdt,
+		  struct fdt_txn_edit *edits, int max_edits)
+{
+	FDT_RW_CHECK_HEADER(fdt);
+
+	txn->fdt = fdt;
+	txn->struct_size = fdt_size_dt_struct(fdt);
+	txn->strings_added = 0;
+	txn->num_edits = 0;
+	txn->max_edits = max_edits;
+	txn->edits = edits;
+	return 0;
+}
+
+int fdt_txn_setprop(struct fdt_txn *txn, int nodeoffset, const char *name,
+		    const void *val, int len)
+{
+	struct fdt_txn_edit *e;
+	int propoffset;
+	int err;
+
+	if ((err = _fdt_txn_check_node(txn, nodeoffset)))
+		return err;
+
+	if (_fdt_txn_in_blob(txn, name, strlen(name) + 1)
+	    || _fdt_txn_in_blob(txn, val, len))
+		return -FDT_ERR_BADVALUE;
+
+	err = _fdt_txn_find_prop(txn, nodeoffset, name, &e, &propoffset);
+	if (err == -FDT_ERR_NOTFOUND) {
+		e = _fdt_txn_new(txn, FDT_TXN_ADDPROP, nodeoffset, name);
+		if (!e)
+			return -FDT_ERR_NOSPACE;
+		e->aux = _fdt_txn_find_add_string(txn, e);
+	} else if (err) {
+		return err;
+	} else if (!e) {
+		e = _fdt_txn_new(txn, FDT_TXN_SETPROP, propoffset, name);
+		if (!e)
+			return -FDT_ERR_NOSPACE;
+	}
+
+	e->val = val;
+	e->len = len;
+	return 0;
+}
+
+int fdt_txn_delprop(struct fdt_txn *txn, int nodeoffset, const char *name)
+{
+	struct fdt_txn_edit *e;
+	int propoffset;
+	int err;
+
+	if ((err = _fdt_txn_check_node(txn, nodeoffset)))
+		return err;
+
+	err = _fdt_txn_find_prop(txn, nodeoffset, name, &e, &propoffset);
+	if (err)
+		return err;
+
+	if (!e) {
+		e = _fdt_txn_new(txn, FDT_TXN_DELPROP, propoffset, name);
+		if (!e)
+			return -FDT_ERR_NOSPACE;
+	} else if (e->type == FDT_TXN_ADDPROP) {
+		/* its name stays in the strings block, as with fdt_delprop() */
+		e->type = FDT_TXN_DEAD;
+	} else {
+		e->type = FDT_TXN_DELPROP;
+	}
+	return 0;
+}
+
+static int _fdt_txn_name_eq(const char *p, const char *s, int len)
+{
+	if (strncmp(p, s, len) != 0)
+		return 0;
+
+	return (p[len] == '\0')
+		|| (!memchr(s, '@', len) && (p[len] == '@'));
+}
+
+int fdt_txn_add_subnode(struct fdt_txn *txn, int parentoffset,
+			const char *name)
+{
+	struct fdt_txn_edit *e;
+	const char *p;
+	int len = strlen(name);
+	int offset;
+	int err;
+
+	if ((err = _fdt_txn_check_node(txn, parentoffset)))
+		return err;
+
+	if (_fdt_txn_in_blob(txn, name, len + 1))
+		return -FDT_ERR_BADVALUE;
+
+	for (e = txn->edits; e < txn->edits + txn->num_edits; e++)
+		if ((e->type == FDT_TXN_ADDNODE) && (e->target == parentoffset)
+		    && _fdt_txn_name_eq(e->name, name, len))
+			return -FDT_ERR_EXISTS;
+
+	if (parentoffset < txn->struct_size) {
+		fdt_for_each_subnode(offset, txn->fdt, parentoffset) {
+			if (_fdt_txn_deleted(txn, offset))
+				continue;
+			p = fdt_get_name(txn->fdt, offset, NULL);
+			if (p && _fdt_txn_name_eq(p, name, len))
+				return -FDT_ERR_EXISTS;
+		}
+		if (offset != -FDT_ERR_NOTFOUND)
+			return offset;
+	}
+
+	e = _fdt_txn_new(txn, FDT_TXN_ADDNODE, parentoffset, name);
+	if (!e)
+		return -FDT_ERR_NOSPACE;
+
+	e->aux = txn->struct_size + e->seq;
+	return e->aux;
+}
+
+int fdt_txn_del_node(struct fdt_txn *txn, int nodeoffset)
+{
+	struct fdt_txn_edit *e;
+	int endoffset;
+	int err;
+
+	if ((err = _fdt_txn_check_node(txn, nodeoffset)))
+		return err;
+
+	if (nodeoffset >= txn->struct_size) {
+		txn->edits[nodeoffset - txn->struct_size].type = FDT_TXN_DEAD;
+		return 0;
+	}
+
+	endoffset = _fdt_node_end_offset(txn->fdt, nodeoffset);
+	if (endoffset < 0)
+		return endoffset;
+
+	e = _fdt_txn_new(txn, FDT_TXN_DELNODE, nodeoffset, NULL);
+	if (!e)
+		return -FDT_ERR_NOSPACE;
+
+	e->aux = endoffset;
+	return 0;
+}
+
+static int _fdt_txn_cmp(const void *a, const void *b)
+{
+	const struct fdt_txn_edit *ea = a, *eb = b;
+
+	if (ea->target != eb->target)
+		return (ea->target < eb->target) ? -1 : 1;
+	if (ea->type != eb->type)
+		return ea->type - eb->type;
+	return eb->seq - ea->seq;
+}
+
+static struct fdt_txn_edit *_fdt_txn_lookup(struct fdt_txn *txn,
+					    int target, int type)
+{
+	int lo = 0, hi = txn->num_edits;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+		struct fdt_txn_edit *e = &txn->edits[mid];
+
+		if ((e->target < target)
+		    || ((e->target == target) && (e->type < type)))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < txn->num_edits) && (txn->edits[lo].target == target)
+	    && (txn->edits[lo].type == type))
+		return &txn->edits[lo];
+	return NULL;
+}
+
+/*
+ * The rebuild streams the old structure block (and everything after
+ * it) into the new one.  On the real pass the old data has first been
+ * moved to the top of the buffer, so output may run ahead of input by
+ * at most the free space; the dry pass measures how far it gets.
+ */
+struct _fdt_txn_stream {
+	const char *in;
+	char *out;
+	int datalen;
+	int r, w;
+	int peak;
+};
+
+static void _fdt_txn_copy(struct _fdt_txn_stream *s, int len)
+{
+	if (s->out)
+		memmove(s->out + s->w, s->in + s->r, len);
+	s->r += len;
+	s->w += len;
+}
+
+static void _fdt_txn_put(struct _fdt_txn_stream *s, const void *p, int len,
+			 int padlen)
+{
+	if (s->out) {
+		if (len)
+			memcpy(s->out + s->w, p, len);
+		memset(s->out + s->w + len, 0, padlen - len);
+	}
+	s->w += padlen;
+	if (s->w - s->r > s->peak)
+		s->peak = s->w - s->r;
+}
+
+static void _fdt_txn_put_tag(struct _fdt_txn_stream *s, uint32_t tag)
+{
+	fdt32_t t = cpu_to_fdt32(tag);
+
+	_fdt_txn_put(s, &t, sizeof(t), sizeof(t));
+}
+
+static void _fdt_txn_put_prop(struct _fdt_txn_stream *s, int nameoff,
+			      const void *val, int len)
+{
+	struct fdt_property prop;
+
+	prop.tag = cpu_to_fdt32(FDT_PROP);
+	prop.len = cpu_to_fdt32(len);
+	prop.nameoff = cpu_to_fdt32(nameoff);
+	_fdt_txn_put(s, &prop, sizeof(prop), sizeof(prop));
+	_fdt_txn_put(s, val, len, FDT_TAGALIGN(len));
+}
+
+static void _fdt_txn_put_props(struct fdt_txn *txn,
+			       struct _fdt_txn_stream *s, int node)
+{
+	struct fdt_txn_edit *e = _fdt_txn_lookup(txn, node, FDT_TXN_ADDPROP);
+
+	for (; e && (e < txn->edits + txn->num_edits)
+		     && (e->target == node) && (e->type == FDT_TXN_ADDPROP);
+	     e++)
+		_fdt_txn_put_prop(s, e->aux, e->val, e->len);
+}
+
+static void _fdt_txn_put_nodes(struct fdt_txn *txn,
+			       struct _fdt_txn_stream *s, int parent)
+{
+	struct fdt_txn_edit *e = _fdt_txn_lookup(txn, parent, FDT_TXN_ADDNODE);
+	int len;
+
+	for (; e && (e < txn->edits + txn->num_edits)
+		     && (e->target == parent) && (e->type == FDT_TXN_ADDNODE);
+	     e++) {
+		len = strlen(e->name);
+		_fdt_txn_put_tag(s, FDT_BEGIN_NODE);
+		_fdt_txn_put(s, e->name, len, FDT_TAGALIGN(len + 1));
+		_fdt_txn_put_props(txn, s, e->aux);
+		_fdt_txn_put_nodes(txn, s, e->aux);
+		_fdt_txn_put_tag(s, FDT_END_NODE);
+	}
+}
+
+static int _fdt_txn_stream(struct fdt_txn *txn, const void *fdt,
+			   struct _fdt_txn_stream *s)
+{
+	const struct fdt_property *prop;
+	struct fdt_txn_edit *e;
+	int offset = 0, nextoffset;
+	int pending = -1;
+	uint32_t tag;
+
+	s->in = (const char *)fdt + fdt_off_dt_struct(fdt);
+	s->r = s->w = s->peak = 0;
+
+	do {
+		tag = fdt_next_tag(fdt, offset, &nextoffset);
+		if (nextoffset < 0)
+			return nextoffset;
+
+		/* new subnodes go after the properties of their parent */
+		if ((pending >= 0) && (tag != FDT_PROP) && (tag != FDT_NOP)) {
+			_fdt_txn_put_nodes(txn, s, pending);
+			pending = -1;
+		}
+
+		switch (tag) {
+		case FDT_BEGIN_NODE:
+			e = _fdt_txn_lookup(txn, offset, FDT_TXN_DELNODE);
+			if (e) {
+				s->r += e->aux - offset;
+				nextoffset = e->aux;
+				break;
+			}
+			_fdt_txn_copy(s, nextoffset - offset);
+			_fdt_txn_put_props(txn, s, offset);
+			pending = offset;
+			break;
+
+		case FDT_PROP:
+			e = _fdt_txn_lookup(txn, offset, FDT_TXN_SETPROP);
+			if (!e)
+				e = _fdt_txn_lookup(txn, offset, FDT_TXN_DELPROP);
+			if (!e) {
+				_fdt_txn_copy(s, nextoffset - offset);
+				break;
+			}
+			prop = (const struct fdt_property *)(s->in + offset);
+			s->r += nextoffset - offset;
+			if (e->type == FDT_TXN_SETPROP)
+				_fdt_txn_put_prop(s, fdt32_to_cpu(prop->nameoff),
+						  e->val, e->len);
+			break;
+
+		default:
+			_fdt_txn_copy(s, nextoffset - offset);
+			break;
+		}
+
+		offset = nextoffset;
+	} while (tag != FDT_END);
+
+	/* the rest of the structure block and the strings, verbatim */
+	_fdt_txn_copy(s, s->datalen - s->r);
+
+	_fdt_txn_put(s, NULL, 0, txn->strings_added);
+	if (s->out)
+		for (e = txn->edits; e < txn->edits + txn->num_edits; e++)
+			if (e->newstr)
+				memcpy(s->out + s->w - txn->strings_added
+				       + e->aux - fdt_size_dt_strings(txn->fdt),
+				       e->name, strlen(e->name) + 1);
+	return 0;
+}
+
+int fdt_txn_commit(struct fdt_txn *txn)
+{
+	void *fdt = txn->fdt;
+	struct _fdt_txn_stream s;
+	int struct_off, room, delta;
+	int err;
+
+	FDT_RW_CHECK_HEADER(fdt);
+
+	if (fdt_size_dt_struct(fdt) != txn->struct_size)
+		return -FDT_ERR_BADSTATE;
+
+	_fdt_heapsort(txn->edits, txn->num_edits, sizeof(*txn->edits),
+		      _fdt_txn_cmp);
+
+	struct_off = fdt_off_dt_struct(fdt);
+	s.datalen = _fdt_data_size(fdt) - struct_off;
+	room = (fdt_totalsize(fdt) - struct_off - s.datalen) & ~7;
+
+	/* dry run: validate and measure */
+	s.out = NULL;
+	err = _fdt_txn_stream(txn, fdt, &s);
+	if (!err && (s.peak > room))
+		err = -FDT_ERR_NOSPACE;
+	if (err) {
+		txn->num_edits = 0;
+		txn->strings_added = 0;
+		return err;
+	}
+
+	/* move the old data to the top and stream it back down */
+	memmove((char *)fdt + struct_off + room, (char *)fdt + struct_off,
+		s.datalen);
+	fdt_set_off_dt_struct(fdt, struct_off + room);
+	s.out = (char *)fdt + struct_off;
+	err = _fdt_txn_stream(txn, fdt, &s);
+	fdt_set_off_dt_struct(fdt, struct_off);
+	if (err)
+		return -FDT_ERR_INTERNAL;
+
+	delta = s.w - s.datalen - txn->strings_added;
+	fdt_set_size_dt_struct(fdt, txn->struct_size + delta);
+	fdt_set_off_dt_strings(fdt, fdt_off_dt_strings(fdt) + delta);
+	fdt_set_size_dt_strings(fdt, fdt_size_dt_strings(fdt)
+				+ txn->strings_added);
+
+	txn->num_edits = 0;
+	txn->strings_added = 0;
+	txn->struct_size = fdt_size_dt_struct(fdt);
+	return 0;
+}
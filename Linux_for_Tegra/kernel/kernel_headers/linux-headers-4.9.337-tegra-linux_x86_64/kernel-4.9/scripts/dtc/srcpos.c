@@ -20,6 +20,7 @@
 #define _GNU_SOURCE
 
 #include <stdio.h>
+#include <sys/stat.h>
 
 #include "dtc.h"
 #include "srcpos.h"
@@ -33,6 +34,24 @@ struct search_path {
 /* This is the list of directories that we search for source files */
 static struct search_path *search_path_head, **search_path_tail;
 
+/*
+ * Contents of the source files read so far, kept when a batch run asks
+ * for it so that .dtsi files shared between jobs are read only once.
+ * Entries are keyed by file identity rather than name, and a file
+ * whose size or mtime changed is read again.
+ */
+struct srcfile_cache {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	char *buf;
+	struct srcfile_cache *next;
+};
+
+static struct srcfile_cache *srcfile_cache_head;
+static bool srcfile_caching;
+
 
 static char *get_dirname(const char *path)
 {
@@ -40,7 +59,7 @@ static char *get_dirname(const char *path)
 
 	if (slash) {
 		int len = slash - path;
-		char *dir = xmalloc(len + 1);
+		char *dir = arena_alloc(len + 1);
 
 		memcpy(dir, path, len);
 		dir[len] = '\0';
@@ -79,6 +98,7 @@ static char *try_open(const char *dirname, const char *fname, FILE **fp)
 
 	*fp = fopen(fullname, "rb");
 	if (!*fp) {
+		cache_note_absent(fullname);
 		free(fullname);
 		fullname = NULL;
 	}
@@ -122,11 +142,13 @@ FILE *srcfile_relative_open(const char *fname, char **fullnamep)
 	if (streq(fname, "-")) {
 		f = stdin;
 		fullname = xstrdup("<stdin>");
+		cache_note_input(NULL);
 	} else {
 		fullname = fopen_any_on_path(fname, &f);
 		if (!f)
 			die("Couldn't open \"%s\": %s\n", fname,
 			    strerror(errno));
+		cache_note_input(fullname);
 	}
 
 	if (depfile)
@@ -140,6 +162,52 @@ FILE *srcfile_relative_open(const char *fname, char **fullnamep)
 	return f;
 }
 
+void srcfile_enable_cache(void)
+{
+	srcfile_caching = true;
+}
+
+/*
+ * Return a stream reading f's contents from the cache, reading them
+ * into it first if needed.  f is closed unless it is returned as is.
+ */
+static FILE *srcfile_cache_open(FILE *f, const char *fullname)
+{
+	struct srcfile_cache *c;
+	struct stat st;
+
+	if ((f == stdin) || fstat(fileno(f), &st) || !S_ISREG(st.st_mode)
+	    || (st.st_size == 0))
+		return f;
+
+	for (c = srcfile_cache_head; c; c = c->next)
+		if ((c->dev == st.st_dev) && (c->ino == st.st_ino)
+		    && (c->size == st.st_size) && (c->mtime == st.st_mtime))
+			break;
+
+	if (!c) {
+		c = xmalloc(sizeof(*c));
+		c->dev = st.st_dev;
+		c->ino = st.st_ino;
+		c->size = st.st_size;
+		c->mtime = st.st_mtime;
+		c->buf = xmalloc(st.st_size);
+		if (fread(c->buf, 1, st.st_size, f) != (size_t)st.st_size)
+			die("Couldn't read \"%s\": %s\n", fullname,
+			    strerror(errno));
+		c->next = srcfile_cache_head;
+		srcfile_cache_head = c;
+	}
+
+	fclose(f);
+	f = fmemopen(c->buf, c->size, "r");
+	if (!f)
+		die("Couldn't reopen \"%s\": %s\n", fullname,
+		    strerror(errno));
+
+	return f;
+}
+
 void srcfile_push(const char *fname)
 {
 	struct srcfile_state *srcfile;
@@ -147,9 +215,11 @@ void srcfile_push(const char *fname)
 	if (srcfile_depth++ >= MAX_SRCFILE_DEPTH)
 		die("Includes nested too deeply");
 
-	srcfile = xmalloc(sizeof(*srcfile));
+	srcfile = arena_alloc(sizeof(*srcfile));
 
 	srcfile->f = srcfile_relative_open(fname, &srcfile->name);
+	if (srcfile_caching)
+		srcfile->f = srcfile_cache_open(srcfile->f, srcfile->name);
 	srcfile->dir = get_dirname(srcfile->name);
 	srcfile->prev = current_srcfile;
 
@@ -166,16 +236,15 @@ bool srcfile_pop(void)
 	assert(srcfile);
 
 	current_srcfile = srcfile->prev;
+	srcfile_depth--;
 
 	if (fclose(srcfile->f))
 		die("Error closing \"%s\": %s\n", srcfile->name,
 		    strerror(errno));
 
-	/* FIXME: We allow the srcfile_state structure to leak,
-	 * because it could still be referenced from a location
-	 * variable being carried through the parser somewhere.  To
-	 * fix this we could either allocate all the files from a
-	 * table, or use a pool allocator. */
+	/* The srcfile_state structure stays in the arena, because it
+	 * could still be referenced from a location variable being
+	 * carried through the parser somewhere. */
 
 	return current_srcfile ? true : false;
 }
@@ -197,6 +266,20 @@ void srcfile_add_search_path(const char *dirname)
 	search_path_tail = &node->next;
 }
 
+void srcfile_reset_search_path(void)
+{
+	struct search_path *node, *next;
+
+	for (node = search_path_head; node; node = next) {
+		next = node->next;
+		free((char *)node->dirname);
+		free(node);
+	}
+
+	search_path_head = NULL;
+	search_path_tail = NULL;
+}
+
 /*
  * The empty source position.
  */
@@ -240,7 +323,7 @@ srcpos_copy(struct srcpos *pos)
 {
 	struct srcpos *pos_new;
 
-	pos_new = xmalloc(sizeof(struct srcpos));
+	pos_new = arena_alloc(sizeof(struct srcpos));
 	memcpy(pos_new, pos, sizeof(struct srcpos));
 
 	return pos_new;
@@ -23,6 +23,7 @@
 
 extern FILE *yyin;
 extern int yyparse(void);
+extern int yylex_destroy(void);
 extern YYLTYPE yylloc;
 
 struct dt_info *parser_output;
@@ -43,6 +44,9 @@ struct dt_info *dt_from_source(const char *fname)
 	if (treesource_error)
 		die("Syntax error parsing input tree\n");
 
+	/* so that a later call starts scanning from a clean state */
+	yylex_destroy();
+
 	return parser_output;
 }
 
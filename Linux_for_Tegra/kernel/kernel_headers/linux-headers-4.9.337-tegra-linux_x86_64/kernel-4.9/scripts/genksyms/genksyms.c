@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <limits.h>
 #ifdef __GNU_LIBRARY__
 #include <getopt.h>
 #endif				/* __GNU_LIBRARY__ */
@@ -53,6 +54,23 @@ static int nsyms;
 static struct symbol *expansion_trail;
 static struct symbol *visited_symbols;
 
+static unsigned long trail_seq;		/* pushes onto expansion_trail */
+static unsigned long trail_min_hit;	/* oldest entry the expansion hit */
+static unsigned long expansion_len;	/* bytes run through the CRC */
+
+/*
+ * The text a symbol expanded to when none of the symbols it leads to
+ * was on the expansion trail yet.  Whenever that holds again the text
+ * is the same, so it need not be expanded again: the CRC is carried
+ * over it with crc32_shift() and its symbols are put on the trail.
+ */
+struct expansion {
+	unsigned long crc;		/* partial_crc32() of the text from 0 */
+	unsigned long len;
+	int nr_syms;
+	struct symbol *syms[];		/* expanded on the way, in trail order */
+};
+
 static const struct {
 	int n;
 	const char *name;
@@ -66,6 +84,7 @@ static const struct {
 };
 
 static int equal_list(struct string_list *a, struct string_list *b);
+static struct string_list *hashcons_list(struct string_list *list);
 static void print_list(FILE * f, struct string_list *list);
 static struct string_list *concat_list(struct string_list *start, ...);
 static struct string_list *mk_node(const char *string);
@@ -146,6 +165,51 @@ static unsigned long crc32(const char *s)
 	return partial_crc32(s, 0xffffffff) ^ 0xffffffff;
 }
 
+/*
+ * partial_crc32() is linear in the state it starts from, so running it
+ * over a text of len bytes turns crc into
+ *
+ *	partial_crc32(text, 0) ^ crc32_shift(crc, len)
+ *
+ * crc32_shift() runs crc over len zero bytes, using the operators for
+ * 2^k zero bytes in crc_pow2[k], each given as the images of the 32
+ * state bits.
+ */
+static unsigned long crc_pow2[32][32];
+
+static unsigned long crc_apply(const unsigned long *op, unsigned long crc)
+{
+	unsigned long res = 0;
+	int i;
+
+	for (i = 0; crc; i++, crc >>= 1)
+		if (crc & 1)
+			res ^= op[i];
+	return res;
+}
+
+static void init_crc32_shift(void)
+{
+	int i, k;
+
+	for (i = 0; i < 32; i++)
+		crc_pow2[0][i] = partial_crc32_one(0, 1UL << i);
+	for (k = 1; k < 32; k++)
+		for (i = 0; i < 32; i++)
+			crc_pow2[k][i] = crc_apply(crc_pow2[k - 1],
+						   crc_pow2[k - 1][i]);
+}
+
+static unsigned long crc32_shift(unsigned long crc, unsigned long len)
+{
+	int k;
+
+	for (k = 0; len; k++, len >>= 1)
+		if (len & 1)
+			crc = crc_apply(crc_pow2[k], crc);
+	return crc;
+}
+
 /*----------------------------------------------------------------------*/
 
 static enum symbol_type map_to_ns(enum symbol_type t)
@@ -238,6 +302,9 @@ static struct symbol *__add_symbol(const char *name, enum symbol_type type,
 			return NULL;
 	}
 
+	if (type != SYM_NORMAL)
+		defn = hashcons_list(defn);
+
 	h = crc32(name) % HASH_BUCKETS;
 	for (sym = symtab[h]; sym; sym = sym->hash_next) {
 		if (map_to_ns(sym->type) == map_to_ns(type) &&
@@ -300,6 +367,7 @@ static struct symbol *__add_symbol(const char *name, enum symbol_type type,
 	sym->is_declared = !is_reference;
 	sym->status = status;
 	sym->is_override = 0;
+	sym->expansion = NULL;
 
 	if (flag_debug) {
 		if (symbol_types[type].name)
@@ -406,6 +474,9 @@ struct string_list *copy_list_range(struct string_list *start,
 static int equal_list(struct string_list *a, struct string_list *b)
 {
 	while (a && b) {
+		/* hash-consed lists that are equal from here on are shared */
+		if (a == b)
+			return 1;
 		if (a->tag != b->tag || strcmp(a->string, b->string))
 			return 0;
 		a = a->next;
@@ -415,6 +486,178 @@ static int equal_list(struct string_list *a, struct string_list *b)
 	return !a && !b;
 }
 
+/*----------------------------------------------------------------------*/
+
+/*
+ * Type definitions are hash-consed: every distinct list of tagged
+ * tokens exists once, made of interned strings, so two equal
+ * definitions are the same pointer.  The lists run from the last token
+ * to the first, which lets definitions that start alike share their
+ * tails.  Declarations of functions and variables are left alone: there
+ * are many of them and only the exported ones are ever expanded.
+ * None of this is ever freed, so it is carved out of large blocks.
+ */
+#define PERM_BLOCK_SIZE	(64 * 1024)
+
+static void *perm_alloc(size_t size)
+{
+	static char *next, *limit;
+	void *p;
+
+	size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (size > PERM_BLOCK_SIZE / 4)
+		return xmalloc(size);
+
+	if ((size_t)(limit - next) < size) {
+		next = xmalloc(PERM_BLOCK_SIZE);
+		limit = next + PERM_BLOCK_SIZE;
+	}
+	p = next;
+	next += size;
+
+	return p;
+}
+
+struct interned_string {
+	struct interned_string *next;
+	unsigned long hash;
+	char string[];
+};
+
+struct cons_node {
+	struct string_list list;
+	struct cons_node *next;
+	unsigned long hash;
+};
+
+static struct interned_string **strings;
+static unsigned int nr_strings, strings_size;
+
+static struct cons_node **conses;
+static unsigned int nr_conses, conses_size;
+
+static void grow_strings(void)
+{
+	struct interned_string **old = strings, *is, *next;
+	unsigned int i, old_size = strings_size;
+
+	strings_size = old_size ? old_size * 2 : 16384;
+	strings = xmalloc(strings_size * sizeof(*strings));
+	memset(strings, 0, strings_size * sizeof(*strings));
+
+	for (i = 0; i < old_size; i++)
+		for (is = old[i]; is; is = next) {
+			next = is->next;
+			is->next = strings[is->hash & (strings_size - 1)];
+			strings[is->hash & (strings_size - 1)] = is;
+		}
+	free(old);
+}
+
+static char *intern_string(const char *string)
+{
+	unsigned long h = 5381;
+	const unsigned char *c;
+	struct interned_string *is;
+	size_t len;
+
+	for (c = (const unsigned char *)string; *c; c++)
+		h = h * 33 + *c;
+
+	if (nr_strings >= strings_size)
+		grow_strings();
+
+	for (is = strings[h & (strings_size - 1)]; is; is = is->next)
+		if (is->hash == h && strcmp(is->string, string) == 0)
+			return is->string;
+
+	len = strlen(string) + 1;
+	is = perm_alloc(sizeof(*is) + len);
+	memcpy(is->string, string, len);
+	is->hash = h;
+	is->next = strings[h & (strings_size - 1)];
+	strings[h & (strings_size - 1)] = is;
+	nr_strings++;
+
+	return is->string;
+}
+
+static unsigned long cons_hash(const char *string, enum symbol_type tag,
+			       struct string_list *next)
+{
+	unsigned long h = (unsigned long)string;
+
+	h = h * 31 + (unsigned long)next;
+	h = h * 31 + tag;
+	h *= 0x9e3779b1UL;
+	return h ^ (h >> 16);
+}
+
+static void grow_conses(void)
+{
+	struct cons_node **old = conses, *cn, *next;
+	unsigned int i, old_size = conses_size;
+
+	conses_size = old_size ? old_size * 2 : 65536;
+	conses = xmalloc(conses_size * sizeof(*conses));
+	memset(conses, 0, conses_size * sizeof(*conses));
+
+	for (i = 0; i < old_size; i++)
+		for (cn = old[i]; cn; cn = next) {
+			next = cn->next;
+			cn->next = conses[cn->hash & (conses_size - 1)];
+			conses[cn->hash & (conses_size - 1)] = cn;
+		}
+	free(old);
+}
+
+/* the node for an interned string with the given tag in front of next */
+static struct string_list *cons(char *string, enum symbol_type tag,
+				struct string_list *next)
+{
+	unsigned long h = cons_hash(string, tag, next);
+	struct cons_node *cn;
+
+	if (nr_conses >= conses_size)
+		grow_conses();
+
+	for (cn = conses[h & (conses_size - 1)]; cn; cn = cn->next)
+		if (cn->hash == h && cn->list.string == string &&
+		    cn->list.tag == tag && cn->list.next == next)
+			return &cn->list;
+
+	cn = perm_alloc(sizeof(*cn));
+	cn->list.string = string;
+	cn->list.tag = tag;
+	cn->list.next = next;
+	cn->list.in_source_file = 0;
+	cn->hash = h;
+	cn->next = conses[h & (conses_size - 1)];
+	conses[h & (conses_size - 1)] = cn;
+	nr_conses++;
+
+	return &cn->list;
+}
+
+static struct string_list *hashcons_list(struct string_list *list)
+{
+	struct string_list **nodes, *res = NULL, *tmp;
+	int elem = 0;
+
+	for (tmp = list; tmp; tmp = tmp->next)
+		elem++;
+
+	nodes = alloca(elem * sizeof(*nodes));
+	elem = 0;
+	for (tmp = list; tmp; tmp = tmp->next)
+		nodes[elem++] = tmp;
+
+	while (elem--)
+		res = cons(intern_string(nodes[elem]->string),
+			   nodes[elem]->tag, res);
+	return res;
+}
+
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
 static struct string_list *read_node(FILE *f)
@@ -539,16 +782,79 @@ static void print_list(FILE * f, struct string_list *list)
 	}
 }
 
+static unsigned long crc_token(const char *s, unsigned long crc)
+{
+	expansion_len += strlen(s) + 1;
+	crc = partial_crc32(s, crc);
+	return partial_crc32_one(' ', crc);
+}
+
+static void push_trail(struct symbol *sym)
+{
+	sym->expansion_trail = expansion_trail;
+	sym->trail_seq = ++trail_seq;
+	expansion_trail = sym;
+}
+
+/* sym is on the trail already and only its name goes into the CRC */
+static void hit_trail(struct symbol *sym)
+{
+	if (sym->trail_seq < trail_min_hit)
+		trail_min_hit = sym->trail_seq;
+}
+
+static int reuse_expansion(struct expansion *x, unsigned long *crc)
+{
+	int i;
+
+	for (i = 0; i < x->nr_syms; i++)
+		if (x->syms[i]->expansion_trail)
+			return 0;
+
+	for (i = 0; i < x->nr_syms; i++)
+		push_trail(x->syms[i]);
+	*crc = x->crc ^ crc32_shift(*crc, x->len);
+	expansion_len += x->len;
+
+	return 1;
+}
+
+/* sym was expanded from crc_in to crc, into len bytes of text */
+static void record_expansion(struct symbol *sym, unsigned long crc_in,
+			     unsigned long crc, unsigned long len)
+{
+	int i, nr_syms = trail_seq - sym->trail_seq;
+	struct expansion *x;
+	struct symbol *s;
+
+	x = xmalloc(sizeof(*x) + nr_syms * sizeof(x->syms[0]));
+	x->crc = crc ^ crc32_shift(crc_in, len);
+	x->len = len;
+	x->nr_syms = nr_syms;
+
+	/* everything pushed after sym is still on top of it */
+	for (s = expansion_trail, i = nr_syms; i > 0; s = s->expansion_trail)
+		x->syms[--i] = s;
+
+	sym->expansion = x;
+}
+
 static unsigned long expand_and_crc_sym(struct symbol *sym, unsigned long crc)
 {
 	struct string_list *list = sym->defn;
 	struct string_list **e, **b;
 	struct string_list *tmp, **tmp2;
+	unsigned long crc_in = crc, len_in = expansion_len;
+	unsigned long min_hit = trail_min_hit;
 	int elem = 1;
 
 	if (!list)
 		return crc;
 
+	if (sym->expansion && reuse_expansion(sym->expansion, &crc))
+		return crc;
+	trail_min_hit = ULONG_MAX;
+
 	tmp = list;
 	while ((tmp = tmp->next) != NULL)
 		elem++;
@@ -570,8 +876,7 @@ static unsigned long expand_and_crc_sym(struct symbol *sym, unsigned long crc)
 		case SYM_NORMAL:
 			if (flag_dump_defs)
 				fprintf(debugfile, "%s ", cur->string);
-			crc = partial_crc32(cur->string, crc);
-			crc = partial_crc32_one(' ', crc);
+			crc = crc_token(cur->string, crc);
 			break;
 
 		case SYM_ENUM_CONST:
@@ -581,11 +886,10 @@ static unsigned long expand_and_crc_sym(struct symbol *sym, unsigned long crc)
 			if (subsym->expansion_trail) {
 				if (flag_dump_defs)
 					fprintf(debugfile, "%s ", cur->string);
-				crc = partial_crc32(cur->string, crc);
-				crc = partial_crc32_one(' ', crc);
+				crc = crc_token(cur->string, crc);
+				hit_trail(subsym);
 			} else {
-				subsym->expansion_trail = expansion_trail;
-				expansion_trail = subsym;
+				push_trail(subsym);
 				crc = expand_and_crc_sym(subsym, crc);
 			}
 			break;
@@ -616,20 +920,24 @@ static unsigned long expand_and_crc_sym(struct symbol *sym, unsigned long crc)
 						cur->string);
 				}
 
-				crc = partial_crc32(symbol_types[cur->tag].name,
-						    crc);
-				crc = partial_crc32_one(' ', crc);
-				crc = partial_crc32(cur->string, crc);
-				crc = partial_crc32_one(' ', crc);
+				crc = crc_token(symbol_types[cur->tag].name, crc);
+				crc = crc_token(cur->string, crc);
+				hit_trail(subsym);
 			} else {
-				subsym->expansion_trail = expansion_trail;
-				expansion_trail = subsym;
+				push_trail(subsym);
 				crc = expand_and_crc_sym(subsym, crc);
 			}
 			break;
 		}
 	}
 
+	/* -D wants the text, so keep expanding it */
+	if (trail_min_hit >= sym->trail_seq && !sym->expansion &&
+	    !flag_dump_defs)
+		record_expansion(sym, crc_in, crc, expansion_len - len_in);
+	if (min_hit < trail_min_hit)
+		trail_min_hit = min_hit;
+
 	{
 		static struct symbol **end = &visited_symbols;
 
@@ -659,8 +967,7 @@ void export_symbol(const char *name)
 
 		expansion_trail = (struct symbol *)-1L;
 
-		sym->expansion_trail = expansion_trail;
-		expansion_trail = sym;
+		push_trail(sym);
 		crc = expand_and_crc_sym(sym, 0xffffffff) ^ 0xffffffff;
 
 		sym = expansion_trail;
@@ -838,6 +1145,8 @@ int main(int argc, char **argv)
 		/* setlinebuf(debugfile); */
 	}
 
+	init_crc32_shift();
+
 	if (flag_reference) {
 		read_reference(ref_file);
 		fclose(ref_file);
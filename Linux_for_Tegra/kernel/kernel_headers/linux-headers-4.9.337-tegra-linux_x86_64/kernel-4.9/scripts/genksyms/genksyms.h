@@ -41,6 +41,8 @@ struct string_list {
 	char *string;
 };
 
+struct expansion;
+
 struct symbol {
 	struct symbol *hash_next;
 	const char *name;
@@ -52,6 +54,8 @@ struct symbol {
 	int is_declared;
 	enum symbol_status status;
 	int is_override;
+	unsigned long trail_seq;
+	struct expansion *expansion;
 };
 
 typedef struct string_list **yystype;
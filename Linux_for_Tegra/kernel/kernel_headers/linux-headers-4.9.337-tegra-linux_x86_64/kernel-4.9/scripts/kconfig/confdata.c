@@ -3,11 +3,15 @@
  * Released under the terms of the GNU GPL v2.0.
  */
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -193,68 +197,400 @@ static int conf_set_sym_val(struct symbol *sym, int def, int def_flags, char *p)
 	return 0;
 }
 
-#define LINE_GROWTH 16
-static int add_byte(int c, char **lineptr, size_t slen, size_t *n)
+/*
+ * Split a line of a config file into the symbol name and its value, or
+ * NULL for "is not set".  Returns 1 if the line assigns a symbol, 0 if it
+ * is to be skipped and -1 if it is not a config line at all.
+ */
+static int conf_split_line(char *line, char **name, char **val)
 {
-	char *nline;
-	size_t new_size = slen + 1;
-	if (new_size > *n) {
-		new_size += LINE_GROWTH - 1;
-		new_size *= 2;
-		nline = realloc(*lineptr, new_size);
-		if (!nline)
-			return -1;
-
-		*lineptr = nline;
-		*n = new_size;
+	char *p, *p2;
+
+	if (line[0] == '#') {
+		if (!line[1] || strncmp(line + 2, CONFIG_, strlen(CONFIG_)))
+			return 0;
+		p = strchr(line + 2 + strlen(CONFIG_), ' ');
+		if (!p)
+			return 0;
+		*p++ = 0;
+		if (strncmp(p, "is not set", 10))
+			return 0;
+		*name = line + 2 + strlen(CONFIG_);
+		*val = NULL;
+		return 1;
+	}
+	if (strncmp(line, CONFIG_, strlen(CONFIG_)) == 0) {
+		p = strchr(line + strlen(CONFIG_), '=');
+		if (!p)
+			return 0;
+		*p++ = 0;
+		p2 = strchr(p, '\n');
+		if (p2) {
+			*p2-- = 0;
+			if (*p2 == '\r')
+				*p2 = 0;
+		}
+		*name = line + strlen(CONFIG_);
+		*val = p;
+		return 1;
 	}
+	if (line[0] != '\r' && line[0] != '\n')
+		return -1;
+	return 0;
+}
 
-	(*lineptr)[slen] = c;
+static void conf_read_entry(char *name, char *val, int def, int def_flags)
+{
+	struct symbol *sym;
 
-	return 0;
+	if (def == S_DEF_USER) {
+		sym = sym_find(name);
+		if (!sym) {
+			sym_add_change_count(1);
+			return;
+		}
+	} else {
+		sym = sym_lookup(name, 0);
+		if (sym->type == S_UNKNOWN)
+			sym->type = val ? S_OTHER : S_BOOLEAN;
+	}
+	if (sym->flags & def_flags) {
+		conf_warning("override: reassigning to symbol %s", sym->name);
+	}
+	if (!val) {
+		switch (sym->type) {
+		case S_BOOLEAN:
+		case S_TRISTATE:
+			sym->def[def].tri = no;
+			sym->flags |= def_flags;
+			break;
+		default:
+			;
+		}
+	} else if (conf_set_sym_val(sym, def, def_flags, val))
+		return;
+
+	if (sym_is_choice_value(sym)) {
+		struct symbol *cs = prop_get_symbol(sym_get_choice_prop(sym));
+		switch (sym->def[def].tri) {
+		case no:
+			break;
+		case mod:
+			if (cs->def[def].tri == yes) {
+				conf_warning("%s creates inconsistent choice state", sym->name);
+				cs->flags &= ~def_flags;
+			}
+			break;
+		case yes:
+			if (cs->def[def].tri != no)
+				conf_warning("override: %s changes choice state", sym->name);
+			cs->def[def].val = sym;
+			break;
+		}
+		cs->def[def].tri = EXPR_OR(cs->def[def].tri, sym->def[def].tri);
+	}
 }
 
-static ssize_t compat_getline(char **lineptr, size_t *n, FILE *stream)
+/* Read all of a file into a NUL-terminated buffer. */
+static char *conf_slurp(FILE *in, size_t *size)
 {
-	char *line = *lineptr;
-	size_t slen = 0;
+	struct stat st;
+	size_t len = 0, alloc = 4096, n;
+	char *buf;
+
+	if (!fstat(fileno(in), &st) && st.st_size + 2 > alloc)
+		alloc = st.st_size + 2;
+	buf = xmalloc(alloc);
+	while ((n = fread(buf + len, 1, alloc - len - 1, in)) > 0) {
+		len += n;
+		if (len + 1 == alloc) {
+			alloc *= 2;
+			buf = xrealloc(buf, alloc);
+		}
+	}
+	buf[len] = 0;
+	*size = len;
 
-	for (;;) {
-		int c = getc(stream);
+	return buf;
+}
 
-		switch (c) {
-		case '\n':
-			if (add_byte(c, &line, slen, n) < 0)
-				goto e_out;
-			slen++;
-			/* fall through */
-		case EOF:
-			if (add_byte('\0', &line, slen, n) < 0)
-				goto e_out;
-			*lineptr = line;
-			if (slen == 0)
-				return -1;
-			return slen;
-		default:
-			if (add_byte(c, &line, slen, n) < 0)
-				goto e_out;
-			slen++;
+struct conf_text {
+	const char *next, *end;
+	char *line;
+	size_t line_asize;
+};
+
+/* Hand out the lines of a buffer one at a time, as getline() would. */
+static char *conf_next_line(struct conf_text *t)
+{
+	const char *nl;
+	size_t len;
+
+	if (t->next >= t->end)
+		return NULL;
+	nl = memchr(t->next, '\n', t->end - t->next);
+	len = nl ? nl + 1 - t->next : t->end - t->next;
+	if (len + 1 > t->line_asize) {
+		t->line_asize = 2 * (len + 1);
+		t->line = xrealloc(t->line, t->line_asize);
+	}
+	memcpy(t->line, t->next, len);
+	t->line[len] = 0;
+	t->next += len;
+
+	return t->line;
+}
+
+static void conf_read_text(const char *text, size_t size, int def, int def_flags)
+{
+	struct conf_text t = { text, text + size };
+	char *line, *name, *val;
+
+	while ((line = conf_next_line(&t))) {
+		conf_lineno++;
+		switch (conf_split_line(line, &name, &val)) {
+		case 1:
+			conf_read_entry(name, val, def, def_flags);
+			break;
+		case -1:
+			conf_warning("unexpected data: %.*s",
+				     (int)strcspn(line, "\r\n"), line);
+			break;
+		}
+	}
+	free(t.line);
+}
+
+/*
+ * conf_write() leaves a compiled form of the file it wrote next to it, in
+ * <name>.snapshot: the lines that assign a symbol, already split into
+ * name and value, in file order.  The snapshot carries the size and hash
+ * of the text it was compiled from and is only used while the text still
+ * hashes the same.  Anything else (no snapshot, an edited or replaced
+ * .config, another CONFIG_ prefix, a truncated or foreign file) falls back
+ * to parsing the text.  The entries are replayed in order with their line
+ * numbers, so both the symbols and any warnings come out as they would
+ * from the text.
+ */
+#define SNAPSHOT_MAGIC		"KCSNAP01"
+#define SNAPSHOT_NOT_SET	0xffffffffU
+
+struct snapshot_header {
+	char magic[8];
+	uint64_t text_hash;
+	uint32_t text_size;
+	uint32_t nr_entries;
+	uint32_t strings_size;
+	uint32_t prefix;	/* CONFIG_ prefix the text was split with */
+};
+
+struct snapshot_entry {
+	uint32_t lineno;
+	uint32_t name;		/* offsets into the strings */
+	uint32_t val;		/* or SNAPSHOT_NOT_SET */
+};
+
+struct snapshot_buf {
+	struct snapshot_entry *entries;
+	size_t nr_entries, entries_alloc;
+	char *strings;
+	size_t strings_size, strings_alloc;
+};
+
+/* FNV-1a */
+static uint64_t snapshot_hash(const char *s, size_t len)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= (unsigned char)*s++;
+		h *= 0x100000001b3ULL;
+	}
+
+	return h;
+}
+
+static bool snapshot_valid(const struct snapshot_header *h, size_t map_size,
+			   const char *text, size_t size)
+{
+	const struct snapshot_entry *e = (const void *)(h + 1);
+	const char *strings;
+	size_t strings_size;
+	uint32_t i;
+
+	if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) ||
+	    h->text_size != size ||
+	    h->nr_entries > (map_size - sizeof(*h)) / sizeof(*e))
+		return false;
+
+	strings = (const char *)(e + h->nr_entries);
+	strings_size = map_size - (strings - (const char *)h);
+	if (h->strings_size != strings_size || !strings_size ||
+	    strings[strings_size - 1] ||
+	    h->prefix >= strings_size || strcmp(strings + h->prefix, CONFIG_))
+		return false;
+
+	for (i = 0; i < h->nr_entries; i++, e++)
+		if (e->name >= strings_size ||
+		    (e->val != SNAPSHOT_NOT_SET && e->val >= strings_size))
+			return false;
+
+	return h->text_hash == snapshot_hash(text, size);
+}
+
+/*
+ * Load the symbols from the snapshot of the config file @name, whose text
+ * is already in @text.  Returns false if there is no snapshot that can be
+ * trusted, before anything has been loaded.
+ */
+static bool conf_read_snapshot(const char *name, const char *text, size_t size,
+			       int def, int def_flags)
+{
+	char path[PATH_MAX + 16];
+	struct snapshot_header *h;
+	struct snapshot_entry *e;
+	struct stat st;
+	char *strings;
+	void *map;
+	uint32_t i;
+	bool ret = false;
+	int fd;
+
+	if (snprintf(path, sizeof(path), "%s.snapshot", name) >= sizeof(path))
+		return false;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) || st.st_size < sizeof(*h)) {
+		close(fd);
+		return false;
+	}
+	/* private and writable, conf_set_sym_val() unescapes in place */
+	map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	h = map;
+	if (!snapshot_valid(h, st.st_size, text, size))
+		goto out;
+
+	e = (struct snapshot_entry *)(h + 1);
+	strings = (char *)(e + h->nr_entries);
+	for (i = 0; i < h->nr_entries; i++, e++) {
+		conf_lineno = e->lineno;
+		conf_read_entry(strings + e->name,
+				e->val == SNAPSHOT_NOT_SET ? NULL : strings + e->val,
+				def, def_flags);
+	}
+	ret = true;
+out:
+	munmap(map, st.st_size);
+	return ret;
+}
+
+static uint32_t snapshot_add_string(struct snapshot_buf *b, const char *s)
+{
+	size_t len = strlen(s) + 1, off = b->strings_size;
+
+	if (off + len > b->strings_alloc) {
+		b->strings_alloc = 2 * (off + len);
+		b->strings = xrealloc(b->strings, b->strings_alloc);
+	}
+	memcpy(b->strings + off, s, len);
+	b->strings_size += len;
+
+	return off;
+}
+
+static void snapshot_add_entry(struct snapshot_buf *b, uint32_t lineno,
+			       const char *name, const char *val)
+{
+	struct snapshot_entry *e;
+
+	if (b->nr_entries == b->entries_alloc) {
+		b->entries_alloc = b->entries_alloc ? 2 * b->entries_alloc : 1024;
+		b->entries = xrealloc(b->entries,
+				      b->entries_alloc * sizeof(*b->entries));
+	}
+	e = &b->entries[b->nr_entries++];
+	e->lineno = lineno;
+	e->name = snapshot_add_string(b, name);
+	e->val = val ? snapshot_add_string(b, val) : SNAPSHOT_NOT_SET;
+}
+
+/*
+ * Compile the config file @name into its snapshot.  The snapshot is only
+ * a cache, so this gives up quietly on any problem and leaves it to the
+ * hash check to ignore what might be left of an older one.
+ */
+static void conf_write_snapshot(const char *name)
+{
+	struct snapshot_buf b = { NULL };
+	struct snapshot_header h;
+	struct conf_text t = { NULL };
+	char path[PATH_MAX + 16], tmpname[PATH_MAX + 32];
+	char *text, *line, *sym_name, *val;
+	uint32_t lineno = 0;
+	size_t size;
+	FILE *in, *out;
+	int ok;
+
+	if (snprintf(path, sizeof(path), "%s.snapshot", name) >= sizeof(path))
+		return;
+	sprintf(tmpname, "%s.%d", path, (int)getpid());
+
+	in = fopen(name, "r");
+	if (!in)
+		return;
+	text = conf_slurp(in, &size);
+	fclose(in);
+	if (size > UINT32_MAX)
+		goto out;
+
+	t.next = text;
+	t.end = text + size;
+	while ((line = conf_next_line(&t))) {
+		lineno++;
+		switch (conf_split_line(line, &sym_name, &val)) {
+		case 1:
+			snapshot_add_entry(&b, lineno, sym_name, val);
+			break;
+		case -1:
+			/* leave the warnings to the text */
+			goto out;
 		}
 	}
 
-e_out:
-	line[slen-1] = '\0';
-	*lineptr = line;
-	return -1;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.text_hash = snapshot_hash(text, size);
+	h.text_size = size;
+	h.prefix = snapshot_add_string(&b, CONFIG_);
+	h.nr_entries = b.nr_entries;
+	h.strings_size = b.strings_size;
+
+	out = fopen(tmpname, "w");
+	if (!out)
+		goto out;
+	ok = fwrite(&h, sizeof(h), 1, out) == 1 &&
+	     fwrite(b.entries, sizeof(*b.entries), b.nr_entries, out) == b.nr_entries &&
+	     fwrite(b.strings, 1, b.strings_size, out) == b.strings_size;
+	if (fclose(out) || !ok || rename(tmpname, path))
+		unlink(tmpname);
+out:
+	free(t.line);
+	free(b.entries);
+	free(b.strings);
+	free(text);
 }
 
 int conf_read_simple(const char *name, int def)
 {
 	FILE *in = NULL;
-	char   *line = NULL;
-	size_t  line_asize = 0;
-	char *p, *p2;
 	struct symbol *sym;
+	char *text;
+	size_t size;
 	int i, def_flags;
 
 	if (name) {
@@ -295,7 +631,10 @@ load:
 	def_flags = SYMBOL_DEF << def;
 	for_all_symbols(i, sym) {
 		sym->flags |= SYMBOL_CHANGED;
-		sym->flags &= ~(def_flags|SYMBOL_VALID);
+		sym->flags &= ~def_flags;
+		/* only the user values go into the calculated ones */
+		if (def == S_DEF_USER)
+			sym->flags &= ~SYMBOL_VALID;
 		if (sym_is_choice(sym))
 			sym->flags |= def_flags;
 		switch (sym->type) {
@@ -311,98 +650,11 @@ load:
 		}
 	}
 
-	while (compat_getline(&line, &line_asize, in) != -1) {
-		conf_lineno++;
-		sym = NULL;
-		if (line[0] == '#') {
-			if (memcmp(line + 2, CONFIG_, strlen(CONFIG_)))
-				continue;
-			p = strchr(line + 2 + strlen(CONFIG_), ' ');
-			if (!p)
-				continue;
-			*p++ = 0;
-			if (strncmp(p, "is not set", 10))
-				continue;
-			if (def == S_DEF_USER) {
-				sym = sym_find(line + 2 + strlen(CONFIG_));
-				if (!sym) {
-					sym_add_change_count(1);
-					goto setsym;
-				}
-			} else {
-				sym = sym_lookup(line + 2 + strlen(CONFIG_), 0);
-				if (sym->type == S_UNKNOWN)
-					sym->type = S_BOOLEAN;
-			}
-			if (sym->flags & def_flags) {
-				conf_warning("override: reassigning to symbol %s", sym->name);
-			}
-			switch (sym->type) {
-			case S_BOOLEAN:
-			case S_TRISTATE:
-				sym->def[def].tri = no;
-				sym->flags |= def_flags;
-				break;
-			default:
-				;
-			}
-		} else if (memcmp(line, CONFIG_, strlen(CONFIG_)) == 0) {
-			p = strchr(line + strlen(CONFIG_), '=');
-			if (!p)
-				continue;
-			*p++ = 0;
-			p2 = strchr(p, '\n');
-			if (p2) {
-				*p2-- = 0;
-				if (*p2 == '\r')
-					*p2 = 0;
-			}
-			if (def == S_DEF_USER) {
-				sym = sym_find(line + strlen(CONFIG_));
-				if (!sym) {
-					sym_add_change_count(1);
-					goto setsym;
-				}
-			} else {
-				sym = sym_lookup(line + strlen(CONFIG_), 0);
-				if (sym->type == S_UNKNOWN)
-					sym->type = S_OTHER;
-			}
-			if (sym->flags & def_flags) {
-				conf_warning("override: reassigning to symbol %s", sym->name);
-			}
-			if (conf_set_sym_val(sym, def, def_flags, p))
-				continue;
-		} else {
-			if (line[0] != '\r' && line[0] != '\n')
-				conf_warning("unexpected data: %.*s",
-					     (int)strcspn(line, "\r\n"), line);
-
-			continue;
-		}
-setsym:
-		if (sym && sym_is_choice_value(sym)) {
-			struct symbol *cs = prop_get_symbol(sym_get_choice_prop(sym));
-			switch (sym->def[def].tri) {
-			case no:
-				break;
-			case mod:
-				if (cs->def[def].tri == yes) {
-					conf_warning("%s creates inconsistent choice state", sym->name);
-					cs->flags &= ~def_flags;
-				}
-				break;
-			case yes:
-				if (cs->def[def].tri != no)
-					conf_warning("override: %s changes choice state", sym->name);
-				cs->def[def].val = sym;
-				break;
-			}
-			cs->def[def].tri = EXPR_OR(cs->def[def].tri, sym->def[def].tri);
-		}
-	}
-	free(line);
+	text = conf_slurp(in, &size);
 	fclose(in);
+	if (!conf_read_snapshot(name, text, size, def, def_flags))
+		conf_read_text(text, size, def, def_flags);
+	free(text);
 	return 0;
 }
 
@@ -462,7 +714,8 @@ int conf_read(const char *name)
 				/* Reset a string value if it's out of range */
 				if (sym_string_within_range(sym, sym->def[S_DEF_USER].val))
 					break;
-				sym->flags &= ~(SYMBOL_VALID|SYMBOL_DEF_USER);
+				sym->flags &= ~SYMBOL_DEF_USER;
+				sym_clear_valid(sym);
 				conf_unsaved++;
 				break;
 			default:
@@ -670,12 +923,14 @@ int conf_write_defconfig(const char *filename)
 	struct symbol *sym;
 	struct menu *menu;
 	FILE *out;
+	int i;
 
 	out = fopen(filename, "w");
 	if (!out)
 		return 1;
 
-	sym_clear_all_valid();
+	for_all_symbols(i, sym)
+		sym->flags &= ~SYMBOL_WRITTEN;
 
 	/* Traverse all menus to find all relevant symbols */
 	menu = rootmenu.list;
@@ -688,9 +943,10 @@ int conf_write_defconfig(const char *filename)
 				goto next_menu;
 		} else if (!sym_is_choice(sym)) {
 			sym_calc_value(sym);
-			if (!(sym->flags & SYMBOL_WRITE))
+			if (!(sym->flags & SYMBOL_WRITE) ||
+			    sym->flags & SYMBOL_WRITTEN)
 				goto next_menu;
-			sym->flags &= ~SYMBOL_WRITE;
+			sym->flags |= SYMBOL_WRITTEN;
 			/* If we cannot change the symbol - skip */
 			if (!sym_is_changable(sym))
 				goto next_menu;
@@ -747,6 +1003,7 @@ int conf_write(const char *name)
 	const char *str;
 	char dirname[PATH_MAX+1], tmpname[PATH_MAX+22], newname[PATH_MAX+8];
 	char *env;
+	int i;
 
 	dirname[0] = 0;
 	if (name && name[0]) {
@@ -784,8 +1041,8 @@ int conf_write(const char *name)
 
 	conf_write_heading(out, &kconfig_printer_cb, NULL);
 
-	if (!conf_get_changed())
-		sym_clear_all_valid();
+	for_all_symbols(i, sym)
+		sym->flags &= ~SYMBOL_WRITTEN;
 
 	menu = rootmenu.list;
 	while (menu) {
@@ -800,9 +1057,10 @@ int conf_write(const char *name)
 				     "#\n", str);
 		} else if (!(sym->flags & SYMBOL_CHOICE)) {
 			sym_calc_value(sym);
-			if (!(sym->flags & SYMBOL_WRITE))
+			if (!(sym->flags & SYMBOL_WRITE) ||
+			    sym->flags & SYMBOL_WRITTEN)
 				goto next;
-			sym->flags &= ~SYMBOL_WRITE;
+			sym->flags |= SYMBOL_WRITTEN;
 
 			conf_write_symbol(out, sym, &kconfig_printer_cb, NULL);
 		}
@@ -830,6 +1088,7 @@ next:
 		if (rename(tmpname, newname))
 			return 1;
 	}
+	conf_write_snapshot(newname);
 
 	conf_message(_("configuration written to %s"), newname);
 
@@ -838,24 +1097,171 @@ next:
 	return 0;
 }
 
+/*
+ * include/config/ holds an empty file for every symbol, touched whenever
+ * the symbol's value changes so that the fixdep dependencies of everything
+ * using it go stale.  Working out which symbols changed is cheap, the file
+ * operations are not (on network file systems especially), so the whole
+ * set is collected first and the files are then handled in sorted shards
+ * by a few forked workers.  The workers only make syscalls, so processes
+ * do as well as threads would without every frontend linking libpthread.
+ *
+ * KCONFIG_SPLITJOBS sets the number of workers, and KCONFIG_SPLITSTATS
+ * prints where the time went.
+ */
+#define SPLIT_MAX_JOBS		8
+#define SPLIT_MIN_BATCH		64	/* files per worker, at least */
+
+struct split_stats {
+	unsigned int touched, created, dirs;
+	int failed;
+};
+
+static double split_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int split_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int split_mkdirs(char *path, struct split_stats *st)
+{
+	char *d = path;
+
+	while ((d = strchr(d, '/'))) {
+		*d = 0;
+		if (!mkdir(path, 0755))
+			st->dirs++;
+		else if (errno != EEXIST) {
+			*d = '/';
+			return 1;
+		}
+		*d++ = '/';
+	}
+	return 0;
+}
+
+static void split_touch(char **paths, int cnt, struct split_stats *st)
+{
+	int i, fd;
+
+	for (i = 0; i < cnt; i++) {
+		/* a single setattr for a file that is already there */
+		if (!utimensat(AT_FDCWD, paths[i], NULL, 0)) {
+			st->touched++;
+			continue;
+		}
+		if (errno != ENOENT)
+			goto fail;
+
+		/* Assume directory path already exists. */
+		fd = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd == -1) {
+			if (errno != ENOENT || split_mkdirs(paths[i], st))
+				goto fail;
+			fd = open(paths[i], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if (fd == -1)
+				goto fail;
+		}
+		close(fd);
+		st->created++;
+	}
+	return;
+fail:
+	st->failed = 1;
+}
+
+static int split_jobs(int cnt)
+{
+	char *env = getenv("KCONFIG_SPLITJOBS");
+	int jobs;
+
+	if (env && *env)
+		jobs = atoi(env);
+	else {
+		jobs = sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs > SPLIT_MAX_JOBS)
+			jobs = SPLIT_MAX_JOBS;
+	}
+	if (jobs > (cnt + SPLIT_MIN_BATCH - 1) / SPLIT_MIN_BATCH)
+		jobs = (cnt + SPLIT_MIN_BATCH - 1) / SPLIT_MIN_BATCH;
+
+	return jobs > 1 ? jobs : 1;
+}
+
+static void split_run(char **paths, int cnt, int jobs, struct split_stats *total)
+{
+	struct split_stats *st;
+	pid_t *pids;
+	int i, first, status;
+
+	if (jobs > 1) {
+		st = mmap(NULL, jobs * sizeof(*st), PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (st == MAP_FAILED)
+			jobs = 1;
+	}
+	if (jobs == 1) {
+		split_touch(paths, cnt, total);
+		return;
+	}
+
+	pids = xcalloc(jobs, sizeof(*pids));
+	for (i = 0; i < jobs; i++) {
+		first = (long)cnt * i / jobs;
+		pids[i] = fork();
+		if (pids[i] == 0) {
+			split_touch(paths + first,
+				    (long)cnt * (i + 1) / jobs - first, &st[i]);
+			_exit(st[i].failed);
+		}
+		/* do the shard ourselves if there is no worker for it */
+		if (pids[i] < 0)
+			split_touch(paths + first,
+				    (long)cnt * (i + 1) / jobs - first, &st[i]);
+	}
+
+	for (i = 0; i < jobs; i++) {
+		if (pids[i] > 0 &&
+		    (waitpid(pids[i], &status, 0) != pids[i] ||
+		     !WIFEXITED(status) || WEXITSTATUS(status)))
+			total->failed = 1;
+		total->touched += st[i].touched;
+		total->created += st[i].created;
+		total->dirs += st[i].dirs;
+		total->failed |= st[i].failed;
+	}
+
+	free(pids);
+	munmap(st, jobs * sizeof(*st));
+}
+
 static int conf_split_config(void)
 {
 	const char *name;
 	char path[PATH_MAX+1];
 	char *s, *d, c;
+	char **paths = NULL;
 	struct symbol *sym;
-	struct stat sb;
-	int res, i, fd;
+	struct split_stats st;
+	double t0, t1, t2, t3;
+	int i, cnt, size, nr_syms, jobs;
 
+	t0 = split_time();
 	name = conf_get_autoconfig_name();
 	conf_read_simple(name, S_DEF_AUTO);
 	sym_calc_value(modules_sym);
 
-	if (chdir("include/config"))
-		return 1;
-
-	res = 0;
+	t1 = split_time();
+	cnt = size = nr_syms = 0;
 	for_all_symbols(i, sym) {
+		nr_syms++;
 		sym_calc_value(sym);
 		if ((sym->flags & SYMBOL_AUTO) || !sym->name)
 			continue;
@@ -915,40 +1321,43 @@ static int conf_split_config(void)
 		}
 		strcpy(d, ".h");
 
-		/* Assume directory path already exists. */
-		fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-		if (fd == -1) {
-			if (errno != ENOENT) {
-				res = 1;
-				break;
-			}
-			/*
-			 * Create directory components,
-			 * unless they exist already.
-			 */
-			d = path;
-			while ((d = strchr(d, '/'))) {
-				*d = 0;
-				if (stat(path, &sb) && mkdir(path, 0755)) {
-					res = 1;
-					goto out;
-				}
-				*d++ = '/';
-			}
-			/* Try it again. */
-			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-			if (fd == -1) {
-				res = 1;
-				break;
-			}
+		if (cnt == size) {
+			size = size ? size * 2 : 256;
+			paths = xrealloc(paths, size * sizeof(*paths));
 		}
-		close(fd);
+		paths[cnt++] = xstrdup(path);
 	}
-out:
+
+	/* files sharing a directory go to the same worker */
+	if (cnt)
+		qsort(paths, cnt, sizeof(*paths), split_cmp);
+
+	t2 = split_time();
+	memset(&st, 0, sizeof(st));
+	jobs = split_jobs(cnt);
+	if (chdir("include/config")) {
+		st.failed = 1;
+		goto out;
+	}
+	split_run(paths, cnt, jobs, &st);
 	if (chdir("../.."))
-		return 1;
+		st.failed = 1;
+	t3 = split_time();
+
+	if (getenv("KCONFIG_SPLITSTATS")) {
+		fprintf(stderr, "split config: %d symbols, %d changed, "
+			"%u touched, %u created, %u directories created\n",
+			nr_syms, cnt, st.touched, st.created, st.dirs);
+		fprintf(stderr, "split config: read %.1fms, compare %.1fms, "
+			"files %.1fms on %d worker%s\n",
+			t1 - t0, t2 - t1, t3 - t2, jobs, jobs > 1 ? "s" : "");
+	}
+out:
+	for (i = 0; i < cnt; i++)
+		free(paths[i]);
+	free(paths);
 
-	return res;
+	return st.failed;
 }
 
 int conf_write_autoconf(void)
@@ -958,8 +1367,6 @@ int conf_write_autoconf(void)
 	FILE *out, *tristate, *out_h;
 	int i;
 
-	sym_clear_all_valid();
-
 	file_write_dep("include/config/auto.conf.cmd");
 
 	if (conf_split_config())
@@ -1021,6 +1428,7 @@ int conf_write_autoconf(void)
 	 */
 	if (rename(".tmpconfig", name))
 		return 1;
+	conf_write_snapshot(name);
 
 	return 0;
 }
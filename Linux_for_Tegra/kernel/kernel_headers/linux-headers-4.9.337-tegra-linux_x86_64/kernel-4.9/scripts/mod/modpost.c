@@ -18,6 +18,8 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include "modpost.h"
 #include "../../include/generated/autoconf.h"
 #include "../../include/linux/license.h"
@@ -37,10 +39,16 @@ static int vmlinux_section_warnings = 1;
 static int warn_unresolved = 0;
 /* How a symbol is exported */
 static int sec_mismatch_count = 0;
+/* and how many of them the object being read has, for the module cache */
+static __thread unsigned int obj_sec_mismatches;
 static int sec_mismatch_verbose = 1;
 static int sec_mismatch_fatal = 0;
 /* ignore missing files */
 static int ignore_missing_files;
+/* Number of threads reading modules and writing .mod.c files */
+static int nr_jobs;
+/* Module cache file (-c), see read_cache() */
+static const char *cache_name;
 
 enum export {
 	export_plain,      export_unused,     export_gpl,
@@ -49,16 +57,33 @@ enum export {
 
 #define PRINTF __attribute__ ((format (printf, 1, 2)))
 
+/*
+ * Where warnings and errors go.  While a module is read or its .mod.c
+ * written they are collected in a buffer of its own, and printed in the
+ * order the modules were given once all of them are done; see
+ * run_parallel().  So does a fatal error, which ends the module's work
+ * through fatal_jmp and is reported after those before it.
+ */
+static __thread FILE *diag_file;
+static __thread jmp_buf *fatal_jmp;
+
+static FILE *diag(void)
+{
+	return diag_file ? diag_file : stderr;
+}
+
 PRINTF void fatal(const char *fmt, ...)
 {
 	va_list arglist;
 
-	fprintf(stderr, "FATAL: ");
+	fprintf(diag(), "FATAL: ");
 
 	va_start(arglist, fmt);
-	vfprintf(stderr, fmt, arglist);
+	vfprintf(diag(), fmt, arglist);
 	va_end(arglist);
 
+	if (fatal_jmp)
+		longjmp(*fatal_jmp, 1);
 	exit(1);
 }
 
@@ -66,10 +91,10 @@ PRINTF void warn(const char *fmt, ...)
 {
 	va_list arglist;
 
-	fprintf(stderr, "WARNING: ");
+	fprintf(diag(), "WARNING: ");
 
 	va_start(arglist, fmt);
-	vfprintf(stderr, fmt, arglist);
+	vfprintf(diag(), fmt, arglist);
 	va_end(arglist);
 }
 
@@ -77,10 +102,10 @@ PRINTF void merror(const char *fmt, ...)
 {
 	va_list arglist;
 
-	fprintf(stderr, "ERROR: ");
+	fprintf(diag(), "ERROR: ");
 
 	va_start(arglist, fmt);
-	vfprintf(stderr, fmt, arglist);
+	vfprintf(diag(), fmt, arglist);
 	va_end(arglist);
 }
 
@@ -114,20 +139,79 @@ void *do_nofail(void *ptr, const char *expr)
 	return ptr;
 }
 
+/* This is FNV-1a, with the murmur3 finaliser so the low bits are good too */
+static inline unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name)
+		h = (h ^ (unsigned char)*name++) * 16777619;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+/*
+ * Both the modules and the exported symbols are kept in open addressing
+ * tables with linear probing, which double in size whenever they are
+ * three quarters full.  Module.symvers alone holds over 14000 exports.
+ */
+#define HASH_MIN_SIZE	1024
+
+static bool hash_full(unsigned int count, unsigned int size)
+{
+	return (count + 1) * 4 > size * 3;
+}
+
 /* A list of all modules we processed */
 static struct module *modules;
 
-static struct module *find_module(char *modname)
+/* and a hash of them by name */
+static struct module **modulehash;
+static unsigned int modulehash_size, nr_modules;
+
+static struct module **module_slot(struct module **table, unsigned int size,
+				   const char *modname, unsigned int hash)
 {
-	struct module *mod;
+	unsigned int i;
 
-	for (mod = modules; mod; mod = mod->next)
-		if (strcmp(mod->name, modname) == 0)
+	for (i = hash & (size - 1); table[i]; i = (i + 1) & (size - 1))
+		if (table[i]->hash == hash && strcmp(table[i]->name, modname) == 0)
 			break;
-	return mod;
+	return &table[i];
 }
 
-static struct module *new_module(const char *modname)
+static void grow_modulehash(void)
+{
+	struct module **old = modulehash;
+	unsigned int i, old_size = modulehash_size;
+
+	modulehash_size = old_size ? old_size * 2 : HASH_MIN_SIZE;
+	modulehash = NOFAIL(calloc(modulehash_size, sizeof(*modulehash)));
+
+	for (i = 0; i < old_size; i++)
+		if (old[i])
+			*module_slot(modulehash, modulehash_size,
+				     old[i]->name, old[i]->hash) = old[i];
+	free(old);
+}
+
+static struct module *find_module(char *modname)
+{
+	if (!nr_modules)
+		return NULL;
+
+	return *module_slot(modulehash, modulehash_size, modname,
+			    name_hash(modname));
+}
+
+/* Allocate a module, not yet on the list or in the hash */
+static struct module *alloc_module(const char *modname)
 {
 	struct module *mod;
 	char *p;
@@ -142,23 +226,45 @@ static struct module *new_module(const char *modname)
 		mod->is_dot_o = 1;
 	}
 
-	/* add to list */
 	mod->name = p;
+	mod->hash = name_hash(p);
 	mod->gpl_compatible = -1;
+
+	return mod;
+}
+
+static struct module *add_module(struct module *mod)
+{
+	struct module **slot;
+
+	/* add to list */
 	mod->next = modules;
 	modules = mod;
 
+	/* a later module of the same name hides the earlier one */
+	if (hash_full(nr_modules, modulehash_size))
+		grow_modulehash();
+	slot = module_slot(modulehash, modulehash_size, mod->name, mod->hash);
+	if (!*slot)
+		nr_modules++;
+	*slot = mod;
+
 	return mod;
 }
 
+static struct module *new_module(const char *modname)
+{
+	return add_module(alloc_module(modname));
+}
+
 /* A hash of all exported symbols,
  * struct symbol is also used for lists of unresolved symbols */
 
-#define SYMBOL_HASH_SIZE 1024
-
 struct symbol {
 	struct symbol *next;
 	struct module *module;
+	unsigned int hash;	/* name_hash() of name */
+	unsigned int seq;	/* order of creation, see write_dump() */
 	unsigned int crc;
 	int crc_valid;
 	unsigned int weak:1;
@@ -170,7 +276,10 @@ struct symbol {
 	char name[0];
 };
 
-static struct symbol *symbolhash[SYMBOL_HASH_SIZE];
+static struct symbol **symbolhash;
+static unsigned int symbolhash_size, nr_symbols;
+/* next symbol->seq, nr_symbols plus the Module.symvers.bin entries */
+static unsigned int symbol_seq;
 
 /* This is based on the hash agorithm from gdbm, via tdb */
 static inline unsigned int tdb_hash(const char *name)
@@ -201,33 +310,178 @@ static struct symbol *alloc_symbol(const char *name, unsigned int weak,
 	return s;
 }
 
-/* For the hash of exported symbols */
-static struct symbol *new_symbol(const char *name, struct module *module,
-				 enum export export)
+static struct symbol **symbol_slot(struct symbol **table, unsigned int size,
+				   const char *name, unsigned int hash)
+{
+	unsigned int i;
+
+	for (i = hash & (size - 1); table[i]; i = (i + 1) & (size - 1))
+		if (table[i]->hash == hash && strcmp(table[i]->name, name) == 0)
+			break;
+	return &table[i];
+}
+
+static void grow_symbolhash(void)
+{
+	struct symbol **old = symbolhash;
+	unsigned int i, old_size = symbolhash_size;
+
+	symbolhash_size = old_size ? old_size * 2 : HASH_MIN_SIZE;
+	symbolhash = NOFAIL(calloc(symbolhash_size, sizeof(*symbolhash)));
+
+	for (i = 0; i < old_size; i++)
+		if (old[i])
+			*symbol_slot(symbolhash, symbolhash_size,
+				     old[i]->name, old[i]->hash) = old[i];
+	free(old);
+}
+
+static struct symbol *insert_symbol(const char *name, unsigned int hash,
+				    unsigned int seq, struct module *module,
+				    enum export export)
 {
-	unsigned int hash;
 	struct symbol *new;
 
-	hash = tdb_hash(name) % SYMBOL_HASH_SIZE;
-	new = symbolhash[hash] = alloc_symbol(name, 0, symbolhash[hash]);
+	if (hash_full(nr_symbols, symbolhash_size))
+		grow_symbolhash();
+
+	new = alloc_symbol(name, 0, NULL);
+	new->hash = hash;
+	new->seq = seq;
 	new->module = module;
 	new->export = export;
+	*symbol_slot(symbolhash, symbolhash_size, name, hash) = new;
+	nr_symbols++;
 	return new;
 }
 
+/* For the hash of exported symbols, name must not be there already */
+static struct symbol *new_symbol(const char *name, struct module *module,
+				 enum export export)
+{
+	return insert_symbol(name, name_hash(name), symbol_seq++,
+			     module, export);
+}
+
+/*
+ * Module.symvers.bin is a prebuilt copy of Module.symvers, see
+ * write_symvers_bin().  When it is fresh, the first dump read is not
+ * parsed at all: the file is mapped, its modules are created up front
+ * and each of its symbols only gets a struct symbol once something
+ * looks it up.  An external module needs a few hundred of the 14000.
+ *
+ * The layout is a header, the module names, the symbols in the order
+ * of the text file, a hash table of symbol numbers plus one (0 for an
+ * empty slot) using name_hash() and linear probing, and the strings.
+ * Everything is in host byte order.
+ */
+#define SYMVERS_BIN_MAGIC	0x4d535642	/* "BVSM" little-endian */
+#define SYMVERS_BIN_VERSION	1
+
+struct symvers_bin_header {
+	uint32_t magic;
+	uint32_t version;
+	/* Module.symvers the file was made from */
+	uint64_t text_size;
+	uint64_t text_mtime_sec;
+	uint64_t text_mtime_nsec;
+	uint64_t text_hash;
+	uint32_t nr_mods;
+	uint32_t nr_syms;
+	uint32_t table_size;
+	uint32_t strings_size;
+};
+
+struct symvers_bin_sym {
+	uint32_t name;		/* offset into the strings */
+	uint32_t hash;		/* name_hash() of name */
+	uint32_t crc;
+	uint32_t module;	/* index into the module names */
+	uint32_t export;
+};
+
+static struct {
+	void *map;
+	unsigned long size;
+	const struct symvers_bin_header *hdr;
+	const struct symvers_bin_sym *syms;
+	const uint32_t *table;
+	const char *strings;
+	struct module **mods;
+	unsigned int kernel;
+	unsigned int seq;	/* symbol->seq of the first entry */
+} symvers_bin;
+
+/* Give entry i the struct symbol read_dump() would have made for it */
+static struct symbol *symvers_bin_symbol(unsigned int i)
+{
+	const struct symvers_bin_sym *e = &symvers_bin.syms[i];
+	struct module *mod = symvers_bin.mods[e->module];
+	struct symbol *s;
+
+	s = insert_symbol(symvers_bin.strings + e->name, e->hash,
+			  symvers_bin.seq + i, mod, e->export);
+	s->vmlinux   = is_vmlinux(mod->name);
+	s->kernel    = symvers_bin.kernel;
+	s->preloaded = 1;
+	s->crc       = e->crc;
+	s->crc_valid = 1;
+	return s;
+}
+
+/* Only called for names not in symbolhash yet */
+static struct symbol *symvers_bin_lookup(const char *name, unsigned int hash)
+{
+	const struct symvers_bin_sym *e;
+	unsigned int i, n, mask;
+
+	if (!symvers_bin.map)
+		return NULL;
+
+	mask = symvers_bin.hdr->table_size - 1;
+	for (i = hash & mask; (n = symvers_bin.table[i]); i = (i + 1) & mask) {
+		e = &symvers_bin.syms[n - 1];
+		if (e->hash == hash &&
+		    strcmp(symvers_bin.strings + e->name, name) == 0)
+			return symvers_bin_symbol(n - 1);
+	}
+	return NULL;
+}
+
+/* Make a struct symbol for every entry that has none yet */
+static void symvers_bin_load_all(void)
+{
+	const struct symvers_bin_sym *e;
+	unsigned int i;
+
+	if (!symvers_bin.map)
+		return;
+
+	for (i = 0; i < symvers_bin.hdr->nr_syms; i++) {
+		e = &symvers_bin.syms[i];
+		if (!nr_symbols ||
+		    !*symbol_slot(symbolhash, symbolhash_size,
+				  symvers_bin.strings + e->name, e->hash))
+			symvers_bin_symbol(i);
+	}
+}
+
 static struct symbol *find_symbol(const char *name)
 {
 	struct symbol *s;
+	unsigned int hash;
 
 	/* For our purposes, .foo matches foo.  PPC64 needs this. */
 	if (name[0] == '.')
 		name++;
 
-	for (s = symbolhash[tdb_hash(name) % SYMBOL_HASH_SIZE]; s; s = s->next) {
-		if (strcmp(s->name, name) == 0)
+	hash = name_hash(name);
+	if (nr_symbols) {
+		s = *symbol_slot(symbolhash, symbolhash_size, name, hash);
+		if (s)
 			return s;
 	}
-	return NULL;
+	return symvers_bin_lookup(name, hash);
 }
 
 static const struct {
@@ -342,6 +596,86 @@ static void sym_update_crc(const char *name, struct module *mod,
 	s->crc_valid = 1;
 }
 
+/*
+ * An object file being read, see read_symbols().  Its exports and CRCs
+ * only go into the symbol hash once every file has been read, in the
+ * order they were given, so they are kept here until then along with
+ * how much of the module's diagnostics came before each one.
+ */
+struct deferred_export {
+	struct deferred_export *next;
+	long diag_pos;
+	int is_crc;
+	unsigned int crc;
+	enum export export;
+	char name[0];
+};
+
+/* What the module cache knows about a file: FILE_ABSENT if there is none */
+struct file_key {
+	uint64_t size;
+	uint64_t mtime_sec;
+	uint64_t mtime_nsec;
+};
+
+#define FILE_ABSENT	(~(uint64_t)0)
+
+struct cached_obj;
+
+struct objfile {
+	const char *filename;
+	struct module *mod;		/* NULL if there was nothing to read */
+	int is_vmlinux;
+	struct deferred_export *exports, **exports_tail;
+
+	/* for the module cache */
+	struct cached_obj *cached;	/* last run's entry, if any */
+	int cache_fresh;		/* object has the same size and time */
+	int src_fresh;			/* so have all srcversion inputs */
+	struct file_key key;
+	uint64_t content_hash;
+	unsigned int sec_mismatches;
+	int want_srcversion;
+	long src_diag_pos;		/* where get_src_version() output starts */
+	struct buffer src_inputs;	/* files get_src_version() read */
+	struct buffer record;		/* cache entry, less the .mod.c part */
+	uint64_t modc_key;		/* see modc_key() */
+	struct file_key modc_file;
+	int modc_err;
+	char *modc_diag;
+};
+
+static void count_sec_mismatch(void)
+{
+	__sync_fetch_and_add(&sec_mismatch_count, 1);
+	obj_sec_mismatches++;
+}
+
+static void add_deferred_export(struct objfile *obj, const char *name,
+				int is_crc, unsigned int crc,
+				enum export export, long diag_pos)
+{
+	struct deferred_export *e;
+
+	e = NOFAIL(malloc(sizeof(*e) + strlen(name) + 1));
+	e->next = NULL;
+	e->diag_pos = diag_pos;
+	e->is_crc = is_crc;
+	e->crc = crc;
+	e->export = export;
+	strcpy(e->name, name);
+
+	*obj->exports_tail = e;
+	obj->exports_tail = &e->next;
+}
+
+static void defer_export(struct objfile *obj, const char *name, int is_crc,
+			 unsigned int crc, enum export export)
+{
+	add_deferred_export(obj, name, is_crc, crc, export,
+			    diag_file ? ftell(diag_file) : 0);
+}
+
 void *grab_file(const char *filename, unsigned long *size)
 {
 	struct stat st;
@@ -371,7 +705,7 @@ failed:
   **/
 char *get_next_line(unsigned long *pos, void *file, unsigned long size)
 {
-	static char line[4096];
+	static __thread char line[4096];
 	int skip = 1;
 	size_t len = 0;
 	signed char *p = (signed char *)file + *pos;
@@ -415,7 +749,7 @@ static int parse_elf(struct elf_info *info, const char *filename)
 	hdr = grab_file(filename, &info->size);
 	if (!hdr) {
 		if (ignore_missing_files) {
-			fprintf(stderr, "%s: %s (ignored)\n", filename,
+			fprintf(diag(), "%s: %s (ignored)\n", filename,
 				strerror(errno));
 			return 0;
 		}
@@ -569,6 +903,8 @@ static int parse_elf(struct elf_info *info, const char *filename)
 
 static void parse_elf_finish(struct elf_info *info)
 {
+	free(info->sym_index);
+	free(info->sec_by_name);
 	release_file(info->hdr, info->size);
 }
 
@@ -604,9 +940,10 @@ static int ignore_undef_symbol(struct elf_info *info, const char *symname)
 #define CRC_PFX     VMLINUX_SYMBOL_STR(__crc_)
 #define KSYMTAB_PFX VMLINUX_SYMBOL_STR(__ksymtab_)
 
-static void handle_modversions(struct module *mod, struct elf_info *info,
+static void handle_modversions(struct objfile *obj, struct elf_info *info,
 			       Elf_Sym *sym, const char *symname)
 {
+	struct module *mod = obj->mod;
 	unsigned int crc;
 	enum export export;
 
@@ -619,8 +956,7 @@ static void handle_modversions(struct module *mod, struct elf_info *info,
 	/* CRC'd symbol */
 	if (strncmp(symname, CRC_PFX, strlen(CRC_PFX)) == 0) {
 		crc = (unsigned int) sym->st_value;
-		sym_update_crc(symname + strlen(CRC_PFX), mod, crc,
-				export);
+		defer_export(obj, symname + strlen(CRC_PFX), 1, crc, export);
 	}
 
 	switch (sym->st_shndx) {
@@ -670,8 +1006,8 @@ static void handle_modversions(struct module *mod, struct elf_info *info,
 	default:
 		/* All exported symbols */
 		if (strncmp(symname, KSYMTAB_PFX, strlen(KSYMTAB_PFX)) == 0) {
-			sym_add_exported(symname + strlen(KSYMTAB_PFX), mod,
-					export);
+			defer_export(obj, symname + strlen(KSYMTAB_PFX), 0, 0,
+				     export);
 		}
 		if (strcmp(symname, VMLINUX_SYMBOL_STR(init_module)) == 0)
 			mod->has_init = 1;
@@ -1253,43 +1589,166 @@ static inline int is_valid_name(struct elf_info *elf, Elf_Sym *sym)
 	return !is_arm_mapping_symbol(name);
 }
 
+/*
+ * The section mismatch checks look up the symbol nearest an address
+ * for every suspect relocation.  Rather than scan the whole symbol table
+ * each time, the symbols with a valid name are sorted once by section,
+ * then address, then position in the symbol table, so a lookup is a
+ * binary search.  The index is only built once a lookup needs it.
+ */
+struct elf_sym_entry {
+	unsigned int secindex;
+	Elf_Addr value;
+	Elf_Sym *sym;
+};
+
+struct elf_sec_name {
+	const char *name;
+	unsigned int secindex;
+};
+
+static int cmp_sym_entry(const void *a, const void *b)
+{
+	const struct elf_sym_entry *x = a, *y = b;
+
+	if (x->secindex != y->secindex)
+		return x->secindex < y->secindex ? -1 : 1;
+	if (x->value != y->value)
+		return x->value < y->value ? -1 : 1;
+	return x->sym < y->sym ? -1 : x->sym > y->sym;
+}
+
+static int cmp_sec_name(const void *a, const void *b)
+{
+	const struct elf_sec_name *x = a, *y = b;
+	int r = strcmp(x->name, y->name);
+
+	if (r)
+		return r;
+	return x->secindex < y->secindex ? -1 : x->secindex > y->secindex;
+}
+
+static void index_elf_symbols(struct elf_info *elf)
+{
+	struct elf_sym_entry *e;
+	Elf_Sym *sym;
+	unsigned int i;
+
+	e = elf->sym_index = NOFAIL(malloc((elf->symtab_stop -
+					    elf->symtab_start + 1) *
+					   sizeof(*e)));
+	for (sym = elf->symtab_start; sym < elf->symtab_stop; sym++) {
+		if (!is_valid_name(elf, sym))
+			continue;
+		e->secindex = get_secindex(elf, sym);
+		e->value = sym->st_value;
+		e->sym = sym;
+		e++;
+	}
+	elf->nr_sym_index = e - elf->sym_index;
+	qsort(elf->sym_index, elf->nr_sym_index, sizeof(*e), cmp_sym_entry);
+
+	elf->sec_by_name = NOFAIL(malloc((elf->num_sections + 1) *
+					 sizeof(*elf->sec_by_name)));
+	for (i = 0; i < elf->num_sections; i++) {
+		elf->sec_by_name[i].name = sec_name(elf, i);
+		elf->sec_by_name[i].secindex = i;
+	}
+	qsort(elf->sec_by_name, elf->num_sections,
+	      sizeof(*elf->sec_by_name), cmp_sec_name);
+}
+
+/* First entry at or after (secindex, value) */
+static struct elf_sym_entry *sym_index_lower(struct elf_info *elf,
+					     unsigned int secindex,
+					     Elf_Addr value)
+{
+	unsigned int lo = 0, hi = elf->nr_sym_index, mid;
+	struct elf_sym_entry *e;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		e = &elf->sym_index[mid];
+		if (e->secindex < secindex ||
+		    (e->secindex == secindex && e->value < value))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return &elf->sym_index[lo];
+}
+
+/* Entries in secindex with a value in [lo, hi], in order */
+#define for_each_sym_in_range(elf, e, sec, lo, hi)			\
+	for ((e) = sym_index_lower(elf, sec, lo);			\
+	     (e) < (elf)->sym_index + (elf)->nr_sym_index &&		\
+	     (e)->secindex == (sec) && (e)->value <= (hi); (e)++)
+
+static void find_near_symbol(struct elf_info *elf, unsigned int secindex,
+			     Elf_Addr lo, Elf_Addr hi, Elf64_Sword addr,
+			     Elf64_Sword *distance, Elf_Sym **near)
+{
+	struct elf_sym_entry *e;
+	Elf64_Sword d;
+
+	for_each_sym_in_range(elf, e, secindex, lo, hi) {
+		if (ELF_ST_TYPE(e->sym->st_info) == STT_SECTION)
+			continue;
+		d = e->sym->st_value - addr;
+		if (d < 0)
+			d = addr - e->sym->st_value;
+		if (d < *distance ||
+		    (d == *distance && *near && e->sym < *near)) {
+			*distance = d;
+			*near = e->sym;
+		}
+	}
+}
+
 /**
  * Find symbol based on relocation record info.
  * In some cases the symbol supplied is a valid symbol so
  * return refsym. If st_name != 0 we assume this is a valid symbol.
  * In other cases the symbol needs to be looked up in the symbol table
  * based on section and address.
+ * Of several symbols at addr, or equally near it, the first one in the
+ * symbol table wins.
  *  **/
 static Elf_Sym *find_elf_symbol(struct elf_info *elf, Elf64_Sword addr,
 				Elf_Sym *relsym)
 {
-	Elf_Sym *sym;
+	struct elf_sym_entry *e;
 	Elf_Sym *near = NULL;
 	Elf64_Sword distance = 20;
-	Elf64_Sword d;
+	Elf_Addr lo, hi;
 	unsigned int relsym_secindex;
 
 	if (relsym->st_name != 0)
 		return relsym;
 
+	if (!elf->sym_index)
+		index_elf_symbols(elf);
+
 	relsym_secindex = get_secindex(elf, relsym);
-	for (sym = elf->symtab_start; sym < elf->symtab_stop; sym++) {
-		if (get_secindex(elf, sym) != relsym_secindex)
-			continue;
-		if (ELF_ST_TYPE(sym->st_info) == STT_SECTION)
+	for_each_sym_in_range(elf, e, relsym_secindex, (Elf_Addr)addr,
+			      (Elf_Addr)addr) {
+		if (ELF_ST_TYPE(e->sym->st_info) == STT_SECTION)
 			continue;
-		if (!is_valid_name(elf, sym))
-			continue;
-		if (sym->st_value == addr)
-			return sym;
-		/* Find a symbol nearby - addr are maybe negative */
-		d = sym->st_value - addr;
-		if (d < 0)
-			d = addr - sym->st_value;
-		if (d < distance) {
-			distance = d;
-			near = sym;
-		}
+		if (e->sym->st_value == addr)
+			return e->sym;
+	}
+
+	/* Find a symbol nearby - addr are maybe negative, so may wrap */
+	lo = addr - 19;
+	hi = addr + 19;
+	if (lo <= hi) {
+		find_near_symbol(elf, relsym_secindex, lo, hi, addr,
+				 &distance, &near);
+	} else {
+		find_near_symbol(elf, relsym_secindex, lo, ~(Elf_Addr)0, addr,
+				 &distance, &near);
+		find_near_symbol(elf, relsym_secindex, 0, hi, addr,
+				 &distance, &near);
 	}
 	/* We need a close match */
 	if (distance < 20)
@@ -1303,32 +1762,46 @@ static Elf_Sym *find_elf_symbol(struct elf_info *elf, Elf64_Sword addr,
  * If we find two symbols with equal offset prefer one with a valid name.
  * The ELF format may have a better way to detect what type of symbol
  * it is, but this works for now.
+ * Of several symbols at the same offset the last one in the symbol
+ * table wins, whichever of the sections called sec it is in.
  **/
 static Elf_Sym *find_elf_symbol2(struct elf_info *elf, Elf_Addr addr,
 				 const char *sec)
 {
-	Elf_Sym *sym;
+	struct elf_sec_name *n, *end;
+	struct elf_sym_entry *e, *first;
 	Elf_Sym *near = NULL;
-	Elf_Addr distance = ~0;
-
-	for (sym = elf->symtab_start; sym < elf->symtab_stop; sym++) {
-		const char *symsec;
+	unsigned int lo, hi, mid;
+
+	if (!elf->sym_index)
+		index_elf_symbols(elf);
+
+	/* find the sections called sec */
+	lo = 0;
+	hi = elf->num_sections;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strcmp(elf->sec_by_name[mid].name, sec) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-		if (is_shndx_special(sym->st_shndx))
-			continue;
-		symsec = sec_name(elf, get_secindex(elf, sym));
-		if (strcmp(symsec, sec) != 0)
-			continue;
-		if (!is_valid_name(elf, sym))
+	end = elf->sec_by_name + elf->num_sections;
+	for (n = elf->sec_by_name + lo; n < end && !strcmp(n->name, sec); n++) {
+		/* the last symbol in the section at or before addr */
+		first = sym_index_lower(elf, n->secindex, 0);
+		e = sym_index_lower(elf, n->secindex, addr);
+		while (e < elf->sym_index + elf->nr_sym_index &&
+		       e->secindex == n->secindex && e->value == addr)
+			e++;
+		if (e == first)
 			continue;
-		if (sym->st_value <= addr) {
-			if ((addr - sym->st_value) < distance) {
-				distance = addr - sym->st_value;
-				near = sym;
-			} else if ((addr - sym->st_value) == distance) {
-				near = sym;
-			}
-		}
+		e--;
+
+		if (!near || e->value > near->st_value ||
+		    (e->value == near->st_value && e->sym > near))
+			near = e->sym;
 	}
 	return near;
 }
@@ -1382,12 +1855,12 @@ static void print_section_list(const char * const list[20])
 	const char *const *s = list;
 
 	while (*s) {
-		fprintf(stderr, "%s", *s);
+		fprintf(diag(), "%s", *s);
 		s++;
 		if (*s)
-			fprintf(stderr, ", ");
+			fprintf(diag(), ", ");
 	}
-	fprintf(stderr, "\n");
+	fprintf(diag(), "\n");
 }
 
 static inline void get_pretty_name(int is_func, const char** name, const char** name_p)
@@ -1418,7 +1891,7 @@ static void report_sec_mismatch(const char *modname,
 	char *prl_from;
 	char *prl_to;
 
-	sec_mismatch_count++;
+	count_sec_mismatch();
 	if (!sec_mismatch_verbose)
 		return;
 
@@ -1434,7 +1907,7 @@ static void report_sec_mismatch(const char *modname,
 	case TEXT_TO_ANY_INIT:
 		prl_from = sec2annotation(fromsec);
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The function %s%s() references\n"
 		"the %s %s%s%s.\n"
 		"This is often because %s lacks a %s\n"
@@ -1447,7 +1920,7 @@ static void report_sec_mismatch(const char *modname,
 		break;
 	case DATA_TO_ANY_INIT: {
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The variable %s references\n"
 		"the %s %s%s%s\n"
 		"If the reference is valid then annotate the\n"
@@ -1460,7 +1933,7 @@ static void report_sec_mismatch(const char *modname,
 	}
 	case TEXT_TO_ANY_EXIT:
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The function %s() references a %s in an exit section.\n"
 		"Often the %s %s%s has valid usage outside the exit section\n"
 		"and the fix is to remove the %sannotation of %s.\n",
@@ -1469,7 +1942,7 @@ static void report_sec_mismatch(const char *modname,
 		break;
 	case DATA_TO_ANY_EXIT: {
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The variable %s references\n"
 		"the %s %s%s%s\n"
 		"If the reference is valid then annotate the\n"
@@ -1484,7 +1957,7 @@ static void report_sec_mismatch(const char *modname,
 	case XXXEXIT_TO_SOME_EXIT:
 		prl_from = sec2annotation(fromsec);
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The %s %s%s%s references\n"
 		"a %s %s%s%s.\n"
 		"If %s is only used by %s then\n"
@@ -1498,7 +1971,7 @@ static void report_sec_mismatch(const char *modname,
 	case ANY_INIT_TO_ANY_EXIT:
 		prl_from = sec2annotation(fromsec);
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The %s %s%s%s references\n"
 		"a %s %s%s%s.\n"
 		"This is often seen when error handling "
@@ -1515,7 +1988,7 @@ static void report_sec_mismatch(const char *modname,
 	case ANY_EXIT_TO_ANY_INIT:
 		prl_from = sec2annotation(fromsec);
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The %s %s%s%s references\n"
 		"a %s %s%s%s.\n"
 		"This is often seen when error handling "
@@ -1531,7 +2004,7 @@ static void report_sec_mismatch(const char *modname,
 		break;
 	case EXPORT_TO_INIT_EXIT:
 		prl_to = sec2annotation(tosec);
-		fprintf(stderr,
+		fprintf(diag(),
 		"The symbol %s is exported and annotated %s\n"
 		"Fix this by removing the %sannotation of %s "
 		"or drop the export.\n",
@@ -1543,7 +2016,7 @@ static void report_sec_mismatch(const char *modname,
 		      "we should never get here.");
 		break;
 	}
-	fprintf(stderr, "\n");
+	fprintf(diag(), "\n");
 }
 
 static void default_mismatch_handler(const char *modname, struct elf_info *elf,
@@ -1588,8 +2061,9 @@ static int is_executable_section(struct elf_info* elf, unsigned int section_inde
 /*
  * We rely on a gross hack in section_rel[a]() calling find_extable_entry_size()
  * to know the sizeof(struct exception_table_entry) for the target architecture.
+ * Each thread finds it for itself; all modules are for the same architecture.
  */
-static unsigned int extable_entry_size = 0;
+static __thread unsigned int extable_entry_size = 0;
 static void find_extable_entry_size(const char* const sec, const Elf_Rela* r)
 {
 	/*
@@ -1649,7 +2123,7 @@ static void report_extable_warnings(const char* modname, struct elf_info* elf,
 
 	if (!match(tosec, mismatch->bad_tosec) &&
 	    is_executable_section(elf, get_secindex(elf, sym)))
-		fprintf(stderr,
+		fprintf(diag(),
 			"The relocation at %s+0x%lx references\n"
 			"section \"%s\" which is not in the list of\n"
 			"authorized sections.  If you're adding a new section\n"
@@ -1667,7 +2141,7 @@ static void extable_mismatch_handler(const char* modname, struct elf_info *elf,
 {
 	const char* tosec = sec_name(elf, get_secindex(elf, sym));
 
-	sec_mismatch_count++;
+	count_sec_mismatch();
 
 	if (sec_mismatch_verbose)
 		report_extable_warnings(modname, elf, mismatch, r, sym,
@@ -1957,60 +2431,577 @@ static char *remove_dot(char *s)
 	return s;
 }
 
-static void read_symbols(char *modname)
+/* Read one object file; this runs in parallel with the others */
+/*
+ * The module cache (-c file) keeps, for each object read, what
+ * read_symbols() found in it, what get_src_version() made of which files,
+ * and what the .mod.c was last written from, so that an incremental
+ * build only does the work for what changed:
+ *
+ *  - an object is not read again while its size and modification time
+ *    stay the same, or failing that its contents still hash the same;
+ *  - a srcversion is reused while none of the files it was computed
+ *    from changed size or time, even if the object did;
+ *  - a .mod.c is not generated again while it is still there as written
+ *    and its object, its srcversion and what each symbol it uses
+ *    resolves to (module and CRC) are all the same.
+ *
+ * The warnings each step printed are kept too and printed again.  All of
+ * it is dropped when modpost itself or an option that affects reading an
+ * object changes.  The file is in host byte order.
+ */
+#define CACHE_MAGIC	0x4343504d	/* "MPCC" little-endian */
+#define CACHE_VERSION	1
+#define CACHE_HASH_INIT	0xcbf29ce484222325ULL
+
+static uint64_t cache_hash(uint64_t h, const void *p, unsigned long len)
+{
+	const unsigned char *c = p;
+	uint64_t w;
+
+	for (; len >= sizeof(w); c += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, c, sizeof(w));
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+		h ^= h >> 32;
+	}
+	while (len--)
+		h = (h ^ *c++) * 0x100000001b3ULL;
+	return h;
+}
+
+static void get_file_key(const char *fname, struct file_key *k)
 {
-	const char *symname;
-	char *version;
-	char *license;
-	struct module *mod;
-	struct elf_info info = { };
-	Elf_Sym *sym;
+	struct stat st;
 
-	if (!parse_elf(&info, modname))
+	if (stat(fname, &st) < 0) {
+		k->size = FILE_ABSENT;
+		k->mtime_sec = k->mtime_nsec = 0;
 		return;
+	}
+	k->size = st.st_size;
+	k->mtime_sec = st.st_mtim.tv_sec;
+	k->mtime_nsec = st.st_mtim.tv_nsec;
+}
 
-	mod = new_module(modname);
+static int same_file_key(const struct file_key *a, const struct file_key *b)
+{
+	return a->size == b->size && a->mtime_sec == b->mtime_sec &&
+	       a->mtime_nsec == b->mtime_nsec;
+}
 
-	/* When there's no vmlinux, don't print warnings about
-	 * unresolved symbols (since there'll be too many ;) */
-	if (is_vmlinux(modname)) {
-		have_vmlinux = 1;
-		mod->skip = 1;
-	}
+/*
+ * The modules of a tree share most of their headers, so each file is
+ * only looked at once per run.  Not thread safe, only used between the
+ * parallel parts.
+ */
+struct stat_memo {
+	char *name;
+	unsigned int hash;
+	struct file_key key;
+};
 
-	license = get_modinfo(info.modinfo, info.modinfo_len, "license");
-	if (info.modinfo && !license && !is_vmlinux(modname))
-		warn("modpost: missing MODULE_LICENSE() in %s\n"
-		     "see include/linux/module.h for "
-		     "more information\n", modname);
-	while (license) {
-		if (license_is_gpl_compatible(license))
-			mod->gpl_compatible = 1;
-		else {
-			mod->gpl_compatible = 0;
+static struct stat_memo *stat_memo;
+static unsigned int stat_memo_size, nr_stat_memo;
+
+static struct stat_memo *stat_memo_slot(struct stat_memo *table,
+					unsigned int size, const char *fname,
+					unsigned int hash)
+{
+	unsigned int i;
+
+	for (i = hash & (size - 1); table[i].name; i = (i + 1) & (size - 1))
+		if (table[i].hash == hash && strcmp(table[i].name, fname) == 0)
 			break;
-		}
-		license = get_next_modinfo(info.modinfo, info.modinfo_len,
-					   "license", license);
+	return &table[i];
+}
+
+static const struct file_key *memo_file_key(const char *fname)
+{
+	struct stat_memo *old = stat_memo, *m;
+	unsigned int i, old_size = stat_memo_size;
+	unsigned int hash = name_hash(fname);
+
+	if (hash_full(nr_stat_memo, stat_memo_size)) {
+		stat_memo_size = old_size ? old_size * 2 : HASH_MIN_SIZE;
+		stat_memo = NOFAIL(calloc(stat_memo_size, sizeof(*stat_memo)));
+		for (i = 0; i < old_size; i++)
+			if (old[i].name)
+				*stat_memo_slot(stat_memo, stat_memo_size,
+						old[i].name, old[i].hash) = old[i];
+		free(old);
 	}
 
-	for (sym = info.symtab_start; sym < info.symtab_stop; sym++) {
-		symname = remove_dot(info.strtab + sym->st_name);
+	m = stat_memo_slot(stat_memo, stat_memo_size, fname, hash);
+	if (!m->name) {
+		m->name = NOFAIL(strdup(fname));
+		m->hash = hash;
+		get_file_key(fname, &m->key);
+		nr_stat_memo++;
+	}
+	return &m->key;
+}
 
-		handle_modversions(mod, &info, sym, symname);
-		handle_moddevtable(mod, &info, sym, symname);
+/* Writing cache entries */
+static void cache_put(struct buffer *b, const void *p, unsigned long len)
+{
+	if (!len)
+		return;
+	if (b->size - b->pos < len) {
+		b->size = (b->pos + len) * 2;
+		b->p = NOFAIL(realloc(b->p, b->size));
 	}
-	if (!is_vmlinux(modname) ||
-	     (is_vmlinux(modname) && vmlinux_section_warnings))
-		check_sec_ref(mod, modname, &info);
+	memcpy(b->p + b->pos, p, len);
+	b->pos += len;
+}
 
-	version = get_modinfo(info.modinfo, info.modinfo_len, "version");
-	if (version)
-		maybe_frob_rcs_version(modname, version, info.modinfo,
+static void cache_put_u32(struct buffer *b, uint32_t v)
+{
+	cache_put(b, &v, sizeof(v));
+}
+
+static void cache_put_u64(struct buffer *b, uint64_t v)
+{
+	cache_put(b, &v, sizeof(v));
+}
+
+static void cache_put_key(struct buffer *b, const struct file_key *k)
+{
+	cache_put_u64(b, k->size);
+	cache_put_u64(b, k->mtime_sec);
+	cache_put_u64(b, k->mtime_nsec);
+}
+
+/* Length, bytes and a NUL, so that text comes back as a C string */
+static void cache_put_mem(struct buffer *b, const char *p, unsigned long len)
+{
+	cache_put_u32(b, len);
+	cache_put(b, p, len);
+	cache_put(b, "", 1);
+}
+
+static void cache_put_str(struct buffer *b, const char *s)
+{
+	cache_put_mem(b, s, strlen(s));
+}
+
+/* Reading them back; once anything is out of bounds, bad is set and
+ * everything after reads as zero */
+struct cache_cursor {
+	const char *p, *end;
+	int bad;
+};
+
+static void cache_get(struct cache_cursor *c, void *p, unsigned long len)
+{
+	if (c->bad || c->end - c->p < len) {
+		c->bad = 1;
+		memset(p, 0, len);
+		return;
+	}
+	memcpy(p, c->p, len);
+	c->p += len;
+}
+
+static uint32_t cache_get_u32(struct cache_cursor *c)
+{
+	uint32_t v;
+
+	cache_get(c, &v, sizeof(v));
+	return v;
+}
+
+static uint64_t cache_get_u64(struct cache_cursor *c)
+{
+	uint64_t v;
+
+	cache_get(c, &v, sizeof(v));
+	return v;
+}
+
+static void cache_get_key(struct cache_cursor *c, struct file_key *k)
+{
+	k->size = cache_get_u64(c);
+	k->mtime_sec = cache_get_u64(c);
+	k->mtime_nsec = cache_get_u64(c);
+}
+
+static const char *cache_get_mem(struct cache_cursor *c, uint32_t *lenp)
+{
+	uint32_t len = cache_get_u32(c);
+	const char *p = c->p;
+
+	if (c->bad || c->end - c->p <= len || p[len] != '\0') {
+		c->bad = 1;
+		len = 0;
+		p = "";
+	} else {
+		c->p += len + 1;
+	}
+	if (lenp)
+		*lenp = len;
+	return p;
+}
+
+static const char *cache_get_str(struct cache_cursor *c)
+{
+	return cache_get_mem(c, NULL);
+}
+
+/*
+ * An entry, pointing into the mapped cache file.  The lists are only
+ * walked to check them here and again when the object is restored.
+ */
+struct cached_obj {
+	const char *record;
+	uint32_t record_len;
+	int used;			/* given again this run */
+
+	const char *filename;
+	unsigned int hash;		/* name_hash() of filename */
+	struct file_key key;
+	uint64_t content_hash;
+	int gpl_compatible;
+	int has_init, has_cleanup;
+	int want_srcversion;
+	unsigned int sec_mismatches;
+	const char *devtable;
+	uint32_t devtable_len;
+	const char *diag;
+	uint32_t diag_len;
+	struct cache_cursor unres, exports, inputs;
+	uint32_t nr_unres, nr_exports, nr_inputs;
+	const char *srcversion, *src_diag;
+	uint64_t modc_key;
+	struct file_key modc_file;
+	int modc_err;
+	const char *modc_diag;
+};
+
+static void *cache_map;
+static unsigned long cache_map_size;
+static struct cached_obj *cache_objs;
+static unsigned int nr_cache_objs;
+static struct cached_obj **cache_slots;
+static unsigned int cache_slots_size;
+
+/* Everything other than the objects a run's results depend on */
+static uint64_t cache_config(void)
+{
+	struct file_key self;
+	const char *modverdir = getenv("MODVERDIR");
+	int flags[] = {
+		modversions, all_versions, vmlinux_section_warnings,
+		sec_mismatch_verbose,
+	};
+	uint64_t h = CACHE_HASH_INIT;
+
+	get_file_key("/proc/self/exe", &self);
+	h = cache_hash(h, &self, sizeof(self));
+	h = cache_hash(h, flags, sizeof(flags));
+	if (modverdir)
+		h = cache_hash(h, modverdir, strlen(modverdir));
+	return h;
+}
+
+static int parse_cached_obj(struct cache_cursor *c, struct cached_obj *e)
+{
+	uint32_t i, len;
+
+	e->filename = cache_get_str(c);
+	e->hash = name_hash(e->filename);
+	cache_get_key(c, &e->key);
+	e->content_hash = cache_get_u64(c);
+	e->gpl_compatible = cache_get_u32(c);
+	e->has_init = cache_get_u32(c);
+	e->has_cleanup = cache_get_u32(c);
+	e->want_srcversion = cache_get_u32(c);
+	e->sec_mismatches = cache_get_u32(c);
+	e->devtable = cache_get_mem(c, &e->devtable_len);
+	e->diag = cache_get_mem(c, &e->diag_len);
+
+	e->nr_unres = cache_get_u32(c);
+	e->unres = *c;
+	for (i = 0; i < e->nr_unres && !c->bad; i++) {
+		cache_get_str(c);
+		cache_get_u32(c);
+	}
+
+	e->nr_exports = cache_get_u32(c);
+	e->exports = *c;
+	for (i = 0; i < e->nr_exports && !c->bad; i++) {
+		cache_get_str(c);
+		cache_get_u32(c);
+		cache_get_u32(c);
+		if (cache_get_u32(c) > export_unknown ||
+		    cache_get_u64(c) > e->diag_len)
+			return 0;
+	}
+
+	e->srcversion = cache_get_mem(c, &len);
+	if (len >= sizeof(((struct module *)0)->srcversion))
+		return 0;
+	e->src_diag = cache_get_str(c);
+	e->nr_inputs = cache_get_u32(c);
+	e->inputs = *c;
+	for (i = 0; i < e->nr_inputs && !c->bad; i++) {
+		struct file_key k;
+
+		cache_get_str(c);
+		cache_get_key(c, &k);
+	}
+
+	e->modc_key = cache_get_u64(c);
+	cache_get_key(c, &e->modc_file);
+	e->modc_err = cache_get_u32(c);
+	e->modc_diag = cache_get_str(c);
+
+	return !c->bad && c->p == c->end;
+}
+
+static struct cached_obj **cache_slot(const char *fname, unsigned int hash)
+{
+	unsigned int i, mask = cache_slots_size - 1;
+
+	for (i = hash & mask; cache_slots[i]; i = (i + 1) & mask)
+		if (cache_slots[i]->hash == hash &&
+		    strcmp(cache_slots[i]->filename, fname) == 0)
+			break;
+	return &cache_slots[i];
+}
+
+/* Load last run's entries; a cache that doesn't fit is ignored */
+static void read_cache(void)
+{
+	struct cache_cursor c;
+	struct cached_obj *e;
+	unsigned int i, n;
+
+	cache_map = grab_file(cache_name, &cache_map_size);
+	if (!cache_map)
+		return;
+
+	c.p = cache_map;
+	c.end = c.p + cache_map_size;
+	c.bad = 0;
+	if (cache_get_u32(&c) != CACHE_MAGIC ||
+	    cache_get_u32(&c) != CACHE_VERSION ||
+	    cache_get_u64(&c) != cache_config())
+		goto drop;
+
+	n = cache_get_u32(&c);
+	if (c.bad || n > cache_map_size)
+		goto drop;
+	cache_objs = NOFAIL(calloc(n + 1, sizeof(*cache_objs)));
+	for (cache_slots_size = 1; cache_slots_size <= 2 * n; )
+		cache_slots_size <<= 1;
+	cache_slots = NOFAIL(calloc(cache_slots_size, sizeof(*cache_slots)));
+
+	for (i = 0; i < n; i++) {
+		struct cache_cursor r;
+
+		e = &cache_objs[i];
+		e->record_len = cache_get_u32(&c);
+		if (c.bad || c.end - c.p < e->record_len)
+			goto drop;
+		e->record = c.p;
+		r.p = c.p;
+		r.end = c.p += e->record_len;
+		r.bad = 0;
+		if (!parse_cached_obj(&r, e))
+			goto drop;
+		/* a later entry for the same file wins */
+		*cache_slot(e->filename, e->hash) = e;
+	}
+	nr_cache_objs = n;
+	return;
+
+drop:
+	free(cache_objs);
+	free(cache_slots);
+	cache_objs = NULL;
+	cache_slots = NULL;
+	cache_slots_size = 0;
+	release_file(cache_map, cache_map_size);
+	cache_map = NULL;
+}
+
+/* Match obj against the cache before the objects are read in parallel */
+static void cache_check(struct objfile *obj)
+{
+	struct cached_obj *e;
+	struct cache_cursor c;
+	struct file_key k;
+	uint32_t i;
+
+	if (!cache_slots_size)
+		return;
+	e = *cache_slot(obj->filename, name_hash(obj->filename));
+	if (!e)
+		return;
+
+	e->used = 1;
+	obj->cached = e;
+	get_file_key(obj->filename, &obj->key);
+	obj->cache_fresh = obj->key.size != FILE_ABSENT &&
+			   same_file_key(&obj->key, &e->key);
+
+	obj->src_fresh = 1;
+	c = e->inputs;
+	for (i = 0; i < e->nr_inputs; i++) {
+		const char *fname = cache_get_str(&c);
+
+		cache_get_key(&c, &k);
+		if (!same_file_key(&k, memo_file_key(fname)))
+			obj->src_fresh = 0;
+	}
+}
+
+static void read_srcversion(struct objfile *obj)
+{
+	struct module *mod = obj->mod;
+
+	obj->src_diag_pos = diag_file ? ftell(diag_file) : 0;
+	if (!obj->want_srcversion)
+		return;
+
+	if (obj->cached && obj->cached->want_srcversion && obj->src_fresh) {
+		strcpy(mod->srcversion, obj->cached->srcversion);
+		fputs(obj->cached->src_diag, diag());
+		return;
+	}
+	obj->src_fresh = 0;
+	get_src_version(obj->filename, mod->srcversion,
+			sizeof(mod->srcversion) - 1,
+			cache_name ? &obj->src_inputs : NULL);
+}
+
+/* Do what read_symbols() would, from the cache entry */
+static void restore_cached_obj(struct objfile *obj)
+{
+	struct cached_obj *e = obj->cached;
+	struct cache_cursor c;
+	struct symbol **unres;
+	struct module *mod;
+	uint32_t i;
+
+	mod = obj->mod = alloc_module(obj->filename);
+	if (is_vmlinux(obj->filename)) {
+		obj->is_vmlinux = 1;
+		mod->skip = 1;
+	}
+	obj->content_hash = e->content_hash;
+	mod->gpl_compatible = e->gpl_compatible;
+	mod->has_init = e->has_init;
+	mod->has_cleanup = e->has_cleanup;
+	if (e->devtable_len) {
+		mod->dev_table_buf.p = NOFAIL(malloc(e->devtable_len));
+		memcpy(mod->dev_table_buf.p, e->devtable, e->devtable_len);
+		mod->dev_table_buf.pos = e->devtable_len;
+		mod->dev_table_buf.size = e->devtable_len;
+	}
+	fputs(e->diag, diag());
+
+	unres = &mod->unres;
+	c = e->unres;
+	for (i = 0; i < e->nr_unres; i++) {
+		const char *name = cache_get_str(&c);
+
+		*unres = alloc_symbol(name, cache_get_u32(&c), NULL);
+		unres = &(*unres)->next;
+	}
+
+	c = e->exports;
+	for (i = 0; i < e->nr_exports; i++) {
+		const char *name = cache_get_str(&c);
+		int is_crc = cache_get_u32(&c);
+		unsigned int crc = cache_get_u32(&c);
+		enum export export = cache_get_u32(&c);
+
+		add_deferred_export(obj, name, is_crc, crc, export,
+				    cache_get_u64(&c));
+	}
+
+	obj->sec_mismatches = e->sec_mismatches;
+	__sync_fetch_and_add(&sec_mismatch_count, e->sec_mismatches);
+
+	obj->want_srcversion = e->want_srcversion;
+	read_srcversion(obj);
+}
+
+static void read_symbols(struct objfile *obj)
+{
+	const char *modname = obj->filename;
+	const char *symname;
+	char *version;
+	char *license;
+	struct module *mod;
+	struct elf_info info = { };
+	Elf_Sym *sym;
+
+	obj->exports_tail = &obj->exports;
+	obj_sec_mismatches = 0;
+
+	if (obj->cached && obj->cache_fresh) {
+		restore_cached_obj(obj);
+		return;
+	}
+
+	if (!parse_elf(&info, modname))
+		return;
+
+	if (cache_name) {
+		obj->content_hash = cache_hash(CACHE_HASH_INIT, info.hdr,
+					       info.size);
+		if (obj->cached && obj->cached->key.size == info.size &&
+		    obj->cached->content_hash == obj->content_hash) {
+			parse_elf_finish(&info);
+			restore_cached_obj(obj);
+			return;
+		}
+	}
+
+	mod = obj->mod = alloc_module(modname);
+
+	/* When there's no vmlinux, don't print warnings about
+	 * unresolved symbols (since there'll be too many ;) */
+	if (is_vmlinux(modname)) {
+		obj->is_vmlinux = 1;
+		mod->skip = 1;
+	}
+
+	license = get_modinfo(info.modinfo, info.modinfo_len, "license");
+	if (info.modinfo && !license && !is_vmlinux(modname))
+		warn("modpost: missing MODULE_LICENSE() in %s\n"
+		     "see include/linux/module.h for "
+		     "more information\n", modname);
+	while (license) {
+		if (license_is_gpl_compatible(license))
+			mod->gpl_compatible = 1;
+		else {
+			mod->gpl_compatible = 0;
+			break;
+		}
+		license = get_next_modinfo(info.modinfo, info.modinfo_len,
+					   "license", license);
+	}
+
+	for (sym = info.symtab_start; sym < info.symtab_stop; sym++) {
+		symname = remove_dot(info.strtab + sym->st_name);
+
+		handle_modversions(obj, &info, sym, symname);
+		handle_moddevtable(mod, &info, sym, symname);
+	}
+	if (!is_vmlinux(modname) ||
+	     (is_vmlinux(modname) && vmlinux_section_warnings))
+		check_sec_ref(mod, modname, &info);
+
+	version = get_modinfo(info.modinfo, info.modinfo_len, "version");
+	if (version)
+		maybe_frob_rcs_version(modname, version, info.modinfo,
 				       version - (char *)info.hdr);
-	if (version || (all_versions && !is_vmlinux(modname)))
-		get_src_version(modname, mod->srcversion,
-				sizeof(mod->srcversion)-1);
+	obj->want_srcversion = version ||
+			       (all_versions && !is_vmlinux(modname));
+	read_srcversion(obj);
 
 	parse_elf_finish(&info);
 
@@ -2020,9 +3011,116 @@ static void read_symbols(char *modname)
 	 * important anyhow */
 	if (modversions)
 		mod->unres = alloc_symbol("module_layout", 0, mod->unres);
+
+	obj->sec_mismatches = obj_sec_mismatches;
+	if (cache_name)
+		get_file_key(modname, &obj->key);
 }
 
-static void read_symbols_from_files(const char *filename)
+/* The entry for obj, up to the .mod.c part, while merge_symbols() still
+ * has everything read_symbols() left */
+static void cache_record_obj(struct objfile *obj, const char *diag_text)
+{
+	struct module *mod = obj->mod;
+	struct buffer *b = &obj->record;
+	struct deferred_export *e;
+	struct symbol *s;
+	struct cache_cursor c;
+	struct file_key k;
+	const char *fname;
+	uint32_t i, n;
+
+	cache_put_str(b, obj->filename);
+	cache_put_key(b, &obj->key);
+	cache_put_u64(b, obj->content_hash);
+	cache_put_u32(b, mod->gpl_compatible);
+	cache_put_u32(b, mod->has_init);
+	cache_put_u32(b, mod->has_cleanup);
+	cache_put_u32(b, obj->want_srcversion);
+	cache_put_u32(b, obj->sec_mismatches);
+	cache_put_mem(b, mod->dev_table_buf.p, mod->dev_table_buf.pos);
+	cache_put_mem(b, diag_text, obj->src_diag_pos);
+
+	for (n = 0, s = mod->unres; s; s = s->next)
+		n++;
+	cache_put_u32(b, n);
+	for (s = mod->unres; s; s = s->next) {
+		cache_put_str(b, s->name);
+		cache_put_u32(b, s->weak);
+	}
+
+	for (n = 0, e = obj->exports; e; e = e->next)
+		n++;
+	cache_put_u32(b, n);
+	for (e = obj->exports; e; e = e->next) {
+		cache_put_str(b, e->name);
+		cache_put_u32(b, e->is_crc);
+		cache_put_u32(b, e->crc);
+		cache_put_u32(b, e->export);
+		cache_put_u64(b, e->diag_pos);
+	}
+
+	cache_put_str(b, mod->srcversion);
+	cache_put_str(b, diag_text + obj->src_diag_pos);
+	if (!obj->want_srcversion) {
+		cache_put_u32(b, 0);
+	} else if (obj->src_fresh) {
+		c = obj->cached->inputs;
+		cache_put_u32(b, obj->cached->nr_inputs);
+		for (i = 0; i < obj->cached->nr_inputs; i++) {
+			cache_put_str(b, cache_get_str(&c));
+			cache_get_key(&c, &k);
+			cache_put_key(b, &k);
+		}
+	} else {
+		for (n = 0, i = 0; i < obj->src_inputs.pos; n++)
+			i += strlen(obj->src_inputs.p + i) + 1;
+		cache_put_u32(b, n);
+		for (i = 0; i < obj->src_inputs.pos; i += strlen(fname) + 1) {
+			fname = obj->src_inputs.p + i;
+			cache_put_str(b, fname);
+			cache_put_key(b, memo_file_key(fname));
+		}
+	}
+	free(obj->src_inputs.p);
+}
+
+/*
+ * Add what read_symbols() found to the list of modules and the symbol
+ * hash, printing its diagnostics as it goes.  This is done for one file
+ * at a time, in order, so the outcome is the same as reading them one
+ * after the other.
+ */
+static void merge_symbols(struct objfile *obj, const char *diag_text)
+{
+	struct deferred_export *e, *next;
+	long printed = 0;
+
+	if (obj->mod) {
+		obj->mod->obj = obj;
+		add_module(obj->mod);
+		if (obj->is_vmlinux)
+			have_vmlinux = 1;
+		if (cache_name)
+			cache_record_obj(obj, diag_text);
+	}
+
+	for (e = obj->exports; e; e = next) {
+		next = e->next;
+		fwrite(diag_text + printed, 1, e->diag_pos - printed, stderr);
+		printed = e->diag_pos;
+
+		if (e->is_crc)
+			sym_update_crc(e->name, obj->mod, e->crc, e->export);
+		else
+			sym_add_exported(e->name, obj->mod, e->export);
+		free(e);
+	}
+	fputs(diag_text + printed, stderr);
+}
+
+static void read_symbols_from_files(const char *filename,
+				    struct objfile **objs, int *nr_objs)
 {
 	FILE *in = stdin;
 	char fname[PATH_MAX];
@@ -2036,13 +3134,89 @@ static void read_symbols_from_files(const char *filename)
 	while (fgets(fname, PATH_MAX, in) != NULL) {
 		if (strends(fname, "\n"))
 			fname[strlen(fname)-1] = '\0';
-		read_symbols(fname);
+		*objs = NOFAIL(realloc(*objs, (*nr_objs + 1) * sizeof(**objs)));
+		memset(&(*objs)[*nr_objs], 0, sizeof(**objs));
+		(*objs)[(*nr_objs)++].filename = NOFAIL(strdup(fname));
 	}
 
 	if (in != stdin)
 		fclose(in);
 }
 
+/*
+ * Run fn() for items 0..nr-1 on up to nr_jobs threads, each item with
+ * its diagnostics going to diags[i] (a string which the caller frees).
+ *
+ * Returns the number of items done before the first one that hit a
+ * fatal error, nr if none did.  The caller deals with those, then
+ * passes the failed item's diagnostics to parallel_fatal(); items after
+ * it may or may not have been run.
+ */
+struct parallel_work {
+	void (*fn)(int i, void *arg);
+	void *arg;
+	char **diags;
+	int nr;
+	int next;
+	int failed;		/* lowest item that hit fatal() */
+};
+
+static void *parallel_worker(void *data)
+{
+	struct parallel_work *w = data;
+	jmp_buf env;
+	size_t len;
+	int i, f;
+
+	while ((i = __sync_fetch_and_add(&w->next, 1)) < w->nr) {
+		if (i > __sync_fetch_and_add(&w->failed, 0))
+			break;
+		diag_file = NOFAIL(open_memstream(&w->diags[i], &len));
+		fatal_jmp = &env;
+		if (setjmp(env))
+			while ((f = __sync_fetch_and_add(&w->failed, 0)) > i &&
+			       !__sync_bool_compare_and_swap(&w->failed, f, i))
+				;
+		else
+			w->fn(i, w->arg);
+		fatal_jmp = NULL;
+		fclose(diag_file);
+		diag_file = NULL;
+	}
+
+	return NULL;
+}
+
+static int run_parallel(int nr, void (*fn)(int i, void *arg), void *arg,
+			char **diags)
+{
+	struct parallel_work w = {
+		.fn = fn, .arg = arg, .diags = diags, .nr = nr, .failed = nr,
+	};
+	pthread_t *threads;
+	int i, n = nr_jobs < nr ? nr_jobs : nr;
+
+	if (n <= 1) {
+		parallel_worker(&w);
+		return w.failed;
+	}
+
+	threads = NOFAIL(malloc(n * sizeof(*threads)));
+	for (i = 0; i < n; i++)
+		if (pthread_create(&threads[i], NULL, parallel_worker, &w))
+			fatal("modpost: can't create thread: %m\n");
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	return w.failed;
+}
+
+static void __attribute__((noreturn)) parallel_fatal(const char *diags)
+{
+	fputs(diags, stderr);
+	exit(1);
+}
+
 #define SZ 500
 
 /* We first write the generated file into memory using the
@@ -2243,16 +3417,13 @@ static int add_versions(struct buffer *b, struct module *mod)
 	return err;
 }
 
-static void add_depends(struct buffer *b, struct module *mod,
-			struct module *modules)
+static void add_depends(struct buffer *b, struct module *mod)
 {
 	struct symbol *s;
-	struct module *m;
+	struct module **seen = NULL;
+	int i, nr_seen = 0;
 	int first = 1;
 
-	for (m = modules; m; m = m->next)
-		m->seen = is_vmlinux(m->name);
-
 	buf_printf(b, "\n");
 	buf_printf(b, "static const char __module_depends[]\n");
 	buf_printf(b, "__used\n");
@@ -2263,10 +3434,17 @@ static void add_depends(struct buffer *b, struct module *mod,
 		if (!s->module)
 			continue;
 
-		if (s->module->seen)
+		/* this runs for several modules at once, so keep seen here */
+		if (is_vmlinux(s->module->name))
+			continue;
+		for (i = 0; i < nr_seen; i++)
+			if (seen[i] == s->module)
+				break;
+		if (i < nr_seen)
 			continue;
 
-		s->module->seen = 1;
+		seen = NOFAIL(realloc(seen, (nr_seen + 1) * sizeof(*seen)));
+		seen[nr_seen++] = s->module;
 		p = strrchr(s->module->name, '/');
 		if (p)
 			p++;
@@ -2276,6 +3454,7 @@ static void add_depends(struct buffer *b, struct module *mod,
 		first = 0;
 	}
 	buf_printf(b, "\";\n");
+	free(seen);
 }
 
 static void add_srcversion(struct buffer *b, struct module *mod)
@@ -2331,15 +3510,160 @@ static void write_if_changed(struct buffer *b, const char *fname)
 	fclose(file);
 }
 
+/* FNV-1a over the whole of Module.symvers */
+static uint64_t symvers_text_hash(const void *p, unsigned long size)
+{
+	const unsigned char *c = p;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (size--)
+		h = (h ^ *c++) * 0x100000001b3ULL;
+	return h;
+}
+
+static char *symvers_bin_name(const char *fname)
+{
+	char *binname = NOFAIL(malloc(strlen(fname) + sizeof(".bin")));
+
+	sprintf(binname, "%s.bin", fname);
+	return binname;
+}
+
+static int symvers_bin_valid(const void *map, unsigned long size)
+{
+	const struct symvers_bin_header *hdr = map;
+	const struct symvers_bin_sym *syms;
+	const uint32_t *mods, *table;
+	const char *strings;
+	uint64_t len;
+	unsigned int i, used = 0;
+
+	if (size < sizeof(*hdr) || hdr->magic != SYMVERS_BIN_MAGIC ||
+	    hdr->version != SYMVERS_BIN_VERSION)
+		return 0;
+
+	len = sizeof(*hdr) + (uint64_t)hdr->nr_mods * sizeof(*mods) +
+	      (uint64_t)hdr->nr_syms * sizeof(*syms) +
+	      (uint64_t)hdr->table_size * sizeof(*table) + hdr->strings_size;
+	if (len != size || hdr->table_size <= hdr->nr_syms ||
+	    (hdr->table_size & (hdr->table_size - 1)) ||
+	    !hdr->strings_size)
+		return 0;
+
+	mods = (const uint32_t *)(hdr + 1);
+	syms = (const struct symvers_bin_sym *)(mods + hdr->nr_mods);
+	table = (const uint32_t *)(syms + hdr->nr_syms);
+	strings = (const char *)(table + hdr->table_size);
+	if (strings[hdr->strings_size - 1] != '\0')
+		return 0;
+
+	for (i = 0; i < hdr->nr_mods; i++)
+		if (mods[i] >= hdr->strings_size)
+			return 0;
+	for (i = 0; i < hdr->nr_syms; i++)
+		if (syms[i].name >= hdr->strings_size ||
+		    syms[i].module >= hdr->nr_mods ||
+		    syms[i].export > export_unknown)
+			return 0;
+	/* lookups rely on finding an empty slot */
+	for (i = 0; i < hdr->table_size; i++) {
+		if (table[i] > hdr->nr_syms)
+			return 0;
+		used += !!table[i];
+	}
+	return used == hdr->nr_syms;
+}
+
+/*
+ * Map fname.bin if it was made from fname as it is now.  The size and
+ * the modification time of fname say so cheaply; failing that, say after
+ * a copy that did not keep the times, it is still good if the contents
+ * hash to the same value.
+ */
+static int open_symvers_bin(const char *fname, unsigned int kernel)
+{
+	const struct symvers_bin_header *hdr;
+	char *binname = symvers_bin_name(fname);
+	unsigned long size, text_size;
+	struct stat st;
+	void *map, *text;
+	const uint32_t *mods;
+	unsigned int i;
+	struct module *mod;
+	int fresh;
+
+	map = grab_file(binname, &size);
+	free(binname);
+	if (!map)
+		return 0;
+	hdr = map;
+	if (!symvers_bin_valid(map, size) || stat(fname, &st) < 0) {
+		release_file(map, size);
+		return 0;
+	}
+
+	fresh = hdr->text_size == st.st_size &&
+		hdr->text_mtime_sec == st.st_mtim.tv_sec &&
+		hdr->text_mtime_nsec == st.st_mtim.tv_nsec;
+	if (!fresh && hdr->text_size == st.st_size) {
+		text = grab_file(fname, &text_size);
+		if (text) {
+			fresh = text_size == hdr->text_size &&
+				symvers_text_hash(text, text_size) ==
+				hdr->text_hash;
+			release_file(text, text_size);
+		}
+	}
+	if (!fresh) {
+		release_file(map, size);
+		return 0;
+	}
+
+	mods = (const uint32_t *)(hdr + 1);
+	symvers_bin.map = map;
+	symvers_bin.size = size;
+	symvers_bin.hdr = hdr;
+	symvers_bin.syms = (const struct symvers_bin_sym *)(mods + hdr->nr_mods);
+	symvers_bin.table = (const uint32_t *)(symvers_bin.syms + hdr->nr_syms);
+	symvers_bin.strings = (const char *)(symvers_bin.table +
+					     hdr->table_size);
+	symvers_bin.kernel = kernel;
+
+	/* the modules come in the order read_dump() would find them */
+	symvers_bin.mods = NOFAIL(calloc(hdr->nr_mods + 1,
+					 sizeof(*symvers_bin.mods)));
+	for (i = 0; i < hdr->nr_mods; i++) {
+		const char *modname = symvers_bin.strings + mods[i];
+
+		if (is_vmlinux(modname))
+			have_vmlinux = 1;
+		mod = new_module(modname);
+		mod->skip = 1;
+		symvers_bin.mods[i] = mod;
+	}
+
+	/* keep the sequence numbers the text file would have given them */
+	symvers_bin.seq = symbol_seq;
+	symbol_seq += hdr->nr_syms;
+
+	return 1;
+}
+
 /* parse Module.symvers file. line format:
  * 0x12345678<tab>symbol<tab>module[[<tab>export]<tab>something]
  **/
 static void read_dump(const char *fname, unsigned int kernel)
 {
 	unsigned long size, pos = 0;
-	void *file = grab_file(fname, &size);
+	void *file;
 	char *line;
 
+	/* Module.symvers.bin can only stand in for the first one */
+	if (!nr_modules && !nr_symbols && !symvers_bin.map &&
+	    open_symvers_bin(fname, kernel))
+		return;
+
+	file = grab_file(fname, &size);
 	if (!file)
 		/* No symbol versions, silently ignore */
 		return;
@@ -2395,24 +3719,206 @@ static int dump_sym(struct symbol *sym)
 	return 1;
 }
 
+/*
+ * Module.symvers has always come out in the order of the old chained hash,
+ * 1024 tdb_hash() buckets with the newest symbol first in each; keep it so
+ * the file only changes when the symbols do.
+ */
+#define DUMP_BUCKETS	1024
+
+/*
+ * Write fname.bin for the dump just written to fname, from the symbols in
+ * the order they appear there, so that reading it back is the same as
+ * parsing fname.
+ */
+static void write_symvers_bin(const char *fname, struct buffer *text,
+			      struct symbol **syms, unsigned int nr_syms)
+{
+	struct symvers_bin_header *hdr;
+	struct symvers_bin_sym *e;
+	struct module **mods, *mod;
+	struct buffer buf = { };
+	struct stat st;
+	uint32_t *modidx, *modnames, *table;
+	unsigned int i, j, n, nr_mods = 0, idx_size = 1, table_size = 1;
+	unsigned long strings_size = 0;
+	char *strings, *binname;
+
+	if (stat(fname, &st) < 0)
+		return;
+
+	/* number the modules by first appearance, one per name */
+	while (idx_size <= 2 * nr_syms)
+		idx_size <<= 1;
+	modidx = NOFAIL(calloc(idx_size, sizeof(*modidx)));
+	mods = NOFAIL(malloc((nr_syms + 1) * sizeof(*mods)));
+	e = NOFAIL(malloc((nr_syms + 1) * sizeof(*e)));
+	for (i = 0; i < nr_syms; i++) {
+		mod = syms[i]->module;
+		for (j = mod->hash & (idx_size - 1); (n = modidx[j]);
+		     j = (j + 1) & (idx_size - 1))
+			if (strcmp(mods[n - 1]->name, mod->name) == 0)
+				break;
+		if (!n) {
+			mods[nr_mods++] = mod;
+			modidx[j] = n = nr_mods;
+			strings_size += strlen(mod->name) + 1;
+		}
+		e[i].module = n - 1;
+		strings_size += strlen(syms[i]->name) + 1;
+	}
+	free(modidx);
+
+	while (table_size <= 2 * nr_syms)
+		table_size <<= 1;
+
+	buf.pos = buf.size = sizeof(*hdr) + nr_mods * sizeof(*modnames) +
+			     nr_syms * sizeof(*e) +
+			     table_size * sizeof(*table) + strings_size;
+	buf.p = NOFAIL(calloc(1, buf.size));
+	hdr = (struct symvers_bin_header *)buf.p;
+	modnames = (uint32_t *)(hdr + 1);
+	memcpy(modnames + nr_mods, e, nr_syms * sizeof(*e));
+	free(e);
+	e = (struct symvers_bin_sym *)(modnames + nr_mods);
+	table = (uint32_t *)(e + nr_syms);
+	strings = (char *)(table + table_size);
+
+	hdr->magic = SYMVERS_BIN_MAGIC;
+	hdr->version = SYMVERS_BIN_VERSION;
+	hdr->text_size = st.st_size;
+	hdr->text_mtime_sec = st.st_mtim.tv_sec;
+	hdr->text_mtime_nsec = st.st_mtim.tv_nsec;
+	hdr->text_hash = symvers_text_hash(text->p, text->pos);
+	hdr->nr_mods = nr_mods;
+	hdr->nr_syms = nr_syms;
+	hdr->table_size = table_size;
+	hdr->strings_size = strings_size;
+
+	n = 0;
+	for (i = 0; i < nr_mods; i++) {
+		modnames[i] = n;
+		strcpy(strings + n, mods[i]->name);
+		n += strlen(mods[i]->name) + 1;
+	}
+	for (i = 0; i < nr_syms; i++) {
+		e[i].name = n;
+		e[i].hash = syms[i]->hash;
+		e[i].crc = syms[i]->crc;
+		e[i].export = syms[i]->export;
+		strcpy(strings + n, syms[i]->name);
+		n += strlen(syms[i]->name) + 1;
+
+		for (j = e[i].hash & (table_size - 1); table[j];
+		     j = (j + 1) & (table_size - 1))
+			;
+		table[j] = i + 1;
+	}
+	free(mods);
+
+	binname = symvers_bin_name(fname);
+	write_if_changed(&buf, binname);
+	free(binname);
+	free(buf.p);
+}
+
 static void write_dump(const char *fname)
 {
 	struct buffer buf = { };
-	struct symbol *symbol;
-	int n;
-
-	for (n = 0; n < SYMBOL_HASH_SIZE ; n++) {
-		symbol = symbolhash[n];
-		while (symbol) {
-			if (dump_sym(symbol))
-				buf_printf(&buf, "0x%08x\t%s\t%s\t%s\n",
-					symbol->crc, symbol->name,
-					symbol->module->name,
-					export_str(symbol->export));
-			symbol = symbol->next;
+	struct symbol **by_seq, **dump, *symbol;
+	unsigned int *bucket, start[DUMP_BUCKETS + 1] = { };
+	unsigned int i, n, nr_dump = 0;
+
+	/*
+	 * Whatever is still only in Module.symvers.bin is dumped too,
+	 * unless it is the kernel's and this is an external module.
+	 */
+	if (!external_module || !symvers_bin.kernel)
+		symvers_bin_load_all();
+
+	/*
+	 * A counting sort on the bucket, going through the symbols newest
+	 * first; entries of Module.symvers.bin never looked up leave holes.
+	 */
+	by_seq = NOFAIL(calloc(symbol_seq + 1, sizeof(*by_seq)));
+	for (i = 0; i < symbolhash_size; i++)
+		if (symbolhash[i])
+			by_seq[symbolhash[i]->seq] = symbolhash[i];
+
+	bucket = NOFAIL(malloc((symbol_seq + 1) * sizeof(*bucket)));
+	for (i = 0; i < symbol_seq; i++) {
+		if (!by_seq[i])
+			continue;
+		bucket[i] = tdb_hash(by_seq[i]->name) % DUMP_BUCKETS;
+		start[bucket[i] + 1]++;
+	}
+	for (i = 0; i < DUMP_BUCKETS; i++)
+		start[i + 1] += start[i];
+
+	dump = NOFAIL(malloc((nr_symbols + 1) * sizeof(*dump)));
+	for (n = symbol_seq; n-- > 0; )
+		if (by_seq[n])
+			dump[start[bucket[n]]++] = by_seq[n];
+
+	for (i = 0; i < nr_symbols; i++) {
+		symbol = dump[i];
+		if (dump_sym(symbol)) {
+			buf_printf(&buf, "0x%08x\t%s\t%s\t%s\n",
+				   symbol->crc, symbol->name,
+				   symbol->module->name,
+				   export_str(symbol->export));
+			dump[nr_dump++] = symbol;
 		}
 	}
+	free(bucket);
+	free(by_seq);
 	write_if_changed(&buf, fname);
+	write_symvers_bin(fname, &buf, dump, nr_dump);
+	free(dump);
+	free(buf.p);
+}
+
+static void write_cache(struct objfile *objs, int nr_objs)
+{
+	struct buffer b = { }, modc = { };
+	struct objfile *obj;
+	unsigned int i, n = 0;
+
+	cache_put_u32(&b, CACHE_MAGIC);
+	cache_put_u32(&b, CACHE_VERSION);
+	cache_put_u64(&b, cache_config());
+	cache_put_u32(&b, 0);
+
+	/* entries for objects not given this time stay for the next */
+	for (i = 0; i < nr_cache_objs; i++) {
+		if (cache_objs[i].used)
+			continue;
+		cache_put_u32(&b, cache_objs[i].record_len);
+		cache_put(&b, cache_objs[i].record, cache_objs[i].record_len);
+		n++;
+	}
+
+	for (obj = objs; obj < objs + nr_objs; obj++) {
+		if (!obj->record.pos)
+			continue;
+		modc.pos = 0;
+		cache_put_u64(&modc, obj->modc_key);
+		cache_put_key(&modc, &obj->modc_file);
+		cache_put_u32(&modc, obj->modc_err);
+		cache_put_str(&modc, obj->modc_diag ? obj->modc_diag : "");
+
+		cache_put_u32(&b, obj->record.pos + modc.pos);
+		cache_put(&b, obj->record.p, obj->record.pos);
+		cache_put(&b, modc.p, modc.pos);
+		free(obj->record.p);
+		free(obj->modc_diag);
+		n++;
+	}
+	memcpy(b.p + 2 * sizeof(uint32_t) + sizeof(uint64_t), &n, sizeof(n));
+
+	write_if_changed(&b, cache_name);
+	free(modc.p);
+	free(b.p);
 }
 
 struct ext_sym_list {
@@ -2420,18 +3926,109 @@ struct ext_sym_list {
 	const char *file;
 };
 
+static void read_symbols_work(int i, void *arg)
+{
+	struct objfile *objs = arg;
+
+	read_symbols(&objs[i]);
+}
+
+struct mod_c_work {
+	struct module **mods;
+	int *err;
+};
+
+/*
+ * Everything the .mod.c of mod is made from: its object and srcversion,
+ * the options that matter, and which module and CRC each symbol it uses
+ * comes from.
+ */
+static uint64_t modc_key(struct module *mod)
+{
+	int flags[] = {
+		external_module, modversions, have_vmlinux, warn_unresolved,
+	};
+	uint64_t h = CACHE_HASH_INIT;
+	struct symbol *s, *exp;
+	unsigned int v[3];
+
+	h = cache_hash(h, &mod->obj->content_hash,
+		       sizeof(mod->obj->content_hash));
+	h = cache_hash(h, flags, sizeof(flags));
+	h = cache_hash(h, mod->name, strlen(mod->name) + 1);
+	h = cache_hash(h, mod->srcversion, strlen(mod->srcversion) + 1);
+	for (s = mod->unres; s; s = s->next) {
+		h = cache_hash(h, s->name, strlen(s->name) + 1);
+		exp = find_symbol(s->name);
+		v[0] = s->weak;
+		v[1] = exp && exp->module != mod ? exp->crc : 0;
+		v[2] = exp && exp->module != mod ? 1 + exp->crc_valid : 0;
+		h = cache_hash(h, v, sizeof(v));
+		if (v[2])
+			h = cache_hash(h, exp->module->name,
+				       strlen(exp->module->name) + 1);
+	}
+	return h;
+}
+
+static void write_mod_c(int i, void *arg)
+{
+	struct mod_c_work *w = arg;
+	struct module *mod = w->mods[i];
+	struct objfile *obj = mod->obj;
+	struct cached_obj *e = obj->cached;
+	struct buffer buf = { };
+	char fname[PATH_MAX];
+	struct file_key k;
+
+	sprintf(fname, "%s.mod.c", mod->name);
+	if (cache_name) {
+		obj->modc_key = modc_key(mod);
+		if (e && e->modc_key == obj->modc_key) {
+			get_file_key(fname, &k);
+			if (same_file_key(&k, &e->modc_file)) {
+				obj->modc_file = k;
+				w->err[i] = e->modc_err;
+				fputs(e->modc_diag, diag());
+				return;
+			}
+		}
+	}
+
+	add_header(&buf, mod);
+	add_intree_flag(&buf, !external_module);
+	add_retpoline(&buf);
+	add_staging_flag(&buf, mod->name);
+	w->err[i] = add_versions(&buf, mod);
+	add_depends(&buf, mod);
+	add_moddevtable(&buf, mod);
+	add_srcversion(&buf, mod);
+
+	write_if_changed(&buf, fname);
+	free(buf.p);
+
+	if (cache_name)
+		get_file_key(fname, &obj->modc_file);
+}
+
 int main(int argc, char **argv)
 {
 	struct module *mod;
-	struct buffer buf = { };
 	char *kernel_read = NULL, *module_read = NULL;
 	char *dump_write = NULL, *files_source = NULL;
 	int opt;
 	int err;
+	int i, done, nr_objs = 0, nr_mods = 0;
+	struct objfile *objs = NULL;
+	struct module **mods;
+	struct mod_c_work work;
+	char **diags;
 	struct ext_sym_list *extsym_iter;
 	struct ext_sym_list *extsym_start = NULL;
 
-	while ((opt = getopt(argc, argv, "i:I:e:mnsST:o:awM:K:E")) != -1) {
+	nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((opt = getopt(argc, argv, "i:I:e:mnsST:o:awM:K:Ej:c:")) != -1) {
 		switch (opt) {
 		case 'i':
 			kernel_read = optarg;
@@ -2475,6 +4072,12 @@ int main(int argc, char **argv)
 		case 'E':
 			sec_mismatch_fatal = 1;
 			break;
+		case 'j':
+			nr_jobs = atoi(optarg);
+			break;
+		case 'c':
+			cache_name = optarg;
+			break;
 		default:
 			exit(1);
 		}
@@ -2491,42 +4094,79 @@ int main(int argc, char **argv)
 		extsym_start = extsym_iter;
 	}
 
-	while (optind < argc)
-		read_symbols(argv[optind++]);
+	for (; optind < argc; optind++) {
+		objs = NOFAIL(realloc(objs, (nr_objs + 1) * sizeof(*objs)));
+		memset(&objs[nr_objs], 0, sizeof(*objs));
+		objs[nr_objs++].filename = argv[optind];
+	}
 
 	if (files_source)
-		read_symbols_from_files(files_source);
+		read_symbols_from_files(files_source, &objs, &nr_objs);
 
-	for (mod = modules; mod; mod = mod->next) {
-		if (mod->skip)
-			continue;
-		check_exports(mod);
+	if (cache_name) {
+		read_cache();
+		for (i = 0; i < nr_objs; i++)
+			cache_check(&objs[i]);
 	}
 
-	err = 0;
+	/*
+	 * The object files are read in parallel, but only merged into the
+	 * module list and the symbol hash afterwards, one at a time in the
+	 * order given.
+	 */
+	diags = NOFAIL(calloc(nr_objs + 1, sizeof(*diags)));
+	done = run_parallel(nr_objs, read_symbols_work, objs, diags);
+	for (i = 0; i < done; i++) {
+		merge_symbols(&objs[i], diags[i]);
+		free(diags[i]);
+	}
+	if (done < nr_objs)
+		parallel_fatal(diags[done]);
+	free(diags);
 
 	for (mod = modules; mod; mod = mod->next) {
-		char fname[PATH_MAX];
-
 		if (mod->skip)
 			continue;
+		check_exports(mod);
+	}
 
-		buf.pos = 0;
+	/*
+	 * From here on the symbol hash is only read, one .mod.c per thread;
+	 * check_exports() has already looked up every symbol add_versions()
+	 * will, so none is left to come in from Module.symvers.bin.
+	 */
+	for (mod = modules; mod; mod = mod->next)
+		nr_mods += !mod->skip;
+	mods = NOFAIL(malloc((nr_mods + 1) * sizeof(*mods)));
+	for (i = 0, mod = modules; mod; mod = mod->next)
+		if (!mod->skip)
+			mods[i++] = mod;
 
-		add_header(&buf, mod);
-		add_intree_flag(&buf, !external_module);
-		add_retpoline(&buf);
-		add_staging_flag(&buf, mod->name);
-		err |= add_versions(&buf, mod);
-		add_depends(&buf, mod, modules);
-		add_moddevtable(&buf, mod);
-		add_srcversion(&buf, mod);
+	work.mods = mods;
+	work.err = NOFAIL(calloc(nr_mods + 1, sizeof(*work.err)));
+	diags = NOFAIL(calloc(nr_mods + 1, sizeof(*diags)));
+	done = run_parallel(nr_mods, write_mod_c, &work, diags);
 
-		sprintf(fname, "%s.mod.c", mod->name);
-		write_if_changed(&buf, fname);
+	err = 0;
+	for (i = 0; i < done; i++) {
+		fputs(diags[i], stderr);
+		err |= work.err[i];
+		if (cache_name) {
+			mods[i]->obj->modc_err = work.err[i];
+			mods[i]->obj->modc_diag = diags[i];
+		} else {
+			free(diags[i]);
+		}
 	}
+	if (done < nr_mods)
+		parallel_fatal(diags[done]);
+	free(diags);
+	free(work.err);
+	free(mods);
 	if (dump_write)
 		write_dump(dump_write);
+	if (cache_name)
+		write_cache(objs, nr_objs);
 	if (sec_mismatch_count) {
 		if (!sec_mismatch_verbose) {
 			warn("modpost: Found %d section mismatch(es).\n"
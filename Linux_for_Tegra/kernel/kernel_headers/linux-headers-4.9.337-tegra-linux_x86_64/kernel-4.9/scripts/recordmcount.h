@@ -22,6 +22,7 @@
 #undef is_fake_mcount
 #undef fn_is_fake_mcount
 #undef MIPS_is_fake_mcount
+#undef mips_old_r_offset
 #undef mcount_adjust
 #undef sift_rel_mcount
 #undef nop_mcount
@@ -65,6 +66,7 @@
 # define is_fake_mcount		is_fake_mcount64
 # define fn_is_fake_mcount	fn_is_fake_mcount64
 # define MIPS_is_fake_mcount	MIPS64_is_fake_mcount
+# define mips_old_r_offset	mips64_old_r_offset
 # define mcount_adjust		mcount_adjust_64
 # define Elf_Addr		Elf64_Addr
 # define Elf_Ehdr		Elf64_Ehdr
@@ -98,6 +100,7 @@
 # define is_fake_mcount		is_fake_mcount32
 # define fn_is_fake_mcount	fn_is_fake_mcount32
 # define MIPS_is_fake_mcount	MIPS32_is_fake_mcount
+# define mips_old_r_offset	mips32_old_r_offset
 # define mcount_adjust		mcount_adjust_32
 # define Elf_Addr		Elf32_Addr
 # define Elf_Ehdr		Elf32_Ehdr
@@ -119,26 +122,25 @@
 # define _size			4
 #endif
 
-/* Functions and pointers that do_file() may override for specific e_machine. */
-static int fn_is_fake_mcount(Elf_Rel const *rp)
+/*
+ * Defaults for the struct mcount_file hooks that do_file() may override
+ * for specific e_machine.
+ */
+static int fn_is_fake_mcount(struct mcount_file *const mf, Elf_Rel const *rp)
 {
 	return 0;
 }
-static int (*is_fake_mcount)(Elf_Rel const *rp) = fn_is_fake_mcount;
 
-static uint_t fn_ELF_R_SYM(Elf_Rel const *rp)
+static uint_t fn_ELF_R_SYM(struct mcount_file *const mf, Elf_Rel const *rp)
 {
-	return ELF_R_SYM(_w(rp->r_info));
+	return ELF_R_SYM(mf->_w(rp->r_info));
 }
-static uint_t (*Elf_r_sym)(Elf_Rel const *rp) = fn_ELF_R_SYM;
 
-static void fn_ELF_R_INFO(Elf_Rel *const rp, unsigned sym, unsigned type)
+static void fn_ELF_R_INFO(struct mcount_file *const mf, Elf_Rel *const rp,
+			  unsigned sym, unsigned type)
 {
-	rp->r_info = _w(ELF_R_INFO(sym, type));
+	rp->r_info = mf->_w(ELF_R_INFO(sym, type));
 }
-static void (*Elf_r_info)(Elf_Rel *const rp, unsigned sym, unsigned type) = fn_ELF_R_INFO;
-
-static int mcount_adjust = 0;
 
 /*
  * MIPS mcount long call has 2 _mcount symbols, only the position of the 1st
@@ -161,21 +163,22 @@ static int mcount_adjust = 0;
  */
 #define MIPS_FAKEMCOUNT_OFFSET	4
 
-static int MIPS_is_fake_mcount(Elf_Rel const *rp)
+static int MIPS_is_fake_mcount(struct mcount_file *const mf, Elf_Rel const *rp)
 {
-	static Elf_Addr old_r_offset = ~(Elf_Addr)0;
-	Elf_Addr current_r_offset = _w(rp->r_offset);
+	Elf_Addr old_r_offset = mf->mips_old_r_offset;
+	Elf_Addr current_r_offset = mf->_w(rp->r_offset);
 	int is_fake;
 
 	is_fake = (old_r_offset != ~(Elf_Addr)0) &&
 		(current_r_offset - old_r_offset == MIPS_FAKEMCOUNT_OFFSET);
-	old_r_offset = current_r_offset;
+	mf->mips_old_r_offset = current_r_offset;
 
 	return is_fake;
 }
 
 /* Append the new shstrtab, Elf_Shdr[], __mcount_loc and its relocations. */
-static void append_func(Elf_Ehdr *const ehdr,
+static void append_func(struct mcount_file *const mf,
+			Elf_Ehdr *const ehdr,
 			Elf_Shdr *const shstr,
 			uint_t const *const mloc0,
 			uint_t const *const mlocp,
@@ -189,108 +192,111 @@ static void append_func(Elf_Ehdr *const ehdr,
 	char const *mc_name = (sizeof(Elf_Rela) == rel_entsize)
 		? ".rela__mcount_loc"
 		:  ".rel__mcount_loc";
-	unsigned const old_shnum = w2(ehdr->e_shnum);
-	uint_t const old_shoff = _w(ehdr->e_shoff);
-	uint_t const old_shstr_sh_size   = _w(shstr->sh_size);
-	uint_t const old_shstr_sh_offset = _w(shstr->sh_offset);
-	uint_t t = 1 + strlen(mc_name) + _w(shstr->sh_size);
+	unsigned const old_shnum = mf->w2(ehdr->e_shnum);
+	uint_t const old_shoff = mf->_w(ehdr->e_shoff);
+	uint_t const old_shstr_sh_size   = mf->_w(shstr->sh_size);
+	uint_t const old_shstr_sh_offset = mf->_w(shstr->sh_offset);
+	uint_t t = 1 + strlen(mc_name) + mf->_w(shstr->sh_size);
 	uint_t new_e_shoff;
 
-	shstr->sh_size = _w(t);
-	shstr->sh_offset = _w(sb.st_size);
-	t += sb.st_size;
+	shstr->sh_size = mf->_w(t);
+	shstr->sh_offset = mf->_w(mf->sb.st_size);
+	t += mf->sb.st_size;
 	t += (_align & -t);  /* word-byte align */
 	new_e_shoff = t;
 
 	/* body for new shstrtab */
-	ulseek(fd_map, sb.st_size, SEEK_SET);
-	uwrite(fd_map, old_shstr_sh_offset + (void *)ehdr, old_shstr_sh_size);
-	uwrite(fd_map, mc_name, 1 + strlen(mc_name));
+	ulseek(mf, mf->sb.st_size, SEEK_SET);
+	uwrite(mf, old_shstr_sh_offset + (void *)ehdr, old_shstr_sh_size);
+	uwrite(mf, mc_name, 1 + strlen(mc_name));
 
 	/* old(modified) Elf_Shdr table, word-byte aligned */
-	ulseek(fd_map, t, SEEK_SET);
+	ulseek(mf, t, SEEK_SET);
 	t += sizeof(Elf_Shdr) * old_shnum;
-	uwrite(fd_map, old_shoff + (void *)ehdr,
+	uwrite(mf, old_shoff + (void *)ehdr,
 	       sizeof(Elf_Shdr) * old_shnum);
 
 	/* new sections __mcount_loc and .rel__mcount_loc */
 	t += 2*sizeof(mcsec);
-	mcsec.sh_name = w((sizeof(Elf_Rela) == rel_entsize) + strlen(".rel")
+	mcsec.sh_name = mf->w((sizeof(Elf_Rela) == rel_entsize) + strlen(".rel")
 		+ old_shstr_sh_size);
-	mcsec.sh_type = w(SHT_PROGBITS);
-	mcsec.sh_flags = _w(SHF_ALLOC);
+	mcsec.sh_type = mf->w(SHT_PROGBITS);
+	mcsec.sh_flags = mf->_w(SHF_ALLOC);
 	mcsec.sh_addr = 0;
-	mcsec.sh_offset = _w(t);
-	mcsec.sh_size = _w((void *)mlocp - (void *)mloc0);
+	mcsec.sh_offset = mf->_w(t);
+	mcsec.sh_size = mf->_w((void *)mlocp - (void *)mloc0);
 	mcsec.sh_link = 0;
 	mcsec.sh_info = 0;
-	mcsec.sh_addralign = _w(_size);
-	mcsec.sh_entsize = _w(_size);
-	uwrite(fd_map, &mcsec, sizeof(mcsec));
+	mcsec.sh_addralign = mf->_w(_size);
+	mcsec.sh_entsize = mf->_w(_size);
+	uwrite(mf, &mcsec, sizeof(mcsec));
 
-	mcsec.sh_name = w(old_shstr_sh_size);
+	mcsec.sh_name = mf->w(old_shstr_sh_size);
 	mcsec.sh_type = (sizeof(Elf_Rela) == rel_entsize)
-		? w(SHT_RELA)
-		: w(SHT_REL);
+		? mf->w(SHT_RELA)
+		: mf->w(SHT_REL);
 	mcsec.sh_flags = 0;
 	mcsec.sh_addr = 0;
-	mcsec.sh_offset = _w((void *)mlocp - (void *)mloc0 + t);
-	mcsec.sh_size   = _w((void *)mrelp - (void *)mrel0);
-	mcsec.sh_link = w(symsec_sh_link);
-	mcsec.sh_info = w(old_shnum);
-	mcsec.sh_addralign = _w(_size);
-	mcsec.sh_entsize = _w(rel_entsize);
-	uwrite(fd_map, &mcsec, sizeof(mcsec));
-
-	uwrite(fd_map, mloc0, (void *)mlocp - (void *)mloc0);
-	uwrite(fd_map, mrel0, (void *)mrelp - (void *)mrel0);
-
-	ehdr->e_shoff = _w(new_e_shoff);
-	ehdr->e_shnum = w2(2 + w2(ehdr->e_shnum));  /* {.rel,}__mcount_loc */
-	ulseek(fd_map, 0, SEEK_SET);
-	uwrite(fd_map, ehdr, sizeof(*ehdr));
+	mcsec.sh_offset = mf->_w((void *)mlocp - (void *)mloc0 + t);
+	mcsec.sh_size   = mf->_w((void *)mrelp - (void *)mrel0);
+	mcsec.sh_link = mf->w(symsec_sh_link);
+	mcsec.sh_info = mf->w(old_shnum);
+	mcsec.sh_addralign = mf->_w(_size);
+	mcsec.sh_entsize = mf->_w(rel_entsize);
+	uwrite(mf, &mcsec, sizeof(mcsec));
+
+	uwrite(mf, mloc0, (void *)mlocp - (void *)mloc0);
+	uwrite(mf, mrel0, (void *)mrelp - (void *)mrel0);
+
+	ehdr->e_shoff = mf->_w(new_e_shoff);
+	/* {.rel,}__mcount_loc */
+	ehdr->e_shnum = mf->w2(2 + mf->w2(ehdr->e_shnum));
+	ulseek(mf, 0, SEEK_SET);
+	uwrite(mf, ehdr, sizeof(*ehdr));
 }
 
-static unsigned get_mcountsym(Elf_Sym const *const sym0,
+static unsigned get_mcountsym(struct mcount_file *const mf,
+			      Elf_Sym const *const sym0,
 			      Elf_Rel const *relp,
 			      char const *const str0)
 {
 	unsigned mcountsym = 0;
 
 	Elf_Sym const *const symp =
-		&sym0[Elf_r_sym(relp)];
-	char const *symname = &str0[w(symp->st_name)];
-	char const *mcount = gpfx == '_' ? "_mcount" : "mcount";
+		&sym0[mf->Elf_r_sym(mf, relp)];
+	char const *symname = &str0[mf->w(symp->st_name)];
+	char const *mcount = mf->gpfx == '_' ? "_mcount" : "mcount";
 	char const *fentry = "__fentry__";
 
 	if (symname[0] == '.')
 		++symname;  /* ppc64 hack */
 	if (strcmp(mcount, symname) == 0 ||
-	    (altmcount && strcmp(altmcount, symname) == 0) ||
+	    (mf->altmcount && strcmp(mf->altmcount, symname) == 0) ||
 	    (strcmp(fentry, symname) == 0))
-		mcountsym = Elf_r_sym(relp);
+		mcountsym = mf->Elf_r_sym(mf, relp);
 
 	return mcountsym;
 }
 
-static void get_sym_str_and_relp(Elf_Shdr const *const relhdr,
+static void get_sym_str_and_relp(struct mcount_file *const mf,
+				 Elf_Shdr const *const relhdr,
 				 Elf_Ehdr const *const ehdr,
 				 Elf_Sym const **sym0,
 				 char const **str0,
 				 Elf_Rel const **relp)
 {
-	Elf_Shdr *const shdr0 = (Elf_Shdr *)(_w(ehdr->e_shoff)
+	Elf_Shdr *const shdr0 = (Elf_Shdr *)(mf->_w(ehdr->e_shoff)
 		+ (void *)ehdr);
-	unsigned const symsec_sh_link = w(relhdr->sh_link);
+	unsigned const symsec_sh_link = mf->w(relhdr->sh_link);
 	Elf_Shdr const *const symsec = &shdr0[symsec_sh_link];
-	Elf_Shdr const *const strsec = &shdr0[w(symsec->sh_link)];
-	Elf_Rel const *const rel0 = (Elf_Rel const *)(_w(relhdr->sh_offset)
+	Elf_Shdr const *const strsec = &shdr0[mf->w(symsec->sh_link)];
+	Elf_Rel const *const rel0 = (Elf_Rel const *)(mf->_w(relhdr->sh_offset)
 		+ (void *)ehdr);
 
-	*sym0 = (Elf_Sym const *)(_w(symsec->sh_offset)
+	*sym0 = (Elf_Sym const *)(mf->_w(symsec->sh_offset)
 				  + (void *)ehdr);
 
-	*str0 = (char const *)(_w(strsec->sh_offset)
+	*str0 = (char const *)(mf->_w(strsec->sh_offset)
 			       + (void *)ehdr);
 
 	*relp = rel0;
@@ -301,7 +307,8 @@ static void get_sym_str_and_relp(Elf_Shdr const *const relhdr,
  * Accumulate the section offsets that are found, and their relocation info,
  * onto the end of the existing arrays.
  */
-static uint_t *sift_rel_mcount(uint_t *mlocp,
+static uint_t *sift_rel_mcount(struct mcount_file *const mf,
+			       uint_t *mlocp,
 			       unsigned const offbase,
 			       Elf_Rel **const mrelpp,
 			       Elf_Shdr const *const relhdr,
@@ -315,24 +322,24 @@ static uint_t *sift_rel_mcount(uint_t *mlocp,
 	Elf_Sym const *sym0;
 	char const *str0;
 	Elf_Rel const *relp;
-	unsigned rel_entsize = _w(relhdr->sh_entsize);
-	unsigned const nrel = _w(relhdr->sh_size) / rel_entsize;
+	unsigned rel_entsize = mf->_w(relhdr->sh_entsize);
+	unsigned const nrel = mf->_w(relhdr->sh_size) / rel_entsize;
 	unsigned mcountsym = 0;
 	unsigned t;
 
-	get_sym_str_and_relp(relhdr, ehdr, &sym0, &str0, &relp);
+	get_sym_str_and_relp(mf, relhdr, ehdr, &sym0, &str0, &relp);
 
 	for (t = nrel; t; --t) {
 		if (!mcountsym)
-			mcountsym = get_mcountsym(sym0, relp, str0);
+			mcountsym = get_mcountsym(mf, sym0, relp, str0);
 
-		if (mcountsym && mcountsym == Elf_r_sym(relp) &&
-				!is_fake_mcount(relp)) {
-			uint_t const addend =
-				_w(_w(relp->r_offset) - recval + mcount_adjust);
-			mrelp->r_offset = _w(offbase
+		if (mcountsym && mcountsym == mf->Elf_r_sym(mf, relp) &&
+				!mf->is_fake_mcount(mf, relp)) {
+			uint_t const addend = mf->_w(mf->_w(relp->r_offset)
+				- recval + mf->mcount_adjust);
+			mrelp->r_offset = mf->_w(offbase
 				+ ((void *)mlocp - (void *)mloc0));
-			Elf_r_info(mrelp, recsym, reltype);
+			mf->Elf_r_info(mf, mrelp, recsym, reltype);
 			if (rel_entsize == sizeof(Elf_Rela)) {
 				((Elf_Rela *)mrelp)->r_addend = addend;
 				*mlocp++ = 0;
@@ -352,39 +359,43 @@ static uint_t *sift_rel_mcount(uint_t *mlocp,
  * that are not going to be traced. The mcount calls here will be converted
  * into nops.
  */
-static void nop_mcount(Elf_Shdr const *const relhdr,
+static void nop_mcount(struct mcount_file *const mf,
+		       Elf_Shdr const *const relhdr,
 		       Elf_Ehdr const *const ehdr,
 		       const char *const txtname)
 {
-	Elf_Shdr *const shdr0 = (Elf_Shdr *)(_w(ehdr->e_shoff)
+	Elf_Shdr *const shdr0 = (Elf_Shdr *)(mf->_w(ehdr->e_shoff)
 		+ (void *)ehdr);
 	Elf_Sym const *sym0;
 	char const *str0;
 	Elf_Rel const *relp;
-	Elf_Shdr const *const shdr = &shdr0[w(relhdr->sh_info)];
-	unsigned rel_entsize = _w(relhdr->sh_entsize);
-	unsigned const nrel = _w(relhdr->sh_size) / rel_entsize;
+	Elf_Shdr const *const shdr = &shdr0[mf->w(relhdr->sh_info)];
+	unsigned rel_entsize = mf->_w(relhdr->sh_entsize);
+	unsigned const nrel = mf->_w(relhdr->sh_size) / rel_entsize;
 	unsigned mcountsym = 0;
 	unsigned t;
 	int once = 0;
 
-	get_sym_str_and_relp(relhdr, ehdr, &sym0, &str0, &relp);
+	get_sym_str_and_relp(mf, relhdr, ehdr, &sym0, &str0, &relp);
 
 	for (t = nrel; t; --t) {
 		int ret = -1;
 
 		if (!mcountsym)
-			mcountsym = get_mcountsym(sym0, relp, str0);
-
-		if (mcountsym == Elf_r_sym(relp) && !is_fake_mcount(relp)) {
-			if (make_nop)
-				ret = make_nop((void *)ehdr, _w(shdr->sh_offset) + _w(relp->r_offset));
+			mcountsym = get_mcountsym(mf, sym0, relp, str0);
+
+		if (mcountsym == mf->Elf_r_sym(mf, relp) &&
+		    !mf->is_fake_mcount(mf, relp)) {
+			if (mf->make_nop)
+				ret = mf->make_nop(mf, (void *)ehdr,
+						   mf->_w(shdr->sh_offset) +
+						   mf->_w(relp->r_offset));
 			if (warn_on_notrace_sect && !once) {
-				printf("Section %s has mcount callers being ignored\n",
-				       txtname);
+				fprintf(mf->out, "Section %s has mcount callers being ignored\n",
+					txtname);
 				once = 1;
 				/* just warn? */
-				if (!make_nop)
+				if (!mf->make_nop)
 					return;
 			}
 		}
@@ -396,9 +407,10 @@ static void nop_mcount(Elf_Shdr const *const relhdr,
 		if (!ret) {
 			Elf_Rel rel;
 			rel = *(Elf_Rel *)relp;
-			Elf_r_info(&rel, Elf_r_sym(relp), rel_type_nop);
-			ulseek(fd_map, (void *)relp - (void *)ehdr, SEEK_SET);
-			uwrite(fd_map, &rel, sizeof(rel));
+			mf->Elf_r_info(mf, &rel, mf->Elf_r_sym(mf, relp),
+				       mf->rel_type_nop);
+			ulseek(mf, (void *)relp - (void *)ehdr, SEEK_SET);
+			uwrite(mf, &rel, sizeof(rel));
 		}
 		relp = (Elf_Rel const *)(rel_entsize + (void *)relp);
 	}
@@ -415,73 +427,79 @@ static void nop_mcount(Elf_Shdr const *const relhdr,
  *    Num:    Value  Size Type    Bind   Vis      Ndx Name
  *      2: 00000000     0 SECTION LOCAL  DEFAULT    1
  */
-static unsigned find_secsym_ndx(unsigned const txtndx,
+static unsigned find_secsym_ndx(struct mcount_file *const mf,
+				unsigned const txtndx,
 				char const *const txtname,
 				uint_t *const recvalp,
 				Elf_Shdr const *const symhdr,
 				Elf_Ehdr const *const ehdr)
 {
-	Elf_Sym const *const sym0 = (Elf_Sym const *)(_w(symhdr->sh_offset)
+	Elf_Sym const *const sym0 = (Elf_Sym const *)(mf->_w(symhdr->sh_offset)
 		+ (void *)ehdr);
-	unsigned const nsym = _w(symhdr->sh_size) / _w(symhdr->sh_entsize);
+	unsigned const nsym = mf->_w(symhdr->sh_size) /
+			      mf->_w(symhdr->sh_entsize);
 	Elf_Sym const *symp;
 	unsigned t;
 
 	for (symp = sym0, t = nsym; t; --t, ++symp) {
 		unsigned int const st_bind = ELF_ST_BIND(symp->st_info);
 
-		if (txtndx == w2(symp->st_shndx)
+		if (txtndx == mf->w2(symp->st_shndx)
 			/* avoid STB_WEAK */
 		    && (STB_LOCAL == st_bind || STB_GLOBAL == st_bind)) {
 			/* function symbols on ARM have quirks, avoid them */
-			if (w2(ehdr->e_machine) == EM_ARM
+			if (mf->w2(ehdr->e_machine) == EM_ARM
 			    && ELF_ST_TYPE(symp->st_info) == STT_FUNC)
 				continue;
 
-			*recvalp = _w(symp->st_value);
+			*recvalp = mf->_w(symp->st_value);
 			return symp - sym0;
 		}
 	}
-	fprintf(stderr, "Cannot find symbol for section %d: %s.\n",
+	fprintf(mf->err, "Cannot find symbol for section %d: %s.\n",
 		txtndx, txtname);
-	fail_file();
+	fail_file(mf);
 }
 
 
 /* Evade ISO C restriction: no declaration after statement in has_rel_mcount. */
 static char const *
-__has_rel_mcount(Elf_Shdr const *const relhdr,  /* is SHT_REL or SHT_RELA */
+__has_rel_mcount(struct mcount_file *const mf,
+		 Elf_Shdr const *const relhdr,  /* is SHT_REL or SHT_RELA */
 		 Elf_Shdr const *const shdr0,
 		 char const *const shstrtab,
 		 char const *const fname)
 {
 	/* .sh_info depends on .sh_type == SHT_REL[,A] */
-	Elf_Shdr const *const txthdr = &shdr0[w(relhdr->sh_info)];
-	char const *const txtname = &shstrtab[w(txthdr->sh_name)];
+	Elf_Shdr const *const txthdr = &shdr0[mf->w(relhdr->sh_info)];
+	char const *const txtname = &shstrtab[mf->w(txthdr->sh_name)];
 
 	if (strcmp("__mcount_loc", txtname) == 0) {
-		fprintf(stderr, "warning: __mcount_loc already exists: %s\n",
+		fprintf(mf->err, "warning: __mcount_loc already exists: %s\n",
 			fname);
-		succeed_file();
+		succeed_file(mf);
 	}
-	if (w(txthdr->sh_type) != SHT_PROGBITS ||
-	    !(_w(txthdr->sh_flags) & SHF_EXECINSTR))
+	if (mf->w(txthdr->sh_type) != SHT_PROGBITS ||
+	    !(mf->_w(txthdr->sh_flags) & SHF_EXECINSTR))
 		return NULL;
 	return txtname;
 }
 
-static char const *has_rel_mcount(Elf_Shdr const *const relhdr,
+static char const *has_rel_mcount(struct mcount_file *const mf,
+				  Elf_Shdr const *const relhdr,
 				  Elf_Shdr const *const shdr0,
 				  char const *const shstrtab,
 				  char const *const fname)
 {
-	if (w(relhdr->sh_type) != SHT_REL && w(relhdr->sh_type) != SHT_RELA)
+	if (mf->w(relhdr->sh_type) != SHT_REL &&
+	    mf->w(relhdr->sh_type) != SHT_RELA)
 		return NULL;
-	return __has_rel_mcount(relhdr, shdr0, shstrtab, fname);
+	return __has_rel_mcount(mf, relhdr, shdr0, shstrtab, fname);
 }
 
 
-static unsigned tot_relsize(Elf_Shdr const *const shdr0,
+static unsigned tot_relsize(struct mcount_file *const mf,
+			    Elf_Shdr const *const shdr0,
 			    unsigned nhdr,
 			    const char *const shstrtab,
 			    const char *const fname)
@@ -491,9 +509,9 @@ static unsigned tot_relsize(Elf_Shdr const *const shdr0,
 	char const *txtname;
 
 	for (; nhdr; --nhdr, ++shdrp) {
-		txtname = has_rel_mcount(shdrp, shdr0, shstrtab, fname);
+		txtname = has_rel_mcount(mf, shdrp, shdr0, shstrtab, fname);
 		if (txtname && is_mcounted_section_name(txtname))
-			totrelsz += _w(shdrp->sh_size);
+			totrelsz += mf->_w(shdrp->sh_size);
 	}
 	return totrelsz;
 }
@@ -501,54 +519,56 @@ static unsigned tot_relsize(Elf_Shdr const *const shdr0,
 
 /* Overall supervision for Elf32 ET_REL file. */
 static void
-do_func(Elf_Ehdr *const ehdr, char const *const fname, unsigned const reltype)
+do_func(struct mcount_file *const mf, Elf_Ehdr *const ehdr,
+	unsigned const reltype)
 {
-	Elf_Shdr *const shdr0 = (Elf_Shdr *)(_w(ehdr->e_shoff)
+	char const *const fname = mf->fname;
+	Elf_Shdr *const shdr0 = (Elf_Shdr *)(mf->_w(ehdr->e_shoff)
 		+ (void *)ehdr);
-	unsigned const nhdr = w2(ehdr->e_shnum);
-	Elf_Shdr *const shstr = &shdr0[w2(ehdr->e_shstrndx)];
-	char const *const shstrtab = (char const *)(_w(shstr->sh_offset)
+	unsigned const nhdr = mf->w2(ehdr->e_shnum);
+	Elf_Shdr *const shstr = &shdr0[mf->w2(ehdr->e_shstrndx)];
+	char const *const shstrtab = (char const *)(mf->_w(shstr->sh_offset)
 		+ (void *)ehdr);
 
 	Elf_Shdr const *relhdr;
 	unsigned k;
 
 	/* Upper bound on space: assume all relevant relocs are for mcount. */
-	unsigned const totrelsz = tot_relsize(shdr0, nhdr, shstrtab, fname);
-	Elf_Rel *const mrel0 = umalloc(totrelsz);
+	unsigned const totrelsz = tot_relsize(mf, shdr0, nhdr, shstrtab, fname);
+	Elf_Rel *const mrel0 = umalloc(mf, totrelsz);
 	Elf_Rel *      mrelp = mrel0;
 
 	/* 2*sizeof(address) <= sizeof(Elf_Rel) */
-	uint_t *const mloc0 = umalloc(totrelsz>>1);
+	uint_t *const mloc0 = umalloc(mf, totrelsz>>1);
 	uint_t *      mlocp = mloc0;
 
 	unsigned rel_entsize = 0;
 	unsigned symsec_sh_link = 0;
 
 	for (relhdr = shdr0, k = nhdr; k; --k, ++relhdr) {
-		char const *const txtname = has_rel_mcount(relhdr, shdr0,
+		char const *const txtname = has_rel_mcount(mf, relhdr, shdr0,
 			shstrtab, fname);
 		if (txtname && is_mcounted_section_name(txtname)) {
 			uint_t recval = 0;
-			unsigned const recsym = find_secsym_ndx(
-				w(relhdr->sh_info), txtname, &recval,
-				&shdr0[symsec_sh_link = w(relhdr->sh_link)],
+			unsigned const recsym = find_secsym_ndx(mf,
+				mf->w(relhdr->sh_info), txtname, &recval,
+				&shdr0[symsec_sh_link = mf->w(relhdr->sh_link)],
 				ehdr);
 
-			rel_entsize = _w(relhdr->sh_entsize);
-			mlocp = sift_rel_mcount(mlocp,
+			rel_entsize = mf->_w(relhdr->sh_entsize);
+			mlocp = sift_rel_mcount(mf, mlocp,
 				(void *)mlocp - (void *)mloc0, &mrelp,
 				relhdr, ehdr, recsym, recval, reltype);
-		} else if (txtname && (warn_on_notrace_sect || make_nop)) {
+		} else if (txtname && (warn_on_notrace_sect || mf->make_nop)) {
 			/*
 			 * This section is ignored by ftrace, but still
 			 * has mcount calls. Convert them to nops now.
 			 */
-			nop_mcount(relhdr, ehdr, txtname);
+			nop_mcount(mf, relhdr, ehdr, txtname);
 		}
 	}
 	if (mloc0 != mlocp) {
-		append_func(ehdr, shstr, mloc0, mlocp, mrel0, mrelp,
+		append_func(mf, ehdr, shstr, mloc0, mlocp, mrel0, mrelp,
 			    rel_entsize, symsec_sh_link);
 	}
 	free(mrel0);
@@ -112,6 +112,8 @@
 #include <stdio.h>
 #include <limits.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 int insert_extra_deps;
@@ -121,8 +123,9 @@ char *cmdline;
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: fixdep [-e] <depfile> <target> <cmdline>\n");
+	fprintf(stderr, "Usage: fixdep [-e] [-c <cache>] <depfile> <target> <cmdline>\n");
 	fprintf(stderr, " -e  insert extra dependencies given on stdin\n");
+	fprintf(stderr, " -c  keep the CONFIG_ words of each header in <cache>\n");
 	exit(1);
 }
 
@@ -168,15 +171,34 @@ static void do_extra_deps(void)
 	}
 }
 
-struct item {
-	struct item	*next;
+/*
+ * Sets of CONFIG_ words, open addressing with linear probing.  The set
+ * only points at the names, it doesn't copy them.
+ */
+struct word {
+	const char	*name;
 	unsigned int	len;
 	unsigned int	hash;
-	char		name[0];
 };
 
-#define HASHSZ 256
-static struct item *hashtab[HASHSZ];
+struct word_set {
+	struct word	*tab;
+	unsigned int	size;		/* a power of two */
+	unsigned int	count;
+};
+
+#define WORD_SET_MIN	256
+
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+
+	if (!p) {
+		perror("fixdep:malloc");
+		exit(1);
+	}
+	return p;
+}
 
 static unsigned int strhash(const char *str, unsigned int sz)
 {
@@ -188,37 +210,180 @@ static unsigned int strhash(const char *str, unsigned int sz)
 	return hash;
 }
 
+static struct word *word_slot(struct word_set *set, const char *name,
+			      unsigned int len, unsigned int hash)
+{
+	unsigned int i = hash & (set->size - 1);
+	struct word *w;
+
+	for (;;) {
+		w = &set->tab[i];
+		if (!w->name || (w->hash == hash && w->len == len &&
+				 memcmp(w->name, name, len) == 0))
+			return w;
+		i = (i + 1) & (set->size - 1);
+	}
+}
+
 /*
- * Lookup a value in the configuration string.
+ * Find a word, or the free slot to put it in.  Keeps the set at most half
+ * full, so the slot stays good until the next call.
  */
-static int is_defined_config(const char *name, int len, unsigned int hash)
+static struct word *word_set_find(struct word_set *set, const char *name,
+				  unsigned int len, unsigned int hash)
 {
-	struct item *aux;
-
-	for (aux = hashtab[hash % HASHSZ]; aux; aux = aux->next) {
-		if (aux->hash == hash && aux->len == len &&
-		    memcmp(aux->name, name, len) == 0)
-			return 1;
+	struct word *old = set->tab, *w;
+	unsigned int i, old_size = set->size;
+
+	if (2 * (set->count + 1) > set->size) {
+		set->size = old_size ? 2 * old_size : WORD_SET_MIN;
+		set->tab = xmalloc(set->size * sizeof(*set->tab));
+		memset(set->tab, 0, set->size * sizeof(*set->tab));
+		for (i = 0; i < old_size; i++) {
+			if (!old[i].name)
+				continue;
+			w = word_slot(set, old[i].name, old[i].len, old[i].hash);
+			*w = old[i];
+		}
+		free(old);
 	}
-	return 0;
+
+	return word_slot(set, name, len, hash);
+}
+
+static void word_set_fill(struct word_set *set, struct word *w,
+			  const char *name, unsigned int len, unsigned int hash)
+{
+	w->name = name;
+	w->len = len;
+	w->hash = hash;
+	set->count++;
+}
+
+static void word_set_clear(struct word_set *set)
+{
+	if (set->count)
+		memset(set->tab, 0, set->size * sizeof(*set->tab));
+	set->count = 0;
 }
 
+/* The CONFIG_* words printed so far */
+static struct word_set used_configs;
+
 /*
- * Add a new value to the configuration string.
+ * Header cache (-c file)
+ *
+ * Every object of a build re-reads much the same few hundred headers,
+ * and reading them costs more than the rest of fixdep together.  So the
+ * CONFIG_ words found in each file are kept in a cache shared by all the
+ * fixdep runs of a build, with the file's device, inode, size, mtime and
+ * ctime.  A file that still stat()s the same is not opened again.
+ *
+ * Many fixdeps run at once, so the cache is a log: a header, then one
+ * record per file scanned.  Each run appends its records with a single
+ * O_APPEND write at the end.  The last record for a path wins.  A
+ * reader maps the file as it is when it starts and stops at a record
+ * that isn't all there yet.  A record is only trusted once its checksum
+ * matches, and a corrupt one gets the cache thrown away.
+ *
+ * Once most records have been superseded by later ones for the same
+ * path, a reader rewrites the cache with only the live records; see
+ * cache_compact().  Outgrowing CACHE_MAX_SIZE still gets the cache
+ * thrown away, in case compacting never gets it down.
+ *
+ * Files modified within the last two seconds are not recorded, as they
+ * may be written again within the same timestamp (the racy-git problem).
+ *
+ * The words of a file are recorded in the order they first appear in it,
+ * so replaying them prints exactly what scanning the file again would.
  */
-static void define_config(const char *name, int len, unsigned int hash)
-{
-	struct item *aux = malloc(sizeof(*aux) + len);
+#define CACHE_MAGIC	"FIXDEPC1"
+#define CACHE_MAX_SIZE	(32 << 20)
+#define CACHE_COMPACT_MIN	(1 << 20)	/* not worth it below this */
+
+struct cache_record {
+	uint32_t	len;		/* whole record, a multiple of 8 */
+	uint32_t	check;		/* fnv32 of what follows */
+	uint32_t	path_hash;
+	uint32_t	nr_words;
+	uint64_t	dev, ino, size;
+	int64_t		mtime_sec, mtime_nsec;
+	int64_t		ctime_sec, ctime_nsec;
+	char		data[];		/* path, then the words, NUL terminated */
+};
 
-	if (!aux) {
-		perror("fixdep:malloc");
-		exit(1);
+static const char *cache_name;
+static int cache_fd = -1;		/* for appending records */
+static void *cache_map;
+static size_t cache_map_size;
+static struct word_set cache_index;	/* paths, pointing into cache_map */
+static time_t start_time;
+
+/* The records of this run, to be appended at the end */
+static char *record;
+static size_t record_len, record_alloc;
+static size_t record_cur = -1;		/* offset of the file being scanned */
+static struct word_set record_words;
+
+static void record_put(const void *p, size_t len)
+{
+	if (record_len + len > record_alloc) {
+		record_alloc = 2 * (record_len + len);
+		record = realloc(record, record_alloc);
+		if (!record) {
+			perror("fixdep:malloc");
+			exit(1);
+		}
 	}
-	memcpy(aux->name, name, len);
-	aux->len = len;
-	aux->hash = hash;
-	aux->next = hashtab[hash % HASHSZ];
-	hashtab[hash % HASHSZ] = aux;
+	memcpy(record + record_len, p, len);
+	record_len += len;
+}
+
+static void record_start(const char *filename, const struct stat *st)
+{
+	struct cache_record r;
+
+	memset(&r, 0, sizeof(r));
+	r.path_hash = strhash(filename, strlen(filename));
+	r.dev = st->st_dev;
+	r.ino = st->st_ino;
+	r.size = st->st_size;
+	r.mtime_sec = st->st_mtim.tv_sec;
+	r.mtime_nsec = st->st_mtim.tv_nsec;
+	r.ctime_sec = st->st_ctim.tv_sec;
+	r.ctime_nsec = st->st_ctim.tv_nsec;
+
+	record_cur = record_len;
+	record_put(&r, sizeof(r));
+	record_put(filename, strlen(filename) + 1);
+	word_set_clear(&record_words);
+}
+
+static void record_word(const char *m, unsigned int slen, unsigned int hash)
+{
+	struct word *w = word_set_find(&record_words, m, slen, hash);
+	struct cache_record *r;
+
+	if (w->name)
+		return;
+	/* m points into the file being scanned, which stays put till then */
+	word_set_fill(&record_words, w, m, slen, hash);
+	record_put(m, slen);
+	record_put("", 1);
+	r = (struct cache_record *)(record + record_cur);
+	r->nr_words++;
+}
+
+static void record_finish(void)
+{
+	static const char pad[8];
+	struct cache_record *r;
+
+	record_put(pad, -record_len & 7);
+	r = (struct cache_record *)(record + record_cur);
+	r->len = record_len - record_cur;
+	r->check = strhash((char *)r + 8, r->len - 8);
+	record_cur = -1;
 }
 
 /*
@@ -227,14 +392,238 @@ static void define_config(const char *name, int len, unsigned int hash)
 static void use_config(const char *m, int slen)
 {
 	unsigned int hash = strhash(m, slen);
+	struct word *w;
+	char *name;
 
-	if (is_defined_config(m, slen, hash))
-	    return;
+	if (record_cur != -1)
+		record_word(m, slen, hash);
 
-	define_config(m, slen, hash);
+	w = word_set_find(&used_configs, m, slen, hash);
+	if (w->name)
+		return;
+
+	name = xmalloc(slen);
+	memcpy(name, m, slen);
+	word_set_fill(&used_configs, w, name, slen, hash);
 	print_config(m, slen);
 }
 
+static void cache_drop(void)
+{
+	unlink(cache_name);
+	if (cache_fd >= 0) {
+		close(cache_fd);
+		cache_fd = -1;
+	}
+	if (cache_map) {
+		munmap(cache_map, cache_map_size);
+		cache_map = NULL;
+	}
+	word_set_clear(&cache_index);
+}
+
+/* Create the cache with its header, unless somebody else just did. */
+static void cache_create(void)
+{
+	char tmpname[PATH_MAX];
+	int fd, ok;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.%d", cache_name,
+		     (int)getpid()) >= sizeof(tmpname))
+		return;
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return;
+	ok = write(fd, CACHE_MAGIC, 8) == 8;
+	if (!close(fd) && ok)
+		link(tmpname, cache_name);
+	unlink(tmpname);
+}
+
+static void cache_close(void)
+{
+	/* whoever reads past a torn record throws the cache away */
+	if (cache_fd >= 0 && record_len &&
+	    write(cache_fd, record, record_len) != (ssize_t)record_len)
+		cache_drop();
+}
+
+/*
+ * Write the records still indexed to a new file and rename it over the
+ * cache.  Runs that append to the old file in the meantime lose their
+ * records, which only costs a rescan of those headers later.
+ */
+static void cache_compact(void)
+{
+	const struct cache_record *r;
+	const char *p, *end;
+	char tmpname[PATH_MAX];
+	struct word *w;
+	char *buf;
+	size_t len;
+	int fd, ok;
+
+	if (snprintf(tmpname, sizeof(tmpname), "%s.%d", cache_name,
+		     (int)getpid()) >= sizeof(tmpname))
+		return;
+	buf = malloc(cache_map_size);
+	if (!buf)
+		return;
+
+	memcpy(buf, CACHE_MAGIC, 8);
+	len = 8;
+	p = (const char *)cache_map + 8;
+	end = (const char *)cache_map + cache_map_size;
+	while (end - p >= sizeof(*r)) {
+		r = (const struct cache_record *)p;
+		if (r->len > end - p)
+			break;
+		w = word_set_find(&cache_index, r->data, strlen(r->data),
+				  r->path_hash);
+		if (w->name == r->data &&
+		    r->check == strhash((const char *)r + 8, r->len - 8)) {
+			memcpy(buf + len, r, r->len);
+			len += r->len;
+		}
+		p += r->len;
+	}
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd >= 0) {
+		ok = write(fd, buf, len) == (ssize_t)len;
+		if (close(fd) || !ok || rename(tmpname, cache_name))
+			unlink(tmpname);
+	}
+	free(buf);
+}
+
+/*
+ * Map the cache and index its records by path.  Anything going wrong
+ * just leaves fixdep without a cache.
+ */
+static void cache_open(void)
+{
+	const struct cache_record *r;
+	const char *p, *end;
+	struct stat st;
+	struct word *w;
+	unsigned int nr_records = 0;
+	size_t len;
+	int fd;
+
+	start_time = time(NULL);
+
+	fd = open(cache_name, O_RDONLY);
+	if (fd < 0) {
+		cache_create();
+		fd = open(cache_name, O_RDONLY);
+		if (fd < 0)
+			return;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < 8) {
+		close(fd);
+		return;
+	}
+	if (st.st_size > CACHE_MAX_SIZE) {
+		close(fd);
+		cache_drop();
+		return;
+	}
+	cache_map_size = st.st_size;
+	cache_map = mmap(NULL, cache_map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (cache_map == MAP_FAILED) {
+		cache_map = NULL;
+		return;
+	}
+	if (memcmp(cache_map, CACHE_MAGIC, 8)) {
+		cache_drop();
+		return;
+	}
+
+	p = (const char *)cache_map + 8;
+	end = (const char *)cache_map + cache_map_size;
+	while (end - p >= sizeof(*r)) {
+		r = (const struct cache_record *)p;
+		if (r->len > end - p)
+			break;		/* still being written */
+		len = r->len - sizeof(*r);
+		if (r->len < sizeof(*r) || r->len & 7 ||
+		    !memchr(r->data, 0, len)) {
+			cache_drop();
+			return;
+		}
+		w = word_set_find(&cache_index, r->data, strlen(r->data),
+				  r->path_hash);
+		if (!w->name)
+			word_set_fill(&cache_index, w, r->data,
+				      strlen(r->data), r->path_hash);
+		else
+			w->name = r->data;	/* a later record wins */
+		nr_records++;
+		p += r->len;
+	}
+
+	if (cache_map_size > CACHE_COMPACT_MIN &&
+	    nr_records > 2 * cache_index.count)
+		cache_compact();
+
+	cache_fd = open(cache_name, O_WRONLY | O_APPEND);
+}
+
+/*
+ * Replay the words cached for a file.  Returns 0 if there is no record
+ * that is good for the file as it is now.
+ */
+static int cache_lookup(const char *filename, const struct stat *st)
+{
+	unsigned int len = strlen(filename), hash = strhash(filename, len);
+	const struct cache_record *r;
+	const char *p, *end;
+	struct word *w;
+	uint32_t i;
+
+	if (!cache_index.count)
+		return 0;
+	w = word_set_find(&cache_index, filename, len, hash);
+	if (!w->name)
+		return 0;
+
+	r = (const struct cache_record *)(w->name - sizeof(*r));
+	if (r->dev != st->st_dev || r->ino != st->st_ino ||
+	    r->size != st->st_size ||
+	    r->mtime_sec != st->st_mtim.tv_sec ||
+	    r->mtime_nsec != st->st_mtim.tv_nsec ||
+	    r->ctime_sec != st->st_ctim.tv_sec ||
+	    r->ctime_nsec != st->st_ctim.tv_nsec)
+		return 0;
+
+	if (r->check != strhash((const char *)r + 8, r->len - 8)) {
+		cache_drop();
+		return 0;
+	}
+
+	/* check the words are all there before using any */
+	p = r->data + len + 1;
+	end = (const char *)r + r->len;
+	for (i = 0; i < r->nr_words; i++) {
+		p = memchr(p, 0, end - p);
+		if (!p++) {
+			cache_drop();
+			return 0;
+		}
+	}
+
+	p = r->data + len + 1;
+	for (i = 0; i < r->nr_words; i++) {
+		len = strlen(p);
+		use_config(p, len);
+		p += len + 1;
+	}
+
+	return 1;
+}
+
 static void parse_config_file(const char *p)
 {
 	const char *q, *r;
@@ -268,9 +657,14 @@ static int strrcmp(const char *s, const char *sub)
 
 static void do_config_file(const char *filename)
 {
+	static char *map;
+	static size_t map_size;
 	struct stat st;
 	int fd;
-	char *map;
+
+	if (cache_index.count && !stat(filename, &st) &&
+	    cache_lookup(filename, &st))
+		return;
 
 	fd = open(filename, O_RDONLY);
 	if (fd < 0) {
@@ -283,15 +677,17 @@ static void do_config_file(const char *filename)
 		perror(filename);
 		exit(2);
 	}
-	if (st.st_size == 0) {
-		close(fd);
-		return;
-	}
-	map = malloc(st.st_size + 1);
-	if (!map) {
-		perror("fixdep: malloc");
-		close(fd);
-		return;
+	/* the buffer is reused for all the files of a run */
+	if (st.st_size + 1 > map_size) {
+		free(map);
+		map_size = st.st_size + 1;
+		map = malloc(map_size);
+		if (!map) {
+			perror("fixdep: malloc");
+			map_size = 0;
+			close(fd);
+			return;
+		}
 	}
 	if (read(fd, map, st.st_size) != st.st_size) {
 		perror("fixdep: read");
@@ -301,9 +697,14 @@ static void do_config_file(const char *filename)
 	map[st.st_size] = '\0';
 	close(fd);
 
+	if (cache_fd >= 0 && st.st_mtime < start_time - 1 &&
+	    st.st_ctime < start_time - 1)
+		record_start(filename, &st);
+
 	parse_config_file(map);
 
-	free(map);
+	if (record_cur != -1)
+		record_finish();
 }
 
 /*
@@ -432,18 +833,33 @@ static void print_deps(void)
 
 int main(int argc, char *argv[])
 {
-	if (argc == 5 && !strcmp(argv[1], "-e")) {
-		insert_extra_deps = 1;
-		argv++;
-	} else if (argc != 4)
+	while (argc > 4) {
+		if (!strcmp(argv[1], "-e")) {
+			insert_extra_deps = 1;
+			argv++;
+			argc--;
+		} else if (!strcmp(argv[1], "-c") && argc > 5) {
+			cache_name = argv[2];
+			argv += 2;
+			argc -= 2;
+		} else
+			usage();
+	}
+	if (argc != 4)
 		usage();
 
 	depfile = argv[1];
 	target = argv[2];
 	cmdline = argv[3];
 
+	if (cache_name)
+		cache_open();
+
 	print_cmdline();
 	print_deps();
 
+	if (cache_name)
+		cache_close();
+
 	return 0;
 }
@@ -0,0 +1,485 @@
+/*
+ * Build cache: skip a compile whose inputs have not changed.
+ *
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307
+ *                                                                   USA
+ */
+
+#include <sys/stat.h>
+
+#include "dtc.h"
+#include "version_gen.h"
+
+/*
+ * With --cache, a successful compile leaves a sidecar file next to its
+ * output:
+ *
+ *	dtc-cache 1 <options hash>
+ *	input <size> <hash> <file>	every file opened, in order
+ *	absent <file>			include paths tried and not found
+ *	node <hash> <path>		with --stats: every node of the tree
+ *	output <size> <hash> <file>
+ *
+ * The next compile with the same options first checks the sidecar: if
+ * every input still has the same contents, no include would now be
+ * found somewhere else and the output is still what was written, the
+ * output is left alone and only the dependency file is rewritten.  The
+ * options hash covers the command line (bar --stats) and the dtc
+ * binary itself.
+ *
+ * Anything else is a full compile; includes are textual, so a changed
+ * one means parsing everything after it again anyway.  The subtree
+ * hashes only serve to tell, with --stats, which parts of the tree the
+ * change touched, so they are only worked out and recorded then, and
+ * compared with those of the last compile that had --stats too.
+ */
+#define CACHE_MAGIC	"dtc-cache 1"
+
+struct cache_input {
+	char *name;
+	bool absent;
+	off_t size;
+	uint64_t hash;
+};
+
+static struct {
+	const char *name;	/* sidecar file, NULL if not caching */
+	bool untracked;		/* an input we can't check later */
+	uint64_t options;
+	struct cache_input *inputs;
+	int nr_inputs;
+} cache;
+
+uint64_t cache_hash(uint64_t h, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	uint64_t w;
+
+	/* FNV-1a, taken a word at a time with an extra shift to mix the
+	 * high bits back down */
+	for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 32;
+	}
+	for (; len; p++, len--)
+		h = (h ^ *p) * 0x100000001b3ULL;
+
+	return h;
+}
+
+static int cache_hash_file(const char *name, off_t *size, uint64_t *hash)
+{
+	char buf[65536];
+	size_t len;
+	FILE *f;
+
+	f = fopen(name, "rb");
+	if (!f)
+		return -1;
+
+	*size = 0;
+	*hash = CACHE_HASH_INIT;
+	while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+		*hash = cache_hash(*hash, buf, len);
+		*size += len;
+	}
+	if (ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static void cache_clear(void)
+{
+	int i;
+
+	for (i = 0; i < cache.nr_inputs; i++)
+		free(cache.inputs[i].name);
+	free(cache.inputs);
+	memset(&cache, 0, sizeof(cache));
+}
+
+void cache_begin(const char *name, int argc, char *argv[])
+{
+	struct stat st;
+	int i;
+
+	cache_clear();
+	if (!name)
+		return;
+
+	cache.name = name;
+	cache.options = cache_hash(CACHE_HASH_INIT, DTC_VERSION,
+				   strlen(DTC_VERSION));
+	for (i = 0; i < argc; i++) {
+		/* asking what changed must not itself change anything */
+		if (streq(argv[i], "--stats"))
+			continue;
+		cache.options = cache_hash(cache.options, argv[i],
+					   strlen(argv[i]) + 1);
+	}
+
+	/* a rebuilt dtc may compile the same input differently */
+	if (stat("/proc/self/exe", &st) == 0) {
+		uint64_t id[] = { st.st_dev, st.st_ino, st.st_size,
+				  st.st_mtime };
+
+		cache.options = cache_hash(cache.options, id, sizeof(id));
+	}
+}
+
+static void cache_add(const char *name, bool absent)
+{
+	struct cache_input *in;
+
+	cache.inputs = xrealloc(cache.inputs,
+				(cache.nr_inputs + 1) * sizeof(*cache.inputs));
+	in = &cache.inputs[cache.nr_inputs++];
+	in->name = xstrdup(name);
+	in->absent = absent;
+	in->size = 0;
+	in->hash = 0;
+
+	if (!absent && cache_hash_file(name, &in->size, &in->hash))
+		cache.untracked = true;
+}
+
+void cache_note_input(const char *fullname)
+{
+	if (!cache.name)
+		return;
+
+	if (fullname)
+		cache_add(fullname, false);
+	else
+		cache.untracked = true;
+}
+
+void cache_note_absent(const char *fullname)
+{
+	if (cache.name)
+		cache_add(fullname, true);
+}
+
+static void cache_write_depfile(const char *depname, const char *outname,
+				char **inputs, int nr_inputs)
+{
+	FILE *f;
+	int i;
+
+	f = fopen(depname, "w");
+	if (!f)
+		die("Couldn't open dependency file %s: %s\n", depname,
+		    strerror(errno));
+
+	fprintf(f, "%s:", outname);
+	for (i = 0; i < nr_inputs; i++)
+		fprintf(f, " %s", inputs[i]);
+	fputc('\n', f);
+	fclose(f);
+}
+
+/* Split "<word> <word> ... <rest of line>" in place */
+static int cache_split(char *line, char **fields, int nr_fields)
+{
+	int n;
+
+	line[strcspn(line, "\n")] = '\0';
+	for (n = 0; n < nr_fields - 1; n++) {
+		fields[n] = line;
+		line = strchr(line, ' ');
+		if (!line)
+			return n + 1;
+		*line++ = '\0';
+	}
+	fields[n] = line;
+
+	return nr_fields;
+}
+
+bool cache_fresh(const char *outname, const char *depname, bool stats)
+{
+	char **inputs = NULL, *fields[4];
+	char *line = NULL, *expect = NULL;
+	bool fresh = false, output = false;
+	unsigned long long size, hash;
+	int nr_inputs = 0, i;
+	size_t linesize = 0;
+	uint64_t h;
+	off_t sz;
+	FILE *f;
+
+	if (!cache.name || streq(outname, "-"))
+		return false;
+
+	f = fopen(cache.name, "r");
+	if (!f)
+		return false;
+
+	xasprintf(&expect, "%s %016llx\n", CACHE_MAGIC,
+		  (unsigned long long)cache.options);
+	if ((getline(&line, &linesize, f) < 0) || !streq(line, expect))
+		goto out;
+
+	while (getline(&line, &linesize, f) >= 0) {
+		if (strneq(line, "input ", 6)) {
+			if ((cache_split(line, fields, 4) != 4)
+			    || (sscanf(fields[1], "%llu", &size) != 1)
+			    || (sscanf(fields[2], "%llx", &hash) != 1))
+				goto out;
+
+			/* same file, same answer */
+			for (i = 0; i < nr_inputs; i++)
+				if (streq(inputs[i], fields[3]))
+					break;
+			if (i == nr_inputs
+			    && (cache_hash_file(fields[3], &sz, &h)
+				|| (sz != size) || (h != hash)))
+				goto out;
+
+			inputs = xrealloc(inputs,
+					  (nr_inputs + 1) * sizeof(*inputs));
+			inputs[nr_inputs++] = xstrdup(fields[3]);
+		} else if (strneq(line, "absent ", 7)) {
+			line[strcspn(line, "\n")] = '\0';
+			if (access(line + 7, F_OK) == 0)
+				goto out;
+		} else if (strneq(line, "node ", 5)) {
+			continue;
+		} else if (strneq(line, "output ", 7)) {
+			if ((cache_split(line, fields, 4) != 4)
+			    || (sscanf(fields[1], "%llu", &size) != 1)
+			    || (sscanf(fields[2], "%llx", &hash) != 1)
+			    || !streq(fields[3], outname)
+			    || cache_hash_file(outname, &sz, &h)
+			    || (sz != size) || (h != hash))
+				goto out;
+			output = true;
+		} else {
+			goto out;
+		}
+	}
+
+	/* a sidecar cut short never gets as far as its output line */
+	fresh = output && !ferror(f);
+
+	if (fresh && depname)
+		cache_write_depfile(depname, outname, inputs, nr_inputs);
+	if (fresh && stats)
+		fprintf(stderr, "cache: %s is up to date\n", outname);
+
+out:
+	for (i = 0; i < nr_inputs; i++)
+		free(inputs[i]);
+	free(inputs);
+	free(expect);
+	free(line);
+	fclose(f);
+
+	return fresh;
+}
+
+/*
+ * Subtree hashes of the previous build, to compare with the new ones.
+ * Nodes come out in the same order every time, so this is only a list.
+ */
+struct cache_node {
+	char *path;
+	uint64_t hash;
+};
+
+struct cache_nodes {
+	struct cache_node *old;
+	int nr_old, next;
+	FILE *f;
+	int nr_nodes, nr_changed;
+
+	/* per depth: has a node below the last one finished changed? */
+	bool *below;
+	int max_depth;
+};
+
+static struct cache_node *cache_read_nodes(const char *name, int *nr)
+{
+	struct cache_node *nodes = NULL;
+	unsigned long long hash;
+	char *line = NULL, *fields[3];
+	size_t linesize = 0;
+	FILE *f;
+
+	*nr = 0;
+	f = fopen(name, "r");
+	if (!f)
+		return NULL;
+
+	while (getline(&line, &linesize, f) >= 0) {
+		if (!strneq(line, "node ", 5)
+		    || (cache_split(line, fields, 3) != 3)
+		    || (sscanf(fields[1], "%llx", &hash) != 1))
+			continue;
+
+		nodes = xrealloc(nodes, (*nr + 1) * sizeof(*nodes));
+		nodes[*nr].path = xstrdup(fields[2]);
+		nodes[*nr].hash = hash;
+		(*nr)++;
+	}
+
+	free(line);
+	fclose(f);
+	return nodes;
+}
+
+static char *cache_node_path(struct node *node)
+{
+	char *parent, *path;
+
+	if (!node->parent)
+		return xstrdup("/");
+
+	parent = cache_node_path(node->parent);
+	path = join_path(parent, node->name);
+	free(parent);
+
+	return path;
+}
+
+static bool cache_node_changed(struct cache_nodes *cn, const char *path,
+			       uint64_t hash)
+{
+	int i;
+
+	/* usually the next one; otherwise the tree's shape changed */
+	for (i = 0; i < cn->nr_old; i++) {
+		struct cache_node *old = &cn->old[(cn->next + i) % cn->nr_old];
+
+		if (streq(old->path, path)) {
+			cn->next = (cn->next + i + 1) % cn->nr_old;
+			return old->hash != hash;
+		}
+	}
+
+	return true;
+}
+
+static void cache_write_node(struct node *node, uint64_t hash, void *arg)
+{
+	struct cache_nodes *cn = arg;
+	struct node *n;
+	bool changed, below;
+	char *path;
+	int depth = 0;
+
+	for (n = node; n->parent; n = n->parent)
+		depth++;
+	if (depth + 1 >= cn->max_depth) {
+		cn->below = xrealloc(cn->below, (depth + 2) * sizeof(bool));
+		memset(cn->below + cn->max_depth, 0,
+		       (depth + 2 - cn->max_depth) * sizeof(bool));
+		cn->max_depth = depth + 2;
+	}
+
+	path = cache_node_path(node);
+	fprintf(cn->f, "node %016llx %s\n", (unsigned long long)hash, path);
+	cn->nr_nodes++;
+
+	/* subtrees are hashed children first */
+	below = cn->below[depth + 1];
+	cn->below[depth + 1] = false;
+
+	if (cn->old) {
+		changed = cache_node_changed(cn, path, hash);
+		if (changed) {
+			cn->nr_changed++;
+			cn->below[depth] = true;
+
+			/* report where a change is, not every node above */
+			if (!below)
+				fprintf(stderr, "cache: %s changed\n", path);
+		}
+	}
+
+	free(path);
+}
+
+void cache_write(struct dt_info *dti, const char *outname, bool stats)
+{
+	struct cache_nodes cn;
+	char *tmpname;
+	off_t size;
+	uint64_t hash;
+	int i;
+
+	if (!cache.name)
+		return;
+
+	if (cache.untracked || streq(outname, "-")
+	    || cache_hash_file(outname, &size, &hash)) {
+		/* don't leave a stale sidecar behind */
+		unlink(cache.name);
+		return;
+	}
+
+	memset(&cn, 0, sizeof(cn));
+	if (stats)
+		cn.old = cache_read_nodes(cache.name, &cn.nr_old);
+
+	/* write it whole or not at all */
+	xasprintf(&tmpname, "%s.tmp", cache.name);
+	cn.f = fopen(tmpname, "w");
+	if (!cn.f)
+		die("Couldn't open cache file %s: %s\n", tmpname,
+		    strerror(errno));
+
+	fprintf(cn.f, "%s %016llx\n", CACHE_MAGIC,
+		(unsigned long long)cache.options);
+	for (i = 0; i < cache.nr_inputs; i++) {
+		struct cache_input *in = &cache.inputs[i];
+
+		if (in->absent)
+			fprintf(cn.f, "absent %s\n", in->name);
+		else
+			fprintf(cn.f, "input %llu %016llx %s\n",
+				(unsigned long long)in->size,
+				(unsigned long long)in->hash, in->name);
+	}
+
+	if (stats)
+		subtree_hash(dti->dt, cache_write_node, &cn);
+
+	fprintf(cn.f, "output %llu %016llx %s\n", (unsigned long long)size,
+		(unsigned long long)hash, outname);
+
+	if (fclose(cn.f))
+		die("Couldn't write cache file %s: %s\n", tmpname,
+		    strerror(errno));
+	if (rename(tmpname, cache.name))
+		die("Couldn't rename %s to %s: %s\n", tmpname, cache.name,
+		    strerror(errno));
+
+	if (cn.old)
+		fprintf(stderr, "cache: %d of %d nodes changed\n",
+			cn.nr_changed, cn.nr_nodes);
+
+	for (i = 0; i < cn.nr_old; i++)
+		free(cn.old[i].path);
+	free(cn.old);
+	free(cn.below);
+	free(tmpname);
+}
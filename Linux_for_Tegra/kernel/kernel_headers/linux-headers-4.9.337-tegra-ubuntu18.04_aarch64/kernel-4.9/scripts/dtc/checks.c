@@ -18,6 +18,8 @@
  *                                                                   USA
  */
 
+#include <time.h>
+
 #include "dtc.h"
 
 #ifdef TRACE_CHECKS
@@ -49,11 +51,17 @@ struct check {
 	bool warn, error;
 	enum checkstatus status;
 	bool inprogress;
+	bool fixup;		/* modifies the tree, see order_checks() */
+	int walk;		/* tree walk this check runs in, 0 if unused */
+	FILE *log;		/* messages, held until the walk is over */
+	char *logbuf;
+	size_t loglen;
+	uint64_t ns;		/* time spent in fn, for --stats */
 	int num_prereqs;
 	struct check **prereq;
 };
 
-#define CHECK_ENTRY(_nm, _fn, _d, _w, _e, ...)	       \
+#define CHECK_ENTRY(_nm, _fn, _d, _w, _e, _fix, ...)	       \
 	static struct check *_nm##_prereqs[] = { __VA_ARGS__ }; \
 	static struct check _nm = { \
 		.name = #_nm, \
@@ -61,16 +69,19 @@ struct check {
 		.data = (_d), \
 		.warn = (_w), \
 		.error = (_e), \
+		.fixup = (_fix), \
 		.status = UNCHECKED, \
 		.num_prereqs = ARRAY_SIZE(_nm##_prereqs), \
 		.prereq = _nm##_prereqs, \
 	};
 #define WARNING(_nm, _fn, _d, ...) \
-	CHECK_ENTRY(_nm, _fn, _d, true, false, __VA_ARGS__)
+	CHECK_ENTRY(_nm, _fn, _d, true, false, false, __VA_ARGS__)
 #define ERROR(_nm, _fn, _d, ...) \
-	CHECK_ENTRY(_nm, _fn, _d, false, true, __VA_ARGS__)
+	CHECK_ENTRY(_nm, _fn, _d, false, true, false, __VA_ARGS__)
 #define CHECK(_nm, _fn, _d, ...) \
-	CHECK_ENTRY(_nm, _fn, _d, false, false, __VA_ARGS__)
+	CHECK_ENTRY(_nm, _fn, _d, false, false, false, __VA_ARGS__)
+#define ERROR_FIXUP(_nm, _fn, _d, ...) \
+	CHECK_ENTRY(_nm, _fn, _d, false, true, true, __VA_ARGS__)
 
 #ifdef __GNUC__
 static inline void check_msg(struct check *c, const char *fmt, ...) __attribute__((format (printf, 2, 3)));
@@ -82,10 +93,15 @@ static inline void check_msg(struct check *c, const char *fmt, ...)
 
 	if ((c->warn && (quiet < 1))
 	    || (c->error && (quiet < 2))) {
-		fprintf(stderr, "%s (%s): ",
+		if (!c->log) {
+			c->log = open_memstream(&c->logbuf, &c->loglen);
+			if (!c->log)
+				die("open_memstream(): %s\n", strerror(errno));
+		}
+		fprintf(c->log, "%s (%s): ",
 			(c->error) ? "ERROR" : "Warning", c->name);
-		vfprintf(stderr, fmt, ap);
-		fprintf(stderr, "\n");
+		vfprintf(c->log, fmt, ap);
+		fprintf(c->log, "\n");
 	}
 	va_end(ap);
 }
@@ -97,58 +113,6 @@ static inline void check_msg(struct check *c, const char *fmt, ...)
 		check_msg((c), __VA_ARGS__); \
 	} while (0)
 
-static void check_nodes_props(struct check *c, struct dt_info *dti, struct node *node)
-{
-	struct node *child;
-
-	TRACE(c, "%s", node->fullpath);
-	if (c->fn)
-		c->fn(c, dti, node);
-
-	for_each_child(node, child)
-		check_nodes_props(c, dti, child);
-}
-
-static bool run_check(struct check *c, struct dt_info *dti)
-{
-	struct node *dt = dti->dt;
-	bool error = false;
-	int i;
-
-	assert(!c->inprogress);
-
-	if (c->status != UNCHECKED)
-		goto out;
-
-	c->inprogress = true;
-
-	for (i = 0; i < c->num_prereqs; i++) {
-		struct check *prq = c->prereq[i];
-		error = error || run_check(prq, dti);
-		if (prq->status != PASSED) {
-			c->status = PREREQ;
-			check_msg(c, "Failed prerequisite '%s'",
-				  c->prereq[i]->name);
-		}
-	}
-
-	if (c->status != UNCHECKED)
-		goto out;
-
-	check_nodes_props(c, dti, dt);
-
-	if (c->status == UNCHECKED)
-		c->status = PASSED;
-
-	TRACE(c, "\tCompleted, status %d", c->status);
-
-out:
-	c->inprogress = false;
-	if ((c->status != PASSED) && (c->error))
-		error = true;
-	return error;
-}
-
 /*
  * Utility check functions
  */
@@ -433,9 +397,9 @@ static void check_explicit_phandles(struct check *c, struct dt_info *dti,
 		return;
 	}
 
-	node->phandle = phandle;
+	set_node_phandle(node, phandle);
 }
-ERROR(explicit_phandles, check_explicit_phandles, NULL);
+ERROR_FIXUP(explicit_phandles, check_explicit_phandles, NULL);
 
 static void check_name_properties(struct check *c, struct dt_info *dti,
 				  struct node *node)
@@ -459,13 +423,11 @@ static void check_name_properties(struct check *c, struct dt_info *dti,
 		/* The name property is correct, and therefore redundant.
 		 * Delete it */
 		*pp = prop->next;
-		free(prop->name);
 		data_free(prop->val);
-		free(prop);
 	}
 }
 ERROR_IF_NOT_STRING(name_is_string, "name");
-ERROR(name_properties, check_name_properties, NULL, &name_is_string);
+ERROR_FIXUP(name_properties, check_name_properties, NULL, &name_is_string);
 
 /*
  * Reference fixup functions
@@ -501,7 +463,7 @@ static void fixup_phandle_references(struct check *c, struct dt_info *dti,
 		}
 	}
 }
-ERROR(phandle_references, fixup_phandle_references, NULL,
+ERROR_FIXUP(phandle_references, fixup_phandle_references, NULL,
       &duplicate_node_names, &explicit_phandles);
 
 static void fixup_path_references(struct check *c, struct dt_info *dti,
@@ -531,7 +493,8 @@ static void fixup_path_references(struct check *c, struct dt_info *dti,
 		}
 	}
 }
-ERROR(path_references, fixup_path_references, NULL, &duplicate_node_names);
+ERROR_FIXUP(path_references, fixup_path_references, NULL,
+	    &duplicate_node_names);
 
 /*
  * Semantic checks
@@ -713,6 +676,105 @@ static struct check *check_table[] = {
 	&always_fail,
 };
 
+/*
+ * Rather than walking the tree once per check, consecutive checks share
+ * a walk and are all run on a node before moving on to the next one.
+ * The checks are taken in the order the old one-walk-per-check scheme
+ * ran them (check_table order, prerequisites first) and a new walk is
+ * started whenever a check
+ *  - has a prerequisite in the current walk, which must have seen the
+ *    whole tree (and have its final status) before the check starts, or
+ *  - is a fixup, or follows one: a change to one node can be seen by
+ *    other checks looking at other nodes, and a fixup must not have run
+ *    at all if an earlier check fails with an error.
+ * Messages are held back until the end of each walk and then printed
+ * check by check, so the output is the same as running the checks one
+ * after the other.
+ */
+static int order_checks(struct check *c, struct check **order, int n)
+{
+	struct check *prev;
+	bool new_walk;
+	int i;
+
+	if (c->walk)
+		return n;
+
+	assert(!c->inprogress);
+	c->inprogress = true;
+
+	for (i = 0; i < c->num_prereqs; i++)
+		n = order_checks(c->prereq[i], order, n);
+
+	c->inprogress = false;
+
+	if (!n) {
+		c->walk = 1;
+	} else {
+		prev = order[n - 1];
+		new_walk = c->fixup || prev->fixup;
+		for (i = 0; i < c->num_prereqs; i++)
+			if (c->prereq[i]->walk == prev->walk)
+				new_walk = true;
+		c->walk = prev->walk + new_walk;
+	}
+
+	order[n++] = c;
+	return n;
+}
+
+static bool check_timing;
+
+static uint64_t check_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void check_nodes_props(struct check **checks, int n,
+			      struct dt_info *dti, struct node *node)
+{
+	struct node *child;
+	uint64_t start;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct check *c = checks[i];
+
+		if (c->status == PREREQ)
+			continue;
+
+		TRACE(c, "%s", node->fullpath);
+		if (!c->fn)
+			continue;
+
+		if (check_timing) {
+			start = check_clock();
+			c->fn(c, dti, node);
+			c->ns += check_clock() - start;
+		} else {
+			c->fn(c, dti, node);
+		}
+	}
+
+	for_each_child(node, child)
+		check_nodes_props(checks, n, dti, child);
+}
+
+static void flush_check_log(struct check *c, bool print)
+{
+	if (!c->log)
+		return;
+
+	fclose(c->log);
+	if (print)
+		fwrite(c->logbuf, 1, c->loglen, stderr);
+	free(c->logbuf);
+	c->log = NULL;
+}
+
 static void enable_warning_error(struct check *c, bool warn, bool error)
 {
 	int i;
@@ -774,16 +836,55 @@ void parse_checks_option(bool warn, bool error, const char *arg)
 	die("Unrecognized check name \"%s\"\n", name);
 }
 
-void process_checks(bool force, struct dt_info *dti)
+void process_checks(bool force, bool timing, struct dt_info *dti)
 {
-	int i;
-	int error = 0;
+	struct check *order[ARRAY_SIZE(check_table)];
+	int i, j, k, n = 0;
+	bool error = false;
 
 	for (i = 0; i < ARRAY_SIZE(check_table); i++) {
 		struct check *c = check_table[i];
 
 		if (c->warn || c->error)
-			error = error || run_check(c, dti);
+			n = order_checks(c, order, n);
+	}
+
+	check_timing = timing;
+
+	for (i = 0; (i < n) && !error; i = j) {
+		for (j = i; (j < n) && (order[j]->walk == order[i]->walk); j++) {
+			struct check *c = order[j];
+
+			for (k = 0; k < c->num_prereqs; k++) {
+				struct check *prq = c->prereq[k];
+
+				if (prq->status != PASSED) {
+					c->status = PREREQ;
+					check_msg(c, "Failed prerequisite '%s'",
+						  prq->name);
+				}
+			}
+		}
+
+		check_nodes_props(order + i, j - i, dti, dti->dt);
+
+		/* As before, nothing after the first error counts */
+		for (k = i; k < j; k++) {
+			struct check *c = order[k];
+
+			flush_check_log(c, !error);
+			if (error) {
+				c->status = UNCHECKED;
+				continue;
+			}
+
+			if (c->status == UNCHECKED)
+				c->status = PASSED;
+			TRACE(c, "\tCompleted, status %d", c->status);
+
+			if ((c->status != PASSED) && c->error)
+				error = true;
+		}
 	}
 
 	if (error) {
@@ -797,3 +898,24 @@ void process_checks(bool force, struct dt_info *dti)
 		}
 	}
 }
+
+void print_check_stats(FILE *f)
+{
+	static const char * const status[] = {
+		[UNCHECKED] = "not run",
+		[PREREQ] = "prereq failed",
+		[PASSED] = "passed",
+		[FAILED] = "failed",
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(check_table); i++) {
+		struct check *c = check_table[i];
+
+		if (!c->walk)
+			continue;
+
+		fprintf(f, "check: %-36s walk %2d %9.3f ms  %s\n", c->name,
+			c->walk, c->ns / 1e6, status[c->status]);
+	}
+}
@@ -58,7 +58,7 @@ static struct node *read_fstree(const char *dirname)
 					"WARNING: Cannot open %s: %s\n",
 					tmpname, strerror(errno));
 			} else {
-				prop = build_property(xstrdup(de->d_name),
+				prop = build_property(arena_strdup(de->d_name),
 						      data_copy_file(pfile,
 								     st.st_size));
 				add_property(tree, prop);
@@ -68,7 +68,8 @@ static struct node *read_fstree(const char *dirname)
 			struct node *newchild;
 
 			newchild = read_fstree(tmpname);
-			newchild = name_node(newchild, xstrdup(de->d_name));
+			newchild = name_node(newchild,
+					     arena_strdup(de->d_name));
 			add_child(tree, newchild);
 		}
 
@@ -83,6 +84,9 @@ struct dt_info *dt_from_fs(const char *dirname)
 {
 	struct node *tree;
 
+	/* there's no telling later whether a directory tree changed */
+	cache_note_input(NULL);
+
 	tree = read_fstree(dirname);
 	tree = name_node(tree, "");
 
@@ -239,6 +239,48 @@ const char *_fdt_find_string(const char *strtab, int tabsize, const char *s)
 	return NULL;
 }
 
+static void _fdt_swap(char *a, char *b, int size)
+{
+	char tmp;
+
+	while (size--) {
+		tmp = *a;
+		*a++ = *b;
+		*b++ = tmp;
+	}
+}
+
+static void _fdt_sift(char *base, int root, int n, int size,
+		      int (*cmp)(const void *, const void *))
+{
+	int child;
+
+	while ((child = 2 * root + 1) < n) {
+		if ((child + 1 < n)
+		    && (cmp(base + child * size, base + (child + 1) * size) < 0))
+			child++;
+		if (cmp(base + root * size, base + child * size) >= 0)
+			return;
+		_fdt_swap(base + root * size, base + child * size, size);
+		root = child;
+	}
+}
+
+/* heapsort: libfdt_env.h need not provide qsort() */
+void _fdt_heapsort(void *base, int n, int size,
+		   int (*cmp)(const void *, const void *))
+{
+	char *b = base;
+	int i;
+
+	for (i = n / 2 - 1; i >= 0; i--)
+		_fdt_sift(b, i, n, size, cmp);
+	for (i = n - 1; i > 0; i--) {
+		_fdt_swap(b, b + i * size, size);
+		_fdt_sift(b, 0, i, size, cmp);
+	}
+}
+
 int fdt_move(const void *fdt, void *buf, int bufsize)
 {
 	FDT_CHECK_HEADER(fdt);
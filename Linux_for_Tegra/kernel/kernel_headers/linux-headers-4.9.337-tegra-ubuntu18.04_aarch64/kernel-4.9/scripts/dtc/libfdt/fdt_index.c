@@ -0,0 +1,405 @@
+/*
+ * libfdt - Flat Device Tree manipulation
+ *
+ * libfdt is dual licensed: you can use it either under the terms of
+ * the GPL, or the BSD license, at your option.
+ *
+ *  a) This library is free software; you can redistribute it and/or
+ *     modify it under the terms of the GNU General Public License as
+ *     published by the Free Software Foundation; either version 2 of the
+ *     License, or (at your option) any later version.
+ *
+ *     This library is distributed in the hope that it will be useful,
+ *     but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *     MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *     GNU General Public License for more details.
+ *
+ *     You should have received a copy of the GNU General Public
+ *     License along with this library; if not, write to the Free
+ *     Software Foundation, Inc., 51 Franklin St, Fifth Floor, Boston,
+ *     MA 02110-1301 USA
+ *
+ * Alternatively,
+ *
+ *  b) Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *     1. Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *     2. Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ *     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ *     CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ *     INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ *     MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *     DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ *     CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *     SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ *     NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *     LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *     HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *     CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ *     OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ *     EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "libfdt_env.h"
+
+#include <fdt.h>
+#include <libfdt.h>
+
+#include "libfdt_internal.h"
+
+/*
+ * The side index is a flat snapshot of the structure block: one record
+ * per node (offset, parent, depth, phandle) in tree order, a phandle
+ * table sorted by phandle and a table of every 'compatible' string
+ * sorted by string.  It lives entirely in a buffer owned by the caller,
+ * who passes it to the fdt_*_idx() functions; the rest of libfdt knows
+ * nothing about it.
+ *
+ * Layout of the buffer:
+ *	struct fdt_index | nodes -> | phandles | ... | <- compat
+ * Node records grow upwards and compatible records downwards during
+ * the single pass over the tree; the phandle table is filled in from
+ * the node records afterwards.
+ */
+#define FDT_INDEX_MAGIC		0x1d0fd7e1
+#define FDT_INDEX_ALIGN		(sizeof(void *))
+
+struct fdt_index_node {
+	int32_t offset;		/* structure block offset */
+	int32_t parent;		/* record number of the parent, -1 for root */
+	int32_t depth;
+	uint32_t phandle;
+};
+
+struct fdt_index_phandle {
+	uint32_t phandle;
+	int32_t offset;
+};
+
+struct fdt_index_compat {
+	const char *str;	/* points into the blob's 'compatible' value */
+	int32_t offset;
+};
+
+struct fdt_index {
+	uint32_t magic;
+	const void *fdt;	/* the blob this index was built for */
+	uint32_t off_dt_struct;
+	uint32_t size_dt_struct;
+	int num_nodes;
+	int num_phandles;
+	int num_compat;
+	struct fdt_index_node *nodes;
+	struct fdt_index_phandle *phandles;	/* by phandle, then offset */
+	struct fdt_index_compat *compat;	/* by string, then offset */
+};
+
+static int _fdt_index_space(int nodes, int phandles, int compat)
+{
+	return (FDT_INDEX_ALIGN - 1) + sizeof(struct fdt_index)
+		+ nodes * sizeof(struct fdt_index_node)
+		+ phandles * sizeof(struct fdt_index_phandle)
+		+ compat * sizeof(struct fdt_index_compat);
+}
+
+static int _fdt_index_count_compat(const void *fdt, int offset,
+				   struct fdt_index_compat *compat, int room,
+				   int *count)
+{
+	const char *list, *end;
+	int len;
+
+	list = fdt_getprop(fdt, offset, "compatible", &len);
+	if (!list)
+		return (len == -FDT_ERR_NOTFOUND) ? 0 : len;
+
+	for (end = list + len; list < end; list += len + 1) {
+		len = strnlen(list, end - list);
+		if (list + len >= end)
+			break; /* unterminated, can never match */
+		if (compat) {
+			if (*count >= room)
+				return -FDT_ERR_NOSPACE;
+			compat[-1 - *count].str = list;
+			compat[-1 - *count].offset = offset;
+		}
+		(*count)++;
+	}
+
+	return 0;
+}
+
+int fdt_index_size(const void *fdt)
+{
+	int offset, depth = 0;
+	int nodes = 0, phandles = 0, compat = 0;
+	int err;
+
+	FDT_CHECK_HEADER(fdt);
+
+	for (offset = 0; (offset >= 0) && (depth >= 0);
+	     offset = fdt_next_node(fdt, offset, &depth)) {
+		nodes++;
+		if (fdt_get_phandle(fdt, offset))
+			phandles++;
+		err = _fdt_index_count_compat(fdt, offset, NULL, 0, &compat);
+		if (err)
+			return err;
+	}
+	if ((offset < 0) && (offset != -FDT_ERR_NOTFOUND))
+		return offset;
+
+	return _fdt_index_space(nodes, phandles, compat);
+}
+
+static int _fdt_index_cmp_phandle(const void *a, const void *b)
+{
+	const struct fdt_index_phandle *pa = a, *pb = b;
+
+	if (pa->phandle != pb->phandle)
+		return (pa->phandle < pb->phandle) ? -1 : 1;
+	return pa->offset - pb->offset;
+}
+
+static int _fdt_index_cmp_compat(const void *a, const void *b)
+{
+	const struct fdt_index_compat *ca = a, *cb = b;
+	int cmp = strcmp(ca->str, cb->str);
+
+	return cmp ? cmp : ca->offset - cb->offset;
+}
+
+int fdt_index_build(const void *fdt, struct fdt_index *idx, int bufsize)
+{
+	uintptr_t start = (uintptr_t)idx;
+	uintptr_t end = start + bufsize;
+	struct fdt_index_node *node;
+	struct fdt_index_phandle *ph;
+	struct fdt_index_compat *top;
+	int offset, depth = 0, prev = -1;
+	int room, i, err;
+
+	FDT_CHECK_HEADER(fdt);
+
+	if (bufsize < 0)
+		return -FDT_ERR_NOSPACE;
+
+	if (start & (FDT_INDEX_ALIGN - 1))
+		return -FDT_ERR_BADOFFSET;
+	end &= ~(uintptr_t)(FDT_INDEX_ALIGN - 1);
+	if (end < start + sizeof(*idx))
+		return -FDT_ERR_NOSPACE;
+
+	memset(idx, 0, sizeof(*idx));
+	idx->nodes = (struct fdt_index_node *)(idx + 1);
+	top = (struct fdt_index_compat *)end;
+
+	for (offset = 0; (offset >= 0) && (depth >= 0);
+	     offset = fdt_next_node(fdt, offset, &depth)) {
+		node = idx->nodes + idx->num_nodes;
+		room = ((char *)top - (char *)(node + 1)) / (int)sizeof(*top);
+		if (room < idx->num_compat)
+			return -FDT_ERR_NOSPACE;
+
+		node->offset = offset;
+		node->depth = depth;
+		node->phandle = fdt_get_phandle(fdt, offset);
+
+		/* climb from the previous node to this one's parent */
+		while ((prev >= 0) && (idx->nodes[prev].depth >= depth))
+			prev = idx->nodes[prev].parent;
+		node->parent = prev;
+		prev = idx->num_nodes++;
+
+		if (node->phandle)
+			idx->num_phandles++;
+
+		err = _fdt_index_count_compat(fdt, offset, top, room,
+					      &idx->num_compat);
+		if (err)
+			return err;
+	}
+	if ((offset < 0) && (offset != -FDT_ERR_NOTFOUND))
+		return offset;
+
+	idx->compat = top - idx->num_compat;
+	idx->phandles = (struct fdt_index_phandle *)
+		(idx->nodes + idx->num_nodes);
+	if ((char *)(idx->phandles + idx->num_phandles) > (char *)idx->compat)
+		return -FDT_ERR_NOSPACE;
+
+	for (i = 0, ph = idx->phandles; i < idx->num_nodes; i++) {
+		node = &idx->nodes[i];
+		if (node->phandle) {
+			ph->phandle = node->phandle;
+			ph->offset = node->offset;
+			ph++;
+		}
+	}
+
+	_fdt_heapsort(idx->phandles, idx->num_phandles, sizeof(*idx->phandles),
+		      _fdt_index_cmp_phandle);
+	_fdt_heapsort(idx->compat, idx->num_compat, sizeof(*idx->compat),
+		      _fdt_index_cmp_compat);
+
+	idx->fdt = fdt;
+	idx->off_dt_struct = fdt_off_dt_struct(fdt);
+	idx->size_dt_struct = fdt_size_dt_struct(fdt);
+	idx->magic = FDT_INDEX_MAGIC;
+
+	return 0;
+}
+
+void fdt_index_invalidate(struct fdt_index *idx)
+{
+	idx->magic = 0;
+}
+
+/* The index if it was built for this blob and still matches it, or NULL */
+static const struct fdt_index *_fdt_index_check(const void *fdt,
+						const struct fdt_index *idx)
+{
+	if (!idx || (idx->magic != FDT_INDEX_MAGIC) || (idx->fdt != fdt))
+		return NULL;
+
+	if (fdt_check_header(fdt) != 0)
+		return NULL;
+
+	/* catch edits made since the index was built */
+	if ((fdt_off_dt_struct(fdt) != idx->off_dt_struct)
+	    || (fdt_size_dt_struct(fdt) != idx->size_dt_struct))
+		return NULL;
+
+	return idx;
+}
+
+static const struct fdt_index_node *_fdt_index_node(const struct fdt_index *idx,
+						    int nodeoffset)
+{
+	int lo = 0, hi = idx->num_nodes;
+
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (idx->nodes[mid].offset < nodeoffset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < idx->num_nodes) && (idx->nodes[lo].offset == nodeoffset))
+		return &idx->nodes[lo];
+	return NULL;
+}
+
+int fdt_supernode_atdepth_offset_idx(const void *fdt,
+				     const struct fdt_index *idx,
+				     int nodeoffset, int supernodedepth,
+				     int *nodedepth)
+{
+	const struct fdt_index_node *node;
+
+	idx = _fdt_index_check(fdt, idx);
+	if (!idx || (supernodedepth < 0)
+	    || !(node = _fdt_index_node(idx, nodeoffset)))
+		return fdt_supernode_atdepth_offset(fdt, nodeoffset,
+						    supernodedepth, nodedepth);
+
+	if (nodedepth)
+		*nodedepth = node->depth;
+	if (supernodedepth > node->depth)
+		return -FDT_ERR_NOTFOUND;
+	while (node->depth > supernodedepth)
+		node = &idx->nodes[node->parent];
+	return node->offset;
+}
+
+int fdt_node_depth_idx(const void *fdt, const struct fdt_index *idx,
+		       int nodeoffset)
+{
+	int nodedepth;
+	int err;
+
+	err = fdt_supernode_atdepth_offset_idx(fdt, idx, nodeoffset, 0,
+					       &nodedepth);
+	if (err)
+		return (err < 0) ? err : -FDT_ERR_INTERNAL;
+	return nodedepth;
+}
+
+int fdt_parent_offset_idx(const void *fdt, const struct fdt_index *idx,
+			  int nodeoffset)
+{
+	int nodedepth = fdt_node_depth_idx(fdt, idx, nodeoffset);
+
+	if (nodedepth < 0)
+		return nodedepth;
+	return fdt_supernode_atdepth_offset_idx(fdt, idx, nodeoffset,
+						nodedepth - 1, NULL);
+}
+
+int fdt_node_offset_by_phandle_idx(const void *fdt,
+				   const struct fdt_index *idx,
+				   uint32_t phandle)
+{
+	int lo, hi;
+
+	idx = _fdt_index_check(fdt, idx);
+	if (!idx || (phandle == 0) || (phandle == -1))
+		return fdt_node_offset_by_phandle(fdt, phandle);
+
+	lo = 0;
+	hi = idx->num_phandles;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (idx->phandles[mid].phandle < phandle)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < idx->num_phandles) && (idx->phandles[lo].phandle == phandle))
+		return idx->phandles[lo].offset;
+	return -FDT_ERR_NOTFOUND;
+}
+
+int fdt_node_offset_by_compatible_idx(const void *fdt,
+				      const struct fdt_index *idx,
+				      int startoffset, const char *compatible)
+{
+	const struct fdt_index_compat *c;
+	int lo, hi;
+	int cmp;
+
+	idx = _fdt_index_check(fdt, idx);
+	if (!idx || ((startoffset >= 0) && !_fdt_index_node(idx, startoffset)))
+		return fdt_node_offset_by_compatible(fdt, startoffset,
+						     compatible);
+
+	/* first entry for compatible located after startoffset */
+	lo = 0;
+	hi = idx->num_compat;
+	while (lo < hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		c = &idx->compat[mid];
+		cmp = strcmp(c->str, compatible);
+		if ((cmp < 0) || ((cmp == 0) && (c->offset <= startoffset)))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((lo < idx->num_compat)
+	    && (strcmp(idx->compat[lo].str, compatible) == 0))
+		return idx->compat[lo].offset;
+	return -FDT_ERR_NOTFOUND;
+}
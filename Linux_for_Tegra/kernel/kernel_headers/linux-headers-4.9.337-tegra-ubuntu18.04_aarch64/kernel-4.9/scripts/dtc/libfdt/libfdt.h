@@ -768,7 +768,8 @@ int fdt_get_path(const void *fdt, int nodeoffset, char *buf, int buflen);
  * will return nodeoffset itself.
  *
  * NOTE: This function is expensive, as it must scan the device tree
- * structure from the start to nodeoffset.
+ * structure from the start to nodeoffset.  See
+ * fdt_supernode_atdepth_offset_idx() for a version using an index.
  *
  * returns:
  *	structure block offset of the node at node offset's ancestor
@@ -793,7 +794,8 @@ int fdt_supernode_atdepth_offset(const void *fdt, int nodeoffset,
  * has depth 0, its immediate subnodes depth 1 and so forth.
  *
  * NOTE: This function is expensive, as it must scan the device tree
- * structure from the start to nodeoffset.
+ * structure from the start to nodeoffset.  See fdt_node_depth_idx()
+ * for a version using an index.
  *
  * returns:
  *	depth of the node at nodeoffset (>=0), on success
@@ -815,7 +817,8 @@ int fdt_node_depth(const void *fdt, int nodeoffset);
  * nodeoffset as a subnode).
  *
  * NOTE: This function is expensive, as it must scan the device tree
- * structure from the start to nodeoffset, *twice*.
+ * structure from the start to nodeoffset, *twice*.  See
+ * fdt_parent_offset_idx() for a version using an index.
  *
  * returns:
  *	structure block offset of the parent of the node at nodeoffset
@@ -1086,6 +1089,130 @@ int fdt_address_cells(const void *fdt, int nodeoffset);
 int fdt_size_cells(const void *fdt, int nodeoffset);
 
 
+/**********************************************************************/
+/* Read-only functions (side index)                                   */
+/**********************************************************************/
+
+struct fdt_index;
+
+/**
+ * fdt_index_size - size of the buffer needed to index a blob
+ * @fdt: pointer to the device tree blob
+ *
+ * fdt_index_size() returns the number of bytes fdt_index_build()
+ * needs to index the given tree.
+ *
+ * returns:
+ *	buffer size in bytes (>0), on success
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_size(const void *fdt);
+
+/**
+ * fdt_index_build - index a blob for fast read-only queries
+ * @fdt: pointer to the device tree blob
+ * @idx: buffer to hold the index, aligned as for malloc()
+ * @bufsize: size of the buffer at idx
+ *
+ * fdt_index_build() scans the tree once and records, in idx, the
+ * parent and depth of every node along with tables mapping phandles
+ * and 'compatible' strings to node offsets, for use by the fdt_*_idx()
+ * functions below.  The buffer belongs to the caller; libfdt keeps no
+ * reference to it.
+ *
+ * The index is tied to the blob at fdt: passed any other blob, the
+ * fdt_*_idx() functions ignore it and scan instead.  The same happens
+ * when the structure block has visibly changed size or place, but
+ * other edits go unnoticed, so after changing the blob the caller must
+ * rebuild the index or call fdt_index_invalidate().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, bufsize is too small, see fdt_index_size()
+ *	-FDT_ERR_BADOFFSET, idx is not suitably aligned
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_index_build(const void *fdt, struct fdt_index *idx, int bufsize);
+
+/**
+ * fdt_index_invalidate - mark an index as out of date
+ * @idx: index previously filled by fdt_index_build()
+ *
+ * After fdt_index_invalidate() the fdt_*_idx() functions no longer use
+ * idx until it is rebuilt.
+ */
+void fdt_index_invalidate(struct fdt_index *idx);
+
+/**
+ * fdt_supernode_atdepth_offset_idx - fdt_supernode_atdepth_offset() using
+ *	an index
+ * @fdt: pointer to the device tree blob
+ * @idx: index built for fdt by fdt_index_build(), or NULL
+ * @nodeoffset: offset of the node whose parent to find
+ * @supernodedepth: depth of the ancestor to find
+ * @nodedepth: pointer to an integer variable (will be overwritten) or NULL
+ *
+ * Returns the same as fdt_supernode_atdepth_offset(), answering from
+ * idx without scanning the structure block.  When idx is NULL, was not
+ * built for fdt or is out of date, or nodeoffset is not a node it
+ * knows, it falls back to fdt_supernode_atdepth_offset().  The same
+ * holds for the other fdt_*_idx() functions below.
+ */
+int fdt_supernode_atdepth_offset_idx(const void *fdt,
+				     const struct fdt_index *idx,
+				     int nodeoffset, int supernodedepth,
+				     int *nodedepth);
+
+/**
+ * fdt_node_depth_idx - fdt_node_depth() using an index
+ * @fdt: pointer to the device tree blob
+ * @idx: index built for fdt by fdt_index_build(), or NULL
+ * @nodeoffset: offset of the node whose depth to find
+ */
+int fdt_node_depth_idx(const void *fdt, const struct fdt_index *idx,
+		       int nodeoffset);
+
+/**
+ * fdt_parent_offset_idx - fdt_parent_offset() using an index
+ * @fdt: pointer to the device tree blob
+ * @idx: index built for fdt by fdt_index_build(), or NULL
+ * @nodeoffset: offset of the node whose parent to find
+ */
+int fdt_parent_offset_idx(const void *fdt, const struct fdt_index *idx,
+			  int nodeoffset);
+
+/**
+ * fdt_node_offset_by_phandle_idx - fdt_node_offset_by_phandle() using an
+ *	index
+ * @fdt: pointer to the device tree blob
+ * @idx: index built for fdt by fdt_index_build(), or NULL
+ * @phandle: phandle value
+ */
+int fdt_node_offset_by_phandle_idx(const void *fdt,
+				   const struct fdt_index *idx,
+				   uint32_t phandle);
+
+/**
+ * fdt_node_offset_by_compatible_idx - fdt_node_offset_by_compatible()
+ *	using an index
+ * @fdt: pointer to the device tree blob
+ * @idx: index built for fdt by fdt_index_build(), or NULL
+ * @startoffset: only find nodes after this offset
+ * @compatible: 'compatible' string to match against
+ */
+int fdt_node_offset_by_compatible_idx(const void *fdt,
+				      const struct fdt_index *idx,
+				      int startoffset, const char *compatible);
+
+
 /**********************************************************************/
 /* Write-in-place functions                                           */
 /**********************************************************************/
@@ -1763,6 +1890,175 @@ int fdt_add_subnode(void *fdt, int parentoffset, const char *name);
  */
 int fdt_del_node(void *fdt, int nodeoffset);
 
+/**********************************************************************/
+/* Read-write transactions                                            */
+/**********************************************************************/
+
+/*
+ * A transaction queues property and node edits and applies them all
+ * with one rebuild of the structure block, rather than moving the
+ * tail of the blob once per edit.  The structures are only exposed so
+ * callers can provide the storage; their contents are private.
+ */
+struct fdt_txn_edit {
+	int type;
+	int target;
+	int seq;
+	int aux;
+	int newstr;
+	const char *name;
+	const void *val;
+	int len;
+};
+
+struct fdt_txn {
+	void *fdt;
+	int struct_size;
+	int strings_added;
+	int num_edits;
+	int max_edits;
+	struct fdt_txn_edit *edits;
+};
+
+/**
+ * fdt_txn_begin - start a batch of edits
+ * @txn: transaction to initialize
+ * @fdt: pointer to the device tree blob
+ * @edits: storage for the queued edits
+ * @max_edits: number of entries at edits
+ *
+ * fdt_txn_begin() prepares txn to queue edits to fdt.  Each queued
+ * call takes at most one entry of edits; repeated edits of the same
+ * property reuse their entry.
+ *
+ * Node offsets given to the fdt_txn_*() functions are those of the
+ * blob as it is now: queueing does not touch the blob, and it must
+ * not be modified by other means until fdt_txn_commit().  Names and
+ * property values are referenced, not copied, and must stay valid
+ * until then too.  As the commit moves the contents of the blob,
+ * they must not point into it: copy such data out first.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTATE, standard meanings
+ */
+int fdt_txn_begin(struct fdt_txn *txn, void *fdt,
+		  struct fdt_txn_edit *edits, int max_edits);
+
+/**
+ * fdt_txn_setprop - queue a property change
+ * @txn: transaction
+ * @nodeoffset: offset of the node, or a handle from fdt_txn_add_subnode()
+ * @name: name of the property to change
+ * @val: pointer to data to set the property value to
+ * @len: length of the property value
+ *
+ * Queues the equivalent of fdt_setprop().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, no free entry left in the transaction
+ *	-FDT_ERR_BADOFFSET, nodeoffset does not refer to a live node
+ *	-FDT_ERR_BADVALUE, name or val points into the blob
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_setprop(struct fdt_txn *txn, int nodeoffset, const char *name,
+		    const void *val, int len);
+
+#define fdt_txn_setprop_string(txn, nodeoffset, name, str) \
+	fdt_txn_setprop((txn), (nodeoffset), (name), (str), strlen(str)+1)
+
+/**
+ * fdt_txn_delprop - queue a property deletion
+ * @txn: transaction
+ * @nodeoffset: offset of the node, or a handle from fdt_txn_add_subnode()
+ * @name: name of the property to delete
+ *
+ * Queues the equivalent of fdt_delprop().
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOTFOUND, the node has no property of that name
+ *	-FDT_ERR_NOSPACE, no free entry left in the transaction
+ *	-FDT_ERR_BADOFFSET, nodeoffset does not refer to a live node
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_delprop(struct fdt_txn *txn, int nodeoffset, const char *name);
+
+/**
+ * fdt_txn_add_subnode - queue the creation of a subnode
+ * @txn: transaction
+ * @parentoffset: offset of the parent, or a handle for a queued node
+ * @name: name of the subnode to create
+ *
+ * Queues the equivalent of fdt_add_subnode().  The returned handle
+ * stands for the new node in later fdt_txn_*() calls of the same
+ * transaction; it is not an offset into the blob.
+ *
+ * returns:
+ *	handle for the new node (>=0), on success
+ *	-FDT_ERR_EXISTS, the parent already has a subnode of that name
+ *	-FDT_ERR_NOSPACE, no free entry left in the transaction
+ *	-FDT_ERR_BADOFFSET, parentoffset does not refer to a live node
+ *	-FDT_ERR_BADVALUE, name points into the blob
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_add_subnode(struct fdt_txn *txn, int parentoffset,
+			const char *name);
+
+/**
+ * fdt_txn_del_node - queue the deletion of a node
+ * @txn: transaction
+ * @nodeoffset: offset of the node, or a handle from fdt_txn_add_subnode()
+ *
+ * Queues the equivalent of fdt_del_node().  Edits already queued for
+ * the node and its subnodes are dropped, and their offsets or handles
+ * become invalid.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, no free entry left in the transaction
+ *	-FDT_ERR_BADOFFSET, nodeoffset does not refer to a live node
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_del_node(struct fdt_txn *txn, int nodeoffset);
+
+/**
+ * fdt_txn_commit - apply the queued edits
+ * @txn: transaction
+ *
+ * fdt_txn_commit() rewrites the blob once, leaving the same bytes
+ * (up to the end of the strings block) that calling fdt_setprop(),
+ * fdt_delprop(), fdt_add_subnode() and fdt_del_node() in the order
+ * the edits were queued would.  The one exception is a blob with
+ * FDT_NOP tags between sibling nodes, where new subnodes may land on
+ * the other side of the NOPs.
+ *
+ * The free space at the end of the blob must cover the largest amount
+ * by which the edits grow the blob ahead of any given point, at most
+ * the total size of everything added.  If it does not, nothing is
+ * changed.  Either way the transaction is empty afterwards and can be
+ * reused for further edits, with offsets taken from the updated blob.
+ *
+ * returns:
+ *	0, on success
+ *	-FDT_ERR_NOSPACE, there is insufficient free space in the blob
+ *	-FDT_ERR_BADSTATE, the blob changed size since fdt_txn_begin()
+ *	-FDT_ERR_BADLAYOUT,
+ *	-FDT_ERR_BADMAGIC,
+ *	-FDT_ERR_BADVERSION,
+ *	-FDT_ERR_BADSTRUCTURE,
+ *	-FDT_ERR_TRUNCATED, standard meanings
+ */
+int fdt_txn_commit(struct fdt_txn *txn);
+
 /**
  * fdt_overlay_apply - Applies a DT overlay on a base DT
  * @fdt: pointer to the base device tree blob
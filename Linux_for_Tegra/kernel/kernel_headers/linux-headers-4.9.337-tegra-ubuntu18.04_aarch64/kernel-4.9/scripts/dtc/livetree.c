@@ -20,6 +20,263 @@
 
 #include "dtc.h"
 
+/*
+ * Lookup index
+ *
+ * get_node_by_phandle(), get_node_by_label() and get_node_by_path()
+ * on the root of a tree are answered from hash tables built on first
+ * use.  add_child(), merge_nodes() and phandle assignment keep the
+ * tables current; anything that removes nodes or labels just throws
+ * the index away so it is rebuilt on the next lookup.
+ *
+ * The walks return the first match in tree order.  When a key is seen
+ * more than once (duplicate labels or phandles, or duplicate sibling
+ * names shadowing a path) the entry is marked ambiguous and lookups
+ * for it fall back to the walk, so results never differ from it.
+ */
+struct index_entry {
+	uint32_t hash;
+	const char *key;	/* label or path, NULL for phandles */
+	cell_t phandle;
+	struct node *node;	/* NULL if the key is ambiguous */
+	struct index_entry *next;
+};
+
+struct index_table {
+	struct index_entry **buckets;
+	int size;		/* power of 2 */
+	int count;
+};
+
+static struct tree_index {
+	struct node *root;
+	bool valid;
+	struct index_table phandles;
+	struct index_table labels;
+	struct index_table paths;
+} tree_index;
+
+static uint32_t index_hash_string(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s)
+		h = (h ^ (unsigned char)*s++) * 16777619;
+
+	return h;
+}
+
+static uint32_t index_hash_phandle(cell_t phandle)
+{
+	return phandle * 2654435761u;
+}
+
+static void index_table_free(struct index_table *t, bool free_keys)
+{
+	struct index_entry *e, *next;
+	int i;
+
+	for (i = 0; i < t->size; i++) {
+		for (e = t->buckets[i]; e; e = next) {
+			next = e->next;
+			if (free_keys)
+				free((char *)e->key);
+			free(e);
+		}
+	}
+	free(t->buckets);
+	memset(t, 0, sizeof(*t));
+}
+
+static void index_table_grow(struct index_table *t)
+{
+	struct index_entry **old = t->buckets;
+	int oldsize = t->size;
+	int i;
+
+	t->size = oldsize ? oldsize * 2 : 256;
+	t->buckets = xmalloc(t->size * sizeof(*t->buckets));
+	memset(t->buckets, 0, t->size * sizeof(*t->buckets));
+
+	for (i = 0; i < oldsize; i++) {
+		struct index_entry *e, *next;
+
+		for (e = old[i]; e; e = next) {
+			next = e->next;
+			e->next = t->buckets[e->hash & (t->size - 1)];
+			t->buckets[e->hash & (t->size - 1)] = e;
+		}
+	}
+	free(old);
+}
+
+static struct index_entry *index_table_find(struct index_table *t,
+					    uint32_t hash, const char *key,
+					    cell_t phandle)
+{
+	struct index_entry *e;
+
+	if (!t->size)
+		return NULL;
+
+	for (e = t->buckets[hash & (t->size - 1)]; e; e = e->next) {
+		if (e->hash != hash)
+			continue;
+		if (key ? streq(e->key, key) : (e->phandle == phandle))
+			return e;
+	}
+
+	return NULL;
+}
+
+/*
+ * Record node under the given key.  Returns false if a different node
+ * already had the key, which leaves it ambiguous.  A NULL node adds
+ * the key as ambiguous from the start.
+ */
+static bool index_table_add(struct index_table *t, uint32_t hash,
+			    const char *key, cell_t phandle, struct node *node)
+{
+	struct index_entry *e;
+
+	e = index_table_find(t, hash, key, phandle);
+	if (e) {
+		if (e->node != node)
+			e->node = NULL;
+		return false;
+	}
+
+	if (t->count >= t->size)
+		index_table_grow(t);
+
+	e = xmalloc(sizeof(*e));
+	e->hash = hash;
+	e->key = key;
+	e->phandle = phandle;
+	e->node = node;
+	e->next = t->buckets[hash & (t->size - 1)];
+	t->buckets[hash & (t->size - 1)] = e;
+	t->count++;
+
+	return true;
+}
+
+static void index_add_labels(struct node *node)
+{
+	struct label *l;
+
+	for_each_label(node->labels, l)
+		index_table_add(&tree_index.labels, index_hash_string(l->label),
+				l->label, 0, node);
+}
+
+static void index_add_phandle(struct node *node)
+{
+	if ((node->phandle == 0) || (node->phandle == -1))
+		return;
+
+	index_table_add(&tree_index.phandles, index_hash_phandle(node->phandle),
+			NULL, node->phandle, node);
+}
+
+/*
+ * Add node and its live descendants, path is the node's full path and
+ * is kept by the index or freed.  A shadowed node sits behind an
+ * earlier sibling of the same name, so the path walk can never reach
+ * it or anything below it.
+ */
+static void index_add_subtree(struct node *node, char *path, bool shadowed)
+{
+	struct node *child;
+	bool stored;
+
+	stored = index_table_add(&tree_index.paths, index_hash_string(path),
+				 path, 0, shadowed ? NULL : node);
+	if (!stored)
+		shadowed = true;
+
+	index_add_labels(node);
+	index_add_phandle(node);
+
+	for_each_child(node, child)
+		index_add_subtree(child, join_path(path, child->name),
+				  shadowed);
+
+	if (!stored)
+		free(path);
+}
+
+static void index_invalidate(void)
+{
+	tree_index.valid = false;
+}
+
+static void index_build(struct node *root)
+{
+	index_table_free(&tree_index.phandles, false);
+	index_table_free(&tree_index.labels, false);
+	index_table_free(&tree_index.paths, true);
+
+	tree_index.root = root;
+	tree_index.valid = true;
+	index_add_subtree(root, xstrdup("/"), false);
+}
+
+/*
+ * Drop the index along with the tree it was built for, before the
+ * tree's memory is reused for another one.
+ */
+void reset_tree_index(void)
+{
+	index_table_free(&tree_index.phandles, false);
+	index_table_free(&tree_index.labels, false);
+	index_table_free(&tree_index.paths, true);
+	memset(&tree_index, 0, sizeof(tree_index));
+}
+
+/* Is node part of the live tree the index was built for? */
+static bool index_covers(struct node *node)
+{
+	if (!tree_index.valid)
+		return false;
+
+	for (; node->parent; node = node->parent)
+		if (node->deleted)
+			return false;
+
+	return (node == tree_index.root) && !node->deleted;
+}
+
+static char *index_node_path(struct node *node)
+{
+	char *path, *tmp;
+
+	if (!node->parent)
+		return xstrdup("/");
+
+	tmp = index_node_path(node->parent);
+	path = join_path(tmp, node->name);
+	free(tmp);
+
+	return path;
+}
+
+/*
+ * Returns true if lookups on tree can be answered from the index,
+ * (re)building it if needed.  Only whole trees are indexed, lookups
+ * on a subtree always walk.
+ */
+static bool index_ready(struct node *tree)
+{
+	if (tree->parent || tree->deleted)
+		return false;
+
+	if (!tree_index.valid || (tree_index.root != tree))
+		index_build(tree);
+
+	return true;
+}
+
 /*
  * Tree building functions
  */
@@ -35,7 +292,7 @@ void add_label(struct label **labels, char *label)
 			return;
 		}
 
-	new = xmalloc(sizeof(*new));
+	new = arena_alloc(sizeof(*new));
 	memset(new, 0, sizeof(*new));
 	new->label = label;
 	new->next = *labels;
@@ -52,7 +309,7 @@ void delete_labels(struct label **labels)
 
 struct property *build_property(char *name, struct data val)
 {
-	struct property *new = xmalloc(sizeof(*new));
+	struct property *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -64,7 +321,7 @@ struct property *build_property(char *name, struct data val)
 
 struct property *build_property_delete(char *name)
 {
-	struct property *new = xmalloc(sizeof(*new));
+	struct property *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -99,7 +356,7 @@ struct property *reverse_properties(struct property *first)
 
 struct node *build_node(struct property *proplist, struct node *children)
 {
-	struct node *new = xmalloc(sizeof(*new));
+	struct node *new = arena_alloc(sizeof(*new));
 	struct node *child;
 
 	memset(new, 0, sizeof(*new));
@@ -116,7 +373,7 @@ struct node *build_node(struct property *proplist, struct node *children)
 
 struct node *build_node_delete(void)
 {
-	struct node *new = xmalloc(sizeof(*new));
+	struct node *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -140,12 +397,18 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 	struct node *new_child, *old_child;
 	struct label *l;
 
+	/* Reviving a deleted node changes the tree shape */
+	if (old_node->deleted)
+		index_invalidate();
 	old_node->deleted = 0;
 
 	/* Add new node labels to old node */
 	for_each_label_withdel(new_node->labels, l)
 		add_label(&old_node->labels, l->label);
 
+	if (index_covers(old_node))
+		index_add_labels(old_node);
+
 	/* Move properties from the new node to the old node.  If there
 	 * is a collision, replace the old value with the new */
 	while (new_node->proplist) {
@@ -156,7 +419,6 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 		if (new_prop->deleted) {
 			delete_property_by_name(old_node, new_prop->name);
-			free(new_prop);
 			continue;
 		}
 
@@ -169,7 +431,6 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 				old_prop->val = new_prop->val;
 				old_prop->deleted = 0;
-				free(new_prop);
 				new_prop = NULL;
 				break;
 			}
@@ -191,7 +452,6 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 
 		if (new_child->deleted) {
 			delete_node_by_name(old_node, new_child->name);
-			free(new_child);
 			continue;
 		}
 
@@ -209,9 +469,8 @@ struct node *merge_nodes(struct node *old_node, struct node *new_node)
 			add_child(old_node, new_child);
 	}
 
-	/* The new node contents are now merged into the old node.  Free
-	 * the new node. */
-	free(new_node);
+	/* The new node contents are now merged into the old node.  The
+	 * empty new node is left to the arena. */
 
 	return old_node;
 }
@@ -290,6 +549,17 @@ void add_child(struct node *parent, struct node *child)
 		p = &((*p)->next_sibling);
 
 	*p = child;
+
+	if (!child->deleted && index_covers(parent)) {
+		char *ppath = index_node_path(parent);
+		struct index_entry *e;
+
+		e = index_table_find(&tree_index.paths,
+				     index_hash_string(ppath), ppath, 0);
+		index_add_subtree(child, join_path(ppath, child->name),
+				  !e || (e->node != parent));
+		free(ppath);
+	}
 }
 
 void delete_node_by_name(struct node *parent, char *name)
@@ -310,6 +580,8 @@ void delete_node(struct node *node)
 	struct property *prop;
 	struct node *child;
 
+	index_invalidate();
+
 	node->deleted = 1;
 	for_each_child(node, child)
 		delete_node(child);
@@ -337,7 +609,7 @@ void append_to_property(struct node *node,
 
 struct reserve_info *build_reserve_entry(uint64_t address, uint64_t size)
 {
-	struct reserve_info *new = xmalloc(sizeof(*new));
+	struct reserve_info *new = arena_alloc(sizeof(*new));
 
 	memset(new, 0, sizeof(*new));
 
@@ -380,7 +652,7 @@ struct dt_info *build_dt_info(unsigned int dtsflags,
 {
 	struct dt_info *dti;
 
-	dti = xmalloc(sizeof(*dti));
+	dti = arena_alloc(sizeof(*dti));
 	dti->dtsflags = dtsflags;
 	dti->reservelist = reservelist;
 	dti->dt = tree;
@@ -483,7 +755,7 @@ struct node *get_subnode(struct node *node, const char *nodename)
 	return NULL;
 }
 
-struct node *get_node_by_path(struct node *tree, const char *path)
+static struct node *get_node_by_path_walk(struct node *tree, const char *path)
 {
 	const char *p;
 	struct node *child;
@@ -503,7 +775,7 @@ struct node *get_node_by_path(struct node *tree, const char *path)
 		if (p &&
 		    (strlen(child->name) == (p - path)) &&
 		    strneq(path, child->name, p-path))
-			return get_node_by_path(child, p+1);
+			return get_node_by_path_walk(child, p+1);
 		else if (!p && streq(path, child->name))
 			return child;
 	}
@@ -511,19 +783,65 @@ struct node *get_node_by_path(struct node *tree, const char *path)
 	return NULL;
 }
 
-struct node *get_node_by_label(struct node *tree, const char *label)
+/* Canonical form of a path as the walk would resolve it: "/a/b" */
+static char *normalize_path(const char *path)
+{
+	char *norm = xmalloc(strlen(path) + 2);
+	char *q = norm;
+
+	while (*path) {
+		while (*path == '/')
+			path++;
+		if (!*path)
+			break;
+		*q++ = '/';
+		while (*path && (*path != '/'))
+			*q++ = *path++;
+	}
+	if (q == norm)
+		*q++ = '/';
+	*q = '\0';
+
+	return norm;
+}
+
+struct node *get_node_by_path(struct node *tree, const char *path)
+{
+	struct index_entry *e;
+	char *norm;
+
+	if (!path || !(*path) || !index_ready(tree))
+		return get_node_by_path_walk(tree, path);
+
+	norm = normalize_path(path);
+	if (streq(norm, "/")) {
+		/* The walk only accepts this with a trailing name */
+		free(norm);
+		return get_node_by_path_walk(tree, path);
+	}
+	e = index_table_find(&tree_index.paths, index_hash_string(norm),
+			     norm, 0);
+	free(norm);
+
+	if (!e)
+		return NULL;
+	if (!e->node)
+		return get_node_by_path_walk(tree, path);
+	return e->node;
+}
+
+static struct node *get_node_by_label_walk(struct node *tree,
+					   const char *label)
 {
 	struct node *child, *node;
 	struct label *l;
 
-	assert(label && (strlen(label) > 0));
-
 	for_each_label(tree->labels, l)
 		if (streq(l->label, label))
 			return tree;
 
 	for_each_child(tree, child) {
-		node = get_node_by_label(child, label);
+		node = get_node_by_label_walk(child, label);
 		if (node)
 			return node;
 	}
@@ -531,11 +849,28 @@ struct node *get_node_by_label(struct node *tree, const char *label)
 	return NULL;
 }
 
-struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
+struct node *get_node_by_label(struct node *tree, const char *label)
 {
-	struct node *child, *node;
+	struct index_entry *e;
 
-	assert((phandle != 0) && (phandle != -1));
+	assert(label && (strlen(label) > 0));
+
+	if (!index_ready(tree))
+		return get_node_by_label_walk(tree, label);
+
+	e = index_table_find(&tree_index.labels, index_hash_string(label),
+			     label, 0);
+	if (!e)
+		return NULL;
+	if (!e->node)
+		return get_node_by_label_walk(tree, label);
+	return e->node;
+}
+
+static struct node *get_node_by_phandle_walk(struct node *tree,
+					     cell_t phandle)
+{
+	struct node *child, *node;
 
 	if (tree->phandle == phandle) {
 		if (tree->deleted)
@@ -544,7 +879,7 @@ struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
 	}
 
 	for_each_child(tree, child) {
-		node = get_node_by_phandle(child, phandle);
+		node = get_node_by_phandle_walk(child, phandle);
 		if (node)
 			return node;
 	}
@@ -552,6 +887,24 @@ struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
 	return NULL;
 }
 
+struct node *get_node_by_phandle(struct node *tree, cell_t phandle)
+{
+	struct index_entry *e;
+
+	assert((phandle != 0) && (phandle != -1));
+
+	if (!index_ready(tree))
+		return get_node_by_phandle_walk(tree, phandle);
+
+	e = index_table_find(&tree_index.phandles, index_hash_phandle(phandle),
+			     NULL, phandle);
+	if (!e)
+		return NULL;
+	if (!e->node)
+		return get_node_by_phandle_walk(tree, phandle);
+	return e->node;
+}
+
 struct node *get_node_by_ref(struct node *tree, const char *ref)
 {
 	if (streq(ref, "/"))
@@ -562,6 +915,14 @@ struct node *get_node_by_ref(struct node *tree, const char *ref)
 		return get_node_by_label(tree, ref);
 }
 
+void set_node_phandle(struct node *node, cell_t phandle)
+{
+	node->phandle = phandle;
+
+	if (index_covers(node))
+		index_add_phandle(node);
+}
+
 cell_t get_node_phandle(struct node *root, struct node *node)
 {
 	static cell_t phandle = 1; /* FIXME: ick, static local */
@@ -572,7 +933,7 @@ cell_t get_node_phandle(struct node *root, struct node *node)
 	while (get_node_by_phandle(root, phandle))
 		phandle++;
 
-	node->phandle = phandle;
+	set_node_phandle(node, phandle);
 
 	if (!get_property(node, "linux,phandle")
 	    && (phandle_format & PHANDLE_LEGACY))
@@ -616,6 +977,42 @@ uint32_t guess_boot_cpuid(struct node *tree)
 	return propval_cell(reg);
 }
 
+/*
+ * Hash of everything in a subtree that ends up in the output: node
+ * names, property names and values, in order.  Labels, markers and
+ * deleted nodes or properties don't count.  fn, if given, is called
+ * for every node with its subtree's hash, children before parents.
+ */
+uint64_t subtree_hash(struct node *node,
+		      void (*fn)(struct node *node, uint64_t hash, void *arg),
+		      void *arg)
+{
+	struct property *prop;
+	struct node *child;
+	uint64_t h, ch;
+	uint32_t n = 0;
+
+	h = cache_hash(CACHE_HASH_INIT, node->name, strlen(node->name) + 1);
+
+	for_each_property(node, prop) {
+		h = cache_hash(h, prop->name, strlen(prop->name) + 1);
+		h = cache_hash(h, &prop->val.len, sizeof(prop->val.len));
+		h = cache_hash(h, prop->val.val, prop->val.len);
+		n++;
+	}
+	h = cache_hash(h, &n, sizeof(n));
+
+	for_each_child(node, child) {
+		ch = subtree_hash(child, fn, arg);
+		h = cache_hash(h, &ch, sizeof(ch));
+	}
+
+	if (fn)
+		fn(node, h, arg);
+
+	return h;
+}
+
 static int cmp_reserve_info(const void *ax, const void *bx)
 {
 	const struct reserve_info *a, *b;
@@ -759,7 +1156,7 @@ static struct node *build_and_name_child_node(struct node *parent, char *name)
 	struct node *node;
 
 	node = build_node(NULL, NULL);
-	name_node(node, xstrdup(name));
+	name_node(node, arena_strdup(name));
 	add_child(parent, node);
 
 	return node;
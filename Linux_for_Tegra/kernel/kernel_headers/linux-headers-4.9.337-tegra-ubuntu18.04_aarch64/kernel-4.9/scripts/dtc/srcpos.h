@@ -58,6 +58,12 @@ FILE *srcfile_relative_open(const char *fname, char **fullnamep);
 void srcfile_push(const char *fname);
 bool srcfile_pop(void);
 
+/**
+ * Keep the contents of every source file read from now on, so later
+ * pushes of the same file don't read it again.
+ */
+void srcfile_enable_cache(void);
+
 /**
  * Add a new directory to the search path for input files
  *
@@ -67,6 +73,11 @@ bool srcfile_pop(void);
  */
 void srcfile_add_search_path(const char *dirname);
 
+/**
+ * Empty the search path for input files
+ */
+void srcfile_reset_search_path(void);
+
 struct srcpos {
     int first_line;
     int first_column;
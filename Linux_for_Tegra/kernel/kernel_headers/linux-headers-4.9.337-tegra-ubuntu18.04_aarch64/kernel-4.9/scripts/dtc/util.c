@@ -264,7 +264,7 @@ int utilfdt_read_err_len(const char *filename, char **buffp, off_t *len)
 		free(buf);
 	else
 		*buffp = buf;
-	*len = bufsize;
+	*len = offset;
 	return ret;
 }
 
@@ -16,6 +16,11 @@
  *      Applied to kernel symbols, this usually produces a compression ratio
  *  of about 50%.
  *
+ *      With --reserve, every table is padded to the size it had in an
+ *  earlier run (or to its own size plus some headroom), so that a table
+ *  generated from one link of vmlinux can be linked into the next one
+ *  without moving anything.  --layout writes down the sizes used.
+ *
  */
 
 #include <stdio.h>
@@ -64,9 +69,46 @@ static int all_symbols = 0;
 static int absolute_percpu = 0;
 static char symbol_prefix_char = '\0';
 static int base_relative = 0;
+static const char *reserve_file, *layout_file;
+
+/* number of entries or bytes emitted for each table, see --reserve */
+struct table_layout {
+	unsigned int syms;	/* kallsyms_addresses or kallsyms_offsets */
+	unsigned int names;	/* bytes of kallsyms_names */
+	unsigned int markers;	/* kallsyms_markers */
+	unsigned int tokens;	/* bytes of kallsyms_token_table */
+};
+
+static struct table_layout layout;
 
 int token_profit[0x10000];
 
+/*
+ * The tokens ordered by profit, highest first and the lowest token on a
+ * tie, so the top of the heap is what a linear scan of token_profit
+ * would pick.  Compressing a symbol leaves most of its tokens alone, so
+ * the count changes for one symbol are summed up first and only the
+ * tokens whose count really moved are sifted, one at a time.
+ */
+static unsigned short token_heap[0x10000];
+static unsigned int token_heap_pos[0x10000];
+static int token_delta[0x10000];
+static unsigned short token_touched[2 * (KSYM_NAME_LEN + 1)];
+static unsigned int token_touched_cnt;
+
+/*
+ * For every token, the symbols that have contained it since the initial
+ * count.  A symbol only ever gains tokens that include the code it was
+ * just compressed with, so appending it to those lists keeps every list
+ * a superset of the symbols that still contain the token.
+ */
+struct token_syms {
+	unsigned int *syms;
+	unsigned int cnt, size;
+};
+
+static struct token_syms token_syms[0x10000];
+
 /* the table that holds the result of the compression */
 unsigned char best_table[256][2];
 unsigned char best_table_len[256];
@@ -77,7 +119,8 @@ static void usage(void)
 	fprintf(stderr, "Usage: kallsyms [--all-symbols] "
 			"[--symbol-prefix=<prefix char>] "
 			"[--page-offset=<CONFIG_PAGE_OFFSET>] "
-			"[--base-relative] < in.map > out.S\n");
+			"[--base-relative] [--reserve=<layout file>] "
+			"[--layout=<layout file>] < in.map > out.S\n");
 	exit(1);
 }
 
@@ -336,6 +379,102 @@ static int symbol_absolute(struct sym_entry *s)
 	return s->percpu_absolute;
 }
 
+/* first line of a layout file: the options that change the table format */
+static const char *layout_options(void)
+{
+	static char buf[64];
+
+	snprintf(buf, sizeof(buf), "kallsyms%s%s\n",
+		 base_relative ? " base-relative" : "",
+		 absolute_percpu ? " absolute-percpu" : "");
+	return buf;
+}
+
+static int read_layout(const char *name, struct table_layout *l)
+{
+	char buf[64];
+	FILE *f;
+	int ok;
+
+	f = fopen(name, "r");
+	if (!f)
+		return 0;
+
+	/* a layout for other options doesn't say anything about this one */
+	ok = fgets(buf, sizeof(buf), f) && strcmp(buf, layout_options()) == 0 &&
+	     fscanf(f, "syms %u names %u markers %u tokens %u",
+		    &l->syms, &l->names, &l->markers, &l->tokens) == 4;
+	fclose(f);
+
+	return ok;
+}
+
+static void write_layout(const char *name, const struct table_layout *l)
+{
+	FILE *f;
+
+	f = fopen(name, "w");
+	if (!f) {
+		fprintf(stderr, "kallsyms failure: unable to write %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+
+	fputs(layout_options(), f);
+	fprintf(f, "syms %u names %u markers %u tokens %u\n",
+		l->syms, l->names, l->markers, l->tokens);
+
+	if (fclose(f)) {
+		fprintf(stderr, "kallsyms failure: unable to write %s\n", name);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+ * Keep the reserved size while the table fits into it, and leave some
+ * room for the symbols the next few builds add when it doesn't.
+ */
+static unsigned int reserve_size(unsigned int size, unsigned int reserved)
+{
+	if (size <= reserved)
+		return reserved;
+	return size + size / 64;
+}
+
+/* work out the size of every table before anything is written */
+static void plan_layout(void)
+{
+	struct table_layout reserved;
+	char buf[KSYM_NAME_LEN];
+	unsigned int i;
+
+	layout.syms = table_cnt;
+	layout.names = 0;
+	for (i = 0; i < table_cnt; i++)
+		layout.names += table[i].len + 1;
+	layout.tokens = 0;
+	for (i = 0; i < 256; i++)
+		layout.tokens += expand_symbol(best_table[i],
+					       best_table_len[i], buf) + 1;
+
+	if (reserve_file) {
+		if (!read_layout(reserve_file, &reserved))
+			memset(&reserved, 0, sizeof(reserved));
+
+		layout.syms = reserve_size(layout.syms, reserved.syms);
+		layout.names = reserve_size(layout.names, reserved.names);
+		layout.tokens = reserve_size(layout.tokens, reserved.tokens);
+	}
+
+	layout.markers = (layout.syms + 255) >> 8;
+}
+
+/* fill a table up to its reserved size */
+static void output_padding(const char *directive, unsigned int count)
+{
+	if (count)
+		printf("\t.rept\t%u\n\t%s\t0\n\t.endr\n", count, directive);
+}
+
 static void write_src(void)
 {
 	unsigned int i, k, off;
@@ -354,6 +493,8 @@ static void write_src(void)
 
 	printf("\t.section .rodata, \"a\"\n");
 
+	plan_layout();
+
 	/* Provide proper symbols relocatability by their relativeness
 	 * to a fixed anchor point in the runtime image, either '_text'
 	 * for absolute address tables, in which case the linker will
@@ -406,6 +547,7 @@ static void write_src(void)
 			printf("\tPTR\t%#llx\n", table[i].addr);
 		}
 	}
+	output_padding(base_relative ? ".long" : "PTR", layout.syms - table_cnt);
 	printf("\n");
 
 	if (base_relative) {
@@ -440,11 +582,13 @@ static void write_src(void)
 
 		off += table[i].len + 1;
 	}
+	output_padding(".byte", layout.names - off);
 	printf("\n");
 
 	output_label("kallsyms_markers");
 	for (i = 0; i < ((table_cnt + 255) >> 8); i++)
 		printf("\tPTR\t%d\n", markers[i]);
+	output_padding("PTR", layout.markers - i);
 	printf("\n");
 
 	free(markers);
@@ -457,6 +601,7 @@ static void write_src(void)
 		printf("\t.asciz\t\"%s\"\n", buf);
 		off += strlen(buf) + 1;
 	}
+	output_padding(".byte", layout.tokens - off);
 	printf("\n");
 
 	output_label("kallsyms_token_index");
@@ -468,13 +613,96 @@ static void write_src(void)
 
 /* table lookup compression functions */
 
+/* note that symbol 'sym' contains 'token' */
+static void add_token_sym(int token, unsigned int sym)
+{
+	struct token_syms *ts = &token_syms[token];
+
+	/* tokens repeat within a symbol */
+	if (ts->cnt && ts->syms[ts->cnt - 1] == sym)
+		return;
+
+	if (ts->cnt >= ts->size) {
+		ts->size = ts->size ? ts->size * 2 : 8;
+		ts->syms = realloc(ts->syms, sizeof(*ts->syms) * ts->size);
+		if (!ts->syms) {
+			fprintf(stderr, "kallsyms failure: "
+				"unable to allocate required amount of memory\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	ts->syms[ts->cnt++] = sym;
+}
+
+static int token_better(int a, int b)
+{
+	if (token_profit[a] != token_profit[b])
+		return token_profit[a] > token_profit[b];
+	return a < b;
+}
+
+static void token_heap_set(unsigned int pos, int token)
+{
+	token_heap[pos] = token;
+	token_heap_pos[token] = pos;
+}
+
+static void token_heap_up(unsigned int pos)
+{
+	int token = token_heap[pos];
+	unsigned int parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (!token_better(token, token_heap[parent]))
+			break;
+		token_heap_set(pos, token_heap[parent]);
+		pos = parent;
+	}
+	token_heap_set(pos, token);
+}
+
+static void token_heap_down(unsigned int pos)
+{
+	int token = token_heap[pos];
+	unsigned int child;
+
+	while ((child = 2 * pos + 1) < 0x10000) {
+		if (child + 1 < 0x10000 &&
+		    token_better(token_heap[child + 1], token_heap[child]))
+			child++;
+		if (!token_better(token_heap[child], token))
+			break;
+		token_heap_set(pos, token_heap[child]);
+		pos = child;
+	}
+	token_heap_set(pos, token);
+}
+
+static void build_token_heap(void)
+{
+	int i;
+
+	for (i = 0; i < 0x10000; i++)
+		token_heap_set(i, i);
+	for (i = 0x10000 / 2 - 1; i >= 0; i--)
+		token_heap_down(i);
+}
+
+static void add_token_delta(int token, int delta)
+{
+	if (!token_delta[token])
+		token_touched[token_touched_cnt++] = token;
+	token_delta[token] += delta;
+}
+
 /* count all the possible tokens in a symbol */
 static void learn_symbol(unsigned char *symbol, int len)
 {
 	int i;
 
 	for (i = 0; i < len - 1; i++)
-		token_profit[ symbol[i] + (symbol[i + 1] << 8) ]++;
+		add_token_delta(symbol[i] + (symbol[i + 1] << 8), 1);
 }
 
 /* decrease the count for all the possible tokens in a symbol */
@@ -483,26 +711,56 @@ static void forget_symbol(unsigned char *symbol, int len)
 	int i;
 
 	for (i = 0; i < len - 1; i++)
-		token_profit[ symbol[i] + (symbol[i + 1] << 8) ]--;
+		add_token_delta(symbol[i] + (symbol[i + 1] << 8), -1);
+}
+
+/* apply the counts summed up by learn_symbol() and forget_symbol() */
+static void update_token_profit(void)
+{
+	unsigned int i;
+	int token, delta;
+
+	for (i = 0; i < token_touched_cnt; i++) {
+		token = token_touched[i];
+		delta = token_delta[token];
+		if (!delta)
+			continue;
+
+		token_delta[token] = 0;
+		token_profit[token] += delta;
+		if (delta > 0)
+			token_heap_up(token_heap_pos[token]);
+		else
+			token_heap_down(token_heap_pos[token]);
+	}
+	token_touched_cnt = 0;
 }
 
 /* remove all the invalid symbols from the table and do the initial token count */
 static void build_initial_tok_table(void)
 {
-	unsigned int i, pos;
+	unsigned int i, j, pos;
+	int token;
 
 	pos = 0;
 	for (i = 0; i < table_cnt; i++) {
 		if ( symbol_valid(&table[i]) ) {
 			if (pos != i)
 				table[pos] = table[i];
-			learn_symbol(table[pos].sym, table[pos].len);
+			for (j = 0; j + 1 < table[pos].len; j++) {
+				token = table[pos].sym[j] +
+					(table[pos].sym[j + 1] << 8);
+				token_profit[token]++;
+				add_token_sym(token, pos);
+			}
 			pos++;
 		} else {
 			free(table[i].sym);
 		}
 	}
 	table_cnt = pos;
+
+	build_token_heap();
 }
 
 static void *find_token(unsigned char *str, int len, unsigned char *token)
@@ -520,11 +778,18 @@ static void *find_token(unsigned char *str, int len, unsigned char *token)
  * to update the counts */
 static void compress_symbols(unsigned char *str, int idx)
 {
-	unsigned int i, len, size;
+	struct token_syms *ts = &token_syms[str[0] + (str[1] << 8)];
+	unsigned int i, j, k, len, size;
 	unsigned char *p1, *p2;
 
-	for (i = 0; i < table_cnt; i++) {
+	/*
+	 * Only the symbols on the token's list can contain it.  Entries
+	 * for symbols that lost the token to an earlier replacement are
+	 * skipped by find_token() like any other symbol without it.
+	 */
+	for (k = 0; k < ts->cnt; k++) {
 
+		i = ts->syms[k];
 		len = table[i].len;
 		p1 = table[i].sym;
 
@@ -556,24 +821,24 @@ static void compress_symbols(unsigned char *str, int idx)
 
 		/* increase the counts for this symbol's new tokens */
 		learn_symbol(table[i].sym, len);
+		update_token_profit();
+
+		/* the only tokens it didn't have before are those with idx */
+		p1 = table[i].sym;
+		for (j = 0; j + 1 < len; j++)
+			if (p1[j] == idx || p1[j + 1] == idx)
+				add_token_sym(p1[j] + (p1[j + 1] << 8), i);
 	}
+
+	/* the token is gone for good, nothing can form it again */
+	free(ts->syms);
+	memset(ts, 0, sizeof(*ts));
 }
 
 /* search the token with the maximum profit */
 static int find_best_token(void)
 {
-	int i, best, bestprofit;
-
-	bestprofit=-10000;
-	best = 0;
-
-	for (i = 0; i < 0x10000; i++) {
-		if (token_profit[i] > bestprofit) {
-			best = i;
-			bestprofit = token_profit[i];
-		}
-	}
-	return best;
+	return token_heap[0];
 }
 
 /* this is the core of the algorithm: calculate the "best" table */
@@ -769,6 +1034,10 @@ int main(int argc, char **argv)
 				symbol_prefix_char = *p;
 			} else if (strcmp(argv[i], "--base-relative") == 0)
 				base_relative = 1;
+			else if (strncmp(argv[i], "--reserve=", 10) == 0)
+				reserve_file = &argv[i][10];
+			else if (strncmp(argv[i], "--layout=", 9) == 0)
+				layout_file = &argv[i][9];
 			else
 				usage();
 		}
@@ -783,6 +1052,8 @@ int main(int argc, char **argv)
 	sort_symbols();
 	optimize_token_table();
 	write_src();
+	if (layout_file)
+		write_layout(layout_file, &layout);
 
 	return 0;
 }
@@ -484,6 +484,133 @@ void sym_clear_all_valid(void)
 	sym_calc_value(modules_sym);
 }
 
+/*
+ * Every symbol keeps a list of the symbols whose value is calculated
+ * from its own: those that name it in a dependency, prompt, default or
+ * range, those it selects, and the members of its choice block.  The
+ * lists are built the first time they are needed, when the parsed
+ * expressions are final.
+ */
+static bool sym_dependents_built;
+static struct symbol **sym_queue;
+static int sym_queue_size;
+
+static void sym_add_dependent(struct symbol *sym, struct symbol *dep)
+{
+	struct expr *e;
+
+	if (!sym || sym == dep || sym->flags & SYMBOL_CONST)
+		return;
+	/* a symbol's dependencies are all added in one go */
+	if (sym->dependents && sym->dependents->right.sym == dep)
+		return;
+	e = expr_alloc_one(E_LIST, sym->dependents);
+	e->right.sym = dep;
+	sym->dependents = e;
+}
+
+static void expr_add_dependent(struct expr *e, struct symbol *dep)
+{
+	struct expr *l;
+	struct symbol *sym;
+
+	if (!e)
+		return;
+	switch (e->type) {
+	case E_OR:
+	case E_AND:
+		expr_add_dependent(e->right.expr, dep);
+		/* fall through */
+	case E_NOT:
+		expr_add_dependent(e->left.expr, dep);
+		break;
+	case E_SYMBOL:
+		sym_add_dependent(e->left.sym, dep);
+		break;
+	case E_EQUAL:
+	case E_UNEQUAL:
+	case E_LTH:
+	case E_LEQ:
+	case E_GTH:
+	case E_GEQ:
+	case E_RANGE:
+		sym_add_dependent(e->left.sym, dep);
+		sym_add_dependent(e->right.sym, dep);
+		break;
+	case E_LIST:
+		expr_list_for_each_sym(e, l, sym)
+			sym_add_dependent(sym, dep);
+		break;
+	case E_NONE:
+		break;
+	}
+}
+
+static void sym_build_dependents(void)
+{
+	struct symbol *sym;
+	struct property *prop;
+	int i;
+
+	for_all_symbols(i, sym) {
+		for (prop = sym->prop; prop; prop = prop->next) {
+			if (prop->type == P_SELECT)
+				continue;
+			expr_add_dependent(prop->visible.expr, sym);
+			expr_add_dependent(prop->expr, sym);
+		}
+		expr_add_dependent(sym->dir_dep.expr, sym);
+		expr_add_dependent(sym->rev_dep.expr, sym);
+	}
+	sym_dependents_built = true;
+}
+
+static void sym_queue_add(struct symbol *sym, int cnt)
+{
+	if (cnt >= sym_queue_size) {
+		sym_queue_size = sym_queue_size ? sym_queue_size * 2 : 256;
+		sym_queue = xrealloc(sym_queue,
+				     sym_queue_size * sizeof(*sym_queue));
+	}
+	sym->flags |= SYMBOL_QUEUED;
+	sym_queue[cnt] = sym;
+}
+
+/*
+ * Like sym_clear_all_valid(), after only sym's own input changed: clear
+ * the value of sym and of everything calculated from it, and leave the
+ * rest alone.  A change that reaches the modules symbol changes the type
+ * of every tristate, so it still falls back to clearing everything.
+ */
+void sym_clear_valid(struct symbol *sym)
+{
+	struct symbol *dep;
+	struct expr *e;
+	bool all;
+	int i, cnt;
+
+	if (!sym_dependents_built)
+		sym_build_dependents();
+
+	cnt = 0;
+	sym_queue_add(sym, cnt++);
+	for (i = 0; i < cnt; i++) {
+		expr_list_for_each_sym(sym_queue[i]->dependents, e, dep) {
+			if (!(dep->flags & SYMBOL_QUEUED))
+				sym_queue_add(dep, cnt++);
+		}
+	}
+
+	all = modules_sym && modules_sym->flags & SYMBOL_QUEUED;
+	for (i = 0; i < cnt; i++)
+		sym_queue[i]->flags &= ~(SYMBOL_QUEUED | SYMBOL_VALID);
+
+	if (all)
+		sym_clear_all_valid();
+	else
+		sym_add_change_count(1);
+}
+
 bool sym_tristate_within_range(struct symbol *sym, tristate val)
 {
 	int type = sym_get_type(sym);
@@ -534,7 +661,7 @@ bool sym_set_tristate_value(struct symbol *sym, tristate val)
 
 	sym->def[S_DEF_USER].tri = val;
 	if (oldval != val)
-		sym_clear_all_valid();
+		sym_clear_valid(sym);
 
 	return true;
 }
@@ -691,7 +818,7 @@ bool sym_set_string_value(struct symbol *sym, const char *newval)
 
 	strcpy(val, newval);
 	free((void *)oldval);
-	sym_clear_all_valid();
+	sym_clear_valid(sym);
 
 	return true;
 }
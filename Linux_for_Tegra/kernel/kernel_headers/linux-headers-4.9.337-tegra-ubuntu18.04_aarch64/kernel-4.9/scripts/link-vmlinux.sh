@@ -33,7 +33,7 @@ set -e
 info()
 {
 	if [ "${quiet}" != "silent_" ]; then
-		printf "  %-7s %s\n" ${1} ${2}
+		printf "  %-7s %s\n" "${1}" "${2}"
 	fi
 }
 
@@ -174,10 +174,16 @@ vmlinux_link()
 }
 
 # Create ${2} .o file with all symbols from the ${1} object file
+# The tables are padded to the layout in ${3}, if given, and the layout
+# used is written next to ${2}
 kallsyms()
 {
 	info KSYM ${2}
-	local kallsymopt;
+	local kallsymopt="--layout=`basename ${2} .o`.layout"
+
+	if [ -n "${3}" ]; then
+		kallsymopt="${kallsymopt} --reserve=${3}"
+	fi
 
 	if [ -n "${CONFIG_HAVE_UNDERSCORE_SYMBOL_PREFIX}" ]; then
 		kallsymopt="${kallsymopt} --symbol-prefix=_"
@@ -318,30 +324,58 @@ if [ -n "${CONFIG_KALLSYMS}" ]; then
 	# 2a) We may use an extra pass as this has been necessary to
 	#     woraround some alignment related bugs.
 	#     KALLSYMS_EXTRA_PASS=1 is used to trigger this.
+	#     It is also taken when the table of step 2 came out with a
+	#     different layout from the one of step 1.
 	# 3)  The correct ${kallsymso} is linked into the final vmlinux.
 	#
 	# a)  Verify that the System.map from vmlinux matches the map from
 	#     ${kallsymso}.
-
-	kallsymso=.tmp_kallsyms2.o
-	kallsyms_vmlinux=.tmp_vmlinux2
+	#
+	# The table of the last build is kept as .tmp_kallsyms.o, and step 1
+	# links against it.  When the table of step 1 comes out with the
+	# same layout, the one in .tmp_vmlinux1 had the same size and
+	# .tmp_vmlinux1 already has the final addresses: step 2 is skipped.
+	# Step 1 sizes its tables from the symbols alone, never from an
+	# earlier build, so the result is the same as that of a build
+	# without the old table.  KALLSYMS_NO_SEED=1 doesn't use it anyway.
+	# Later steps pad each table to the layout of the step before.
+
+	kallsymso=.tmp_kallsyms1.o
+	kallsyms_vmlinux=.tmp_vmlinux1
+	kallsyms_passes=1
+	kallsyms_seed=""
+
+	if [ -z "${KALLSYMS_EXTRA_PASS}" ] && [ -z "${KALLSYMS_NO_SEED}" ] &&
+	   [ -r .tmp_kallsyms.o ] && [ -r .tmp_kallsyms.layout ]; then
+		kallsyms_seed=.tmp_kallsyms.o
+	fi
 
 	# step 1
-	vmlinux_link "" .tmp_vmlinux1
+	vmlinux_link "${kallsyms_seed}" .tmp_vmlinux1
 	kallsyms .tmp_vmlinux1 .tmp_kallsyms1.o
 
-	# step 2
-	vmlinux_link .tmp_kallsyms1.o .tmp_vmlinux2
-	kallsyms .tmp_vmlinux2 .tmp_kallsyms2.o
+	if [ -z "${kallsyms_seed}" ] ||
+	   ! cmp -s .tmp_kallsyms.layout .tmp_kallsyms1.layout; then
+		kallsymso=.tmp_kallsyms2.o
+		kallsyms_vmlinux=.tmp_vmlinux2
+		kallsyms_passes=2
+
+		# step 2
+		vmlinux_link .tmp_kallsyms1.o .tmp_vmlinux2
+		kallsyms .tmp_vmlinux2 .tmp_kallsyms2.o .tmp_kallsyms1.layout
+	fi
 
 	# step 2a
-	if [ -n "${KALLSYMS_EXTRA_PASS}" ]; then
+	if [ ${kallsyms_passes} -eq 2 ] &&
+	   { [ -n "${KALLSYMS_EXTRA_PASS}" ] ||
+	     ! cmp -s .tmp_kallsyms1.layout .tmp_kallsyms2.layout; }; then
 		kallsymso=.tmp_kallsyms3.o
 		kallsyms_vmlinux=.tmp_vmlinux3
+		kallsyms_passes=3
 
 		vmlinux_link .tmp_kallsyms2.o .tmp_vmlinux3
 
-		kallsyms .tmp_vmlinux3 .tmp_kallsyms3.o
+		kallsyms .tmp_vmlinux3 .tmp_kallsyms3.o .tmp_kallsyms2.layout
 	fi
 fi
 
@@ -365,6 +399,14 @@ if [ -n "${CONFIG_KALLSYMS}" ]; then
 		echo >&2 Try "make KALLSYMS_EXTRA_PASS=1" as a workaround
 		exit 1
 	fi
+
+	# keep the table for the next build to link against
+	cp -f ${kallsymso} .tmp_kallsyms.o
+	cp -f `basename ${kallsymso} .o`.layout .tmp_kallsyms.layout
+
+	if [ -n "${kallsyms_seed}" ] && [ ${kallsyms_passes} -eq 1 ]; then
+		info KSYM "layout unchanged, skipped 1 of 2 link passes"
+	fi
 fi
 
 # We made a new kernel - delete old version file
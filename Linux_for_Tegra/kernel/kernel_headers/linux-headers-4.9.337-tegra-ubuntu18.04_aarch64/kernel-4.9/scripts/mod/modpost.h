@@ -108,18 +108,21 @@ buf_printf(struct buffer *buf, const char *fmt, ...);
 void
 buf_write(struct buffer *buf, const char *s, int len);
 
+struct objfile;
+
 struct module {
 	struct module *next;
 	const char *name;
+	unsigned int hash;	/* name_hash() of name */
 	int gpl_compatible;
 	struct symbol *unres;
-	int seen;
 	int skip;
 	int has_init;
 	int has_cleanup;
 	struct buffer dev_table_buf;
 	char	     srcversion[25];
 	int is_dot_o;
+	struct objfile *obj;	/* the object it was read from, if any */
 };
 
 struct elf_info {
@@ -145,6 +148,11 @@ struct elf_info {
 	 * take shndx from symtab_shndx_start[N] instead */
 	Elf32_Word   *symtab_shndx_start;
 	Elf32_Word   *symtab_shndx_stop;
+
+	/* for the section mismatch checks, see index_elf_symbols() */
+	struct elf_sym_entry *sym_index;
+	unsigned int nr_sym_index;
+	struct elf_sec_name *sec_by_name;
 };
 
 static inline int is_shndx_special(unsigned int i)
@@ -181,7 +189,8 @@ void maybe_frob_rcs_version(const char *modfilename,
 			    char *version,
 			    void *modinfo,
 			    unsigned long modinfo_offset);
-void get_src_version(const char *modname, char sum[], unsigned sumlen);
+void get_src_version(const char *modname, char sum[], unsigned sumlen,
+		     struct buffer *inputs);
 
 /* from modpost.c */
 void *grab_file(const char *filename, unsigned long *size);
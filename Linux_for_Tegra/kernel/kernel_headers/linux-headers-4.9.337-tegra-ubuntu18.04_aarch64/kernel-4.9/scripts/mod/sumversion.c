@@ -300,9 +300,17 @@ static int is_static_library(const char *objfile)
 		return 0;
 }
 
+/* Note a file the checksum depends on, for the module cache */
+static void note_input(struct buffer *inputs, const char *fname)
+{
+	if (inputs)
+		buf_write(inputs, fname, strlen(fname) + 1);
+}
+
 /* We have dir/file.o.  Open dir/.file.o.cmd, look for source_ and deps_ line
  * to figure out source files. */
-static int parse_source_files(const char *objfile, struct md4_ctx *md)
+static int parse_source_files(const char *objfile, struct md4_ctx *md,
+			      struct buffer *inputs)
 {
 	char *cmd, *file, *line, *dir;
 	const char *base;
@@ -324,6 +332,7 @@ static int parse_source_files(const char *objfile, struct md4_ctx *md)
 	strncpy(dir, objfile, dirlen);
 	dir[dirlen] = '\0';
 
+	note_input(inputs, cmd);
 	file = grab_file(cmd, &flen);
 	if (!file) {
 		warn("could not find %s for %s\n", cmd, objfile);
@@ -348,6 +357,7 @@ static int parse_source_files(const char *objfile, struct md4_ctx *md)
 				goto out_file;
 			}
 			p++;
+			note_input(inputs, p);
 			if (!parse_file(p, md)) {
 				warn("could not open %s: %s\n",
 				     p, strerror(errno));
@@ -376,6 +386,7 @@ static int parse_source_files(const char *objfile, struct md4_ctx *md)
 
 		/* Check if this file is in same dir as objfile */
 		if ((strstr(line, dir)+strlen(dir)-1) == strrchr(line, '/')) {
+			note_input(inputs, line);
 			if (!parse_file(line, md)) {
 				warn("could not open %s: %s\n",
 				     line, strerror(errno));
@@ -396,8 +407,11 @@ out:
 	return ret;
 }
 
-/* Calc and record src checksum. */
-void get_src_version(const char *modname, char sum[], unsigned sumlen)
+/* Calc and record src checksum.  If inputs is not NULL, the names of
+ * the files it was computed from are added to it, each followed by a
+ * NUL. */
+void get_src_version(const char *modname, char sum[], unsigned sumlen,
+		     struct buffer *inputs)
 {
 	void *file;
 	unsigned long len;
@@ -419,6 +433,7 @@ void get_src_version(const char *modname, char sum[], unsigned sumlen)
 	snprintf(filelist, sizeof(filelist), "%s/%.*s.mod", modverdir,
 		(int) strlen(basename) - 2, basename);
 
+	note_input(inputs, filelist);
 	file = grab_file(filelist, &len);
 	if (!file)
 		/* not a module or .mod file missing - ignore */
@@ -443,7 +458,7 @@ void get_src_version(const char *modname, char sum[], unsigned sumlen)
 		if (!*fname)
 			continue;
 		if (!(is_static_library(fname)) &&
-				!parse_source_files(fname, &md))
+				!parse_source_files(fname, &md, inputs))
 			goto release;
 	}
 
@@ -26,7 +26,9 @@
 #include <sys/stat.h>
 #include <getopt.h>
 #include <elf.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -57,19 +59,58 @@
 #define R_ARM_THM_CALL		10
 #define R_ARM_CALL		28
 
-static int fd_map;	/* File descriptor for file being modified. */
-static int mmap_failed; /* Boolean flag. */
-static char gpfx;	/* prefix for global symbol name (sometimes '_') */
-static struct stat sb;	/* Remember .st_size, etc. */
-static jmp_buf jmpenv;	/* setjmp/longjmp per-file error escape */
-static const char *altmcount;	/* alternate mcount symbol name */
 static int warn_on_notrace_sect; /* warn when section has mcount not being recorded */
-static void *file_map;	/* pointer of the mapped file */
-static void *file_end;	/* pointer to the end of the mapped file */
-static int file_updated; /* flag to state file was changed */
-static void *file_ptr;	/* current file pointer location */
-static void *file_append; /* added to the end of the file */
-static size_t file_append_size; /* how much is added to end of file */
+static int nr_jobs;	/* Number of files processed at once (-j) */
+
+/*
+ * Everything that belongs to the file being processed, so that several
+ * files can be worked on at the same time; see run_files().
+ */
+struct mcount_file {
+	char const *fname;
+	int fd_map;	/* File descriptor for file being modified. */
+	int mmap_failed; /* Boolean flag. */
+	char gpfx;	/* prefix for global symbol name (sometimes '_') */
+	struct stat sb;	/* Remember .st_size, etc. */
+	jmp_buf jmpenv;	/* setjmp/longjmp per-file error escape */
+	const char *altmcount;	/* alternate mcount symbol name */
+	void *file_map;	/* pointer of the mapped file */
+	void *file_end;	/* pointer to the end of the mapped file */
+	int file_updated; /* flag to state file was changed */
+	void *file_ptr;	/* current file pointer location */
+	void *file_append; /* added to the end of the file */
+	size_t file_append_size; /* how much is added to end of file */
+	int failed;	/* the file could not be processed */
+
+	/* Where -w warnings and error messages go. */
+	FILE *out;
+	FILE *err;
+	char *out_buf;
+	char *err_buf;
+	size_t out_size;
+	size_t err_size;
+
+	/* Set up by do_file() for the file's endianness and e_machine. */
+	uint64_t (*w8)(uint64_t);
+	uint32_t (*w)(uint32_t);
+	uint32_t (*w2)(uint16_t);
+	unsigned char *ideal_nop;
+	char rel_type_nop;
+	int (*make_nop)(struct mcount_file *mf, void *map,
+			size_t const offset);
+	int (*is_fake_mcount32)(struct mcount_file *mf, Elf32_Rel const *rp);
+	int (*is_fake_mcount64)(struct mcount_file *mf, Elf64_Rel const *rp);
+	uint32_t (*Elf32_r_sym)(struct mcount_file *mf, Elf32_Rel const *rp);
+	uint64_t (*Elf64_r_sym)(struct mcount_file *mf, Elf64_Rel const *rp);
+	void (*Elf32_r_info)(struct mcount_file *mf, Elf32_Rel *const rp,
+			     unsigned sym, unsigned type);
+	void (*Elf64_r_info)(struct mcount_file *mf, Elf64_Rel *const rp,
+			     unsigned sym, unsigned type);
+	int mcount_adjust_32;
+	int mcount_adjust_64;
+	Elf32_Addr mips32_old_r_offset;
+	Elf64_Addr mips64_old_r_offset;
+};
 
 /* setjmp() return values */
 enum {
@@ -80,88 +121,99 @@ enum {
 
 /* Per-file resource cleanup when multiple files. */
 static void
-cleanup(void)
+cleanup(struct mcount_file *const mf)
 {
-	if (!mmap_failed)
-		munmap(file_map, sb.st_size);
+	if (!mf->mmap_failed)
+		munmap(mf->file_map, mf->sb.st_size);
 	else
-		free(file_map);
-	file_map = NULL;
-	free(file_append);
-	file_append = NULL;
-	file_append_size = 0;
-	file_updated = 0;
+		free(mf->file_map);
+	mf->file_map = NULL;
+	free(mf->file_append);
+	mf->file_append = NULL;
+	mf->file_append_size = 0;
+	mf->file_updated = 0;
 }
 
 static void __attribute__((noreturn))
-fail_file(void)
+fail_file(struct mcount_file *const mf)
 {
-	cleanup();
-	longjmp(jmpenv, SJ_FAIL);
+	cleanup(mf);
+	longjmp(mf->jmpenv, SJ_FAIL);
 }
 
 static void __attribute__((noreturn))
-succeed_file(void)
+succeed_file(struct mcount_file *const mf)
 {
-	cleanup();
-	longjmp(jmpenv, SJ_SUCCEED);
+	cleanup(mf);
+	longjmp(mf->jmpenv, SJ_SUCCEED);
+}
+
+/* perror() to the file's error stream */
+static void
+uperror(struct mcount_file *const mf, char const *const s)
+{
+	fprintf(mf->err, "%s: %s\n", s, strerror(errno));
 }
 
 /* ulseek, uread, ...:  Check return value for errors. */
 
 static off_t
-ulseek(int const fd, off_t const offset, int const whence)
+ulseek(struct mcount_file *const mf, off_t const offset, int const whence)
 {
 	switch (whence) {
 	case SEEK_SET:
-		file_ptr = file_map + offset;
+		mf->file_ptr = mf->file_map + offset;
 		break;
 	case SEEK_CUR:
-		file_ptr += offset;
+		mf->file_ptr += offset;
 		break;
 	case SEEK_END:
-		file_ptr = file_map + (sb.st_size - offset);
+		mf->file_ptr = mf->file_map + (mf->sb.st_size - offset);
 		break;
 	}
-	if (file_ptr < file_map) {
-		fprintf(stderr, "lseek: seek before file\n");
-		fail_file();
+	if (mf->file_ptr < mf->file_map) {
+		fprintf(mf->err, "lseek: seek before file\n");
+		fail_file(mf);
 	}
-	return file_ptr - file_map;
+	return mf->file_ptr - mf->file_map;
 }
 
 static size_t
-uread(int const fd, void *const buf, size_t const count)
+uread(struct mcount_file *const mf, void *const buf, size_t const count)
 {
-	size_t const n = read(fd, buf, count);
+	size_t const n = read(mf->fd_map, buf, count);
 	if (n != count) {
-		perror("read");
-		fail_file();
+		uperror(mf, "read");
+		fail_file(mf);
 	}
 	return n;
 }
 
 static size_t
-uwrite(int const fd, void const *const buf, size_t const count)
+uwrite(struct mcount_file *const mf, void const *const buf, size_t const count)
 {
 	size_t cnt = count;
 	off_t idx = 0;
 
-	file_updated = 1;
+	mf->file_updated = 1;
 
-	if (file_ptr + count >= file_end) {
-		off_t aoffset = (file_ptr + count) - file_end;
+	if (mf->file_ptr + count >= mf->file_end) {
+		off_t aoffset = (mf->file_ptr + count) - mf->file_end;
 
-		if (aoffset > file_append_size) {
-			file_append = realloc(file_append, aoffset);
-			file_append_size = aoffset;
+		if (aoffset > mf->file_append_size) {
+			mf->file_append = realloc(mf->file_append, aoffset);
+			/* Alignment gaps are never written; keep them zero. */
+			if (mf->file_append)
+				memset(mf->file_append + mf->file_append_size,
+				       0, aoffset - mf->file_append_size);
+			mf->file_append_size = aoffset;
 		}
-		if (!file_append) {
-			perror("write");
-			fail_file();
+		if (!mf->file_append) {
+			uperror(mf, "write");
+			fail_file(mf);
 		}
-		if (file_ptr < file_end) {
-			cnt = file_end - file_ptr;
+		if (mf->file_ptr < mf->file_end) {
+			cnt = mf->file_end - mf->file_ptr;
 		} else {
 			cnt = 0;
 			idx = aoffset - count;
@@ -169,35 +221,31 @@ uwrite(int const fd, void const *const buf, size_t const count)
 	}
 
 	if (cnt)
-		memcpy(file_ptr, buf, cnt);
+		memcpy(mf->file_ptr, buf, cnt);
 
 	if (cnt < count)
-		memcpy(file_append + idx, buf + cnt, count - cnt);
+		memcpy(mf->file_append + idx, buf + cnt, count - cnt);
 
-	file_ptr += count;
+	mf->file_ptr += count;
 	return count;
 }
 
 static void *
-umalloc(size_t size)
+umalloc(struct mcount_file *const mf, size_t size)
 {
 	void *const addr = malloc(size);
 	if (addr == 0) {
-		fprintf(stderr, "malloc failed: %zu bytes\n", size);
-		fail_file();
+		fprintf(mf->err, "malloc failed: %zu bytes\n", size);
+		fail_file(mf);
 	}
 	return addr;
 }
 
 static unsigned char ideal_nop5_x86_64[5] = { 0x0f, 0x1f, 0x44, 0x00, 0x00 };
 static unsigned char ideal_nop5_x86_32[5] = { 0x3e, 0x8d, 0x74, 0x26, 0x00 };
-static unsigned char *ideal_nop;
-
-static char rel_type_nop;
 
-static int (*make_nop)(void *map, size_t const offset);
-
-static int make_nop_x86(void *map, size_t const offset)
+static int make_nop_x86(struct mcount_file *const mf, void *map,
+			size_t const offset)
 {
 	uint32_t *ptr;
 	unsigned char *op;
@@ -212,13 +260,14 @@ static int make_nop_x86(void *map, size_t const offset)
 		return -1;
 
 	/* convert to nop */
-	ulseek(fd_map, offset - 1, SEEK_SET);
-	uwrite(fd_map, ideal_nop, 5);
+	ulseek(mf, offset - 1, SEEK_SET);
+	uwrite(mf, mf->ideal_nop, 5);
 	return 0;
 }
 
 static unsigned char ideal_nop4_arm64[4] = {0x1f, 0x20, 0x03, 0xd5};
-static int make_nop_arm64(void *map, size_t const offset)
+static int make_nop_arm64(struct mcount_file *const mf, void *map,
+			  size_t const offset)
 {
 	uint32_t *ptr;
 
@@ -228,8 +277,8 @@ static int make_nop_arm64(void *map, size_t const offset)
 		return -1;
 
 	/* Convert to nop */
-	ulseek(fd_map, offset, SEEK_SET);
-	uwrite(fd_map, ideal_nop, 4);
+	ulseek(mf, offset, SEEK_SET);
+	uwrite(mf, mf->ideal_nop, 4);
 	return 0;
 }
 
@@ -246,38 +295,41 @@ static int make_nop_arm64(void *map, size_t const offset)
  * locking because it is expensive and the use case of kernel build
  * makes multiple writers unlikely.
  */
-static void *mmap_file(char const *fname)
+static void *mmap_file(struct mcount_file *const mf)
 {
-	fd_map = open(fname, O_RDONLY);
-	if (fd_map < 0 || fstat(fd_map, &sb) < 0) {
-		perror(fname);
-		fail_file();
+	char const *const fname = mf->fname;
+
+	mf->fd_map = open(fname, O_RDONLY);
+	if (mf->fd_map < 0 || fstat(mf->fd_map, &mf->sb) < 0) {
+		uperror(mf, fname);
+		fail_file(mf);
 	}
-	if (!S_ISREG(sb.st_mode)) {
-		fprintf(stderr, "not a regular file: %s\n", fname);
-		fail_file();
+	if (!S_ISREG(mf->sb.st_mode)) {
+		fprintf(mf->err, "not a regular file: %s\n", fname);
+		fail_file(mf);
 	}
-	file_map = mmap(0, sb.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE,
-			fd_map, 0);
-	mmap_failed = 0;
-	if (file_map == MAP_FAILED) {
-		mmap_failed = 1;
-		file_map = umalloc(sb.st_size);
-		uread(fd_map, file_map, sb.st_size);
+	mf->file_map = mmap(0, mf->sb.st_size, PROT_READ|PROT_WRITE,
+			    MAP_PRIVATE, mf->fd_map, 0);
+	mf->mmap_failed = 0;
+	if (mf->file_map == MAP_FAILED) {
+		mf->mmap_failed = 1;
+		mf->file_map = umalloc(mf, mf->sb.st_size);
+		uread(mf, mf->file_map, mf->sb.st_size);
 	}
-	close(fd_map);
+	close(mf->fd_map);
 
-	file_end = file_map + sb.st_size;
+	mf->file_end = mf->file_map + mf->sb.st_size;
 
-	return file_map;
+	return mf->file_map;
 }
 
-static void write_file(const char *fname)
+static void write_file(struct mcount_file *const mf)
 {
+	char const *const fname = mf->fname;
 	char tmp_file[strlen(fname) + 4];
 	size_t n;
 
-	if (!file_updated)
+	if (!mf->file_updated)
 		return;
 
 	sprintf(tmp_file, "%s.rc", fname);
@@ -287,27 +339,28 @@ static void write_file(const char *fname)
 	 * and write it back, to prevent weird side effects of modifying
 	 * an object file in place.
 	 */
-	fd_map = open(tmp_file, O_WRONLY | O_TRUNC | O_CREAT, sb.st_mode);
-	if (fd_map < 0) {
-		perror(fname);
-		fail_file();
+	mf->fd_map = open(tmp_file, O_WRONLY | O_TRUNC | O_CREAT,
+			  mf->sb.st_mode);
+	if (mf->fd_map < 0) {
+		uperror(mf, fname);
+		fail_file(mf);
 	}
-	n = write(fd_map, file_map, sb.st_size);
-	if (n != sb.st_size) {
-		perror("write");
-		fail_file();
+	n = write(mf->fd_map, mf->file_map, mf->sb.st_size);
+	if (n != mf->sb.st_size) {
+		uperror(mf, "write");
+		fail_file(mf);
 	}
-	if (file_append_size) {
-		n = write(fd_map, file_append, file_append_size);
-		if (n != file_append_size) {
-			perror("write");
-			fail_file();
+	if (mf->file_append_size) {
+		n = write(mf->fd_map, mf->file_append, mf->file_append_size);
+		if (n != mf->file_append_size) {
+			uperror(mf, "write");
+			fail_file(mf);
 		}
 	}
-	close(fd_map);
+	close(mf->fd_map);
 	if (rename(tmp_file, fname) < 0) {
-		perror(fname);
-		fail_file();
+		uperror(mf, fname);
+		fail_file(mf);
 	}
 }
 
@@ -354,10 +407,6 @@ static uint32_t w2nat(uint16_t const x)
 	return x;
 }
 
-static uint64_t (*w8)(uint64_t);
-static uint32_t (*w)(uint32_t);
-static uint32_t (*w2)(uint16_t);
-
 /* Names of the sections that could contain calls to mcount. */
 static int
 is_mcounted_section_name(char const *const txtname)
@@ -379,9 +428,10 @@ is_mcounted_section_name(char const *const txtname)
 #define RECORD_MCOUNT_64
 #include "recordmcount.h"
 
-static int arm_is_fake_mcount(Elf32_Rel const *rp)
+static int arm_is_fake_mcount(struct mcount_file *const mf,
+			      Elf32_Rel const *rp)
 {
-	switch (ELF32_R_TYPE(w(rp->r_info))) {
+	switch (ELF32_R_TYPE(mf->w(rp->r_info))) {
 	case R_ARM_THM_CALL:
 	case R_ARM_CALL:
 	case R_ARM_PC24:
@@ -412,149 +462,311 @@ union mips_r_info {
 	} r_mips;
 };
 
-static uint64_t MIPS64_r_sym(Elf64_Rel const *rp)
+static uint64_t MIPS64_r_sym(struct mcount_file *const mf,
+			     Elf64_Rel const *rp)
 {
-	return w(((union mips_r_info){ .r_info = rp->r_info }).r_mips.r_sym);
+	union mips_r_info const ri = { .r_info = rp->r_info };
+
+	return mf->w(ri.r_mips.r_sym);
 }
 
-static void MIPS64_r_info(Elf64_Rel *const rp, unsigned sym, unsigned type)
+static void MIPS64_r_info(struct mcount_file *const mf, Elf64_Rel *const rp,
+			  unsigned sym, unsigned type)
 {
 	rp->r_info = ((union mips_r_info){
-		.r_mips = { .r_sym = w(sym), .r_type = type }
+		.r_mips = { .r_sym = mf->w(sym), .r_type = type }
 	}).r_info;
 }
 
 static void
-do_file(char const *const fname)
+do_file(struct mcount_file *const mf)
 {
-	Elf32_Ehdr *const ehdr = mmap_file(fname);
+	char const *const fname = mf->fname;
+	Elf32_Ehdr *const ehdr = mmap_file(mf);
 	unsigned int reltype = 0;
 
-	w = w4nat;
-	w2 = w2nat;
-	w8 = w8nat;
+	mf->w = w4nat;
+	mf->w2 = w2nat;
+	mf->w8 = w8nat;
 	switch (ehdr->e_ident[EI_DATA]) {
 		static unsigned int const endian = 1;
 	default:
-		fprintf(stderr, "unrecognized ELF data encoding %d: %s\n",
+		fprintf(mf->err, "unrecognized ELF data encoding %d: %s\n",
 			ehdr->e_ident[EI_DATA], fname);
-		fail_file();
+		fail_file(mf);
 		break;
 	case ELFDATA2LSB:
 		if (*(unsigned char const *)&endian != 1) {
 			/* main() is big endian, file.o is little endian. */
-			w = w4rev;
-			w2 = w2rev;
-			w8 = w8rev;
+			mf->w = w4rev;
+			mf->w2 = w2rev;
+			mf->w8 = w8rev;
 		}
 		break;
 	case ELFDATA2MSB:
 		if (*(unsigned char const *)&endian != 0) {
 			/* main() is little endian, file.o is big endian. */
-			w = w4rev;
-			w2 = w2rev;
-			w8 = w8rev;
+			mf->w = w4rev;
+			mf->w2 = w2rev;
+			mf->w8 = w8rev;
 		}
 		break;
 	}  /* end switch */
 	if (memcmp(ELFMAG, ehdr->e_ident, SELFMAG) != 0
-	||  w2(ehdr->e_type) != ET_REL
+	||  mf->w2(ehdr->e_type) != ET_REL
 	||  ehdr->e_ident[EI_VERSION] != EV_CURRENT) {
-		fprintf(stderr, "unrecognized ET_REL file %s\n", fname);
-		fail_file();
+		fprintf(mf->err, "unrecognized ET_REL file %s\n", fname);
+		fail_file(mf);
 	}
 
-	gpfx = 0;
-	switch (w2(ehdr->e_machine)) {
+	mf->gpfx = 0;
+	mf->is_fake_mcount32 = fn_is_fake_mcount32;
+	mf->is_fake_mcount64 = fn_is_fake_mcount64;
+	mf->Elf32_r_sym = fn_ELF32_R_SYM;
+	mf->Elf64_r_sym = fn_ELF64_R_SYM;
+	mf->Elf32_r_info = fn_ELF32_R_INFO;
+	mf->Elf64_r_info = fn_ELF64_R_INFO;
+	mf->mips32_old_r_offset = ~(Elf32_Addr)0;
+	mf->mips64_old_r_offset = ~(Elf64_Addr)0;
+	switch (mf->w2(ehdr->e_machine)) {
 	default:
-		fprintf(stderr, "unrecognized e_machine %d %s\n",
-			w2(ehdr->e_machine), fname);
-		fail_file();
+		fprintf(mf->err, "unrecognized e_machine %d %s\n",
+			mf->w2(ehdr->e_machine), fname);
+		fail_file(mf);
 		break;
 	case EM_386:
 		reltype = R_386_32;
-		rel_type_nop = R_386_NONE;
-		make_nop = make_nop_x86;
-		ideal_nop = ideal_nop5_x86_32;
-		mcount_adjust_32 = -1;
+		mf->rel_type_nop = R_386_NONE;
+		mf->make_nop = make_nop_x86;
+		mf->ideal_nop = ideal_nop5_x86_32;
+		mf->mcount_adjust_32 = -1;
 		break;
 	case EM_ARM:	 reltype = R_ARM_ABS32;
-			 altmcount = "__gnu_mcount_nc";
-			 is_fake_mcount32 = arm_is_fake_mcount;
+			 mf->altmcount = "__gnu_mcount_nc";
+			 mf->is_fake_mcount32 = arm_is_fake_mcount;
 			 break;
 	case EM_AARCH64:
 			reltype = R_AARCH64_ABS64;
-			make_nop = make_nop_arm64;
-			rel_type_nop = R_AARCH64_NONE;
-			ideal_nop = ideal_nop4_arm64;
-			gpfx = '_';
+			mf->make_nop = make_nop_arm64;
+			mf->rel_type_nop = R_AARCH64_NONE;
+			mf->ideal_nop = ideal_nop4_arm64;
+			mf->gpfx = '_';
 			break;
-	case EM_IA_64:	 reltype = R_IA64_IMM64;   gpfx = '_'; break;
+	case EM_IA_64:	 reltype = R_IA64_IMM64;   mf->gpfx = '_'; break;
 	case EM_METAG:	 reltype = R_METAG_ADDR32;
-			 altmcount = "_mcount_wrapper";
-			 rel_type_nop = R_METAG_NONE;
+			 mf->altmcount = "_mcount_wrapper";
+			 mf->rel_type_nop = R_METAG_NONE;
 			 /* We happen to have the same requirement as MIPS */
-			 is_fake_mcount32 = MIPS32_is_fake_mcount;
+			 mf->is_fake_mcount32 = MIPS32_is_fake_mcount;
 			 break;
-	case EM_MIPS:	 /* reltype: e_class    */ gpfx = '_'; break;
-	case EM_PPC:	 reltype = R_PPC_ADDR32;   gpfx = '_'; break;
-	case EM_PPC64:	 reltype = R_PPC64_ADDR64; gpfx = '_'; break;
-	case EM_S390:    /* reltype: e_class    */ gpfx = '_'; break;
-	case EM_SH:	 reltype = R_SH_DIR32;                 break;
-	case EM_SPARCV9: reltype = R_SPARC_64;     gpfx = '_'; break;
+	case EM_MIPS:	 /* reltype: e_class    */ mf->gpfx = '_'; break;
+	case EM_PPC:	 reltype = R_PPC_ADDR32;   mf->gpfx = '_'; break;
+	case EM_PPC64:	 reltype = R_PPC64_ADDR64; mf->gpfx = '_'; break;
+	case EM_S390:    /* reltype: e_class    */ mf->gpfx = '_'; break;
+	case EM_SH:	 reltype = R_SH_DIR32;                     break;
+	case EM_SPARCV9: reltype = R_SPARC_64;     mf->gpfx = '_'; break;
 	case EM_X86_64:
-		make_nop = make_nop_x86;
-		ideal_nop = ideal_nop5_x86_64;
+		mf->make_nop = make_nop_x86;
+		mf->ideal_nop = ideal_nop5_x86_64;
 		reltype = R_X86_64_64;
-		rel_type_nop = R_X86_64_NONE;
-		mcount_adjust_64 = -1;
+		mf->rel_type_nop = R_X86_64_NONE;
+		mf->mcount_adjust_64 = -1;
 		break;
 	}  /* end switch */
 
 	switch (ehdr->e_ident[EI_CLASS]) {
 	default:
-		fprintf(stderr, "unrecognized ELF class %d %s\n",
+		fprintf(mf->err, "unrecognized ELF class %d %s\n",
 			ehdr->e_ident[EI_CLASS], fname);
-		fail_file();
+		fail_file(mf);
 		break;
 	case ELFCLASS32:
-		if (w2(ehdr->e_ehsize) != sizeof(Elf32_Ehdr)
-		||  w2(ehdr->e_shentsize) != sizeof(Elf32_Shdr)) {
-			fprintf(stderr,
+		if (mf->w2(ehdr->e_ehsize) != sizeof(Elf32_Ehdr)
+		||  mf->w2(ehdr->e_shentsize) != sizeof(Elf32_Shdr)) {
+			fprintf(mf->err,
 				"unrecognized ET_REL file: %s\n", fname);
-			fail_file();
+			fail_file(mf);
 		}
-		if (w2(ehdr->e_machine) == EM_MIPS) {
+		if (mf->w2(ehdr->e_machine) == EM_MIPS) {
 			reltype = R_MIPS_32;
-			is_fake_mcount32 = MIPS32_is_fake_mcount;
+			mf->is_fake_mcount32 = MIPS32_is_fake_mcount;
 		}
-		do32(ehdr, fname, reltype);
+		do32(mf, ehdr, reltype);
 		break;
 	case ELFCLASS64: {
 		Elf64_Ehdr *const ghdr = (Elf64_Ehdr *)ehdr;
-		if (w2(ghdr->e_ehsize) != sizeof(Elf64_Ehdr)
-		||  w2(ghdr->e_shentsize) != sizeof(Elf64_Shdr)) {
-			fprintf(stderr,
+		if (mf->w2(ghdr->e_ehsize) != sizeof(Elf64_Ehdr)
+		||  mf->w2(ghdr->e_shentsize) != sizeof(Elf64_Shdr)) {
+			fprintf(mf->err,
 				"unrecognized ET_REL file: %s\n", fname);
-			fail_file();
+			fail_file(mf);
 		}
-		if (w2(ghdr->e_machine) == EM_S390) {
+		if (mf->w2(ghdr->e_machine) == EM_S390) {
 			reltype = R_390_64;
-			mcount_adjust_64 = -14;
+			mf->mcount_adjust_64 = -14;
 		}
-		if (w2(ghdr->e_machine) == EM_MIPS) {
+		if (mf->w2(ghdr->e_machine) == EM_MIPS) {
 			reltype = R_MIPS_64;
-			Elf64_r_sym = MIPS64_r_sym;
-			Elf64_r_info = MIPS64_r_info;
-			is_fake_mcount64 = MIPS64_is_fake_mcount;
+			mf->Elf64_r_sym = MIPS64_r_sym;
+			mf->Elf64_r_info = MIPS64_r_info;
+			mf->is_fake_mcount64 = MIPS64_is_fake_mcount;
 		}
-		do64(ghdr, fname, reltype);
+		do64(mf, ghdr, reltype);
 		break;
 	}
 	}  /* end switch */
 
-	write_file(fname);
-	cleanup();
+	write_file(mf);
+	cleanup(mf);
+}
+
+/* Process one file, allowing deep failure. */
+static void
+process_file(struct mcount_file *const mf)
+{
+	int const sjval = setjmp(mf->jmpenv);
+
+	switch (sjval) {
+	default:
+		fprintf(mf->err, "internal error: %s\n", mf->fname);
+		exit(1);
+		break;
+	case SJ_SETJMP:    /* normal sequence */
+		/* Avoid problems if early cleanup() */
+		mf->fd_map = -1;
+		mf->mmap_failed = 1;
+		mf->file_map = NULL;
+		mf->file_ptr = NULL;
+		mf->file_updated = 0;
+		do_file(mf);
+		break;
+	case SJ_FAIL:    /* error in do_file or below */
+		fprintf(mf->err, "%s: failed\n", mf->fname);
+		mf->failed = 1;
+		break;
+	case SJ_SUCCEED:    /* premature success */
+		/* do nothing */
+		break;
+	}  /* end switch */
+}
+
+/*
+ * Files are handed out to up to nr_jobs threads.  When there is more
+ * than one, each file's messages are collected in buffers of its own and
+ * printed in the order the files were given once all of them are done.
+ */
+struct file_work {
+	struct mcount_file *files;
+	int nr;
+	int next;
+};
+
+static void *file_worker(void *data)
+{
+	struct file_work *fw = data;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&fw->next, 1)) < fw->nr)
+		process_file(&fw->files[i]);
+
+	return NULL;
+}
+
+static void run_files(struct mcount_file *files, int nr)
+{
+	struct file_work fw = { .files = files, .nr = nr };
+	pthread_t *threads;
+	int i, n = nr_jobs < nr ? nr_jobs : nr;
+
+	if (n <= 1) {
+		for (i = 0; i < nr; i++) {
+			files[i].out = stdout;
+			files[i].err = stderr;
+		}
+		file_worker(&fw);
+		return;
+	}
+
+	for (i = 0; i < nr; i++) {
+		files[i].out = open_memstream(&files[i].out_buf,
+					      &files[i].out_size);
+		files[i].err = open_memstream(&files[i].err_buf,
+					      &files[i].err_size);
+		if (!files[i].out || !files[i].err) {
+			perror("open_memstream");
+			exit(1);
+		}
+	}
+
+	threads = malloc(n * sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "malloc failed: %zu bytes\n",
+			n * sizeof(*threads));
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		if (pthread_create(&threads[i], NULL, file_worker, &fw)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (i = 0; i < nr; i++) {
+		fclose(files[i].out);
+		fclose(files[i].err);
+		fputs(files[i].out_buf, stdout);
+		fputs(files[i].err_buf, stderr);
+		free(files[i].out_buf);
+		free(files[i].err_buf);
+	}
+}
+
+/* Order files by identity, ties by position on the command line. */
+static int cmp_file_id(void const *a, void const *b)
+{
+	struct mcount_file const *const fa = *(struct mcount_file *const *)a;
+	struct mcount_file const *const fb = *(struct mcount_file *const *)b;
+
+	if (fa->sb.st_dev != fb->sb.st_dev)
+		return fa->sb.st_dev < fb->sb.st_dev ? -1 : 1;
+	if (fa->sb.st_ino != fb->sb.st_ino)
+		return fa->sb.st_ino < fb->sb.st_ino ? -1 : 1;
+	return fa < fb ? -1 : fa > fb;
+}
+
+/*
+ * A file named twice, possibly by different paths, would be worked on
+ * by two threads at once.  Keep the first mention only: a second pass
+ * over the same file only warned that __mcount_loc already existed.
+ */
+static int drop_duplicates(struct mcount_file *files, int nr)
+{
+	struct mcount_file **by_id;
+	int i, j, n = 0;
+
+	by_id = malloc(nr * sizeof(*by_id));
+	if (!by_id) {
+		perror("malloc");
+		exit(1);
+	}
+	/* those that cannot be stat()ed fail later with a message */
+	for (i = 0; i < nr; i++)
+		if (stat(files[i].fname, &files[i].sb) == 0)
+			by_id[n++] = &files[i];
+
+	qsort(by_id, n, sizeof(*by_id), cmp_file_id);
+	for (i = 1; i < n; i++)
+		if (by_id[i]->sb.st_dev == by_id[i - 1]->sb.st_dev
+		    && by_id[i]->sb.st_ino == by_id[i - 1]->sb.st_ino)
+			by_id[i]->fname = NULL;
+	free(by_id);
+
+	for (i = j = 0; i < nr; i++)
+		if (files[i].fname)
+			files[j++].fname = files[i].fname;
+	return j;
 }
 
 int
@@ -562,30 +774,40 @@ main(int argc, char *argv[])
 {
 	const char ftrace[] = "/ftrace.o";
 	int ftrace_size = sizeof(ftrace) - 1;
+	struct mcount_file *files;
 	int n_error = 0;  /* gcc-4.3.0 false positive complaint */
+	int nr = 0;
 	int c;
 	int i;
 
-	while ((c = getopt(argc, argv, "w")) >= 0) {
+	nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "wj:")) >= 0) {
 		switch (c) {
 		case 'w':
 			warn_on_notrace_sect = 1;
 			break;
+		case 'j':
+			nr_jobs = atoi(optarg);
+			break;
 		default:
-			fprintf(stderr, "usage: recordmcount [-w] file.o...\n");
+			fprintf(stderr, "usage: recordmcount [-w] [-j jobs] file.o...\n");
 			return 0;
 		}
 	}
 
 	if ((argc - optind) < 1) {
-		fprintf(stderr, "usage: recordmcount [-w] file.o...\n");
+		fprintf(stderr, "usage: recordmcount [-w] [-j jobs] file.o...\n");
 		return 0;
 	}
 
-	/* Process each file in turn, allowing deep failure. */
+	files = calloc(argc - optind, sizeof(*files));
+	if (!files) {
+		perror("calloc");
+		return 1;
+	}
 	for (i = optind; i < argc; i++) {
 		char *file = argv[i];
-		int const sjval = setjmp(jmpenv);
 		int len;
 
 		/*
@@ -598,28 +820,14 @@ main(int argc, char *argv[])
 		    strcmp(file + (len - ftrace_size), ftrace) == 0)
 			continue;
 
-		switch (sjval) {
-		default:
-			fprintf(stderr, "internal error: %s\n", file);
-			exit(1);
-			break;
-		case SJ_SETJMP:    /* normal sequence */
-			/* Avoid problems if early cleanup() */
-			fd_map = -1;
-			mmap_failed = 1;
-			file_map = NULL;
-			file_ptr = NULL;
-			file_updated = 0;
-			do_file(file);
-			break;
-		case SJ_FAIL:    /* error in do_file or below */
-			fprintf(stderr, "%s: failed\n", file);
-			++n_error;
-			break;
-		case SJ_SUCCEED:    /* premature success */
-			/* do nothing */
-			break;
-		}  /* end switch */
+		files[nr++].fname = file;
 	}
+
+	nr = drop_duplicates(files, nr);
+	run_files(files, nr);
+
+	for (i = 0; i < nr; i++)
+		n_error += files[i].failed;
+	free(files);
 	return !!n_error;
 }
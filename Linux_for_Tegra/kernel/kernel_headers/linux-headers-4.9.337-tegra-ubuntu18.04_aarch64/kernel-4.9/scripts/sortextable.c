@@ -21,7 +21,9 @@
 #include <sys/stat.h>
 #include <getopt.h>
 #include <elf.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -51,11 +53,37 @@
 #define EM_ARCV2	195
 #endif
 
-static int fd_map;	/* File descriptor for file being modified. */
-static int mmap_failed; /* Boolean flag. */
-static void *ehdr_curr; /* current ElfXX_Ehdr *  for resource cleanup */
-static struct stat sb;	/* Remember .st_size, etc. */
-static jmp_buf jmpenv;	/* setjmp/longjmp per-file error escape */
+static int nr_jobs;	/* Number of files processed at once (-j) */
+
+/*
+ * Everything that belongs to the file being processed, so that several
+ * files can be worked on at the same time; see run_files().
+ */
+struct extable_file {
+	char const *fname;
+	int fd_map;	/* File descriptor for file being modified. */
+	int mmap_failed; /* Boolean flag. */
+	void *ehdr_curr; /* current ElfXX_Ehdr *  for resource cleanup */
+	struct stat sb;	/* Remember .st_size, etc. */
+	jmp_buf jmpenv;	/* setjmp/longjmp per-file error escape */
+	int failed;	/* the file could not be processed */
+
+	/* Where error messages go. */
+	FILE *err;
+	char *err_buf;
+	size_t err_size;
+
+	/* Set up by do_file() for the file's endianness. */
+	uint64_t (*r8)(const uint64_t *);
+	uint32_t (*r)(const uint32_t *);
+	uint16_t (*r2)(const uint16_t *);
+	void (*w8)(uint64_t, uint64_t *);
+	void (*w)(uint32_t, uint32_t *);
+	void (*w2)(uint16_t, uint16_t *);
+};
+
+/* The file whose table is being qsort()ed, for the compare functions */
+static __thread struct extable_file *sort_file;
 
 /* setjmp() return values */
 enum {
@@ -66,18 +94,18 @@ enum {
 
 /* Per-file resource cleanup when multiple files. */
 static void
-cleanup(void)
+cleanup(struct extable_file *ef)
 {
-	if (!mmap_failed)
-		munmap(ehdr_curr, sb.st_size);
-	close(fd_map);
+	if (!ef->mmap_failed)
+		munmap(ef->ehdr_curr, ef->sb.st_size);
+	close(ef->fd_map);
 }
 
 static void __attribute__((noreturn))
-fail_file(void)
+fail_file(struct extable_file *ef)
 {
-	cleanup();
-	longjmp(jmpenv, SJ_FAIL);
+	cleanup(ef);
+	longjmp(ef->jmpenv, SJ_FAIL);
 }
 
 /*
@@ -86,25 +114,26 @@ fail_file(void)
  * avoids copying unused pieces; else just read the whole file.
  * Open for both read and write.
  */
-static void *mmap_file(char const *fname)
+static void *mmap_file(struct extable_file *ef)
 {
+	char const *const fname = ef->fname;
 	void *addr;
 
-	fd_map = open(fname, O_RDWR);
-	if (fd_map < 0 || fstat(fd_map, &sb) < 0) {
-		perror(fname);
-		fail_file();
+	ef->fd_map = open(fname, O_RDWR);
+	if (ef->fd_map < 0 || fstat(ef->fd_map, &ef->sb) < 0) {
+		fprintf(ef->err, "%s: %s\n", fname, strerror(errno));
+		fail_file(ef);
 	}
-	if (!S_ISREG(sb.st_mode)) {
-		fprintf(stderr, "not a regular file: %s\n", fname);
-		fail_file();
+	if (!S_ISREG(ef->sb.st_mode)) {
+		fprintf(ef->err, "not a regular file: %s\n", fname);
+		fail_file(ef);
 	}
-	addr = mmap(0, sb.st_size, PROT_READ|PROT_WRITE, MAP_SHARED,
-		    fd_map, 0);
+	addr = mmap(0, ef->sb.st_size, PROT_READ|PROT_WRITE, MAP_SHARED,
+		    ef->fd_map, 0);
 	if (addr == MAP_FAILED) {
-		mmap_failed = 1;
-		fprintf(stderr, "Could not mmap file: %s\n", fname);
-		fail_file();
+		ef->mmap_failed = 1;
+		fprintf(ef->err, "Could not mmap file: %s\n", fname);
+		fail_file(ef);
 	}
 	return addr;
 }
@@ -159,14 +188,7 @@ static void w2le(uint16_t val, uint16_t *x)
 	put_unaligned_le16(val, x);
 }
 
-static uint64_t (*r8)(const uint64_t *);
-static uint32_t (*r)(const uint32_t *);
-static uint16_t (*r2)(const uint16_t *);
-static void (*w8)(uint64_t, uint64_t *);
-static void (*w)(uint32_t, uint32_t *);
-static void (*w2)(uint16_t, uint16_t *);
-
-typedef void (*table_sort_t)(char *, int);
+typedef void (*table_sort_t)(struct extable_file *, char *, int);
 
 /*
  * Move reserved section indices SHN_LORESERVE..SHN_HIRESERVE out of
@@ -181,7 +203,8 @@ static inline int is_shndx_special(unsigned int i)
 }
 
 /* Accessor for sym->st_shndx, hides ugliness of "64k sections" */
-static inline unsigned int get_secindex(unsigned int shndx,
+static inline unsigned int get_secindex(struct extable_file *ef,
+					unsigned int shndx,
 					unsigned int sym_offs,
 					const Elf32_Word *symtab_shndx_start)
 {
@@ -189,7 +212,7 @@ static inline unsigned int get_secindex(unsigned int shndx,
 		return SPECIAL(shndx);
 	if (shndx != SHN_XINDEX)
 		return shndx;
-	return r(&symtab_shndx_start[sym_offs]);
+	return ef->r(&symtab_shndx_start[sym_offs]);
 }
 
 /* 32 bit and 64 bit are very similar */
@@ -199,8 +222,8 @@ static inline unsigned int get_secindex(unsigned int shndx,
 
 static int compare_relative_table(const void *a, const void *b)
 {
-	int32_t av = (int32_t)r(a);
-	int32_t bv = (int32_t)r(b);
+	int32_t av = (int32_t)sort_file->r(a);
+	int32_t bv = (int32_t)sort_file->r(b);
 
 	if (av < bv)
 		return -1;
@@ -209,7 +232,8 @@ static int compare_relative_table(const void *a, const void *b)
 	return 0;
 }
 
-static void x86_sort_relative_table(char *extab_image, int image_size)
+static void x86_sort_relative_table(struct extable_file *ef,
+				   char *extab_image, int image_size)
 {
 	int i;
 
@@ -217,28 +241,30 @@ static void x86_sort_relative_table(char *extab_image, int image_size)
 	while (i < image_size) {
 		uint32_t *loc = (uint32_t *)(extab_image + i);
 
-		w(r(loc) + i, loc);
-		w(r(loc + 1) + i + 4, loc + 1);
-		w(r(loc + 2) + i + 8, loc + 2);
+		ef->w(ef->r(loc) + i, loc);
+		ef->w(ef->r(loc + 1) + i + 4, loc + 1);
+		ef->w(ef->r(loc + 2) + i + 8, loc + 2);
 
 		i += sizeof(uint32_t) * 3;
 	}
 
+	sort_file = ef;
 	qsort(extab_image, image_size / 12, 12, compare_relative_table);
 
 	i = 0;
 	while (i < image_size) {
 		uint32_t *loc = (uint32_t *)(extab_image + i);
 
-		w(r(loc) - i, loc);
-		w(r(loc + 1) - (i + 4), loc + 1);
-		w(r(loc + 2) - (i + 8), loc + 2);
+		ef->w(ef->r(loc) - i, loc);
+		ef->w(ef->r(loc + 1) - (i + 4), loc + 1);
+		ef->w(ef->r(loc + 2) - (i + 8), loc + 2);
 
 		i += sizeof(uint32_t) * 3;
 	}
 }
 
-static void sort_relative_table(char *extab_image, int image_size)
+static void sort_relative_table(struct extable_file *ef,
+				char *extab_image, int image_size)
 {
 	int i;
 
@@ -249,64 +275,68 @@ static void sort_relative_table(char *extab_image, int image_size)
 	i = 0;
 	while (i < image_size) {
 		uint32_t *loc = (uint32_t *)(extab_image + i);
-		w(r(loc) + i, loc);
+		ef->w(ef->r(loc) + i, loc);
 		i += 4;
 	}
 
+	sort_file = ef;
 	qsort(extab_image, image_size / 8, 8, compare_relative_table);
 
 	/* Now denormalize. */
 	i = 0;
 	while (i < image_size) {
 		uint32_t *loc = (uint32_t *)(extab_image + i);
-		w(r(loc) - i, loc);
+		ef->w(ef->r(loc) - i, loc);
 		i += 4;
 	}
 }
 
 static void
-do_file(char const *const fname)
+do_file(struct extable_file *ef)
 {
+	char const *const fname = ef->fname;
 	table_sort_t custom_sort;
-	Elf32_Ehdr *ehdr = mmap_file(fname);
+	Elf32_Ehdr *ehdr = mmap_file(ef);
 
-	ehdr_curr = ehdr;
+	ef->ehdr_curr = ehdr;
 	switch (ehdr->e_ident[EI_DATA]) {
 	default:
-		fprintf(stderr, "unrecognized ELF data encoding %d: %s\n",
+		fprintf(ef->err, "unrecognized ELF data encoding %d: %s\n",
 			ehdr->e_ident[EI_DATA], fname);
-		fail_file();
+		fail_file(ef);
 		break;
 	case ELFDATA2LSB:
-		r = rle;
-		r2 = r2le;
-		r8 = r8le;
-		w = wle;
-		w2 = w2le;
-		w8 = w8le;
+		ef->r = rle;
+		ef->r2 = r2le;
+		ef->r8 = r8le;
+		ef->w = wle;
+		ef->w2 = w2le;
+		ef->w8 = w8le;
 		break;
 	case ELFDATA2MSB:
-		r = rbe;
-		r2 = r2be;
-		r8 = r8be;
-		w = wbe;
-		w2 = w2be;
-		w8 = w8be;
+		ef->r = rbe;
+		ef->r2 = r2be;
+		ef->r8 = r8be;
+		ef->w = wbe;
+		ef->w2 = w2be;
+		ef->w8 = w8be;
 		break;
 	}  /* end switch */
 	if (memcmp(ELFMAG, ehdr->e_ident, SELFMAG) != 0
-	||  (r2(&ehdr->e_type) != ET_EXEC && r2(&ehdr->e_type) != ET_DYN)
+	||  (ef->r2(&ehdr->e_type) != ET_EXEC &&
+	     ef->r2(&ehdr->e_type) != ET_DYN)
 	||  ehdr->e_ident[EI_VERSION] != EV_CURRENT) {
-		fprintf(stderr, "unrecognized ET_EXEC/ET_DYN file %s\n", fname);
-		fail_file();
+		fprintf(ef->err, "unrecognized ET_EXEC/ET_DYN file %s\n",
+			fname);
+		fail_file(ef);
 	}
 
 	custom_sort = NULL;
-	switch (r2(&ehdr->e_machine)) {
+	switch (ef->r2(&ehdr->e_machine)) {
 	default:
-		fprintf(stderr, "unrecognized e_machine %d %s\n",
-			r2(&ehdr->e_machine), fname);
-		fail_file();
+		fprintf(ef->err, "unrecognized e_machine %d %s\n",
+			ef->r2(&ehdr->e_machine), fname);
+		fail_file(ef);
 		break;
 	case EM_386:
 	case EM_X86_64:
@@ -329,70 +359,214 @@ do_file(char const *const fname)
 
 	switch (ehdr->e_ident[EI_CLASS]) {
 	default:
-		fprintf(stderr, "unrecognized ELF class %d %s\n",
+		fprintf(ef->err, "unrecognized ELF class %d %s\n",
 			ehdr->e_ident[EI_CLASS], fname);
-		fail_file();
+		fail_file(ef);
 		break;
 	case ELFCLASS32:
-		if (r2(&ehdr->e_ehsize) != sizeof(Elf32_Ehdr)
-		||  r2(&ehdr->e_shentsize) != sizeof(Elf32_Shdr)) {
-			fprintf(stderr,
+		if (ef->r2(&ehdr->e_ehsize) != sizeof(Elf32_Ehdr)
+		||  ef->r2(&ehdr->e_shentsize) != sizeof(Elf32_Shdr)) {
+			fprintf(ef->err,
 				"unrecognized ET_EXEC/ET_DYN file: %s\n", fname);
-			fail_file();
+			fail_file(ef);
 		}
-		do32(ehdr, fname, custom_sort);
+		do32(ef, ehdr, custom_sort);
 		break;
 	case ELFCLASS64: {
 		Elf64_Ehdr *const ghdr = (Elf64_Ehdr *)ehdr;
-		if (r2(&ghdr->e_ehsize) != sizeof(Elf64_Ehdr)
-		||  r2(&ghdr->e_shentsize) != sizeof(Elf64_Shdr)) {
-			fprintf(stderr,
+		if (ef->r2(&ghdr->e_ehsize) != sizeof(Elf64_Ehdr)
+		||  ef->r2(&ghdr->e_shentsize) != sizeof(Elf64_Shdr)) {
+			fprintf(ef->err,
 				"unrecognized ET_EXEC/ET_DYN file: %s\n", fname);
-			fail_file();
+			fail_file(ef);
 		}
-		do64(ghdr, fname, custom_sort);
+		do64(ef, ghdr, custom_sort);
 		break;
 	}
 	}  /* end switch */
 
-	cleanup();
+	cleanup(ef);
+}
+
+/* Process one file, allowing deep failure. */
+static void
+process_file(struct extable_file *ef)
+{
+	int const sjval = setjmp(ef->jmpenv);
+
+	switch (sjval) {
+	default:
+		fprintf(ef->err, "internal error: %s\n", ef->fname);
+		exit(1);
+		break;
+	case SJ_SETJMP:    /* normal sequence */
+		/* Avoid problems if early cleanup() */
+		ef->fd_map = -1;
+		ef->ehdr_curr = NULL;
+		ef->mmap_failed = 1;
+		do_file(ef);
+		break;
+	case SJ_FAIL:    /* error in do_file or below */
+		ef->failed = 1;
+		break;
+	case SJ_SUCCEED:    /* premature success */
+		/* do nothing */
+		break;
+	}  /* end switch */
+}
+
+/*
+ * Files are handed out to up to nr_jobs threads.  When there is more
+ * than one, each file's messages are collected in a buffer of its own
+ * and printed in the order the files were given once all are done.
+ */
+struct file_work {
+	struct extable_file *files;
+	int nr;
+	int next;
+};
+
+static void *file_worker(void *data)
+{
+	struct file_work *fw = data;
+	int i;
+
+	while ((i = __sync_fetch_and_add(&fw->next, 1)) < fw->nr)
+		process_file(&fw->files[i]);
+
+	return NULL;
+}
+
+static void run_files(struct extable_file *files, int nr)
+{
+	struct file_work fw = { .files = files, .nr = nr };
+	pthread_t *threads;
+	int i, n = nr_jobs < nr ? nr_jobs : nr;
+
+	if (n <= 1) {
+		for (i = 0; i < nr; i++)
+			files[i].err = stderr;
+		file_worker(&fw);
+		return;
+	}
+
+	for (i = 0; i < nr; i++) {
+		files[i].err = open_memstream(&files[i].err_buf,
+					      &files[i].err_size);
+		if (!files[i].err) {
+			perror("open_memstream");
+			exit(1);
+		}
+	}
+
+	threads = malloc(n * sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "malloc failed: %zu bytes\n",
+			n * sizeof(*threads));
+		exit(1);
+	}
+	for (i = 0; i < n; i++)
+		if (pthread_create(&threads[i], NULL, file_worker, &fw)) {
+			perror("pthread_create");
+			exit(1);
+		}
+	for (i = 0; i < n; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	for (i = 0; i < nr; i++) {
+		fclose(files[i].err);
+		fputs(files[i].err_buf, stderr);
+		free(files[i].err_buf);
+	}
+}
+
+/* Order files by identity, ties by position on the command line. */
+static int cmp_file_id(void const *a, void const *b)
+{
+	struct extable_file const *const fa = *(struct extable_file *const *)a;
+	struct extable_file const *const fb = *(struct extable_file *const *)b;
+
+	if (fa->sb.st_dev != fb->sb.st_dev)
+		return fa->sb.st_dev < fb->sb.st_dev ? -1 : 1;
+	if (fa->sb.st_ino != fb->sb.st_ino)
+		return fa->sb.st_ino < fb->sb.st_ino ? -1 : 1;
+	return fa < fb ? -1 : fa > fb;
+}
+
+/*
+ * A file named twice, possibly by different paths, would be worked on
+ * by two threads at once.  Keep the first mention only: a second pass
+ * over the same file used to sort an already sorted table.
+ */
+static int drop_duplicates(struct extable_file *files, int nr)
+{
+	struct extable_file **by_id;
+	int i, j, n = 0;
+
+	by_id = malloc(nr * sizeof(*by_id));
+	if (!by_id) {
+		perror("malloc");
+		exit(1);
+	}
+	/* those that cannot be stat()ed fail later with a message */
+	for (i = 0; i < nr; i++)
+		if (stat(files[i].fname, &files[i].sb) == 0)
+			by_id[n++] = &files[i];
+
+	qsort(by_id, n, sizeof(*by_id), cmp_file_id);
+	for (i = 1; i < n; i++)
+		if (by_id[i]->sb.st_dev == by_id[i - 1]->sb.st_dev
+		    && by_id[i]->sb.st_ino == by_id[i - 1]->sb.st_ino)
+			by_id[i]->fname = NULL;
+	free(by_id);
+
+	for (i = j = 0; i < nr; i++)
+		if (files[i].fname)
+			files[j++].fname = files[i].fname;
+	return j;
 }
 
 int
 main(int argc, char *argv[])
 {
+	struct extable_file *files;
 	int n_error = 0;  /* gcc-4.3.0 false positive complaint */
+	int nr = 0;
+	int c;
 	int i;
 
-	if (argc < 2) {
-		fprintf(stderr, "usage: sortextable vmlinux...\n");
-		return 0;
+	nr_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "j:")) >= 0) {
+		switch (c) {
+		case 'j':
+			nr_jobs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: sortextable [-j jobs] vmlinux...\n");
+			return 0;
+		}
 	}
 
-	/* Process each file in turn, allowing deep failure. */
-	for (i = 1; i < argc; i++) {
-		char *file = argv[i];
-		int const sjval = setjmp(jmpenv);
+	if ((argc - optind) < 1) {
+		fprintf(stderr, "usage: sortextable [-j jobs] vmlinux...\n");
+		return 0;
+	}
 
-		switch (sjval) {
-		default:
-			fprintf(stderr, "internal error: %s\n", file);
-			exit(1);
-			break;
-		case SJ_SETJMP:    /* normal sequence */
-			/* Avoid problems if early cleanup() */
-			fd_map = -1;
-			ehdr_curr = NULL;
-			mmap_failed = 1;
-			do_file(file);
-			break;
-		case SJ_FAIL:    /* error in do_file or below */
-			++n_error;
-			break;
-		case SJ_SUCCEED:    /* premature success */
-			/* do nothing */
-			break;
-		}  /* end switch */
+	files = calloc(argc - optind, sizeof(*files));
+	if (!files) {
+		perror("calloc");
+		return 1;
 	}
+	for (i = optind; i < argc; i++)
+		files[nr++].fname = argv[i];
+
+	nr = drop_duplicates(files, nr);
+	run_files(files, nr);
+
+	for (i = 0; i < nr; i++)
+		n_error += files[i].failed;
+	free(files);
 	return !!n_error;
 }
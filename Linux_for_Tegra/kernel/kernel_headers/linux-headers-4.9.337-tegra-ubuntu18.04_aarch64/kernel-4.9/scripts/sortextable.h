@@ -79,8 +79,8 @@
 
 static int compare_extable(const void *a, const void *b)
 {
-	Elf_Addr av = _r(a);
-	Elf_Addr bv = _r(b);
+	Elf_Addr av = sort_file->_r(a);
+	Elf_Addr bv = sort_file->_r(b);
 
 	if (av < bv)
 		return -1;
@@ -90,8 +90,9 @@ static int compare_extable(const void *a, const void *b)
 }
 
 static void
-do_func(Elf_Ehdr *ehdr, char const *const fname, table_sort_t custom_sort)
+do_func(struct extable_file *ef, Elf_Ehdr *ehdr, table_sort_t custom_sort)
 {
+	char const *const fname = ef->fname;
 	Elf_Shdr *shdr;
 	Elf_Shdr *shstrtab_sec;
 	Elf_Shdr *strtab_sec = NULL;
@@ -114,60 +115,63 @@ do_func(Elf_Ehdr *ehdr, char const *const fname, table_sort_t custom_sort)
 	unsigned int num_sections;
 	unsigned int secindex_strings;
 
-	shdr = (Elf_Shdr *)((char *)ehdr + _r(&ehdr->e_shoff));
+	shdr = (Elf_Shdr *)((char *)ehdr + ef->_r(&ehdr->e_shoff));
 
-	num_sections = r2(&ehdr->e_shnum);
+	num_sections = ef->r2(&ehdr->e_shnum);
 	if (num_sections == SHN_UNDEF)
-		num_sections = _r(&shdr[0].sh_size);
+		num_sections = ef->_r(&shdr[0].sh_size);
 
-	secindex_strings = r2(&ehdr->e_shstrndx);
+	secindex_strings = ef->r2(&ehdr->e_shstrndx);
 	if (secindex_strings == SHN_XINDEX)
-		secindex_strings = r(&shdr[0].sh_link);
+		secindex_strings = ef->r(&shdr[0].sh_link);
 
 	shstrtab_sec = shdr + secindex_strings;
-	secstrtab = (const char *)ehdr + _r(&shstrtab_sec->sh_offset);
+	secstrtab = (const char *)ehdr + ef->_r(&shstrtab_sec->sh_offset);
 	for (i = 0; i < num_sections; i++) {
-		idx = r(&shdr[i].sh_name);
+		idx = ef->r(&shdr[i].sh_name);
 		if (strcmp(secstrtab + idx, "__ex_table") == 0) {
 			extab_sec = shdr + i;
 			extab_index = i;
 		}
-		if ((r(&shdr[i].sh_type) == SHT_REL ||
-		     r(&shdr[i].sh_type) == SHT_RELA) &&
-		    r(&shdr[i].sh_info) == extab_index) {
-			relocs = (void *)ehdr + _r(&shdr[i].sh_offset);
-			relocs_size = _r(&shdr[i].sh_size);
+		if ((ef->r(&shdr[i].sh_type) == SHT_REL ||
+		     ef->r(&shdr[i].sh_type) == SHT_RELA) &&
+		    ef->r(&shdr[i].sh_info) == extab_index) {
+			relocs = (void *)ehdr + ef->_r(&shdr[i].sh_offset);
+			relocs_size = ef->_r(&shdr[i].sh_size);
 		}
 		if (strcmp(secstrtab + idx, ".symtab") == 0)
 			symtab_sec = shdr + i;
 		if (strcmp(secstrtab + idx, ".strtab") == 0)
 			strtab_sec = shdr + i;
-		if (r(&shdr[i].sh_type) == SHT_SYMTAB_SHNDX)
-			symtab_shndx_start = (Elf32_Word *)(
-				(const char *)ehdr + _r(&shdr[i].sh_offset));
+		if (ef->r(&shdr[i].sh_type) == SHT_SYMTAB_SHNDX)
+			symtab_shndx_start = (Elf32_Word *)((const char *)ehdr +
+				ef->_r(&shdr[i].sh_offset));
 	}
 	if (strtab_sec == NULL) {
-		fprintf(stderr,	"no .strtab in  file: %s\n", fname);
-		fail_file();
+		fprintf(ef->err,	"no .strtab in  file: %s\n", fname);
+		fail_file(ef);
 	}
 	if (symtab_sec == NULL) {
-		fprintf(stderr,	"no .symtab in  file: %s\n", fname);
-		fail_file();
+		fprintf(ef->err,	"no .symtab in  file: %s\n", fname);
+		fail_file(ef);
 	}
 	symtab = (const Elf_Sym *)((const char *)ehdr +
-				   _r(&symtab_sec->sh_offset));
+				   ef->_r(&symtab_sec->sh_offset));
 	if (extab_sec == NULL) {
-		fprintf(stderr,	"no __ex_table in  file: %s\n", fname);
-		fail_file();
+		fprintf(ef->err,	"no __ex_table in  file: %s\n", fname);
+		fail_file(ef);
 	}
-	strtab = (const char *)ehdr + _r(&strtab_sec->sh_offset);
+	strtab = (const char *)ehdr + ef->_r(&strtab_sec->sh_offset);
 
-	extab_image = (void *)ehdr + _r(&extab_sec->sh_offset);
+	extab_image = (void *)ehdr + ef->_r(&extab_sec->sh_offset);
 
 	if (custom_sort) {
-		custom_sort(extab_image, _r(&extab_sec->sh_size));
+		custom_sort(ef, extab_image, ef->_r(&extab_sec->sh_size));
 	} else {
-		int num_entries = _r(&extab_sec->sh_size) / extable_ent_size;
+		int num_entries =
+			ef->_r(&extab_sec->sh_size) / extable_ent_size;
+
+		sort_file = ef;
 		qsort(extab_image, num_entries,
 		      extable_ent_size, compare_extable);
 	}
@@ -177,35 +181,35 @@ do_func(Elf_Ehdr *ehdr, char const *const fname, table_sort_t custom_sort)
 
 	/* find main_extable_sort_needed */
 	sort_needed_sym = NULL;
-	for (i = 0; i < _r(&symtab_sec->sh_size) / sizeof(Elf_Sym); i++) {
-		sym = (void *)ehdr + _r(&symtab_sec->sh_offset);
+	for (i = 0; i < ef->_r(&symtab_sec->sh_size) / sizeof(Elf_Sym); i++) {
+		sym = (void *)ehdr + ef->_r(&symtab_sec->sh_offset);
 		sym += i;
 		if (ELF_ST_TYPE(sym->st_info) != STT_OBJECT)
 			continue;
-		idx = r(&sym->st_name);
+		idx = ef->r(&sym->st_name);
 		if (strcmp(strtab + idx, "main_extable_sort_needed") == 0) {
 			sort_needed_sym = sym;
 			break;
 		}
 	}
 	if (sort_needed_sym == NULL) {
-		fprintf(stderr,
+		fprintf(ef->err,
 			"no main_extable_sort_needed symbol in  file: %s\n",
 			fname);
-		fail_file();
+		fail_file(ef);
 	}
-	sort_needed_sec = &shdr[get_secindex(r2(&sym->st_shndx),
+	sort_needed_sec = &shdr[get_secindex(ef, ef->r2(&sym->st_shndx),
 					     sort_needed_sym - symtab,
 					     symtab_shndx_start)];
 	sort_done_location = (void *)ehdr +
-		_r(&sort_needed_sec->sh_offset) +
-		_r(&sort_needed_sym->st_value) -
-		_r(&sort_needed_sec->sh_addr);
+		ef->_r(&sort_needed_sec->sh_offset) +
+		ef->_r(&sort_needed_sym->st_value) -
+		ef->_r(&sort_needed_sec->sh_addr);
 
 #if 0
 	printf("sort done marker at %lx\n",
 	       (unsigned long)((char *)sort_done_location - (char *)ehdr));
 #endif
 	/* We sorted it, clear the flag. */
-	w(0, sort_done_location);
+	ef->w(0, sort_done_location);
 }